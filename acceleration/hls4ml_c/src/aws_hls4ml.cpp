@@ -29,33 +29,164 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 /*******************************************************************************
 Description:
-    HLS pragmas can be used to optimize the design : improve throughput, reduce latency and 
-    device resource utilization of the resulting RTL code
-    This is vector addition example to demonstrate how HLS optimizations are used in kernel. 
+    Wrapper kernel running an hls4ml project on a stream of events.
+    The number of events is a runtime argument, so one launch can cover an
+    arbitrarily large batch. Events are moved through a dataflow pipeline one
+    at a time, the memory stages unpack and pack whole bus beats per cycle:
+
+     ____________
+    |            |<----- Input events from Global Memory
+    | read_input |
+    |____________|------>| in_stream
+     ____________        |
+    |            |<------|
+    |   infer    |          (MYPROJ)
+    |____________|------>| out_stream
+     ______________      |
+    |              |<----|
+    | write_result |
+    |______________|-----> Output results to Global Memory
+
 *******************************************************************************/
 
 #define PROJ_HDR <MYPROJ.h>
 
+#include <hls_stream.h>
 #include <parameters.h>
 #include PROJ_HDR
 #include "kernel_params.h"
 
+// One event worth of inputs/outputs, moved through the streams as a unit
+struct input_event {
+    input_t data[N_INPUTS];
+};
+struct result_event {
+    result_t data[N_OUTPUTS];
+};
+
+// Read packed inputs from Global Memory and write complete events into
+// in_stream. Every iteration unpacks a whole beat at once into a window of
+// values when the window holds less than one event, and hands out the event
+// at the front of the window as soon as it is complete, so the loop runs at
+// one beat and one event per cycle.
+static void read_input(const bus_t *in, hls::stream<input_event> &in_stream,
+        int nevents)
+{
+    const int width = input_t::width;
+    input_t window[INPUTS_PER_BEAT + N_INPUTS];
+#pragma HLS ARRAY_PARTITION variable=window complete
+    int fill = 0;
+    int nbeat = 0;
+    int i = 0;
+    mem_rd: while (i < nevents) {
+#pragma HLS LOOP_TRIPCOUNT min=STREAMSIZE max=STREAMSIZE
+#pragma HLS PIPELINE
+        if (fill < N_INPUTS) {
+            bus_t beat = in[nbeat++];
+            unpack: for (int k = 0; k < INPUTS_PER_BEAT + N_INPUTS; k++) {
+                int j = k - fill;
+                if (j >= 0 && j < INPUTS_PER_BEAT)
+                    window[k].range(width-1, 0) = beat.range(j*width + width-1, j*width);
+            }
+            fill += INPUTS_PER_BEAT;
+        }
+        if (fill >= N_INPUTS) {
+            input_event ev;
+            event: for (int k = 0; k < N_INPUTS; k++) {
+                ev.data[k] = window[k];
+            }
+            in_stream << ev;
+            shift: for (int k = 0; k < INPUTS_PER_BEAT; k++) {
+                window[k] = window[k + N_INPUTS];
+            }
+            fill -= N_INPUTS;
+            i++;
+        }
+    }
+}
+
+// Run the hls4ml project on every event of in_stream
+static void infer(hls::stream<input_event> &in_stream,
+        hls::stream<result_event> &out_stream, int nevents)
+{
+    execute: for (int i = 0; i < nevents; i++) {
+#pragma HLS LOOP_TRIPCOUNT min=STREAMSIZE max=STREAMSIZE
+        unsigned short insize, outsize;
+        input_event ev = in_stream.read();
+        result_event res;
+//these will get partitioned properly in the hls4ml code
+        hls4ml: MYPROJ(ev.data,res.data,insize,outsize);
+        out_stream << res;
+    }
+}
+
+// Read results from out_stream and write them packed to Global Memory. Every
+// iteration appends the results of one event to a window of values when the
+// window holds less than one beat, and packs a whole beat at once from the
+// front of the window as soon as it is full. A partially filled last beat is
+// flushed at the end.
+static void write_result(bus_t *out, hls::stream<result_event> &out_stream,
+        int nevents)
+{
+    const int width = result_t::width;
+    result_t window[RESULTS_PER_BEAT + N_OUTPUTS];
+#pragma HLS ARRAY_PARTITION variable=window complete
+    int fill = 0;
+    int nbeat = 0;
+    int i = 0;
+    mem_wr: while (i < nevents || fill >= RESULTS_PER_BEAT) {
+#pragma HLS LOOP_TRIPCOUNT min=STREAMSIZE max=STREAMSIZE
+#pragma HLS PIPELINE
+        if (fill < RESULTS_PER_BEAT) {
+            result_event res = out_stream.read();
+            append: for (int k = 0; k < RESULTS_PER_BEAT + N_OUTPUTS; k++) {
+                int j = k - fill;
+                if (j >= 0 && j < N_OUTPUTS)
+                    window[k] = res.data[j];
+            }
+            fill += N_OUTPUTS;
+            i++;
+        }
+        if (fill >= RESULTS_PER_BEAT) {
+            bus_t beat = 0;
+            pack: for (int k = 0; k < RESULTS_PER_BEAT; k++) {
+                beat.range(k*width + width-1, k*width) = window[k].range(width-1, 0);
+            }
+            out[nbeat++] = beat;
+            shift: for (int k = 0; k < N_OUTPUTS; k++) {
+                window[k] = window[k + RESULTS_PER_BEAT];
+            }
+            fill -= RESULTS_PER_BEAT;
+        }
+    }
+    if (fill != 0) {
+        bus_t beat = 0;
+        flush: for (int k = 0; k < RESULTS_PER_BEAT; k++) {
+            if (k < fill)
+                beat.range(k*width + width-1, k*width) = window[k].range(width-1, 0);
+        }
+        out[nbeat] = beat;
+    }
+}
+
 /*
-    Vector Addition Kernel Implementation 
+    hls4ml Kernel Implementation 
     Arguments:
-        in    (input)     --> Input Vector
-        out   (output)    --> Output Vector
+        in      (input)     --> Packed input_t values, nevents x N_INPUTS
+        out     (output)    --> Packed result_t values, nevents x N_OUTPUTS
+        nevents (input)     --> Number of events to process
    */
 extern "C" {
 void aws_hls4ml(
-        const data32_t *in, // Read-Only Vector
-        data32_t *out       // Output Result
+        const bus_t *in,    // Read-Only Vector
+        bus_t *out,         // Output Result
+        int nevents         // Number of events
         )
 {
 // SDAccel kernel must have one and only one s_axilite interface which will be used by host application to configure the kernel.
-// Here bundle control is defined which is s_axilite interface and associated with all the arguments (in1, in2, out and size),
+// Here bundle control is defined which is s_axilite interface and associated with all the arguments (in, out and nevents),
 // control interface must also be associated with "return".
-// All the global memory access arguments must be associated to one m_axi(AXI Master Interface). Here all three arguments(in1, in2, out) are 
+// All the global memory access arguments must be associated to one m_axi(AXI Master Interface). Here all the arguments(in, out) are 
 // associated to bundle gmem which means that a AXI master interface named "gmem" will be created in Kernel and all these variables will be 
 // accessing global memory through this interface.
 // Multiple interfaces can also be created based on the requirements. For example when multiple memory accessing arguments need access to
@@ -64,34 +195,19 @@ void aws_hls4ml(
 #pragma HLS INTERFACE m_axi port=out offset=slave bundle=gmem
 #pragma HLS INTERFACE s_axilite port=in   bundle=control
 #pragma HLS INTERFACE s_axilite port=out  bundle=control
+#pragma HLS INTERFACE s_axilite port=nevents bundle=control
 #pragma HLS INTERFACE s_axilite port=return bundle=control
 
-    unsigned short insize, outsize;
-
-    input_t in_buf[STREAMSIZE][N_INPUTS];
-    result_t out_buf[STREAMSIZE][N_OUTPUTS];
-//these will get partitioned properly in the hls4ml code
-
-    for (int i = 0; i < STREAMSIZE; i++) {
-#pragma HLS LOOP UNROLL
-        for (int j = 0; j < N_INPUTS; j++) {
-#pragma HLS LOOP UNROLL
-            in_buf[i][j] = (input_t)in[i*N_INPUTS+j];
-        }
-    }
+    hls::stream<input_event> in_stream("input_stream");
+    hls::stream<result_event> out_stream("output_stream");
+#pragma HLS STREAM variable=in_stream  depth=32
+#pragma HLS STREAM variable=out_stream depth=32
+#pragma HLS DATA_PACK variable=in_stream
+#pragma HLS DATA_PACK variable=out_stream
 
-    for (int i = 0; i < STREAMSIZE; i++) {
 #pragma HLS dataflow
-        hls4ml: MYPROJ(in_buf[i],out_buf[i],insize,outsize);
-    }
-
-    for (int i = 0; i < STREAMSIZE; i++) {
-#pragma HLS LOOP UNROLL
-        for (int j = 0; j < N_OUTPUTS; j++) {
-#pragma HLS LOOP UNROLL
-            out[i*N_OUTPUTS+j] = (data32_t)out_buf[i][j];
-        }
-    }
-
+    read_input(in,in_stream,nevents);
+    infer(in_stream,out_stream,nevents);
+    write_result(out,out_stream,nevents);
 }
 }
@@ -0,0 +1,231 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+
+/*******************************************************************************
+Description:
+    Throughput benchmark of the hls4ml project on the CPU engine and on the
+    aws_hls4ml kernel for several batch sizes (events per call/launch).
+    The FPGA outputs are diffed against the CPU engine outputs, which act as
+    the golden reference. The CPU engine follows the original 32 bit
+    transfer path, so this also checks that the packed transfer format is
+    bit exact. The host side conversion cost and the transfer volume of both
+    formats are reported as well.
+
+    Usage: ./bench [nevents] [nthreads]
+*******************************************************************************/
+
+#include "xcl2.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <vector>
+#include <parameters.h>
+#include "kernel_params.h"
+#include "cpu_engine.h"
+#include "packing.h"
+
+typedef std::vector<data32_t,aligned_allocator<data32_t>> data_vector;
+typedef std::vector<uint64_t,aligned_allocator<uint64_t>> packed_vector;
+
+static const int batch_sizes[] = {1, 16, 128, 1024, 8192};
+
+// Time the CPU engine over nevents events, batch events per call
+static double run_cpu(CpuEngine &engine, const data_vector &in, data_vector &out,
+        long nevents, int batch)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    for (long first = 0; first < nevents; first += batch) {
+        long count = std::min<long>(batch, nevents - first);
+        engine.run(&in[first*N_INPUTS], &out[first*N_OUTPUTS], count);
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(stop - start).count();
+}
+
+// Time the kernel over nevents events, one launch per batch events. Every
+// launch takes its buffers from the pool and hands them back afterwards, the
+// way a long running service handling one request per launch would.
+static double run_fpga(xcl::BufferPool &pool, cl::CommandQueue &q, cl::Program &program,
+        const data_vector &in, data_vector &out, long nevents, int batch)
+{
+    cl::Kernel krnl(program,"aws_hls4ml");
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (long first = 0; first < nevents; first += batch) {
+        int count = (int)std::min<long>(batch, nevents - first);
+        xcl::PooledBuffer batch_in = pool.acquire(
+                sizeof(uint64_t)*BUS_WORDS*input_beats(count), CL_MEM_READ_ONLY);
+        xcl::PooledBuffer batch_out = pool.acquire(
+                sizeof(uint64_t)*BUS_WORDS*result_beats(count), CL_MEM_WRITE_ONLY);
+        pack_inputs(&in[first*N_INPUTS], count, batch_in.data<uint64_t>());
+        krnl.setArg(0, batch_in.buffer());
+        krnl.setArg(1, batch_out.buffer());
+        krnl.setArg(2, count);
+        q.enqueueMigrateMemObjects({batch_in.buffer()},0/* 0 means from host*/);
+        q.enqueueTask(krnl);
+        q.enqueueMigrateMemObjects({batch_out.buffer()},CL_MIGRATE_MEM_OBJECT_HOST);
+        q.finish();
+        unpack_results(batch_out.data<uint64_t>(), count, &out[first*N_OUTPUTS]);
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(stop - start).count();
+}
+
+// Time the host side conversions of the 32 bit and of the packed transfer
+// formats and check that packing preserves the input_t bit patterns
+static bool run_conversion(long nevents)
+{
+    std::vector<float> values(nevents*N_INPUTS);
+    for (long j = 0; j < nevents*N_INPUTS; j++) {
+        values[j] = 12.34*(j+N_INPUTS*STREAMSIZE);
+    }
+    data_vector in(nevents*N_INPUTS);
+    packed_vector packed(BUS_WORDS*input_beats(nevents));
+
+    // 32 bit format: the float to data32_t cast is all the host does
+    auto start = std::chrono::high_resolution_clock::now();
+    for (long j = 0; j < nevents*N_INPUTS; j++) {
+        in[j] = (data32_t)values[j];
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    double cast_time = std::chrono::duration<double>(stop - start).count();
+
+    // packed format: the same cast followed by packing
+    start = std::chrono::high_resolution_clock::now();
+    for (long j = 0; j < nevents*N_INPUTS; j++) {
+        in[j] = (data32_t)values[j];
+    }
+    pack_inputs(in.data(), nevents, packed.data());
+    stop = std::chrono::high_resolution_clock::now();
+    double pack_time = std::chrono::duration<double>(stop - start).count();
+
+    long mismatches = 0;
+    for (long k = 0; k < nevents*N_INPUTS; k++) {
+        input_t expected = (input_t)in[k];
+        uint64_t bits = get_bits(&packed[(k / INPUTS_PER_BEAT) * BUS_WORDS],
+                                 (k % INPUTS_PER_BEAT) * input_t::width, input_t::width);
+        if (bits != expected.range(input_t::width - 1, 0).to_uint64()) mismatches++;
+    }
+
+    double bytes32 = sizeof(data32_t) * (N_INPUTS + N_OUTPUTS);
+    double bytes_packed = (double)(sizeof(uint64_t) * BUS_WORDS
+            * (input_beats(nevents) + result_beats(nevents))) / nevents;
+    std::cout << "Transfer bytes/event: 32 bit " << bytes32
+              << " packed " << bytes_packed
+              << " (" << std::setprecision(3) << bytes32 / bytes_packed << "x less)" << std::endl;
+    std::cout << "Host conversion events/s: 32 bit " << (long)(nevents / cast_time)
+              << " packed " << (long)(nevents / pack_time) << std::endl;
+    if (mismatches) {
+        std::cout << "Error: " << mismatches << " packed inputs differ from their input_t value" << std::endl;
+    }
+    return mismatches == 0;
+}
+
+int main(int argc, char** argv)
+{
+    long nevents = 65536;
+    if (argc > 1) nevents = atol(argv[1]);
+    int nthreads = 0;
+    if (argc > 2) nthreads = atoi(argv[2]);
+    if (nevents < 1 || nthreads < 0) {
+        std::cout << "Usage: " << argv[0] << " [nevents] [nthreads]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    data_vector source_in(nevents*N_INPUTS);
+    data_vector cpu_results(nevents*N_OUTPUTS);
+    data_vector hw_results(nevents*N_OUTPUTS);
+    for (long j = 0; j < nevents*N_INPUTS; j++) {
+        source_in[j] = (data32_t)(12.34*(j+N_INPUTS*STREAMSIZE));
+        //this is just a random number to produce dummy input data
+    }
+
+    bool match = run_conversion(nevents);
+
+    CpuEngine engine(nthreads);
+    std::cout << "CPU engine threads=" << engine.threads() << std::endl;
+
+// OPENCL HOST CODE AREA START
+    std::vector<cl::Device> devices = xcl::get_xil_devices();
+    cl::Device device = devices[0];
+
+    cl::Context context(device);
+    cl::CommandQueue q(context, device, CL_QUEUE_PROFILING_ENABLE);
+    std::string device_name = device.getInfo<CL_DEVICE_NAME>();
+    std::cout << "Found Device=" << device_name.c_str() << std::endl;
+
+    // Startup cost: the first get_program() call searches, maps and loads
+    // the xclbin, the second one is served from the program cache. Run with
+    // XCL_PROGRAM_CACHE=0 to see the second load without the cache.
+    auto load_start = std::chrono::high_resolution_clock::now();
+    cl::Program program = xcl::get_program(context, device, "aws_hls4ml");
+    auto load_first = std::chrono::high_resolution_clock::now();
+    cl::Program program_again = xcl::get_program(context, device, "aws_hls4ml");
+    auto load_again = std::chrono::high_resolution_clock::now();
+    std::cout << "Program load (s): first "
+              << std::chrono::duration<double>(load_first - load_start).count()
+              << " again " << std::chrono::duration<double>(load_again - load_first).count()
+              << (program_again() == program() ? " (cached)" : "") << std::endl;
+    xcl::BufferPool pool(context);
+
+    std::cout << std::setw(8) << "batch"
+              << std::setw(16) << "cpu events/s"
+              << std::setw(16) << "fpga events/s"
+              << std::setw(12) << "mismatches" << std::endl;
+    for (int batch : batch_sizes) {
+        std::fill(cpu_results.begin(), cpu_results.end(), 0);
+        std::fill(hw_results.begin(), hw_results.end(), 0);
+        double cpu_time = run_cpu(engine, source_in, cpu_results, nevents, batch);
+        double hw_time = run_fpga(pool, q, program, source_in, hw_results, nevents, batch);
+
+        long mismatches = 0;
+        for (long j = 0; j < nevents*N_OUTPUTS; j++) {
+            if (cpu_results[j] != hw_results[j]) {
+                if (mismatches == 0) {
+                    std::cout << "Error: Result mismatch at event " << j / N_OUTPUTS
+                              << " output " << j % N_OUTPUTS << ": cpu " << cpu_results[j]
+                              << " fpga " << hw_results[j] << std::endl;
+                }
+                mismatches++;
+            }
+        }
+        if (mismatches) match = false;
+
+        std::cout << std::setw(8) << batch
+                  << std::setw(16) << (long)(nevents / cpu_time)
+                  << std::setw(16) << (long)(nevents / hw_time)
+                  << std::setw(12) << mismatches << std::endl;
+    }
+    pool.print_stats();
+// OPENCL HOST CODE AREA END
+
+    std::cout << "TEST " << (match ? "PASSED" : "FAILED") << std::endl;
+    return (match ? EXIT_SUCCESS : EXIT_FAILURE);
+}
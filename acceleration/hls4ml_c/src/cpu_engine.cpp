@@ -0,0 +1,67 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+
+#define PROJ_HDR <MYPROJ.h>
+
+#include <parameters.h>
+#include PROJ_HDR
+#include "cpu_engine.h"
+
+// Same per event processing as the aws_hls4ml kernel
+static void infer_events(const data32_t *in, data32_t *out, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; i++) {
+        unsigned short insize, outsize;
+        input_t in_buf[N_INPUTS];
+        result_t out_buf[N_OUTPUTS];
+        for (int j = 0; j < N_INPUTS; j++) {
+            in_buf[j] = (input_t)in[i*N_INPUTS+j];
+        }
+        MYPROJ(in_buf,out_buf,insize,outsize);
+        for (int j = 0; j < N_OUTPUTS; j++) {
+            out[i*N_OUTPUTS+j] = (data32_t)out_buf[j];
+        }
+    }
+}
+
+CpuEngine::CpuEngine(size_t nthreads) : m_pool(nthreads)
+{
+}
+
+void CpuEngine::run(const data32_t *in, data32_t *out, long nevents)
+{
+    // Small batches are not worth waking up the workers for
+    if (nevents < 64) {
+        infer_events(in, out, 0, nevents);
+        return;
+    }
+    m_pool.parallel_for(nevents, 0, [in, out](size_t begin, size_t end) {
+        infer_events(in, out, begin, end);
+    });
+}
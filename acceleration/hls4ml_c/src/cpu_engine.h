@@ -0,0 +1,59 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+
+/*******************************************************************************
+Description:
+    Host side CPU engine for the hls4ml project. It compiles the same MYPROJ
+    and parameters.h as the aws_hls4ml kernel as plain C++ and applies the
+    same conversions to and from data32_t, so its outputs can be diffed
+    against the FPGA outputs bit for bit.
+*******************************************************************************/
+
+#ifndef CPU_ENGINE_H_
+#define CPU_ENGINE_H_
+
+#include "kernel_params.h"
+#include "threadpool.h"
+
+class CpuEngine {
+public:
+    // nthreads == 0 uses one worker per hardware thread
+    explicit CpuEngine(size_t nthreads = 0);
+
+    // Run nevents events, in is nevents x N_INPUTS and out nevents x N_OUTPUTS,
+    // the same layout as the aws_hls4ml kernel arguments
+    void run(const data32_t *in, data32_t *out, long nevents);
+
+    size_t threads() const { return m_pool.size(); }
+
+private:
+    sda::ThreadPool m_pool;
+};
+
+#endif /* CPU_ENGINE_H_ */
@@ -28,37 +28,211 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 **********/
 
 #include "xcl2.hpp"
+#include "profiler.h"
+#include <algorithm>
+#include <string.h>
+#include <chrono>
 #include <vector>
 #include <parameters.h>
 #include "kernel_params.h"
+#include "packing.h"
+#include "cpu_engine.h"
 
 #define DATA_SIZE_IN N_INPUTS
 #define DATA_SIZE_OUT N_OUTPUTS
 
-int main(int argc, char** argv)
+typedef std::vector<data32_t,aligned_allocator<data32_t>> data_vector;
+
+// One set of host/device buffers. In streaming mode several of these are in
+// flight at once so that the transfer of one launch overlaps the inference of
+// the previous one, and each launch goes to whichever compute unit the
+// scheduler picks.
+// in/out hold the data32_t values seen by the application, in_packed and
+// out_packed the packed representation actually transferred (packing.h),
+// taken from the buffer pool together with their device buffers.
+struct buffer_set {
+    data_vector in;
+    data_vector out;
+    xcl::PooledBuffer in_packed;
+    xcl::PooledBuffer out_packed;
+    cl::Kernel krnl;
+    cl::Event write_event;
+    cl::Event task_event;
+    cl::Event read_event;
+    std::future<size_t> done;  // ready once the launch held by this set is back
+    int launch;  // launch currently held by this set, -1 if idle
+};
+
+// Create the test data for events [first, first + count) of the input stream.
+// The values only depend on the event index, so results do not depend on how
+// the stream is split into launches.
+static void make_events(data32_t *in, long first, long count)
 {
+    for(long j = 0 ; j < DATA_SIZE_IN*count ; j++){
+        in[j] = (data32_t)(12.34*(j+DATA_SIZE_IN*(first+STREAMSIZE)));
+        //this is just a random number to produce dummy input data
+    }
+}
 
-    int nevents = 1;
-    if (argc > 1) nevents = atoi(argv[1]);
+static void fill_input(buffer_set &set, long first, int count)
+{
+    make_events(set.in.data(), first, count);
+    pack_inputs(set.in.data(), count, set.in_packed.data<uint64_t>());
+}
 
-    size_t vector_size_in_bytes = sizeof(data32_t) * DATA_SIZE_IN * STREAMSIZE;
-    size_t vector_size_out_bytes = sizeof(data32_t) * DATA_SIZE_OUT * STREAMSIZE;
-    // Allocate Memory in Host Memory
-    // When creating a buffer with user pointer (CL_MEM_USE_HOST_PTR), under the hood user ptr 
-    // is used if it is properly aligned. when not aligned, runtime had no choice but to create
-    // its own host side buffer. So it is recommended to use this allocator if user wish to
-    // create buffer using CL_MEM_USE_HOST_PTR to align user buffer to page boundary. It will 
-    // ensure that user buffer is used when user create Buffer/Mem object with CL_MEM_USE_HOST_PTR 
-    std::vector<data32_t,aligned_allocator<data32_t>> source_in(DATA_SIZE_IN*STREAMSIZE);
-    std::vector<data32_t,aligned_allocator<data32_t>> source_hw_results(DATA_SIZE_OUT*STREAMSIZE);
-
-    //initialize
-    for(int j = 0 ; j < DATA_SIZE_IN*STREAMSIZE ; j++){
-        source_in[j] = 0;
+// Compare count events of kernel results against the CPU build of the same
+// hls4ml project, bit for bit. Returns the number of mismatching outputs and
+// prints the first one.
+static long compare_results(const data32_t *cpu, const data32_t *fpga, long first, long count)
+{
+    long mismatches = 0;
+    for (long j = 0 ; j < DATA_SIZE_OUT*count ; j++){
+        if (cpu[j] != fpga[j]) {
+            if (mismatches == 0) {
+                std::cout << "Error: Result mismatch in event " << first + j / DATA_SIZE_OUT
+                          << " output " << j % DATA_SIZE_OUT << ": cpu " << cpu[j]
+                          << " fpga " << fpga[j] << std::endl;
+            }
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+static void set_kernel_args(cl::Kernel &krnl, buffer_set &set, int count)
+{
+    int narg = 0;
+    krnl.setArg(narg++, set.in_packed.buffer());
+    krnl.setArg(narg++, set.out_packed.buffer());
+    krnl.setArg(narg++, count);
+}
+
+// Run count events starting at first on a set of buffers and wait for them,
+// the original serial flow
+static void run_serial(cl::CommandQueue &q, buffer_set &set, long first, int count)
+{
+    fill_input(set, first, count);
+    set_kernel_args(set.krnl, set, count);
+
+    // Copy input data to device global memory
+    q.enqueueMigrateMemObjects({set.in_packed.buffer()},0/* 0 means from host*/);
+    // Launch the Kernel
+    // For HLS kernels global and local size is always (1,1,1). So, it is recommended
+    // to always use enqueueTask() for invoking HLS kernel
+    q.enqueueTask(set.krnl);
+    // Copy Result from Device Global Memory to Host Local Memory
+    q.enqueueMigrateMemObjects({set.out_packed.buffer()},CL_MIGRATE_MEM_OBJECT_HOST);
+    q.finish();
+    unpack_results(set.out_packed.data<uint64_t>(), count, set.out.data());
+}
+
+// Enqueue one launch of batch events on the out of order queue and kernel of
+// the compute unit the scheduler picked. The three commands are chained
+// through their events; nothing here blocks. Returns the event of the read
+// back, which completes the launch for the scheduler.
+static cl::Event enqueue_launch(cl::CommandQueue &q, cl::Kernel &krnl, buffer_set &set,
+        int batch, sda::Profiler &profiler)
+{
+    set_kernel_args(krnl, set, batch);
+
+    q.enqueueMigrateMemObjects({set.in_packed.buffer()}, 0/* 0 means from host*/,
+            NULL, &set.write_event);
+
+    std::vector<cl::Event> task_deps = {set.write_event};
+    q.enqueueTask(krnl, &task_deps, &set.task_event);
+
+    std::vector<cl::Event> read_deps = {set.task_event};
+    q.enqueueMigrateMemObjects({set.out_packed.buffer()}, CL_MIGRATE_MEM_OBJECT_HOST,
+            &read_deps, &set.read_event);
+
+    profiler.record("write inputs", set.write_event);
+    profiler.record("kernel exec", set.task_event);
+    profiler.record("read results", set.read_event);
+    return set.read_event;
+}
+
+// Latency of a launch from the moment its input transfer was queued until its
+// results are back in host memory, in microseconds
+static double launch_latency_us(buffer_set &set)
+{
+    cl_ulong queued = set.write_event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+    cl_ulong end = set.read_event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+    return (end - queued) / 1000.0;
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty()) return 0.0;
+    size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[idx];
+}
+
+static void alloc_buffer_set(xcl::BufferPool &pool, cl::Program &program,
+        buffer_set &set, int count)
+{
+    size_t vector_size_in_bytes = sizeof(uint64_t) * BUS_WORDS * input_beats(count);
+    size_t vector_size_out_bytes = sizeof(uint64_t) * BUS_WORDS * result_beats(count);
+    set.in.assign(DATA_SIZE_IN*count, 0);
+    set.out.assign(DATA_SIZE_OUT*count, 0);
+    // The pool hands out page aligned blocks bound to CL_MEM_USE_HOST_PTR
+    // buffers for efficient memory and Device-to-host communication
+    set.in_packed = pool.acquire(vector_size_in_bytes, CL_MEM_READ_ONLY);
+    set.out_packed = pool.acquire(vector_size_out_bytes, CL_MEM_WRITE_ONLY);
+    set.krnl = cl::Kernel(program,"aws_hls4ml");
+    set_kernel_args(set.krnl, set, count);
+    set.launch = -1;
+}
+
+// Launch sizes the streaming and serial flows do not cover by default: an
+// empty launch, which must complete without writing any result, a single
+// event, which only fills part of a beat, and more than STREAMSIZE events.
+static bool check_launch_sizes(xcl::BufferPool &pool, cl::CommandQueue &q,
+        cl::Program &program, CpuEngine &engine)
+{
+    const int counts[] = {0, 1, 2*STREAMSIZE + 3};
+    bool match = true;
+    for (int count : counts) {
+        buffer_set set;
+        alloc_buffer_set(pool, program, set, std::max(count, 1));
+        size_t out_bytes = sizeof(uint64_t) * BUS_WORDS * result_beats(std::max(count, 1));
+        // the sentinel has to be on the device, the launch reads back whatever is there
+        memset(set.out_packed.host(), 0xA5, out_bytes);
+        q.enqueueMigrateMemObjects({set.out_packed.buffer()}, 0/* 0 means from host*/);
+        run_serial(q, set, 0, count);
+
+        bool ok;
+        if (count == 0) {
+            const unsigned char *out = set.out_packed.data<unsigned char>();
+            ok = std::count(out, out + out_bytes, 0xA5) == (long)out_bytes;
+            if (!ok) std::cout << "Error: Empty launch wrote results" << std::endl;
+        } else {
+            data_vector cpu(DATA_SIZE_OUT*count);
+            engine.run(set.in.data(), cpu.data(), count);
+            ok = compare_results(cpu.data(), set.out.data(), 0, count) == 0;
+        }
+        std::cout << "Launch of " << count << " events: " << (ok ? "match" : "MISMATCH") << std::endl;
+        match = match && ok;
     }
-    for(int j = 0 ; j < DATA_SIZE_OUT*STREAMSIZE ; j++){
-        source_hw_results[j] = 0;
+    return match;
+}
+
+int main(int argc, char** argv)
+{
+
+    int nlaunches = 1;
+    if (argc > 1) nlaunches = atoi(argv[1]);
+    // Number of buffer sets kept in flight. 0 selects the original serial
+    // flow which prints every output; anything else selects streaming mode.
+    int ninflight = 0;
+    if (argc > 2) ninflight = atoi(argv[2]);
+    // Number of events processed by each kernel launch
+    int batch = STREAMSIZE;
+    if (argc > 3) batch = atoi(argv[3]);
+    if (nlaunches < 1 || ninflight < 0 || batch < 1) {
+        std::cout << "Usage: " << argv[0] << " [nlaunches] [ninflight] [batch]" << std::endl;
+        return EXIT_FAILURE;
     }
+    bool streaming = ninflight > 0;
 
 // OPENCL HOST CODE AREA START
     // get_xil_devices() is a utility API which will find the xilinx
@@ -71,74 +245,137 @@ int main(int argc, char** argv)
     std::string device_name = device.getInfo<CL_DEVICE_NAME>(); 
     std::cout << "Found Device=" << device_name.c_str() << std::endl;
 
-    // find_binary_file() is a utility API which will search the xclbin file for
-    // targeted mode (sw_emu/hw_emu/hw) and for targeted platforms.
-    std::string binaryFile = xcl::find_binary_file(device_name,"aws_hls4ml");
+    // get_program() is a utility API which searches the xclbin file for the
+    // targeted mode (sw_emu/hw_emu/hw) and platform, maps it and creates the
+    // program. Repeated calls for the same context reuse the cached program.
+    cl::Program program = xcl::get_program(context, device, "aws_hls4ml");
+
+    // Reference results come from the same hls4ml project built for the CPU
+    CpuEngine engine;
 
-    // import_binary_file() ia a utility API which will load the binaryFile
-    // and will return Binaries.
-    cl::Program::Binaries bins = xcl::import_binary_file(binaryFile);
-    devices.resize(1);
-    cl::Program program(context, devices, bins);
+    // Allocate Memory in Host Memory and Buffers in Global Memory
+    // When creating a buffer with user pointer (CL_MEM_USE_HOST_PTR), under the hood user ptr 
+    // is used if it is properly aligned. when not aligned, runtime had no choice but to create
+    // its own host side buffer. The pool only hands out page aligned blocks, which ensures
+    // that user buffer is used, and keeps the blocks of released sets for later ones.
+    xcl::BufferPool pool(context);
+    int nsets = streaming ? ninflight : 1;
+    std::vector<buffer_set> sets(nsets);
+    for (int s = 0 ; s < nsets ; s++){
+        alloc_buffer_set(pool, program, sets[s], batch);
+    }
 
-    // Allocate Buffer in Global Memory
-    // Buffers are allocated using CL_MEM_USE_HOST_PTR for efficient memory and 
-    // Device-to-host communication
-    cl::Buffer buffer_in   (context,CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, 
-            vector_size_in_bytes, source_in.data());
-    cl::Buffer buffer_output(context,CL_MEM_USE_HOST_PTR | CL_MEM_WRITE_ONLY, 
-            vector_size_out_bytes, source_hw_results.data());
+    if (!streaming) {
+        bool match = true;
+        data_vector cpu(DATA_SIZE_OUT*batch);
+        std::cout << "Output of HLS4ML algo is:"<<std::endl;
+        for (int i = 0 ; i < nlaunches ; i++){
+            run_serial(q, sets[0], (long)i * batch, batch);
+            for (int j = 0 ; j < batch ; j++){
+                for (int k = 0 ; k < DATA_SIZE_OUT ; k++){
+                    std::cout << sets[0].out[j*DATA_SIZE_OUT + k] << " ";
+                }
+                std::cout << std::endl;
+            }
+            std::cout<<"---- END EVENT "<<i+1<<" ----"<<std::endl;
+            engine.run(sets[0].in.data(), cpu.data(), batch);
+            if (compare_results(cpu.data(), sets[0].out.data(), (long)i * batch, batch))
+                match = false;
+        }
+        if (!check_launch_sizes(pool, q, program, engine))
+            match = false;
+        std::cout << "TEST " << (match ? "PASSED" : "FAILED") << std::endl; 
+        return (match ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
 
-    std::vector<cl::Memory> inBufVec, outBufVec;
-    inBufVec.push_back(buffer_in);
-    outBufVec.push_back(buffer_output);
+    // Streaming mode: keep every buffer set busy. A set is refilled as soon
+    // as the results of its previous launch have been read back, so up to
+    // ninflight launches are queued on the device at any time. The scheduler
+    // spreads them over every compute unit of the kernel (--nk aws_hls4ml:<n>),
+    // each with its own out of order queue where the dependencies between
+    // transfers and kernel runs are expressed as events.
+    xcl::Scheduler sched(context, device, program, "aws_hls4ml",
+            xcl::Scheduler::LEAST_LOADED, nsets);
+    std::cout << "Streaming " << nlaunches << " launches of " << batch
+              << " events with " << nsets << " buffer sets in flight" << std::endl;
 
-    cl::Kernel krnl_aws_hls4ml(program,"aws_hls4ml");
+    // Results of the first few launches are kept so that they can be checked
+    // against the CPU, which validates the event chaining.
+    int ncheck = std::min(nlaunches, 2 * nsets);
+    std::vector<std::vector<data32_t>> stream_results(ncheck);
+    std::vector<double> latencies;
+    latencies.reserve(nlaunches);
+    sda::Profiler profiler;
 
-    //int size = DATA_SIZE;
-    int narg = 0;
-    krnl_aws_hls4ml.setArg(narg++, buffer_in);
-    krnl_aws_hls4ml.setArg(narg++, buffer_output);
-    //krnl_vector_add.setArg(narg++, size);
-    //q.enqueueMigrateMemObjects(inBufVec,0/* 0 means from host*/);
-    // Launch the Kernel
-    // For HLS kernels global and local size is always (1,1,1). So, it is recommended
-    // to always use enqueueTask() for invoking HLS kernel
-    //q.enqueueTask(krnl_aws_hls4ml);
-    // Copy Result from Device Global Memory to Host Local Memory
-    //q.enqueueMigrateMemObjects({buffer_output},CL_MIGRATE_MEM_OBJECT_HOST);
-
-    //q.finish();
-    std::cout << "Output of HLS4ML algo is:"<<std::endl;
-    for (int i = 0 ; i < nevents ; i++){
-        // Create the test data 
-        for(int j = 0 ; j < DATA_SIZE_IN*STREAMSIZE ; j++){
-            source_in[j] = (data32_t)(12.34*(j+DATA_SIZE_IN*STREAMSIZE*(i+1)));
-            //this is just a random number to produce dummy input data
+    bool match = true;
+    auto retire = [&](buffer_set &set) {
+        try {
+            set.done.get();
+        } catch (const std::exception &e) {
+            std::cout << "Error: launch " << set.launch << " failed: " << e.what() << std::endl;
+            match = false;
+            set.launch = -1;
+            return;
         }
-        for(int j = 0 ; j < DATA_SIZE_OUT*STREAMSIZE ; j++){
-            source_hw_results[j] = 0;
-        }
-    
-        // Copy input data to device global memory
-        q.enqueueMigrateMemObjects(inBufVec,0/* 0 means from host*/);
-        // Launch the Kernel
-        // For HLS kernels global and local size is always (1,1,1). So, it is recommended
-        // to always use enqueueTask() for invoking HLS kernel
-        q.enqueueTask(krnl_aws_hls4ml);
-        // Copy Result from Device Global Memory to Host Local Memory
-        q.enqueueMigrateMemObjects({buffer_output},CL_MIGRATE_MEM_OBJECT_HOST);
-        q.finish();
-        for (int j = 0 ; j < STREAMSIZE ; j++){
-            for (int k = 0 ; k < DATA_SIZE_OUT ; k++){
-    	        std::cout << source_hw_results[j*DATA_SIZE_OUT + k] << " ";
-            }
-            std::cout << std::endl;
-        }
-        std::cout<<"---- END EVENT "<<i+1<<" ----"<<std::endl;
+        latencies.push_back(launch_latency_us(set));
+        unpack_results(set.out_packed.data<uint64_t>(), batch, set.out.data());
+        if (set.launch < ncheck)
+            stream_results[set.launch].assign(set.out.begin(), set.out.end());
+        set.launch = -1;
+    };
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0 ; i < nlaunches ; i++){
+        buffer_set &set = sets[i % nsets];
+        if (set.launch >= 0) retire(set);
+        fill_input(set, (long)i * batch, batch);
+        set.launch = i;
+        set.done = sched.submit([&set, batch, &profiler](cl::CommandQueue &cu_q, cl::Kernel &krnl) {
+            return enqueue_launch(cu_q, krnl, set, batch, profiler);
+        });
+    }
+    // Drain the remaining launches in submission order
+    for (int i = std::max(0, nlaunches - nsets) ; i < nlaunches ; i++){
+        buffer_set &set = sets[i % nsets];
+        if (set.launch >= 0) retire(set);
+    }
+    sched.finish();
+    auto stop = std::chrono::high_resolution_clock::now();
+
+    double seconds = std::chrono::duration<double>(stop - start).count();
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "Launches processed     : " << nlaunches << std::endl;
+    std::cout << "Wall time (s)          : " << seconds << std::endl;
+    std::cout << "Sustained launches/sec : " << nlaunches / seconds << std::endl;
+    std::cout << "Sustained events/sec   : " << (double)nlaunches * batch / seconds << std::endl;
+    std::cout << "Transfer bytes/event   : " << (double)(sizeof(uint64_t) * BUS_WORDS
+                    * (input_beats(batch) + result_beats(batch))) / batch << std::endl;
+    std::cout << "Launch latency (us)    : p50 " << percentile(latencies, 0.50)
+              << " p90 " << percentile(latencies, 0.90)
+              << " p99 " << percentile(latencies, 0.99)
+              << " max " << (latencies.empty() ? 0.0 : latencies.back()) << std::endl;
+    std::vector<size_t> per_cu = sched.completed_per_cu();
+    for (size_t cu = 0 ; cu < per_cu.size() ; cu++){
+        std::cout << "Launches on " << sched.cu_name(cu) << " : " << per_cu[cu] << std::endl;
+    }
+    profiler.report();
+
+    // Check the kept launches against the CPU build of the project, then the
+    // launch sizes the streaming run does not cover
+    long nchecked = (long)ncheck * batch;
+    data_vector check_in(DATA_SIZE_IN*nchecked);
+    data_vector cpu(DATA_SIZE_OUT*nchecked);
+    make_events(check_in.data(), 0, nchecked);
+    engine.run(check_in.data(), cpu.data(), nchecked);
+    for (int i = 0 ; match && i < ncheck ; i++){
+        if (compare_results(&cpu[(long)i*batch*DATA_SIZE_OUT], stream_results[i].data(),
+                    (long)i * batch, batch))
+            match = false;
     }
+    if (!check_launch_sizes(pool, q, program, engine))
+        match = false;
 // OPENCL HOST CODE AREA END
 
-    std::cout << "TEST PASSED" << std::endl; 
-    return EXIT_SUCCESS;
+    std::cout << "TEST " << (match ? "PASSED" : "FAILED") << std::endl; 
+    return (match ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -1,5 +1,15 @@
 #include "ap_fixed.h"
+#include "ap_int.h"
 
+// Default number of events per kernel launch. The kernel takes the actual
+// count as an argument, this is only used by the host and as loop tripcount.
 #define STREAMSIZE 128
 
 typedef ap_fixed<32,8> data32_t;
+
+// Inputs and results are transferred packed in their native width, several
+// values per AXI beat (see packing.h for the layout)
+#define BUS_WIDTH 512
+typedef ap_uint<BUS_WIDTH> bus_t;
+#define INPUTS_PER_BEAT (BUS_WIDTH / input_t::width)
+#define RESULTS_PER_BEAT (BUS_WIDTH / result_t::width)
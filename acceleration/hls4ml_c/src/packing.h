@@ -0,0 +1,115 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+
+/*******************************************************************************
+Description:
+    Packed transfer format of the aws_hls4ml kernel.
+    Inputs and results are moved as their native input_t/result_t bit
+    patterns, packed back to back into BUS_WIDTH wide beats. Values of
+    consecutive events follow each other without padding: value k of the
+    stream (event k / N_INPUTS, input k % N_INPUTS) lives in beat
+    k / INPUTS_PER_BEAT at bit offset (k % INPUTS_PER_BEAT) * input_t::width.
+    On the host a beat is BUS_WORDS little endian 64 bit words, which is the
+    memory layout of an ap_uint<BUS_WIDTH> on the device.
+*******************************************************************************/
+
+#ifndef PACKING_H_
+#define PACKING_H_
+
+#include <stdint.h>
+#include <parameters.h>
+#include "kernel_params.h"
+
+#define BUS_WORDS (BUS_WIDTH / 64)
+
+// Number of beats holding nevents events worth of inputs/results
+inline long input_beats(long nevents)
+{
+    return (nevents * N_INPUTS + INPUTS_PER_BEAT - 1) / INPUTS_PER_BEAT;
+}
+
+inline long result_beats(long nevents)
+{
+    return (nevents * N_OUTPUTS + RESULTS_PER_BEAT - 1) / RESULTS_PER_BEAT;
+}
+
+// Write/read width bits at bit offset pos of a beat. Values never straddle
+// a beat but may straddle two 64 bit words when width does not divide 64.
+inline void put_bits(uint64_t *beat, int pos, int width, uint64_t bits)
+{
+    uint64_t mask = (width == 64) ? ~0ULL : ((1ULL << width) - 1);
+    bits &= mask;
+    int word = pos / 64, shift = pos % 64;
+    beat[word] |= bits << shift;
+    if (shift + width > 64)
+        beat[word + 1] |= bits >> (64 - shift);
+}
+
+inline uint64_t get_bits(const uint64_t *beat, int pos, int width)
+{
+    uint64_t mask = (width == 64) ? ~0ULL : ((1ULL << width) - 1);
+    int word = pos / 64, shift = pos % 64;
+    uint64_t bits = beat[word] >> shift;
+    if (shift + width > 64)
+        bits |= beat[word + 1] << (64 - shift);
+    return bits & mask;
+}
+
+// Convert nevents events of data32_t inputs to input_t and pack them.
+// packed must hold input_beats(nevents) * BUS_WORDS words. The conversion is
+// the same (input_t) cast the 32 bit path did in the kernel, so the packed
+// values are bit identical to what the kernel used to compute on.
+inline void pack_inputs(const data32_t *in, long nevents, uint64_t *packed)
+{
+    const int width = input_t::width;
+    long nbeats = input_beats(nevents);
+    for (long w = 0; w < nbeats * BUS_WORDS; w++)
+        packed[w] = 0;
+    for (long k = 0; k < nevents * N_INPUTS; k++) {
+        input_t v = (input_t)in[k];
+        put_bits(&packed[(k / INPUTS_PER_BEAT) * BUS_WORDS],
+                 (k % INPUTS_PER_BEAT) * width, width,
+                 v.range(width - 1, 0).to_uint64());
+    }
+}
+
+// Unpack nevents events of result_t and convert them to data32_t, the same
+// (data32_t) cast the 32 bit path did in the kernel
+inline void unpack_results(const uint64_t *packed, long nevents, data32_t *out)
+{
+    const int width = result_t::width;
+    for (long k = 0; k < nevents * N_OUTPUTS; k++) {
+        result_t v;
+        v.range(width - 1, 0) = get_bits(&packed[(k / RESULTS_PER_BEAT) * BUS_WORDS],
+                                         (k % RESULTS_PER_BEAT) * width, width);
+        out[k] = (data32_t)v;
+    }
+}
+
+#endif /* PACKING_H_ */
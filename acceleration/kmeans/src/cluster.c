@@ -85,7 +85,10 @@ int cluster(int     npoints,                /* number of data points */
             float   *min_rmse,              /* out: minimum RMSE */
             int     isRMSE,                 /* calculate RMSE */
             int     nloops,                 /* number of iteration for each number of clusters */
-            const char*   goldenFile
+            const char*   goldenFile,
+            int     engine,                 /* KMEANS_ENGINE_FPGA, _CPU or _BOTH */
+            const kmeans_cpu_options *cpu_options, /* CPU engine settings, NULL: defaults */
+            fpga_kmeans_context *fpga_ctx   /* device settings, NULL: defaults */
             )
 {    
     int     nclusters;          /* number of clusters k */
@@ -93,52 +96,110 @@ int cluster(int     npoints,                /* number of data points */
     float   rmse;               /* RMSE for each clustering */
     int    *membership;         /* which cluster a data point belongs to */
     int    *cmodel_membership;  /* which cluster a data point belongs to */
+    int    *cpu_membership;     /* CPU engine result when both engines run */
     float **tmp_cluster_centres;/* hold coordinates of cluster centers */
     int     i;
     
     struct timespec d_start,d_end;
     double d_time;
+    kmeans_cpu_options cpu_opt;
+    kmeans_cpu_stats   cpu_stats;
     
     /* allocate memory for membership */
     membership = (int*) malloc(npoints * sizeof(int));
     cmodel_membership = (int*) malloc(npoints * sizeof(int));
-    if ((membership == NULL) | (cmodel_membership == NULL)){
+    cpu_membership = (int*) malloc(npoints * sizeof(int));
+    if ((membership == NULL) | (cmodel_membership == NULL) | (cpu_membership == NULL)){
         fprintf(stderr, "Error: Failed to run malloc\n");
         exit(1);
     }
 
-     fpga_kmeans_init();
+    if (cpu_options)
+        cpu_opt = *cpu_options;
+    else
+        kmeans_cpu_default_options(&cpu_opt);
+    /* as golden model the CPU engine has to start from the device's centers */
+    if (engine == KMEANS_ENGINE_BOTH)
+        cpu_opt.seeding = KMEANS_SEED_FIRST;
+
+    fpga_kmeans_context *ctx = NULL;
+    if (engine & KMEANS_ENGINE_FPGA) {
+        ctx = fpga_ctx ? fpga_ctx : fpga_kmeans_create();
+        fpga_kmeans_init(ctx, nfeatures, max_nclusters);
+    }
 
     /* sweep k from min to max_nclusters to find the best number of clusters */
     for(nclusters = min_nclusters; nclusters <= max_nclusters; nclusters++)
     {
         if (nclusters > npoints) break;    /* cannot have more clusters than points */
-        clock_gettime(CLOCK_MONOTONIC,&d_start);
-        clock_gettime(CLOCK_MONOTONIC,&d_end);
-        d_time = time_elapsed(d_start,d_end);
-        printf("Device Initialization Time %f ms\n",d_time);
-        clock_gettime(CLOCK_MONOTONIC,&d_start);
-        /* allocate device memory, (@ kmeans_cuda.cu) */
-        fpga_kmeans_allocate(npoints, nfeatures, nclusters, features);
-        clock_gettime(CLOCK_MONOTONIC,&d_end);
-        d_time = time_elapsed(d_start,d_end);
-        printf("Device Data Writing Time %f ms\n",d_time);
-        /* iterate nloops times for each number of clusters */
-        for(i = 0; i < nloops; i++)
-        {
-            printf("Running Device execution \n");
+        if (engine & KMEANS_ENGINE_FPGA) {
             clock_gettime(CLOCK_MONOTONIC,&d_start);
-            /* initialize initial cluster centers, CUDA calls (@ kmeans_cuda.cu) */
-            tmp_cluster_centres = fpga_kmeans_clustering(
-                                                    features,
-                                                    nfeatures,
-                                                    npoints,
-                                                    nclusters,
-                                                    threshold,
-                                                    membership);
             clock_gettime(CLOCK_MONOTONIC,&d_end);
             d_time = time_elapsed(d_start,d_end);
-            printf("Device execution Time %f ms\n",d_time);
+            printf("Device Initialization Time %f ms\n",d_time);
+            clock_gettime(CLOCK_MONOTONIC,&d_start);
+            /* allocate device memory, (@ kmeans_cuda.cu) */
+            fpga_kmeans_allocate(ctx, npoints, nfeatures, nclusters, features);
+            clock_gettime(CLOCK_MONOTONIC,&d_end);
+            d_time = time_elapsed(d_start,d_end);
+            printf("Device Data Writing Time %f ms\n",d_time);
+        }
+        /* iterate nloops times for each number of clusters */
+        for(i = 0; i < nloops; i++)
+        {
+            tmp_cluster_centres = NULL;
+            if (engine & KMEANS_ENGINE_FPGA) {
+                printf("Running Device execution \n");
+                clock_gettime(CLOCK_MONOTONIC,&d_start);
+                /* initialize initial cluster centers, CUDA calls (@ kmeans_cuda.cu) */
+                tmp_cluster_centres = fpga_kmeans_clustering(
+                                                        ctx,
+                                                        features,
+                                                        nfeatures,
+                                                        npoints,
+                                                        nclusters,
+                                                        threshold,
+                                                        membership);
+                clock_gettime(CLOCK_MONOTONIC,&d_end);
+                d_time = time_elapsed(d_start,d_end);
+                printf("Device execution Time %f ms\n",d_time);
+            }
+            if (engine & KMEANS_ENGINE_CPU) {
+                /* fallback when running alone, golden model next to the device */
+                int    *cpu_out = (engine & KMEANS_ENGINE_FPGA) ? cpu_membership : membership;
+                float **cpu_cluster_centres;
+                printf("Running CPU engine execution \n");
+                clock_gettime(CLOCK_MONOTONIC,&d_start);
+                cpu_cluster_centres = kmeans_clustering_cpu(features,
+                                                        nfeatures,
+                                                        npoints,
+                                                        nclusters,
+                                                        threshold,
+                                                        cpu_out,
+                                                        &cpu_opt,
+                                                        &cpu_stats);
+                clock_gettime(CLOCK_MONOTONIC,&d_end);
+                d_time = time_elapsed(d_start,d_end);
+                printf("CPU engine execution Time %f ms\n",d_time);
+                kmeans_cpu_print_report(&cpu_stats);
+                if (engine & KMEANS_ENGINE_FPGA) {
+                    int mismatch = 0;
+                    for (int j = 0 ; j < npoints ; j++){
+                        if (cpu_membership[j] != membership[j])
+                            mismatch++;
+                    }
+                    float mismatch_rate = float (100 * mismatch) / npoints;
+                    if (mismatch_rate > 10){
+                        printf("FAILED:Based on CPU engine: Points Membership Mismatch %d Mismatch Rate %.3f \n",mismatch, mismatch_rate);
+                    }else{
+                        printf("PASSED:Based on CPU engine: Points membership with Match Rate %.3f and mismatch %d with CPU engine. \n", 100.0 - mismatch_rate, mismatch);
+                    }
+                    free(cpu_cluster_centres[0]);
+                    free(cpu_cluster_centres);
+                }else{
+                    tmp_cluster_centres = cpu_cluster_centres;
+                }
+            }
             printf("Running Host execution \n");
 
 #ifdef VERIFY_USING_CMODEL
@@ -229,13 +290,19 @@ int cluster(int     npoints,                /* number of data points */
                 }
             }            
         }
-        fpga_kmeans_deallocateMemory();                            /* free device memory (@ kmeans_cuda.cu) */
-        fpga_kmeans_print_report();
+        if (engine & KMEANS_ENGINE_FPGA) {
+            fpga_kmeans_deallocateMemory(ctx);                        /* free device memory (@ kmeans_cuda.cu) */
+            fpga_kmeans_print_report(ctx);
+        }
     }
 
-    fpga_kmeans_shutdown();
+    if (engine & KMEANS_ENGINE_FPGA) {
+        fpga_kmeans_shutdown(ctx);
+        if (fpga_ctx == NULL) fpga_kmeans_release(ctx);
+    }
     free(membership);
     free(cmodel_membership);
+    free(cpu_membership);
 
     return index;
 }
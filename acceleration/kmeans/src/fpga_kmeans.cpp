@@ -29,6 +29,15 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "fpga_kmeans.h"
 #include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "kmeans.h"
 #include <CL/cl.h>
 #include "xcl.h"
@@ -37,32 +46,102 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define FLOAT_DT    0
 #define INT_DT      1
 
+//Must match kmeans.cl and kmeans_tiled.cl on-chip buffer limits
+#define MAX_FEATURES        64
+#define MAX_CLUSTERS        1024
+#define MAX_CLUSTER_SIZE    (32 * 1024)
+#define MAX_TILE_CLUSTERS   64
+#ifndef PARALLEL_FEATURES
+#define PARALLEL_FEATURES   2
+#endif
+
 
 #if USE_DATA_TYPE == INT_DT
     #define DATA_TYPE unsigned int 
     #define INT_DATA_TYPE int
+    #define ACC_DATA_TYPE cl_long
+    #define DIST_DATA_TYPE cl_ulong
+    //Must match kmeans.cl: features are quantised per feature to QUANT_BITS,
+    //16 and 8 bit features are packed 2 and 4 to a word for kmeans kernel
+    #ifndef QUANT_BITS
+    #define QUANT_BITS 24
+    #endif
+    #define QUANT_LEVELS ((1u << QUANT_BITS) - 1)
+    #define FEATURES_PER_WORD ((QUANT_BITS == 24) ? 1 : 32 / QUANT_BITS)
+    //Must match kmeans.cl: squared 24 bit differences times the weight fill 64 bits
+    #define MAX_WEIGHT ((QUANT_BITS == 24) ? 0xFFFFu : 0xFFFFFFFFu)
 #else
     #define DATA_TYPE float
     #define INT_DATA_TYPE int
+    #define ACC_DATA_TYPE float
+    #define DIST_DATA_TYPE float
+    #define FEATURES_PER_WORD 1
 #endif
 
 
-//Global Variables
-xcl_world       g_world;
-cl_program      g_prog;
-INT_DATA_TYPE   *g_membership_OCL;
-cl_kernel       g_kernel_kmeans;
+//DDR banks of the card, compute unit i is connected to bank i % DDR_BANKS
+//(see --sp options in Makefile)
+#ifndef DDR_BANKS
+#define DDR_BANKS 4
+#endif
+//kmeans:{kmeans_1} to kmeans:{kmeans_N} are looked up in the xclbin
+#define MAX_COMPUTE_UNITS 16
 
-cl_mem d_feature;
-cl_mem d_cluster;
-cl_mem d_membership;
+//A compute unit with the range of points it owns. All its buffers live in the
+//bank it is connected to, so compute units do not compete for DDR bandwidth.
+struct fpga_kmeans_cu {
+    std::string         name;
+    cl_kernel           kernel;
+    cl_command_queue    queue;
+    int                 bank;           //-1: runtime picks the bank
+    int                 point_start;    //first point, multiple of vector size
+    int                 n_points;
+    int                 work_items;
 
-int g_global_size = 1;
-int g_vector_size = 16;
-float g_scale_factor =  1.0;
+    cl_mem d_feature;
+    cl_mem d_cluster;
+    cl_mem d_membership;
+    cl_mem d_sums;
+    cl_mem d_counts;
+    cl_mem d_delta;
+    cl_mem d_min_dist;
+    cl_mem d_weights;
+
+    //Per work item partial results of the on-device centroid update
+    std::vector<ACC_DATA_TYPE>  sums;
+    std::vector<INT_DATA_TYPE>  counts;
+    std::vector<INT_DATA_TYPE>  delta;
+
+    cl_ulong            t_busy;         //ns spent running kernels
+};
+
+struct fpga_kmeans_context {
+    int                 global_size;
+    int                 tiled_setting;
+    int                 max_compute_units;
+
+    xcl_world           world;
+    cl_program          prog;
+    bool                initialised;
+    std::vector<fpga_kmeans_cu> cus;
+
+    //Tiled mode streams centroids through kmeans_tiled kernel tile_clusters at a time
+    bool                tiled;
+    int                 tile_clusters;
+    std::vector<DATA_TYPE>      tiles;
 
-float g_t_exec;
-int   g_iteration;
+    //Per feature quantisation, feature f is stored as (value - min[f]) / scale[f]
+    std::vector<float>          quant_min;
+    std::vector<float>          quant_scale;
+    std::vector<DATA_TYPE>      quant_weight;
+
+    std::vector<INT_DATA_TYPE>  membership;
+
+    cl_ulong            t_exec;         //ns from first kernel start to last kernel end, summed over rounds
+    int                 iteration;
+};
+
+int g_vector_size = 16;
 
 
 // Wrap any OpenCL API calls that return error code(cl_int) with the below macro
@@ -85,47 +164,138 @@ void check(cl_int err_code) {
   }
 }
 
-#if USE_DATA_TYPE == INT_DT
+//kmeans kernel keeps every centroid, their sums and a point group's features on chip.
+//Sums are banked by PARALLEL_FEATURES, features are padded to whole tiles there.
+static bool fits_on_chip(int n_features, int n_clusters)
+{
+    int padded_features = (n_features + PARALLEL_FEATURES - 1) / PARALLEL_FEATURES * PARALLEL_FEATURES;
+    return (n_features <= MAX_FEATURES) && (n_clusters <= MAX_CLUSTERS) &&
+           (n_clusters * padded_features <= MAX_CLUSTER_SIZE);
+}
 
-static void calculate_scale_factor(float* mem, int size)
+//largest centroid tile kmeans_tiled kernel can hold
+static int tile_size(int n_features, int n_clusters)
 {
-    float min = mem[0];
-    float max = mem[0];
-    for (int i = 0 ; i < size ; i++)
+    int tile = MAX_CLUSTER_SIZE / n_features;
+    if (tile > MAX_TILE_CLUSTERS) tile = MAX_TILE_CLUSTERS;
+    if (tile > n_clusters)        tile = n_clusters;
+    return tile;
+}
+
+//Device buffer in the given DDR bank, any bank for -1
+static cl_mem bank_malloc(fpga_kmeans_context *ctx, int bank, cl_mem_flags flags, size_t size)
+{
+    if (bank < 0)
+        return xcl_malloc(ctx->world, flags, size);
+
+    static const unsigned bank_flags[] = {XCL_MEM_DDR_BANK0, XCL_MEM_DDR_BANK1,
+                                          XCL_MEM_DDR_BANK2, XCL_MEM_DDR_BANK3};
+    cl_mem_ext_ptr_t ext;
+    ext.flags = bank_flags[bank % 4];
+    ext.obj   = 0;
+    ext.param = 0;
+    cl_int err;
+    cl_mem mem = clCreateBuffer(ctx->world.context, flags | CL_MEM_EXT_PTR_XILINX, size, &ext, &err);
+    if (err != CL_SUCCESS){
+        printf("Error: Failed to allocate %zu bytes in DDR bank %d: %s\n", size, bank, oclErrorCode(err));
+        exit(EXIT_FAILURE);
+    }
+    return mem;
+}
+
+#if USE_DATA_TYPE == INT_DT
+//Affine quantisation of every feature to its own range. Distances in quantised
+//units are weighted by scale^2, as integers relative to the widest feature. The
+//weight is rounded up to at least 1 and the scale is recomputed from it, so that
+//weights stay exact and narrow features are quantised no finer than they count.
+static void calculate_quantisation(fpga_kmeans_context *ctx, float* mem, int n_points, int n_features)
+{
+    ctx->quant_min.assign(n_features, 0.0f);
+    ctx->quant_scale.assign(n_features, 0.0f);
+    ctx->quant_weight.assign(n_features, 0);
+    float max_scale = 0;
+    for (int f = 0 ; f < n_features ; f++)
     {
-        float value = mem[i];
-        if (value < min)    min = value;
-        if (value > max)    max = value;
+        float min = mem[f];
+        float max = mem[f];
+        for (int i = 0 ; i < n_points ; i++)
+        {
+            float value = mem[i * n_features + f];
+            if (value < min)    min = value;
+            if (value > max)    max = value;
+        }
+        ctx->quant_min[f] = min;
+        ctx->quant_scale[f] = (max - min) / QUANT_LEVELS;
+        if (ctx->quant_scale[f] > max_scale) max_scale = ctx->quant_scale[f];
+    }
+    //every feature constant: any non-zero scale quantises them to 0
+    if (max_scale == 0) max_scale = 1.0f;
+    for (int f = 0 ; f < n_features ; f++)
+    {
+        //constant features quantise to 0 whatever the scale, their differences are always 0
+        if (ctx->quant_scale[f] == 0)
+        {
+            ctx->quant_scale[f] = max_scale;
+            ctx->quant_weight[f] = 1;
+            continue;
+        }
+        double ratio = ctx->quant_scale[f] / max_scale;
+        double weight = ceil(ratio * ratio * MAX_WEIGHT);
+        if (weight < 1)             weight = 1;
+        if (weight > MAX_WEIGHT)    weight = MAX_WEIGHT;
+        ctx->quant_weight[f] = (DATA_TYPE) weight;
+        ctx->quant_scale[f] = (float) (max_scale * sqrt(weight / MAX_WEIGHT));
     }
-    float diff = max -min;
-    g_scale_factor = diff / 0x00FFFFFF;
-    printf ("Float to Integer Scale Factor = %f MaxFloat=%f and MinFloat=%f \n",g_scale_factor, max,min);
+    printf ("Float to Integer Quantisation: %d bits per feature, %d features per word\n", QUANT_BITS, ctx->tiled ? 1 : FEATURES_PER_WORD);
+}
+
+static DATA_TYPE quantise (const fpga_kmeans_context *ctx, float value, int f)
+{
+    float scaled_value = (value - ctx->quant_min[f]) / ctx->quant_scale[f] + 0.5f;
+    if (scaled_value <= 0)              return 0;
+    if (scaled_value >= QUANT_LEVELS)   return QUANT_LEVELS;
+    return (DATA_TYPE) scaled_value;
 }
-static int scaled_float2int (float value)
+#endif
+
+//words per point feature vector, kmeans_tiled kernel reads unpacked features
+static int feature_words(const fpga_kmeans_context *ctx, int n_features)
 {
-    int ret_value;
-    float fv = value;
-    float scaled_value = fv / g_scale_factor;
-    ret_value = scaled_value;
-    return ret_value;
+    int per_word = ctx->tiled ? 1 : FEATURES_PER_WORD;
+    return (n_features - 1) / per_word + 1;
 }
+
+//Store a point into one lane of its vector block, feature f goes to word f / per_word
+static void pack_point(const fpga_kmeans_context *ctx, const float* src, int n_features, DATA_TYPE* lane)
+{
+    for (int w = 0 ; w < feature_words(ctx, n_features) ; w++)
+        lane[w * g_vector_size] = 0;
+    for (int f = 0 ; f < n_features ; f++)
+    {
+#if USE_DATA_TYPE == INT_DT
+        int per_word = ctx->tiled ? 1 : FEATURES_PER_WORD;
+        lane[(f / per_word) * g_vector_size] |= quantise(ctx, src[f], f) << ((f % per_word) * QUANT_BITS);
+#else
+        lane[f * g_vector_size] = src[f];
 #endif
+    }
+}
 
-static DATA_TYPE* re_align_clusters(float** clusters, int n_clusters, int N_Features, int n_features)
+static DATA_TYPE* re_align_clusters(const fpga_kmeans_context *ctx, float** clusters, int n_clusters, int N_Features, int n_features)
 {
-    int next_cfeature = 0; 
+    int next_cfeature = 0;
     DATA_TYPE* temp_clusters = (DATA_TYPE* )malloc(n_clusters * N_Features * sizeof(DATA_TYPE));
     if (temp_clusters== NULL){
         fprintf(stderr, "Error: Failed to allocate memory for temp_clusters\n");
-        exit(EXIT_FAILURE);                                                      
+        exit(EXIT_FAILURE);
     }
     for ( int cid = 0 ; cid < n_clusters; cid ++){
         for (int fid = 0 ; fid < N_Features; fid++){
             if (fid < n_features){
                 float fValue = clusters[0][cid * n_features + fid];
                 DATA_TYPE value;
-#if USE_DATA_TYPE == INT_DT 
-                value = scaled_float2int(fValue);
+#if USE_DATA_TYPE == INT_DT
+                value = quantise(ctx, fValue, fid);
 #else
                 value = fValue;
 #endif
@@ -139,36 +309,136 @@ static DATA_TYPE* re_align_clusters(float** clusters, int n_clusters, int N_Feat
 
 }
 
-static DATA_TYPE* re_align_features(float** feature, int N_Features, int NPoints, int n_features, int n_points, int size)
+static DATA_TYPE* re_align_features(const fpga_kmeans_context *ctx, float** feature, int NPoints, int n_features, int n_points, int size)
 {
-    int next_feature=0;
-    DATA_TYPE* temp_feature = (DATA_TYPE*)malloc( NPoints * n_features * sizeof (DATA_TYPE));
+    int n_words = feature_words(ctx, n_features);
+    DATA_TYPE* temp_feature = (DATA_TYPE*)malloc( NPoints * n_words * sizeof (DATA_TYPE));
     if (temp_feature== NULL){
         fprintf(stderr, "Error: Failed to allocate memory for temp_feature\n");
-        exit(EXIT_FAILURE);                                                      
+        exit(EXIT_FAILURE);
     }
     for (int pid = 0 ; pid < NPoints; pid += size){
-        for (int fid = 0 ; fid < n_features; fid++){
-            for (int tpid = 0 ; tpid < size; tpid++){
-                if (pid + tpid < n_points){
-                    float fValue = feature[0][ (pid + tpid) * n_features + fid];
-                    DATA_TYPE value;
-#if USE_DATA_TYPE == INT_DT 
-                    value = scaled_float2int(fValue);
+        for (int tpid = 0 ; tpid < size; tpid++){
+            DATA_TYPE* lane = temp_feature + pid * n_words + tpid;
+            if (pid + tpid < n_points){
+                pack_point(ctx, feature[0] + (pid + tpid) * n_features, n_features, lane);
+            }else{
+                for (int w = 0 ; w < n_words ; w++)
+                    lane[w * size] = 0;
+            }
+        }
+    }
+    return temp_feature;
+}
+
+//Busy time of every compute unit and the span from the first kernel start to
+//the last kernel end of one round of concurrently running kernels
+static void account_kernels(fpga_kmeans_context *ctx, std::vector<cl_event> &events, std::vector<int> &event_cu)
+{
+    cl_ulong first = 0, last = 0;
+    for (size_t e = 0; e < events.size(); e++)
+    {
+        cl_ulong start, end;
+        OCL_CHECK(clGetEventProfilingInfo(events[e], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL));
+        OCL_CHECK(clGetEventProfilingInfo(events[e], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL));
+        ctx->cus[event_cu[e]].t_busy += end - start;
+        if (e == 0 || start < first) first = start;
+        if (e == 0 || end > last)    last = end;
+        clReleaseEvent(events[e]);
+    }
+    ctx->t_exec += last - first;
+    events.clear();
+    event_cu.clear();
+}
+
+static int  fpga_kmeans_compute(
+           fpga_kmeans_context *ctx,
+           int     n_features,
+           int     n_clusters,
+           float **clusters,
+           int     *new_centers_len,
+           float  **new_centers)
+{
+
+    int delta = 0;
+    int i, j, g;
+    std::vector<cl_event> events;
+    std::vector<int>      event_cu;
+
+    size_t local_work[3] = { 1, 1, 1 };
+
+    int N_Features = ( (n_features -1)/g_vector_size + 1) * g_vector_size;
+    DATA_TYPE* temp_clusters = re_align_clusters(ctx, clusters,n_clusters, N_Features,n_features);
+
+    //Every compute unit gets the centroids and runs on its own points
+    //concurrently, the in-order queue of each orders write, kernel and reads
+    for (size_t c = 0; c < ctx->cus.size(); c++)
+    {
+        fpga_kmeans_cu &cu = ctx->cus[c];
+        if (cu.n_points == 0) continue;
+        size_t global_work[3] = { (size_t) cu.work_items, 1, 1 };
+        cl_event wait_event;
+        OCL_CHECK(clEnqueueWriteBuffer(cu.queue, cu.d_cluster, CL_FALSE, 0, n_clusters * N_Features * sizeof(DATA_TYPE), temp_clusters, 0, NULL, NULL));
+
+        int narg = 0;
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &cu.d_feature);
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &cu.d_cluster);
+#if USE_DATA_TYPE == INT_DT
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &cu.d_weights);
+#endif
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &cu.d_membership);
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &cu.d_sums);
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &cu.d_counts);
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &cu.d_delta);
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_int), (void*) &cu.n_points);
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_int), (void*) &n_clusters);
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_int), (void*) &n_features);
+        OCL_CHECK(clEnqueueNDRangeKernel(cu.queue, cu.kernel, 3, NULL, global_work, local_work, 0, NULL,   &wait_event));
+        events.push_back(wait_event);
+        event_cu.push_back(c);
+
+        //Membership stays on device, only the per work item cluster sums, counts
+        //and delta are read back and reduced here
+        OCL_CHECK(clEnqueueReadBuffer(cu.queue, cu.d_sums, CL_FALSE, 0, cu.sums.size() * sizeof(ACC_DATA_TYPE), cu.sums.data(), 0, NULL, NULL));
+        OCL_CHECK(clEnqueueReadBuffer(cu.queue, cu.d_counts, CL_FALSE, 0, cu.counts.size() * sizeof(INT_DATA_TYPE), cu.counts.data(), 0, NULL, NULL));
+        OCL_CHECK(clEnqueueReadBuffer(cu.queue, cu.d_delta, CL_FALSE, 0, cu.delta.size() * sizeof(INT_DATA_TYPE), cu.delta.data(), 0, NULL, NULL));
+    }
+    for (size_t c = 0; c < ctx->cus.size(); c++)
+        if (ctx->cus[c].n_points) clFinish(ctx->cus[c].queue);
+    free(temp_clusters);
+    account_kernels(ctx, events, event_cu);
+    ctx->iteration++;
+
+    delta = 0;
+    for (size_t c = 0; c < ctx->cus.size(); c++)
+    {
+        fpga_kmeans_cu &cu = ctx->cus[c];
+        if (cu.n_points == 0) continue;
+        for (g = 0; g < cu.work_items; g++)
+        {
+            delta += cu.delta[g];
+            for (i = 0; i < n_clusters; i++)
+            {
+                ACC_DATA_TYPE *sums = cu.sums.data() + (g * n_clusters + i) * n_features;
+                int count = cu.counts[g * n_clusters + i];
+                new_centers_len[i] += count;
+                for (j = 0; j < n_features; j++)
+                {
+#if USE_DATA_TYPE == INT_DT
+                    new_centers[i][j] += (float)((double)sums[j] * ctx->quant_scale[j] + (double)count * ctx->quant_min[j]);
 #else
-                    value = fValue;
+                    new_centers[i][j] += sums[j];
 #endif
-                    temp_feature[next_feature++] = value ;
-                }else{
-                    temp_feature[next_feature++] = 0.0;
                 }
             }
         }
     }
-    return temp_feature;
+
+    return delta;
 }
 
-static int  fpga_kmeans_compute(
+static int  fpga_kmeans_compute_tiled(
+           fpga_kmeans_context *ctx,
         float **feature,    /* in: [npoints][nfeatures] */
            int     n_features,
            int     n_points,
@@ -178,64 +448,95 @@ static int  fpga_kmeans_compute(
            int     *new_centers_len,
            float  **new_centers)
 {
-  
     int delta = 0;
     int i, j;
-    cl_event wait_event;
-    
-    size_t global_work[3] = { g_global_size, 1, 1 }; 
+    std::vector<cl_event> events;
+    std::vector<int>      event_cu;
+
     size_t local_work[3] = { 1, 1, 1 };
 
-    int N_Features = ( (n_features -1)/g_vector_size + 1) * g_vector_size;
-    DATA_TYPE* temp_clusters = re_align_clusters(clusters,n_clusters, N_Features,n_features);
-    xcl_memcpy_to_device(g_world,d_cluster, temp_clusters, n_clusters * N_Features * sizeof(DATA_TYPE));
-    clFinish(g_world.command_queue);
-    free(temp_clusters);
+    //Tiles are the same for every compute unit, quantise them once
+    for (i = 0; i < n_clusters; i++)
+    {
+        for (j = 0; j < n_features; j++)
+        {
+#if USE_DATA_TYPE == INT_DT
+            ctx->tiles[i * n_features + j] = quantise(ctx, clusters[i][j], j);
+#else
+            ctx->tiles[i * n_features + j] = clusters[i][j];
+#endif
+        }
+    }
 
+    //Each compute unit streams the centroids past its points, running minimum
+    //stays on device. Compute units run their tile sequences concurrently.
+    for (size_t c = 0; c < ctx->cus.size(); c++)
+    {
+        fpga_kmeans_cu &cu = ctx->cus[c];
+        if (cu.n_points == 0) continue;
+        size_t global_work[3] = { (size_t) cu.work_items, 1, 1 };
+        for (int tile_start = 0; tile_start < n_clusters; tile_start += ctx->tile_clusters)
+        {
+            int tile_clusters = n_clusters - tile_start;
+            if (tile_clusters > ctx->tile_clusters) tile_clusters = ctx->tile_clusters;
+            int first_tile = (tile_start == 0);
+            cl_event wait_event;
+            OCL_CHECK(clEnqueueWriteBuffer(cu.queue, cu.d_cluster, CL_FALSE, 0, tile_clusters * n_features * sizeof(DATA_TYPE),
+                                           &ctx->tiles[tile_start * n_features], 0, NULL, NULL));
+
+            int narg = 0;
+            xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &cu.d_feature);
+            xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &cu.d_cluster);
+#if USE_DATA_TYPE == INT_DT
+            xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &cu.d_weights);
+#endif
+            xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &cu.d_membership);
+            xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &cu.d_min_dist);
+            xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_int), (void*) &cu.n_points);
+            xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_int), (void*) &tile_start);
+            xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_int), (void*) &tile_clusters);
+            xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_int), (void*) &n_features);
+            xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_int), (void*) &first_tile);
+            OCL_CHECK(clEnqueueNDRangeKernel(cu.queue, cu.kernel, 3, NULL, global_work, local_work, 0, NULL,   &wait_event));
+            events.push_back(wait_event);
+            event_cu.push_back(c);
+        }
+        //k x nfeatures sums do not fit on chip for tiled sizes, reduce on host
+        OCL_CHECK(clEnqueueReadBuffer(cu.queue, cu.d_membership, CL_FALSE, 0, cu.n_points * sizeof(INT_DATA_TYPE),
+                                      &ctx->membership[cu.point_start], 0, NULL, NULL));
+    }
+    for (size_t c = 0; c < ctx->cus.size(); c++)
+        if (ctx->cus[c].n_points) clFinish(ctx->cus[c].queue);
+    account_kernels(ctx, events, event_cu);
+    ctx->iteration++;
 
-    int narg = 0;
-    xcl_set_kernel_arg(g_kernel_kmeans, narg++, sizeof(cl_mem), &d_feature);
-    xcl_set_kernel_arg(g_kernel_kmeans, narg++, sizeof(cl_mem), &d_cluster);
-    xcl_set_kernel_arg(g_kernel_kmeans, narg++, sizeof(cl_mem), &d_membership);
-    xcl_set_kernel_arg(g_kernel_kmeans, narg++, sizeof(cl_int), (void*) &n_points);
-    xcl_set_kernel_arg(g_kernel_kmeans, narg++, sizeof(cl_int), (void*) &n_clusters);
-    xcl_set_kernel_arg(g_kernel_kmeans, narg++, sizeof(cl_int), (void*) &n_features);
-    OCL_CHECK(clEnqueueNDRangeKernel(g_world.command_queue, g_kernel_kmeans, 3, NULL, global_work, local_work, 0, NULL,   &wait_event));
-
-    clWaitForEvents(1,&wait_event);
-    g_t_exec += xcl_get_event_duration(wait_event);
-    g_iteration++;
-    clFinish(g_world.command_queue);
-    xcl_memcpy_from_device(g_world,g_membership_OCL,d_membership, n_points * sizeof(INT_DATA_TYPE));
-    clFinish(g_world.command_queue);
-    
-    delta = 0;
     for (i = 0; i < n_points; i++)
     {
-        int cluster_id = g_membership_OCL[i];
+        int cluster_id = ctx->membership[i];
         new_centers_len[cluster_id]++;
-        if (g_membership_OCL[i] != membership[i])
+        if (ctx->membership[i] != membership[i])
         {
             delta++;
-            membership[i] = g_membership_OCL[i];
+            membership[i] = ctx->membership[i];
         }
         for (j = 0; j < n_features; j++)
         {
             new_centers[cluster_id][j] += feature[i][j];
         }
     }
-    
+
     return delta;
 }
 
 float** fpga_kmeans_clustering(
+                          fpga_kmeans_context *ctx,
                           float **feature,    /* in: [npoints][nfeatures] */
                           int     nfeatures,
                           int     npoints,
                           int     nclusters,
                           float   threshold,
                           int    *membership) /* out: [npoints] */
-{    
+{
     int     i, j, n = 0;       /* counters */
     int     loop=0, temp;
     int     *new_centers_len;   /* [nclusters]: no. of points in each cluster */
@@ -259,12 +560,12 @@ float** fpga_kmeans_clustering(
     clusters    = (float**) malloc(nclusters *             sizeof(float*));
     if (clusters== NULL){
         fprintf(stderr, "Error: Failed to allocate memory for clusters\n");
-        exit(EXIT_FAILURE);                                                      
+        exit(EXIT_FAILURE);
     }
     clusters[0] = (float*)  malloc(nclusters * nfeatures * sizeof(float));
     if (clusters[0]== NULL){
         fprintf(stderr, "Error: Failed to allocate memory for clusters[0]\n");
-        exit(EXIT_FAILURE);                                                      
+        exit(EXIT_FAILURE);
     }
     for (i=1; i<nclusters; i++)
         clusters[i] = clusters[i-1] + nfeatures;
@@ -273,7 +574,7 @@ float** fpga_kmeans_clustering(
     initial = (int *) malloc (npoints * sizeof(int));
     if (initial == NULL){
         fprintf(stderr, "Error: Failed to allocate memory for initial\n");
-        exit(EXIT_FAILURE);                                            
+        exit(EXIT_FAILURE);
     }
     for (i = 0; i < npoints; i++)
     {
@@ -284,10 +585,10 @@ float** fpga_kmeans_clustering(
     /* randomly pick cluster centers */
     for (i=0; i<nclusters && initial_points >= 0; i++) {
         //n = (int)rand() % initial_points;
-        
+
         for (j=0; j<nfeatures; j++)
             clusters[i][j] = feature[initial[n]][j];// remapped
-        
+
         /* swap the selected index to the end (not really necessary,
            could just move the end up) */
         temp = initial[n];
@@ -297,26 +598,34 @@ float** fpga_kmeans_clustering(
         n++;
     }
 
-    /* initialize the membership to -1 for all */
+    /* initialize the membership to -1 for all, the devices keep it from now on */
     for (i=0; i < npoints; i++)
       membership[i] = -1;
+    for (size_t u = 0; u < ctx->cus.size(); u++)
+    {
+        fpga_kmeans_cu &cu = ctx->cus[u];
+        if (cu.n_points == 0) continue;
+        std::vector<INT_DATA_TYPE> init_membership(( (cu.n_points-1)/g_vector_size+ 1 ) * g_vector_size, -1);
+        OCL_CHECK(clEnqueueWriteBuffer(cu.queue, cu.d_membership, CL_TRUE, 0, init_membership.size() * sizeof(INT_DATA_TYPE),
+                                       init_membership.data(), 0, NULL, NULL));
+    }
 
     /* allocate space for and initialize new_centers_len and new_centers */
     new_centers_len = (int*) calloc(nclusters, sizeof(int));
     if (new_centers_len == NULL){
         fprintf(stderr, "Error: Failed to allocate memory for new_centers_len\n");
-        exit(EXIT_FAILURE);                                                      
+        exit(EXIT_FAILURE);
     }
 
     new_centers    = (float**) malloc(nclusters * sizeof(float*));
     if (new_centers == NULL){
         fprintf(stderr, "Error: Failed to allocate memory for new_centers\n");
-        exit(EXIT_FAILURE);                                                      
+        exit(EXIT_FAILURE);
     }
     new_centers[0] = (float*)  calloc(nclusters * nfeatures, sizeof(float));
     if (new_centers[0] == NULL){
         fprintf(stderr, "Error: Failed to allocate memory for new_centers[0]\n");
-        exit(EXIT_FAILURE);                                                      
+        exit(EXIT_FAILURE);
     }
     for (i=1; i<nclusters; i++)
         new_centers[i] = new_centers[i-1] + nfeatures;
@@ -327,7 +636,9 @@ float** fpga_kmeans_clustering(
         printf(" %d ", loop + 1);
         delta = 0.0;
         // CUDA
-        delta = (float) fpga_kmeans_compute(
+        if (ctx->tiled)
+            delta = (float) fpga_kmeans_compute_tiled(
+                            ctx,
                             feature,            /* in: [npoints][nfeatures] */
                             nfeatures,          /* number of attributes for each point */
                             npoints,            /* number of data points */
@@ -337,7 +648,16 @@ float** fpga_kmeans_clustering(
                             new_centers_len,    /* out: number of points in each cluster */
                             new_centers         /* sum of points in each cluster */
                             );
-        
+        else
+            delta = (float) fpga_kmeans_compute(
+                            ctx,
+                            nfeatures,          /* number of attributes for each point */
+                            nclusters,          /* number of clusters */
+                            clusters,           /* out: [nclusters][nfeatures] */
+                            new_centers_len,    /* out: number of points in each cluster */
+                            new_centers         /* sum of points in each cluster */
+                            );
+
         /* replace old cluster centers with new_centers */
         /* CPU side of reduction */
         for (i=0; i<nclusters; i++) {
@@ -351,76 +671,618 @@ float** fpga_kmeans_clustering(
         c++;
     } while ((delta > threshold) && (loop++ < 1000));/* makes sure loop terminates */
     printf("\niterated %d times\n", c);
+
+    /* final membership, read once after convergence from every compute unit */
+    for (size_t u = 0; u < ctx->cus.size(); u++)
+    {
+        fpga_kmeans_cu &cu = ctx->cus[u];
+        if (cu.n_points == 0) continue;
+        OCL_CHECK(clEnqueueReadBuffer(cu.queue, cu.d_membership, CL_FALSE, 0, cu.n_points * sizeof(INT_DATA_TYPE),
+                                      &ctx->membership[cu.point_start], 0, NULL, NULL));
+    }
+    for (size_t u = 0; u < ctx->cus.size(); u++)
+        if (ctx->cus[u].n_points) clFinish(ctx->cus[u].queue);
+    for (i=0; i < npoints; i++)
+      membership[i] = ctx->membership[i];
     free(new_centers[0]);
     free(new_centers);
     free(new_centers_len);
+    free(initial);
 
     return clusters;
 }
 
 
-int fpga_kmeans_shutdown()
+fpga_kmeans_context* fpga_kmeans_create(int global_size, int tiled, int compute_units)
+{
+    fpga_kmeans_context *ctx = new fpga_kmeans_context();
+    ctx->global_size        = global_size;
+    ctx->tiled_setting      = tiled;
+    ctx->max_compute_units  = (compute_units > 0 && compute_units < MAX_COMPUTE_UNITS) ? compute_units : MAX_COMPUTE_UNITS;
+    ctx->initialised        = false;
+    ctx->tiled              = false;
+    ctx->tile_clusters      = 0;
+    ctx->t_exec             = 0;
+    ctx->iteration          = 0;
+    return ctx;
+}
+
+void fpga_kmeans_release(fpga_kmeans_context *ctx)
+{
+    if (ctx == NULL) return;
+    if (ctx->initialised) fpga_kmeans_shutdown(ctx);
+    delete ctx;
+}
+
+int fpga_kmeans_shutdown(fpga_kmeans_context *ctx)
 {
     // release resources
-    clReleaseKernel(g_kernel_kmeans);
-    clReleaseProgram(g_prog);
-    xcl_release_world(g_world);
+    for (size_t c = 0; c < ctx->cus.size(); c++)
+    {
+        clReleaseKernel(ctx->cus[c].kernel);
+        clReleaseCommandQueue(ctx->cus[c].queue);
+    }
+    ctx->cus.clear();
+    clReleaseProgram(ctx->prog);
+    xcl_release_world(ctx->world);
+    ctx->initialised = false;
     return 0;
 }
-int fpga_kmeans_init()
+
+int fpga_kmeans_init(fpga_kmeans_context *ctx, int n_features, int max_nclusters)
 {
-    g_world = xcl_world_single();
-    g_prog = xcl_import_binary(g_world, "kmeans");
-    g_kernel_kmeans = xcl_get_kernel(g_prog, "kmeans");
+    //Tiled kernel comes in its own xclbin, pick the one the largest clustering needs
+    if (ctx->tiled_setting == FPGA_KMEANS_TILED_AUTO)
+        ctx->tiled = (n_features > 0) && !fits_on_chip(n_features, max_nclusters);
+    else
+        ctx->tiled = (ctx->tiled_setting == FPGA_KMEANS_TILED_ON);
+    if (!ctx->tiled && n_features > 0 && !fits_on_chip(n_features, max_nclusters)){
+        fprintf(stderr, "Error: kmeans kernel supports at most %d features, %d clusters and %d cluster values, use tiled mode\n",
+                MAX_FEATURES, MAX_CLUSTERS, MAX_CLUSTER_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    ctx->t_exec = 0;
+    ctx->iteration = 0;
+
+    const char *kernel_name = ctx->tiled ? "kmeans_tiled" : "kmeans";
+    ctx->world = xcl_world_single();
+    ctx->prog = xcl_import_binary(ctx->world, kernel_name);
+
+    //Compute units are named <kernel>_1 .. <kernel>_N by --nk, each gets its
+    //own kernel object and queue so that they can run concurrently
+    for (int i = 1; i <= ctx->max_compute_units; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "%s:{%s_%d}", kernel_name, kernel_name, i);
+        cl_int err;
+        cl_kernel kernel = clCreateKernel(ctx->prog, name, &err);
+        if (err != CL_SUCCESS || kernel == NULL) break;
+        fpga_kmeans_cu cu;
+        cu.name   = name + strlen(kernel_name) + 2;
+        cu.name.erase(cu.name.size() - 1);
+        cu.kernel = kernel;
+        cu.bank   = (i - 1) % DDR_BANKS;
+        ctx->cus.push_back(cu);
+    }
+    //xclbin without numbered compute units, leave placement to the runtime
+    if (ctx->cus.empty())
+    {
+        fpga_kmeans_cu cu;
+        cu.name   = kernel_name;
+        cu.kernel = xcl_get_kernel(ctx->prog, kernel_name);
+        cu.bank   = -1;
+        ctx->cus.push_back(cu);
+    }
+    for (size_t c = 0; c < ctx->cus.size(); c++)
+    {
+        fpga_kmeans_cu &cu = ctx->cus[c];
+        cl_int err;
+        cu.queue = clCreateCommandQueue(ctx->world.context, ctx->world.device_id, CL_QUEUE_PROFILING_ENABLE, &err);
+        if (err != CL_SUCCESS){
+            printf("Error: Failed to create command queue: %s\n", oclErrorCode(err));
+            exit(EXIT_FAILURE);
+        }
+        cu.point_start = 0;
+        cu.n_points    = 0;
+        cu.work_items  = 0;
+        cu.t_busy      = 0;
+    }
+    ctx->initialised = true;
     return 0;
 }
-int fpga_kmeans_allocate(int n_points, int n_features, int n_clusters, float **feature)
+
+int fpga_kmeans_allocate(fpga_kmeans_context *ctx, int n_points, int n_features, int n_clusters, float **feature)
 {
-    DATA_TYPE* temp_feature;
+    if (ctx->tiled){
+        if (n_features > MAX_CLUSTER_SIZE){
+            fprintf(stderr, "Error: kmeans_tiled kernel supports at most %d features\n", MAX_CLUSTER_SIZE);
+            exit(EXIT_FAILURE);
+        }
+        ctx->tile_clusters = tile_size(n_features, n_clusters);
+    }else if (!fits_on_chip(n_features, n_clusters)){
+        fprintf(stderr, "Error: kmeans kernel supports at most %d features, %d clusters and %d cluster values, use tiled mode\n",
+                MAX_FEATURES, MAX_CLUSTERS, MAX_CLUSTER_SIZE);
+        exit(EXIT_FAILURE);
+    }
 #if USE_DATA_TYPE == INT_DT
-    calculate_scale_factor(feature[0], n_points * n_features);
+    calculate_quantisation(ctx, feature[0], n_points, n_features);
 #endif
     int N_Features = ( (n_features -1)/g_vector_size + 1) * g_vector_size;
-    int NPoints = ( (n_points-1)/g_vector_size+ 1 ) * g_vector_size;
-    temp_feature = re_align_features(feature,N_Features, NPoints, n_features, n_points ,g_vector_size );
-    d_feature   = xcl_malloc(g_world, CL_MEM_READ_WRITE, NPoints * n_features * sizeof(DATA_TYPE));
-    d_cluster   = xcl_malloc(g_world, CL_MEM_READ_WRITE, n_clusters * N_Features * sizeof(DATA_TYPE));
-    d_membership= xcl_malloc(g_world, CL_MEM_READ_WRITE, NPoints * sizeof(INT_DATA_TYPE));
-    xcl_memcpy_to_device(g_world,d_feature,temp_feature, NPoints * n_features * sizeof(DATA_TYPE));
-    clFinish(g_world.command_queue);
-    free(temp_feature);
-    g_membership_OCL = ( INT_DATA_TYPE *) malloc(n_points * sizeof(int));
-    if (g_membership_OCL == NULL){
-        fprintf(stderr, "Error: Failed to allocate memory for g_membership_OCL\n");
-        exit(EXIT_FAILURE);                                                      
+    int n_words = feature_words(ctx, n_features);
+
+    //Split the point vectors evenly over the compute units, global size work
+    //items are shared out the same way
+    int n_cus = ctx->cus.size();
+    int n_vectors = (n_points - 1) / g_vector_size + 1;
+    int work_items = ctx->global_size / n_cus;
+    if (work_items < 1) work_items = 1;
+    int next_vector = 0;
+    for (int c = 0; c < n_cus; c++)
+    {
+        fpga_kmeans_cu &cu = ctx->cus[c];
+        int vectors = n_vectors / n_cus + (c < n_vectors % n_cus ? 1 : 0);
+        cu.point_start = next_vector * g_vector_size;
+        cu.n_points    = std::min((next_vector + vectors) * g_vector_size, n_points) - cu.point_start;
+        cu.work_items  = work_items;
+        cu.t_busy      = 0;
+        next_vector   += vectors;
+        if (cu.n_points == 0) continue;
+
+        int NPoints = vectors * g_vector_size;
+        DATA_TYPE* temp_feature = re_align_features(ctx, feature + cu.point_start, NPoints, n_features, cu.n_points, g_vector_size);
+        cu.d_feature   = bank_malloc(ctx, cu.bank, CL_MEM_READ_WRITE, NPoints * n_words * sizeof(DATA_TYPE));
+        cu.d_membership= bank_malloc(ctx, cu.bank, CL_MEM_READ_WRITE, NPoints * sizeof(INT_DATA_TYPE));
+        if (ctx->tiled){
+            cu.d_cluster   = bank_malloc(ctx, cu.bank, CL_MEM_READ_ONLY, ctx->tile_clusters * n_features * sizeof(DATA_TYPE));
+            cu.d_min_dist  = bank_malloc(ctx, cu.bank, CL_MEM_READ_WRITE, NPoints * sizeof(DIST_DATA_TYPE));
+        }else{
+            cu.d_cluster   = bank_malloc(ctx, cu.bank, CL_MEM_READ_WRITE, n_clusters * N_Features * sizeof(DATA_TYPE));
+            cu.d_sums      = bank_malloc(ctx, cu.bank, CL_MEM_WRITE_ONLY, work_items * n_clusters * n_features * sizeof(ACC_DATA_TYPE));
+            cu.d_counts    = bank_malloc(ctx, cu.bank, CL_MEM_WRITE_ONLY, work_items * n_clusters * sizeof(INT_DATA_TYPE));
+            cu.d_delta     = bank_malloc(ctx, cu.bank, CL_MEM_WRITE_ONLY, work_items * sizeof(INT_DATA_TYPE));
+            cu.sums.resize((size_t) work_items * n_clusters * n_features);
+            cu.counts.resize((size_t) work_items * n_clusters);
+            cu.delta.resize(work_items);
+        }
+        OCL_CHECK(clEnqueueWriteBuffer(cu.queue, cu.d_feature, CL_TRUE, 0, NPoints * n_words * sizeof(DATA_TYPE), temp_feature, 0, NULL, NULL));
+#if USE_DATA_TYPE == INT_DT
+        cu.d_weights   = bank_malloc(ctx, cu.bank, CL_MEM_READ_ONLY, n_features * sizeof(DATA_TYPE));
+        OCL_CHECK(clEnqueueWriteBuffer(cu.queue, cu.d_weights, CL_TRUE, 0, n_features * sizeof(DATA_TYPE), ctx->quant_weight.data(), 0, NULL, NULL));
+#endif
+        free(temp_feature);
     }
+    ctx->membership.resize(n_points);
+    if (ctx->tiled)
+        ctx->tiles.resize((size_t) n_clusters * n_features);
     return true;
 }
 
-int fpga_kmeans_deallocateMemory()
+int fpga_kmeans_deallocateMemory(fpga_kmeans_context *ctx)
 {
-   clReleaseMemObject(d_feature);
-   clReleaseMemObject(d_cluster);
-   clReleaseMemObject(d_membership);
-   free(g_membership_OCL);
+   for (size_t c = 0; c < ctx->cus.size(); c++)
+   {
+       fpga_kmeans_cu &cu = ctx->cus[c];
+       if (cu.n_points == 0) continue;
+       clReleaseMemObject(cu.d_feature);
+       clReleaseMemObject(cu.d_cluster);
+       clReleaseMemObject(cu.d_membership);
+#if USE_DATA_TYPE == INT_DT
+       clReleaseMemObject(cu.d_weights);
+#endif
+       if (ctx->tiled){
+           clReleaseMemObject(cu.d_min_dist);
+           continue;
+       }
+       clReleaseMemObject(cu.d_sums);
+       clReleaseMemObject(cu.d_counts);
+       clReleaseMemObject(cu.d_delta);
+   }
+   ctx->membership.clear();
+   ctx->tiles.clear();
    return true;
 }
 
-int fpga_kmeans_print_report()
+int fpga_kmeans_print_report(const fpga_kmeans_context *ctx)
 {
     printf("*******************************************************\n");
     printf("\tK-means Execution Summary:\n");
     printf("*******************************************************\n");
-    printf("\tGlobal Size                   : %d\n",g_global_size);
-    printf("\tIteration                     : %d\n",g_iteration);
+    printf("\tGlobal Size                   : %d\n",ctx->global_size);
+    printf("\tData Type                     : %s\n",fpga_kmeans_data_type(ctx));
+    if (ctx->tiled)
+        printf("\tTiled Mode                    : %d clusters per tile\n",ctx->tile_clusters);
+    printf("\tIteration                     : %d\n",ctx->iteration);
     //Deviding time by 1E6 to change ns(nano sec) to ms (mili sec)
-    printf("\tKernel Execution Time(ms)     : %f\n",g_t_exec/1E6);
+    printf("\tKernel Execution Time(ms)     : %f\n",ctx->t_exec/1E6);
+    printf("\tCompute Units                 : %d\n",(int) ctx->cus.size());
+    for (size_t c = 0; c < ctx->cus.size(); c++)
+    {
+        const fpga_kmeans_cu &cu = ctx->cus[c];
+        char bank[16] = "any";
+        if (cu.bank >= 0) snprintf(bank, sizeof(bank), "%d", cu.bank);
+        //Utilisation is the share of the kernel execution time the unit was busy
+        printf("\t  %-14s bank %-3s : %d points, %f ms, %.1f%% utilisation\n", cu.name.c_str(), bank,
+               cu.n_points, cu.t_busy/1E6, ctx->t_exec ? 100.0 * cu.t_busy / ctx->t_exec : 0.0);
+    }
     printf("*******************************************************\n");
     return 0;
 }
 
-int fpga_kmeans_setup( int global_size)
+const char* fpga_kmeans_data_type(const fpga_kmeans_context *ctx)
+{
+#if USE_DATA_TYPE == INT_DT
+    if (ctx->tiled || FEATURES_PER_WORD == 1)
+        return (QUANT_BITS == 24) ? "INT24" : (QUANT_BITS == 16) ? "INT16" : "INT8";
+    return (QUANT_BITS == 16) ? "INT16 packed x2" : "INT8 packed x4";
+#else
+    return "FLOAT";
+#endif
+}
+
+int fpga_kmeans_compute_units(const fpga_kmeans_context *ctx)
+{
+    return ctx->cus.size();
+}
+
+int fpga_kmeans_get_stats(const fpga_kmeans_context *ctx, int *iteration, double *kernel_time, int *tile_clusters)
+{
+    if (iteration)      *iteration = ctx->iteration;
+    //Deviding time by 1E6 to change ns(nano sec) to ms (mili sec)
+    if (kernel_time)    *kernel_time = ctx->t_exec / 1E6;
+    if (tile_clusters)  *tile_clusters = ctx->tiled ? ctx->tile_clusters : 0;
+    return 0;
+}
+
+/*---< Mini-batch K-means >---------------------------------------------------*/
+
+//held-out evaluations without improvement before mini-batch stops
+#define MINIBATCH_PATIENCE 3
+
+void fpga_kmeans_minibatch_default_options(fpga_kmeans_minibatch_options *opt)
+{
+    opt->batch_points   = 64 * 1024;
+    opt->holdout_points = 8 * 1024;
+    opt->max_epochs     = 10;
+    opt->eval_interval  = 16;
+    opt->tolerance      = 1e-4;
+}
+
+static float** alloc_points(long n_points, int n_features)
+{
+    float **points = (float**) malloc(n_points * sizeof(float*));
+    if (points == NULL){
+        fprintf(stderr, "Error: Failed to allocate memory for points\n");
+        exit(EXIT_FAILURE);                                                      
+    }
+    points[0] = (float*) malloc(n_points * n_features * sizeof(float));
+    if (points[0] == NULL){
+        fprintf(stderr, "Error: Failed to allocate memory for points[0]\n");
+        exit(EXIT_FAILURE);                                                      
+    }
+    for (long i = 1; i < n_points; i++)
+        points[i] = points[i-1] + n_features;
+    return points;
+}
+
+//Pack points [first, last) of the mapped file into the kernel's vector layout,
+//leaving out the held-out points. Returns the number of packed points.
+static int pack_batch(const fpga_kmeans_context *ctx, const float *data, long first, long last, int n_features,
+                      long holdout_stride, DATA_TYPE *dst)
+{
+    int n = 0;
+    int n_words = feature_words(ctx, n_features);
+    for (long p = first; p < last; p++)
+    {
+        if (p % holdout_stride == 0) continue;
+        DATA_TYPE *lane = dst + (size_t)(n / g_vector_size) * n_words * g_vector_size + n % g_vector_size;
+        pack_point(ctx, data + p * n_features, n_features, lane);
+        n++;
+    }
+    //dummy points padding the last vector
+    for (int q = n; q % g_vector_size; q++)
+    {
+        DATA_TYPE *lane = dst + (size_t)(q / g_vector_size) * n_words * g_vector_size + q % g_vector_size;
+        for (int w = 0; w < n_words; w++)
+            lane[w * g_vector_size] = 0;
+    }
+    return n;
+}
+
+//mean squared distance of the points to their nearest centroid
+static double sample_inertia(float **points, int n_points, float **clusters, int n_clusters, int n_features)
 {
-    g_global_size   = global_size;
+    double sum = 0;
+    for (int i = 0; i < n_points; i++)
+    {
+        double min_dist = DBL_MAX;
+        for (int c = 0; c < n_clusters; c++)
+        {
+            double dist = 0;
+            for (int f = 0; f < n_features; f++)
+                dist += (points[i][f] - clusters[c][f]) * (points[i][f] - clusters[c][f]);
+            if (dist < min_dist) min_dist = dist;
+        }
+        sum += min_dist;
+    }
+    return sum / n_points;
+}
+
+float** fpga_kmeans_minibatch(fpga_kmeans_context *ctx,
+                              const char *filename,
+                              int   n_clusters,
+                              float threshold,
+                              const fpga_kmeans_minibatch_options *opt,
+                              fpga_kmeans_minibatch_stats *stats)
+{
+    struct timespec t_start, t_end;
+    cl_int err;
+    int i, j, g;
+
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    memset(stats, 0, sizeof(*stats));
+
+    //Map the point file, pages are only brought in as batches are packed
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0){
+        fprintf(stderr, "Error: no such file (%s)\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    fstat(fd, &st);
+    int header[2] = {0, 0};
+    if (st.st_size < (off_t) sizeof(header) || read(fd, header, sizeof(header)) != sizeof(header)){
+        fprintf(stderr, "Error: %s is not a binary point file\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    long n_points = header[0];
+    int n_features = header[1];
+    if (n_points <= 0 || n_features <= 0 ||
+        st.st_size < (off_t) (sizeof(header) + n_points * n_features * sizeof(float))){
+        fprintf(stderr, "Error: %s is truncated or not a binary point file\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    char *base = (char*) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED){
+        fprintf(stderr, "Error: Failed to map %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+    const float *data = (const float*) (base + sizeof(header));
+    stats->npoints   = n_points;
+    stats->nfeatures = n_features;
+
+    //Batches are reduced on the device, which only the kmeans kernel does
+    if (ctx->tiled_setting == FPGA_KMEANS_TILED_ON){
+        fprintf(stderr, "Error: mini-batch mode does not support the tiled kernel\n");
+        exit(EXIT_FAILURE);
+    }
+    ctx->tiled_setting = FPGA_KMEANS_TILED_OFF;
+    fpga_kmeans_init(ctx, n_features, n_clusters);
+    //Batches go through the first compute unit, the batch queue keeps it busy
+    fpga_kmeans_cu &cu = ctx->cus[0];
+    cu.work_items = ctx->global_size;
+
+    //Every holdout_stride-th point is held out of training for the convergence
+    //check, the points half way in between seed the centroids
+    long n_holdout = opt->holdout_points;
+    if (n_holdout > n_points / 4) n_holdout = n_points / 4;
+    if (n_holdout < n_clusters){
+        fprintf(stderr, "Error: %ld points are too few for %d clusters in mini-batch mode\n", n_points, n_clusters);
+        exit(EXIT_FAILURE);
+    }
+    long holdout_stride = n_points / n_holdout;
+    float **samples = alloc_points(2 * n_holdout, n_features);
+    float **holdout = samples;
+    float **seeding = samples + n_holdout;
+    for (i = 0; i < n_holdout; i++)
+    {
+        memcpy(holdout[i], data + i * holdout_stride * n_features, n_features * sizeof(float));
+        memcpy(seeding[i], data + (i * holdout_stride + holdout_stride / 2) * n_features, n_features * sizeof(float));
+    }
+#if USE_DATA_TYPE == INT_DT
+    //values outside the sampled range are clamped to it
+    calculate_quantisation(ctx, samples[0], 2 * n_holdout, n_features);
+#endif
+
+    //Initial centroids from k-means|| and Lloyd iterations on the seeding sample
+    kmeans_cpu_options cpu_options;
+    kmeans_cpu_default_options(&cpu_options);
+    int *sample_membership = (int*) malloc(n_holdout * sizeof(int));
+    if (sample_membership == NULL){
+        fprintf(stderr, "Error: Failed to allocate memory for sample_membership\n");
+        exit(EXIT_FAILURE);                                                      
+    }
+    float **clusters = kmeans_clustering_cpu(seeding, n_features, n_holdout, n_clusters, threshold,
+                                             sample_membership, &cpu_options, NULL);
+    free(sample_membership);
+
+    //Double buffered batches: while the kernel works on one, the next one is
+    //packed from the mapping and written to the other
+    int batch_points = ((opt->batch_points - 1) / g_vector_size + 1) * g_vector_size;
+    size_t batch_size = (size_t) batch_points * feature_words(ctx, n_features) * sizeof(DATA_TYPE);
+    int N_Features = ( (n_features -1)/g_vector_size + 1) * g_vector_size;
+    cl_command_queue queue = clCreateCommandQueue(ctx->world.context, ctx->world.device_id,
+                                                  CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &err);
+    if (err != CL_SUCCESS){
+        printf("Error: Failed to create command queue: %s\n", oclErrorCode(err));
+        exit(EXIT_FAILURE);
+    }
+    DATA_TYPE *staging[2];
+    int        staged_points[2];
+    cl_event   write_event[2];
+    cl_mem     d_batch[2], d_batch_membership[2], d_batch_sums[2], d_batch_counts[2], d_batch_delta[2];
+    for (i = 0; i < 2; i++)
+    {
+        staging[i] = (DATA_TYPE*) malloc(batch_size);
+        if (staging[i] == NULL){
+            fprintf(stderr, "Error: Failed to allocate memory for staging\n");
+            exit(EXIT_FAILURE);                                                      
+        }
+        d_batch[i]            = bank_malloc(ctx, cu.bank, CL_MEM_READ_ONLY, batch_size);
+        d_batch_membership[i] = bank_malloc(ctx, cu.bank, CL_MEM_READ_WRITE, batch_points * sizeof(INT_DATA_TYPE));
+        d_batch_sums[i]       = bank_malloc(ctx, cu.bank, CL_MEM_WRITE_ONLY, cu.work_items * n_clusters * n_features * sizeof(ACC_DATA_TYPE));
+        d_batch_counts[i]     = bank_malloc(ctx, cu.bank, CL_MEM_WRITE_ONLY, cu.work_items * n_clusters * sizeof(INT_DATA_TYPE));
+        d_batch_delta[i]      = bank_malloc(ctx, cu.bank, CL_MEM_WRITE_ONLY, cu.work_items * sizeof(INT_DATA_TYPE));
+    }
+    cu.d_cluster = bank_malloc(ctx, cu.bank, CL_MEM_READ_ONLY, n_clusters * N_Features * sizeof(DATA_TYPE));
+#if USE_DATA_TYPE == INT_DT
+    cu.d_weights = bank_malloc(ctx, cu.bank, CL_MEM_READ_ONLY, n_features * sizeof(DATA_TYPE));
+    OCL_CHECK(clEnqueueWriteBuffer(queue, cu.d_weights, CL_TRUE, 0, n_features * sizeof(DATA_TYPE), ctx->quant_weight.data(), 0, NULL, NULL));
+#endif
+    std::vector<ACC_DATA_TYPE> sums((size_t) cu.work_items * n_clusters * n_features);
+    std::vector<INT_DATA_TYPE> counts((size_t) cu.work_items * n_clusters);
+    std::vector<double> seen(n_clusters, 0.0);   //points assigned so far, learning rate is 1/seen
+
+    long next_point = 0;
+    auto stage = [&](int slot) -> bool {
+        //a batch of held out points only has nothing to train, move on to the next one
+        do {
+            if (next_point >= n_points) {
+                if (stats->epochs >= opt->max_epochs) return false;
+                next_point = 0;
+            }
+            if (next_point == 0) stats->epochs++;
+            long last = next_point + batch_points;
+            if (last > n_points) last = n_points;
+            staged_points[slot] = pack_batch(ctx, data, next_point, last, n_features, holdout_stride, staging[slot]);
+            //packed copy is all the device needs, let the kernel drop the pages
+            long page = sysconf(_SC_PAGESIZE);
+            size_t begin = (sizeof(header) + next_point * n_features * sizeof(float)) / page * page;
+            size_t end   = (sizeof(header) + last * n_features * sizeof(float)) / page * page;
+            if (end > begin) madvise(base + begin, end - begin, MADV_DONTNEED);
+            next_point = last;
+        } while (staged_points[slot] == 0);
+        size_t size = ((size_t) (staged_points[slot] - 1) / g_vector_size + 1) * g_vector_size * feature_words(ctx, n_features) * sizeof(DATA_TYPE);
+        OCL_CHECK(clEnqueueWriteBuffer(queue, d_batch[slot], CL_FALSE, 0, size, staging[slot], 0, NULL, &write_event[slot]));
+        return true;
+    };
+
+    double best = sample_inertia(holdout, n_holdout, clusters, n_clusters, n_features);
+    int    stale = 0;
+    int    cur = 0;
+    bool   have = stage(cur);
+    printf("\nRunning Mini-batches : ");
+    while (have)
+    {
+        int n = staged_points[cur];
+        int epoch = stats->epochs;
+        DATA_TYPE* temp_clusters = re_align_clusters(ctx, clusters, n_clusters, N_Features, n_features);
+        OCL_CHECK(clEnqueueWriteBuffer(queue, cu.d_cluster, CL_TRUE, 0, n_clusters * N_Features * sizeof(DATA_TYPE), temp_clusters, 0, NULL, NULL));
+        free(temp_clusters);
+
+        int narg = 0;
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &d_batch[cur]);
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &cu.d_cluster);
+#if USE_DATA_TYPE == INT_DT
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &cu.d_weights);
+#endif
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &d_batch_membership[cur]);
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &d_batch_sums[cur]);
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &d_batch_counts[cur]);
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_mem), &d_batch_delta[cur]);
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_int), (void*) &n);
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_int), (void*) &n_clusters);
+        xcl_set_kernel_arg(cu.kernel, narg++, sizeof(cl_int), (void*) &n_features);
+        size_t global_work[3] = { (size_t) cu.work_items, 1, 1 }; 
+        size_t local_work[3] = { 1, 1, 1 };
+        cl_event kernel_event, read_event[2];
+        OCL_CHECK(clEnqueueNDRangeKernel(queue, cu.kernel, 3, NULL, global_work, local_work, 1, &write_event[cur], &kernel_event));
+        OCL_CHECK(clEnqueueReadBuffer(queue, d_batch_sums[cur], CL_FALSE, 0, sums.size() * sizeof(ACC_DATA_TYPE), sums.data(), 1, &kernel_event, &read_event[0]));
+        OCL_CHECK(clEnqueueReadBuffer(queue, d_batch_counts[cur], CL_FALSE, 0, counts.size() * sizeof(INT_DATA_TYPE), counts.data(), 1, &kernel_event, &read_event[1]));
+
+        bool have_next = stage(1 - cur);
+
+        clWaitForEvents(2, read_event);
+        cl_ulong duration = xcl_get_event_duration(kernel_event);
+        cu.t_busy   += duration;
+        ctx->t_exec += duration;
+        clReleaseEvent(write_event[cur]);
+        clReleaseEvent(kernel_event);
+        clReleaseEvent(read_event[0]);
+        clReleaseEvent(read_event[1]);
+
+        //c += (batch mean - c) * n_batch / seen
+        for (i = 0; i < n_clusters; i++)
+        {
+            int count = 0;
+            for (g = 0; g < cu.work_items; g++)
+                count += counts[g * n_clusters + i];
+            if (count == 0) continue;
+            seen[i] += count;
+            double rate = count / seen[i];
+            for (j = 0; j < n_features; j++)
+            {
+                double sum = 0;
+                for (g = 0; g < cu.work_items; g++)
+                    sum += sums[((size_t) g * n_clusters + i) * n_features + j];
+#if USE_DATA_TYPE == INT_DT
+                sum = sum * ctx->quant_scale[j] + (double) count * ctx->quant_min[j];
+#endif
+                clusters[i][j] += (float) ((sum / count - clusters[i][j]) * rate);
+            }
+        }
+        stats->batches++;
+        stats->points += n;
+        printf(" %d ", stats->batches);
+
+        //held-out check every eval_interval batches and at the end of every pass
+        bool epoch_end = !have_next || stats->epochs != epoch;
+        if ((stats->batches % opt->eval_interval == 0) || epoch_end)
+        {
+            double inertia = sample_inertia(holdout, n_holdout, clusters, n_clusters, n_features);
+            if (inertia < best * (1.0 - opt->tolerance)) {
+                best = inertia;
+                stale = 0;
+            } else if (++stale >= MINIBATCH_PATIENCE) {
+                stats->converged = 1;
+                if (have_next) clReleaseEvent(write_event[1 - cur]);
+                break;
+            }
+        }
+        cur = 1 - cur;
+        have = have_next;
+    }
+    clFinish(queue);
+    printf("\nprocessed %d mini-batches\n", stats->batches);
+    stats->inertia = sample_inertia(holdout, n_holdout, clusters, n_clusters, n_features);
+
+    for (i = 0; i < 2; i++)
+    {
+        clReleaseMemObject(d_batch[i]);
+        clReleaseMemObject(d_batch_membership[i]);
+        clReleaseMemObject(d_batch_sums[i]);
+        clReleaseMemObject(d_batch_counts[i]);
+        clReleaseMemObject(d_batch_delta[i]);
+        free(staging[i]);
+    }
+    clReleaseMemObject(cu.d_cluster);
+#if USE_DATA_TYPE == INT_DT
+    clReleaseMemObject(cu.d_weights);
+#endif
+    clReleaseCommandQueue(queue);
+    free(samples[0]);
+    free(samples);
+    munmap(base, st.st_size);
+    close(fd);
+
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    stats->kernel_time = ctx->t_exec / 1E6;
+    stats->total_time  = time_elapsed(t_start, t_end);
+    return clusters;
+}
+
+int fpga_kmeans_minibatch_print_report(const fpga_kmeans_context *ctx, const fpga_kmeans_minibatch_stats *stats)
+{
+    printf("*******************************************************\n");
+    printf("\tK-means Mini-batch Execution Summary:\n");
+    printf("*******************************************************\n");
+    printf("\tPoints x Features             : %d x %d\n",stats->npoints, stats->nfeatures);
+    printf("\tGlobal Size                   : %d\n",ctx->global_size);
+    printf("\tMini-batches                  : %d (%d epochs, %lld points)\n",stats->batches, stats->epochs, stats->points);
+    printf("\tConverged                     : %s\n",stats->converged ? "yes" : "no (epoch limit)");
+    printf("\tHeld-out Inertia              : %f\n",stats->inertia);
+    printf("\tKernel Execution Time(ms)     : %f\n",stats->kernel_time);
+    printf("\tTotal Time(ms)                : %f\n",stats->total_time);
+    printf("*******************************************************\n");
     return 0;
 }
@@ -35,7 +35,29 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <CL/cl.h>
 #include "kmeans.h"
 
+/* Host state of a clustering: the program, its compute units and the point
+   range, DDR bank and buffers of every compute unit. Points are split evenly
+   over the compute units, which run concurrently every iteration, and their
+   partial centroid sums are merged on the host. */
+typedef struct fpga_kmeans_context fpga_kmeans_context;
+
+/* fpga_kmeans_create() tiled mode: the tiled kernel streams centroid tiles
+   through on-chip memory for more features or clusters than kmeans kernel holds */
+#define FPGA_KMEANS_TILED_AUTO  -1  /* tiled only when the clustering does not fit */
+#define FPGA_KMEANS_TILED_OFF    0
+#define FPGA_KMEANS_TILED_ON     1
+
+/* global_size work items are shared out over the compute units,
+   compute_units 0 uses every compute unit in the xclbin */
+fpga_kmeans_context* fpga_kmeans_create(int global_size = 1, int tiled = FPGA_KMEANS_TILED_AUTO, int compute_units = 0);
+void fpga_kmeans_release(fpga_kmeans_context *ctx);
+
+int fpga_kmeans_init(fpga_kmeans_context *ctx, int n_features = 0, int max_nclusters = 0);
+int fpga_kmeans_shutdown(fpga_kmeans_context *ctx);
+int fpga_kmeans_allocate(fpga_kmeans_context *ctx, int n_points, int n_features, int n_clusters, float **feature);
+int fpga_kmeans_deallocateMemory(fpga_kmeans_context *ctx);
 float** fpga_kmeans_clustering(
+                          fpga_kmeans_context *ctx,
                           float **feature,    /* in: [npoints][nfeatures] */
                           int     nfeatures,
                           int     npoints,
@@ -43,11 +65,45 @@ float** fpga_kmeans_clustering(
                           float   threshold,
                           int    *membership /* out: [npoints] */
         );
+int fpga_kmeans_print_report(const fpga_kmeans_context *ctx);
+int fpga_kmeans_get_stats(const fpga_kmeans_context *ctx, int *iteration, double *kernel_time, int *tile_clusters);
+/* compute units found by fpga_kmeans_init() */
+int fpga_kmeans_compute_units(const fpga_kmeans_context *ctx);
+/* "FLOAT" or the quantisation of the INT build, e.g. "INT16 packed x2" */
+const char* fpga_kmeans_data_type(const fpga_kmeans_context *ctx);
+
+/* Mini-batch K-means streaming a binary point file (int npoints, int nfeatures,
+   float features[npoints][nfeatures]) from a memory mapping through double
+   buffered device buffers, so the data set does not have to fit in host or
+   device memory. Centroids are updated after every batch with per cluster
+   learning rates and convergence is checked on a held-out sample. Batches
+   run on the first compute unit of the context. */
+typedef struct {
+    int    batch_points;    /* points per mini-batch */
+    int    holdout_points;  /* held-out sample size, also the size of the seeding sample */
+    int    max_epochs;      /* passes over the file */
+    int    eval_interval;   /* batches between held-out evaluations */
+    float  tolerance;       /* minimum relative held-out improvement */
+} fpga_kmeans_minibatch_options;
+
+typedef struct {
+    int    npoints;
+    int    nfeatures;
+    int    batches;
+    int    epochs;          /* started passes over the file */
+    long long points;       /* points streamed through the device */
+    double inertia;         /* mean squared distance of the held-out points */
+    int    converged;
+    double kernel_time;     /* ms */
+    double total_time;      /* ms */
+} fpga_kmeans_minibatch_stats;
 
-int fpga_kmeans_setup(int global_size = 1);
-int fpga_kmeans_init();
-int fpga_kmeans_shutdown();
-int fpga_kmeans_allocate( int n_points, int n_features, int n_clusters, float **feature);
-int fpga_kmeans_deallocateMemory();
-int fpga_kmeans_print_report();
+void fpga_kmeans_minibatch_default_options(fpga_kmeans_minibatch_options *opt);
+float** fpga_kmeans_minibatch(fpga_kmeans_context *ctx,
+                              const char *filename,
+                              int   nclusters,
+                              float threshold,   /* for the seeding run on the sample */
+                              const fpga_kmeans_minibatch_options *opt,
+                              fpga_kmeans_minibatch_stats *stats);
+int fpga_kmeans_minibatch_print_report(const fpga_kmeans_context *ctx, const fpga_kmeans_minibatch_stats *stats);
 #endif // _H_FPGA_KMEANS_
@@ -107,6 +107,16 @@ int main(int argc, char **argv) {
     parser.addSwitch("--threshold",     "-t",    "thresold value",                     "0.001");
     parser.addSwitch("--output",        "-o",    "output cluster center coordinates",  "0");
     parser.addSwitch("--global_size",   "-g",    "Specify Global Size",                "1");
+    parser.addSwitch("--tiled",         "-T",    "tiled kernel: auto, on or off",       "auto");
+    parser.addSwitch("--compute_units", "-u",    "compute units sharing the points (0: all)", "0");
+    parser.addSwitch("--engine",        "-e",    "fpga, cpu or both (cpu as golden model)", "fpga");
+    parser.addSwitch("--seeding",       "-s",    "cpu engine seeding: first or parallel", "parallel");
+    parser.addSwitch("--bounds",        "-d",    "cpu engine bounds: auto, hamerly or elkan", "auto");
+    parser.addSwitch("--cpu_threads",   "-p",    "cpu engine threads (0: all)",        "0");
+    parser.addSwitch("--minibatch",     "-M",    "mini-batch points, streams a binary input file (0: off)", "0");
+    parser.addSwitch("--holdout",       "-H",    "mini-batch held-out sample points",  "8192");
+    parser.addSwitch("--epochs",        "-E",    "mini-batch maximum passes over the input", "10");
+    parser.addSwitch("--write_binary",  "-w",    "write the input as a binary point file", "");
     parser.parse(argc, argv);
 
     //read settings
@@ -119,11 +129,61 @@ int main(int argc, char **argv) {
     isOutput        = parser.value_to_int("output");       
     global_size     = parser.value_to_int("global_size");
 
+    int engine;
+    std::string engine_name = parser.value("engine");
+    if (engine_name == "fpga")      engine = KMEANS_ENGINE_FPGA;
+    else if (engine_name == "cpu")  engine = KMEANS_ENGINE_CPU;
+    else if (engine_name == "both") engine = KMEANS_ENGINE_BOTH;
+    else {
+        fprintf(stderr, "Error: unknown engine (%s)\n", engine_name.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    kmeans_cpu_options cpu_options;
+    kmeans_cpu_default_options(&cpu_options);
+    std::string seeding = parser.value("seeding");
+    std::string bounds  = parser.value("bounds");
+    cpu_options.seeding  = (seeding == "first") ? KMEANS_SEED_FIRST : KMEANS_SEED_PARALLEL;
+    cpu_options.bounds   = (bounds == "hamerly") ? KMEANS_BOUNDS_HAMERLY :
+                           (bounds == "elkan")   ? KMEANS_BOUNDS_ELKAN : KMEANS_BOUNDS_AUTO;
+    cpu_options.nthreads = parser.value_to_int("cpu_threads");
+
     if (filename.empty() ){
         parser.printHelp();
         exit(EXIT_FAILURE);
     }
-    fpga_kmeans_setup(global_size);
+    std::string tiled = parser.value("tiled");
+    fpga_kmeans_context *fpga_ctx = fpga_kmeans_create(global_size,
+                                   (tiled == "on")  ? FPGA_KMEANS_TILED_ON :
+                                   (tiled == "off") ? FPGA_KMEANS_TILED_OFF : FPGA_KMEANS_TILED_AUTO,
+                                   parser.value_to_int("compute_units"));
+
+    //Mini-batch mode streams the binary file itself, no need to load it
+    fpga_kmeans_minibatch_options mb_options;
+    fpga_kmeans_minibatch_default_options(&mb_options);
+    mb_options.batch_points   = parser.value_to_int("minibatch");
+    mb_options.holdout_points = parser.value_to_int("holdout");
+    mb_options.max_epochs     = parser.value_to_int("epochs");
+    if (mb_options.batch_points > 0) {
+        fpga_kmeans_minibatch_stats mb_stats;
+        cluster_centres = fpga_kmeans_minibatch(fpga_ctx, filename.c_str(), max_nclusters, threshold, &mb_options, &mb_stats);
+        fpga_kmeans_shutdown(fpga_ctx);
+        fpga_kmeans_minibatch_print_report(fpga_ctx, &mb_stats);
+        fpga_kmeans_release(fpga_ctx);
+        if (isOutput == 1) {
+            printf("\n================= Centroid Coordinates =================\n");
+            for(i = 0; i < max_nclusters; i++){
+                printf("\n\n%d:", i);
+                for(j = 0; j < mb_stats.nfeatures; j++){
+                    printf(" %.2f", cluster_centres[i][j]);
+                }
+                printf("\n\n");
+            }
+        }
+        free(cluster_centres[0]);
+        free(cluster_centres);
+        return(0);
+    }
 
     /* ============== I/O begin ==============*/
     /* get nfeatures and npoints */
@@ -183,6 +243,19 @@ int main(int argc, char **argv) {
         fclose(infile);
     }
     
+    std::string binaryfile = parser.value("write_binary");
+    if (!binaryfile.empty()) {
+        int outfile;
+        if ((outfile = open(binaryfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+            fprintf(stderr, "Error: cannot create file (%s)\n", binaryfile.c_str());
+            exit(EXIT_FAILURE);
+        }
+        write(outfile, &npoints,   sizeof(int));
+        write(outfile, &nfeatures, sizeof(int));
+        write(outfile, buf, npoints*nfeatures*sizeof(float));
+        close(outfile);
+    }
+
     printf("\nI/O completed\n");
     printf("\nfileName=%s\n",filename.c_str());
     printf("\nNumber of objects: %d\n", npoints);
@@ -206,7 +279,7 @@ int main(int argc, char **argv) {
     /* ======================= core of the clustering ===================*/
     
     
-    //FPGA Based cluster
+    //FPGA Based cluster, CPU engine as fallback or golden model
     cluster_centres = NULL;
     index = cluster(npoints,            /* number of data points */
                     nfeatures,          /* number of features for each point */
@@ -219,7 +292,11 @@ int main(int argc, char **argv) {
                     &rmse,              /* Root Mean Squared Error */
                     isRMSE,             /* calculate RMSE */
                     nloops,             /* number of iteration for each number of clusters */
-                    goldenfile.c_str());
+                    goldenfile.c_str(),
+                    engine,
+                    &cpu_options,
+                    fpga_ctx);
+    fpga_kmeans_release(fpga_ctx);
     
     
     //cluster_timing = omp_get_wtime() - cluster_timing;
@@ -55,11 +55,33 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
     #define VMULT_TYPE  ulong16
     #define VECTOR_SIZE 16
     #define MAX_VALUE   0xFFFFFFFFFFFFFFFF
+    //Quantised features are unsigned, sums need 64 bits
+    #define ACC_TYPE    long
+    #define ACC_VALUE(v) ((long)(v))
+    //Host quantises every feature to QUANT_BITS over its own range. 16 and 8 bit
+    //features are packed 2 and 4 to a word, 24 bit features take a whole word.
+    #ifndef QUANT_BITS
+    #define QUANT_BITS 24
+    #endif
+    //Squared differences are multiplied by 16 bit (24 bit features) or 32 bit
+    //weights and only then shifted, so that the weighted terms of even the tiled
+    //kernel's many features add up in 64 bits without dropping small differences.
+    #if QUANT_BITS == 24
+        #define FEATURES_PER_WORD 1
+        #define DIST_SHIFT 16
+    #else
+        #define FEATURES_PER_WORD (32 / QUANT_BITS)
+        #define DIST_SHIFT ((QUANT_BITS == 16) ? 16 : 0)
+    #endif
+    #define QUANT_MASK ((1u << QUANT_BITS) - 1)
 #else
     #define DATA_TYPE   float
     #define VDATA_TYPE  float16
     #define VMULT_TYPE  float16
     #define MAX_VALUE   3.40282347e+38
+    #define ACC_TYPE    float
+    #define ACC_VALUE(v) (v)
+    #define FEATURES_PER_WORD 1
 #endif
 
 
@@ -69,12 +91,23 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define MAX_CLUSTER_SIZE (CLUSTER_MEM_SIZE_IN_KB * 1024) // 32KB Reserve for Cluster
 
+// Maximum number of clusters the per cluster point counters can hold
+#define MAX_CLUSTERS 1024
+
 /*
    This Application do K-means operations. 
     operation:For each point find the minimum distance cluster and set the cluster id of each Point on membership.
+              Each point is also added to the feature sums and point count of its new cluster and compared 
+              with its previous cluster id, so that host only reads back the sums, counts and number of 
+              changed points of every work item instead of whole membership.
     Arguments:
-        feature     (input)     --> Memory location of all the points's features
-        membership  (output)    --> Kernel execution will find the minimum clusters for each point and set the cluster id into this memory
+        feature     (input)     --> Memory location of all the points's features, FEATURES_PER_WORD to a word
+        clusters    (input)     --> Current cluster centers
+        weights     (input)     --> INT only: weight of each feature's squared difference (scale^2)
+        membership  (in/out)    --> Previous cluster id of each point (-1 on first iteration), overwritten with the new one
+        sums        (output)    --> [global_size][nclusters][nfeatures] feature sums of the points in each cluster
+        counts      (output)    --> [global_size][nclusters] number of points in each cluster
+        delta       (output)    --> [global_size] number of points which changed cluster
         npoints     (input)     --> Total number of points to execute
         nclusters   (input)     --> Total number clusters
         nfeatures   (input)     --> Total number of features
@@ -83,7 +116,13 @@ __kernel __attribute__ ((reqd_work_group_size(1, 1, 1)))
 void kmeans(
                 __global VDATA_TYPE         * feature,   
                 __global VDATA_TYPE         * clusters,
+#if USE_DATA_TYPE == INT_DT
+                __global DATA_TYPE          * weights,
+#endif
                 __global MEMBERSHIP_TYPE    * membership,
+                __global ACC_TYPE           * sums,
+                __global int                * counts,
+                __global int                * delta,
                 int     _npoints,
                 int     nclusters,
                 int     nfeatures
@@ -98,11 +137,23 @@ void kmeans(
 
 
     //local memory to perform burst read entire features of each point before starting the operation
-    local VDATA_TYPE point_features[PARALLEL_POINTS][MAX_FEATURES] __attribute__((xcl_array_partition(complete, 1))); 
+    local VDATA_TYPE point_features[PARALLEL_POINTS][MAX_FEATURES] __attribute__((xcl_array_partition(complete, 1)))
+                                                                    __attribute__((xcl_array_partition(cyclic, PARALLEL_FEATURES, 2)));
+
+#if USE_DATA_TYPE == INT_DT
+    //Padding features past nfeatures get weight 0
+    DATA_TYPE feature_weights[MAX_FEATURES] __attribute__((xcl_array_partition(cyclic, PARALLEL_FEATURES, 1)));
+    __attribute__((xcl_pipeline_loop))
+    weight_read:for (int i = 0 ; i < MAX_FEATURES ; i++)
+    {
+        feature_weights[i] = (i < nfeatures) ? weights[i] : 0;
+    }
+#endif
 
     int npoints   = (_npoints   -1) / VECTOR_SIZE + 1;
 
     int N_Features = (nfeatures -1) / VECTOR_SIZE + 1 ;
+    int nwords = (nfeatures -1) / FEATURES_PER_WORD + 1;
 
     int total_cluster_size = nclusters * N_Features;
     int clusterIdx = 0;
@@ -130,6 +181,29 @@ void kmeans(
     int kernel_point_end   = kernel_point_start + kernel_point_size;
     if (kernel_point_end > npoints) kernel_point_end = npoints;
 
+    //Local memory to accumulate new centroids of this work item's points. Sums are
+    //banked per feature of a PARALLEL_FEATURES tile: feature f of cluster c lives in
+    //bank f % PARALLEL_FEATURES at c * ftiles + f / PARALLEL_FEATURES, so a whole
+    //tile is updated in one cycle. Host keeps nclusters * ftiles within a bank.
+    int ftiles = (nfeatures - 1) / PARALLEL_FEATURES + 1;
+    ACC_TYPE cluster_sums[PARALLEL_FEATURES][MAX_CLUSTER_SIZE / PARALLEL_FEATURES] __attribute__((xcl_array_partition(complete, 1)));
+    int cluster_counts[MAX_CLUSTERS];
+    int changed = 0;
+    __attribute__((xcl_pipeline_loop))
+    sums_init:for (int i = 0 ; i < nclusters * ftiles ; i++)
+    {
+        __attribute__((opencl_unroll_hint))
+        for (int fl = 0 ; fl < PARALLEL_FEATURES ; fl++)
+        {
+            cluster_sums[fl][i] = 0;
+        }
+    }
+    __attribute__((xcl_pipeline_loop))
+    counts_init:for (int i = 0 ; i < nclusters ; i++)
+    {
+        cluster_counts[i] = 0;
+    }
+
 #ifdef DEBUG
     printf("Global_Size=%d Global_ID=%d start=%d End=%d\n",global_size, global_id, kernel_point_start, kernel_point_end);
 #endif
@@ -143,19 +217,25 @@ void kmeans(
             total_points = kernel_point_end  - start_point_id;
         }
 
-        int fIdx = 0;
+        int wIdx = 0;
         int pIdx = 0;
-        //Reading Features of point into local memory
+        //Reading Features of point into local memory, unpacking packed words
         __attribute__((xcl_pipeline_loop))
-        read_features:for (int i = 0 ; i < total_points * nfeatures; i++, fIdx++)
+        read_features:for (int i = 0 ; i < total_points * nwords; i++, wIdx++)
         {
-            VDATA_TYPE vValue = feature[start_point_id * nfeatures + i];
-            if (fIdx == nfeatures)
+            VDATA_TYPE vValue = feature[start_point_id * nwords + i];
+            if (wIdx == nwords)
             {
-                fIdx = 0;
+                wIdx = 0;
                 pIdx++;
             }
-            point_features[pIdx][fIdx] = vValue;
+#if FEATURES_PER_WORD > 1
+            __attribute__((opencl_unroll_hint))
+            unpack:for (int k = 0 ; k < FEATURES_PER_WORD ; k++)
+                point_features[pIdx][wIdx * FEATURES_PER_WORD + k] = (vValue >> (k * QUANT_BITS)) & QUANT_MASK;
+#else
+            point_features[pIdx][wIdx] = vValue;
+#endif
         }
         //Local Variable for Keeping Index and Minimum Distance for each point
         MEMBERSHIP_TYPE vIndex[PARALLEL_POINTS];
@@ -171,7 +251,7 @@ void kmeans(
 
         int cIdx = 0;
         int cfIdx = 0;
-        fIdx = 0;
+        int fIdx = 0;
         int total_loop_count = ( (nfeatures -1) / PARALLEL_FEATURES + 1 )  * nclusters;
         __attribute__((xcl_pipeline_loop))
         kmeans_ops:for (int i = 0; i < total_loop_count ; i ++) 
@@ -200,7 +280,11 @@ void kmeans(
                       vDiff[vid] = vValue[vid];
 
                    vDiff = vDiff - cf[fl];
+#if USE_DATA_TYPE == INT_DT
+                   dist[fl]  = (vDiff * vDiff * feature_weights[fIdx + fl]) >> DIST_SHIFT;
+#else
                    dist[fl]  = vDiff * vDiff;
+#endif
                }
                __attribute__((opencl_unroll_hint))
                calc_dist:for (int fl = 0 ; fl < PARALLEL_FEATURES ; fl ++ )
@@ -237,13 +321,76 @@ void kmeans(
              }
         }
 
-        //Writing membership 
+        //Writing membership and counting points which changed cluster
         __attribute__((xcl_pipeline_loop))
         membership_write:for ( int i = 0 ; i < total_points; i++)
         {
-            membership[start_point_id + i] = vIndex[i];
+            MEMBERSHIP_TYPE old_index = membership[start_point_id + i];
+            MEMBERSHIP_TYPE new_index = vIndex[i];
+            membership[start_point_id + i] = new_index;
+            __attribute__((opencl_unroll_hint))
+            for (int vid = 0 ; vid < VECTOR_SIZE ; vid++)
+            {
+                //last vector is padded with dummy points
+                if ((start_point_id + i) * VECTOR_SIZE + vid < _npoints && old_index[vid] != new_index[vid]) changed++;
+            }
         }
+
+        //Adding every valid point to its new cluster, one feature tile of one point per cycle
+        int vid  = 0;
+        int tIdx = 0;
+        pIdx = 0;
+        __attribute__((xcl_pipeline_loop))
+        accumulate:for (int i = 0 ; i < total_points * VECTOR_SIZE * ftiles ; i++)
+        {
+            //last vector is padded with dummy points
+            if ((start_point_id + pIdx) * VECTOR_SIZE + vid < _npoints)
+            {
+                int cid = vIndex[pIdx][vid];
+                if (tIdx == 0) cluster_counts[cid]++;
+                __attribute__((opencl_unroll_hint))
+                accumulate_features:for (int fl = 0 ; fl < PARALLEL_FEATURES ; fl++)
+                {
+                    int f = tIdx * PARALLEL_FEATURES + fl;
+                    if (f < nfeatures)
+                    {
+                        VDATA_TYPE vValue = point_features[pIdx][f];
+                        cluster_sums[fl][cid * ftiles + tIdx] += ACC_VALUE(vValue[vid]);
+                    }
+                }
+            }
+            tIdx++;
+            if (tIdx == ftiles)
+            {
+                tIdx = 0;
+                vid++;
+                if (vid == VECTOR_SIZE)
+                {
+                    vid = 0;
+                    pIdx++;
+                }
+            }
+        }
+    }
+
+    //Writing partial sums, counts and delta of this work item
+    __attribute__((xcl_pipeline_loop))
+    sums_write:for (int i = 0, cid = 0, f = 0 ; i < nclusters * nfeatures ; i++)
+    {
+        sums[global_id * nclusters * nfeatures + i] = cluster_sums[f % PARALLEL_FEATURES][cid * ftiles + f / PARALLEL_FEATURES];
+        f++;
+        if (f == nfeatures)
+        {
+            f = 0;
+            cid++;
+        }
+    }
+    __attribute__((xcl_pipeline_loop))
+    counts_write:for (int i = 0 ; i < nclusters ; i++)
+    {
+        counts[global_id * nclusters + i] = cluster_counts[i];
     }
+    delta[global_id] = changed;
     return;
 }
 
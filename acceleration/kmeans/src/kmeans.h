@@ -42,11 +42,21 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string.h>
 #include <time.h>
 #include <CL/cl.h>
+#include "kmeans_cpu.h"
+
+/* cluster() engines */
+#define KMEANS_ENGINE_FPGA  1
+#define KMEANS_ENGINE_CPU   2
+#define KMEANS_ENGINE_BOTH  (KMEANS_ENGINE_FPGA | KMEANS_ENGINE_CPU)
+
 /* rmse.c */
 float   euclid_dist_2        (float*, float*, int);
 int     find_nearest_point   (float* , int, float**, int);
 float   rms_err(float**, int, int, float**, int);
-int     cluster(int, int, float**, int, int, float, int*, float***, float*, int, int, const char* goldenFile = NULL);
+struct fpga_kmeans_context;
+int     cluster(int, int, float**, int, int, float, int*, float***, float*, int, int, const char* goldenFile = NULL,
+                int engine = KMEANS_ENGINE_FPGA, const kmeans_cpu_options* cpu_options = NULL,
+                struct fpga_kmeans_context* fpga_ctx = NULL);
 float** kmeans_clustering_cmodel(float **feature, int nfeatures, int npoints, int nclusters, float threshold, 
         int* iteration, int *membership); 
 //return elapsed time in ms from t0 to t1
@@ -0,0 +1,298 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+
+/*******************************************************************************
+Description:
+    K-means benchmark sweeping the number of clusters and features on synthetic
+    data. Every configuration is clustered on the device, in tiled mode when it
+    does not fit the kmeans kernel, and by a golden model started from the same
+    initial centers. Iterations, time, kernel throughput, membership mismatch and
+    inertia relative to the golden model are reported, so INT builds of every
+    QUANT_BITS can be compared against the float C-Model. With -s the feature
+    ranges spread over that many decades. First both kernels (or the one -T
+    selects) have to match the float CPU engine on features whose ranges differ
+    by 10^6.
+
+    ./kmeans_bench [-p npoints] [-k 16,256,1024,4096] [-d 32,256,1024] [-g global_size]
+                   [-t threshold] [-r cmodel|cpu] [-T auto|on|off] [-s decades]
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include "kmeans.h"
+#include "fpga_kmeans.h"
+#include "cmdlineparser.h"
+
+using namespace sda::utils;
+
+static std::vector<int> parse_list(const std::string& list)
+{
+    std::vector<int> values;
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        if (end > start) values.push_back(atoi(list.substr(start, end - start).c_str()));
+        start = end + 1;
+    }
+    return values;
+}
+
+//npoints points scattered around nblobs random centers, feature f is scaled
+//down by up to 10^spread so that features have different ranges
+static float** make_points(int npoints, int nfeatures, int nblobs, float spread)
+{
+    std::vector<float> centers((size_t) nblobs * nfeatures);
+    for (size_t i = 0; i < centers.size(); i++)
+        centers[i] = (float) (rand() % 10000) / 100.0f;
+
+    float **features = (float**) malloc(npoints * sizeof(float*));
+    features[0] = (float*) malloc((size_t) npoints * nfeatures * sizeof(float));
+    if (features[0] == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for features\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 1; i < npoints; i++)
+        features[i] = features[i-1] + nfeatures;
+    std::vector<float> range(nfeatures);
+    for (int j = 0; j < nfeatures; j++)
+        range[j] = powf(10.0f, -spread * j / (nfeatures > 1 ? nfeatures - 1 : 1));
+    for (int i = 0; i < npoints; i++) {
+        const float *c = &centers[(size_t) (rand() % nblobs) * nfeatures];
+        for (int j = 0; j < nfeatures; j++)
+            features[i][j] = (c[j] + (float) (rand() % 1000) / 100.0f) * range[j];
+    }
+    return features;
+}
+
+static void free_2d(float **p)
+{
+    if (p) {
+        free(p[0]);
+        free(p);
+    }
+}
+
+//Points around the corners of a unit cube in features 1..nfeatures-1, the first
+//points visit every corner once. Only point 2^(nfeatures-1) leaves feature 0 and
+//stretches its range to 10^decades, so the clusters differ in narrow features only.
+static float** make_skewed_points(int npoints, int nfeatures, float decades)
+{
+    int corners = 1 << (nfeatures - 1);
+    float **features = (float**) malloc(npoints * sizeof(float*));
+    features[0] = (float*) malloc((size_t) npoints * nfeatures * sizeof(float));
+    if (features[0] == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for features\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 1; i < npoints; i++)
+        features[i] = features[i-1] + nfeatures;
+    for (int i = 0; i < npoints; i++) {
+        features[i][0] = (i == corners) ? powf(10.0f, decades) : 0;
+        for (int j = 1; j < nfeatures; j++)
+            features[i][j] = (float) (((i % corners) >> (j - 1)) & 1) + (float) (rand() % 200 - 100) / 1000.0f;
+    }
+    return features;
+}
+
+//Narrow features must keep their weight and precision next to a wide one: device
+//memberships have to match the float CPU engine started from the same centres
+static bool check_skewed_ranges(int global_size, int tiled_mode, int compute_units, float threshold,
+                                kmeans_cpu_options *cpu_options)
+{
+    int npoints = 4096, nfeatures = 4, nclusters = (1 << (nfeatures - 1)) + 1;
+    float **points = make_skewed_points(npoints, nfeatures, 6);
+    std::vector<int> membership(npoints), golden_membership(npoints);
+
+    fpga_kmeans_context *ctx = fpga_kmeans_create(global_size, tiled_mode, compute_units);
+    fpga_kmeans_init(ctx, nfeatures, nclusters);
+    fpga_kmeans_allocate(ctx, npoints, nfeatures, nclusters, points);
+    float **centres = fpga_kmeans_clustering(ctx, points, nfeatures, npoints, nclusters, threshold, membership.data());
+    fpga_kmeans_deallocateMemory(ctx);
+    fpga_kmeans_release(ctx);
+    free_2d(centres);
+
+    kmeans_cpu_stats cpu_stats;
+    centres = kmeans_clustering_cpu(points, nfeatures, npoints, nclusters, threshold,
+                                    golden_membership.data(), cpu_options, &cpu_stats);
+    free_2d(centres);
+    free_2d(points);
+
+    int mismatch = 0;
+    for (int i = 0; i < npoints; i++)
+        if (membership[i] != golden_membership[i]) mismatch++;
+    printf("Skewed feature ranges (10^6, %s): %d of %d memberships differ from the CPU engine\n",
+           tiled_mode == FPGA_KMEANS_TILED_ON ? "kmeans_tiled" : "kmeans", mismatch, npoints);
+    return mismatch == 0;
+}
+
+//mean squared distance of the points to their nearest centre
+static double inertia(float **points, int npoints, int nfeatures, float **centres, int nclusters)
+{
+    double sum = 0;
+    for (int i = 0; i < npoints; i++) {
+        double min_dist = DBL_MAX;
+        for (int c = 0; c < nclusters; c++) {
+            double dist = 0;
+            for (int j = 0; j < nfeatures; j++)
+                dist += (points[i][j] - centres[c][j]) * (points[i][j] - centres[c][j]);
+            if (dist < min_dist) min_dist = dist;
+        }
+        sum += min_dist;
+    }
+    return sum / npoints;
+}
+
+int main(int argc, char **argv) {
+    CmdLineParser parser;
+    parser.addSwitch("--npoints",     "-p", "number of points",                   "16384");
+    parser.addSwitch("--clusters",    "-k", "comma separated cluster counts",     "16,256,1024,4096");
+    parser.addSwitch("--features",    "-d", "comma separated feature counts",     "32,256,1024");
+    parser.addSwitch("--global_size", "-g", "Specify Global Size",                "2");
+    parser.addSwitch("--threshold",   "-t", "thresold value",                     "0.001");
+    parser.addSwitch("--golden",      "-r", "golden model: cmodel or cpu",        "cmodel");
+    parser.addSwitch("--tiled",       "-T", "tiled kernel: auto, on or off",      "auto");
+    parser.addSwitch("--compute_units", "-u", "compute units sharing the points (0: all)", "0");
+    parser.addSwitch("--spread",      "-s", "decades between widest and narrowest feature range", "0");
+    parser.parse(argc, argv);
+
+    int npoints       = parser.value_to_int("npoints");
+    int global_size   = parser.value_to_int("global_size");
+    int compute_units = parser.value_to_int("compute_units");
+    float threshold   = atof(parser.value("threshold").c_str());
+    float spread      = atof(parser.value("spread").c_str());
+    bool use_cmodel   = parser.value("golden") != "cpu";
+    std::string tiled = parser.value("tiled");
+    int tiled_mode    = (tiled == "on")  ? FPGA_KMEANS_TILED_ON :
+                        (tiled == "off") ? FPGA_KMEANS_TILED_OFF : FPGA_KMEANS_TILED_AUTO;
+    std::vector<int> clusters = parse_list(parser.value("clusters"));
+    std::vector<int> features = parse_list(parser.value("features"));
+
+    kmeans_cpu_options cpu_options;
+    kmeans_cpu_default_options(&cpu_options);
+    cpu_options.seeding = KMEANS_SEED_FIRST;
+
+    int *membership        = (int*) malloc(npoints * sizeof(int));
+    int *golden_membership = (int*) malloc(npoints * sizeof(int));
+    if ((membership == NULL) || (golden_membership == NULL)) {
+        fprintf(stderr, "Error: Failed to run malloc\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct timespec t0, t1;
+    bool failed = false;
+    std::string table;
+    std::string data_type;
+    srand(7);
+    if (tiled_mode != FPGA_KMEANS_TILED_ON)
+        failed |= !check_skewed_ranges(global_size, FPGA_KMEANS_TILED_OFF, compute_units, threshold, &cpu_options);
+    if (tiled_mode != FPGA_KMEANS_TILED_OFF)
+        failed |= !check_skewed_ranges(global_size, FPGA_KMEANS_TILED_ON, compute_units, threshold, &cpu_options);
+    for (size_t d = 0; d < features.size(); d++) {
+        int nfeatures = features[d];
+        int max_k = 0;
+        for (size_t k = 0; k < clusters.size(); k++)
+            if (clusters[k] > max_k) max_k = clusters[k];
+        float **points = make_points(npoints, nfeatures, max_k > 0 ? max_k : 1, spread);
+
+        for (size_t k = 0; k < clusters.size(); k++) {
+            int nclusters = clusters[k];
+            if (nclusters > npoints) continue;
+
+            fpga_kmeans_context *ctx = fpga_kmeans_create(global_size, tiled_mode, compute_units);
+            fpga_kmeans_init(ctx, nfeatures, nclusters);
+            fpga_kmeans_allocate(ctx, npoints, nfeatures, nclusters, points);
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            float **centres = fpga_kmeans_clustering(ctx, points, nfeatures, npoints, nclusters, threshold, membership);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            double device_time = time_elapsed(t0, t1);
+            int device_iteration, tile_clusters;
+            double kernel_time;
+            fpga_kmeans_get_stats(ctx, &device_iteration, &kernel_time, &tile_clusters);
+            int device_cus = fpga_kmeans_compute_units(ctx);
+            if (data_type.empty()) data_type = fpga_kmeans_data_type(ctx);
+            fpga_kmeans_deallocateMemory(ctx);
+            fpga_kmeans_release(ctx);
+            double device_inertia = inertia(points, npoints, nfeatures, centres, nclusters);
+            free_2d(centres);
+
+            int golden_iteration = 0;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            if (use_cmodel) {
+                centres = kmeans_clustering_cmodel(points, nfeatures, npoints, nclusters, threshold,
+                                                   &golden_iteration, golden_membership);
+            } else {
+                kmeans_cpu_stats cpu_stats;
+                centres = kmeans_clustering_cpu(points, nfeatures, npoints, nclusters, threshold,
+                                                golden_membership, &cpu_options, &cpu_stats);
+                golden_iteration = cpu_stats.iterations;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            double golden_time = time_elapsed(t0, t1);
+            double golden_inertia = inertia(points, npoints, nfeatures, centres, nclusters);
+            free_2d(centres);
+
+            int mismatch = 0;
+            for (int i = 0; i < npoints; i++)
+                if (membership[i] != golden_membership[i]) mismatch++;
+            float mismatch_rate = float (100 * mismatch) / npoints;
+            if (mismatch_rate > 10) failed = true;
+
+            //points assigned per second by the kernel, in millions
+            double throughput = kernel_time > 0 ? (double) npoints * device_iteration / kernel_time / 1E3 : 0;
+            double inertia_ratio = golden_inertia > 0 ? 100.0 * device_inertia / golden_inertia : 100.0;
+
+            char row[256];
+            snprintf(row, sizeof(row), "%8d %8d %6d %4d %8d %12.3f %12.3f %10.2f %8d %12.3f %10.3f %10.3f\n",
+                     nclusters, nfeatures, tile_clusters, device_cus, device_iteration, device_time, kernel_time,
+                     throughput, golden_iteration, golden_time, mismatch_rate, inertia_ratio);
+            table += row;
+        }
+        free_2d(points);
+    }
+
+    printf("\n*******************************************************\n");
+    printf("\tK-means Benchmark: %d points, %s device, golden model %s\n", npoints,
+           data_type.c_str(), use_cmodel ? "C-Model" : "CPU engine");
+    printf("*******************************************************\n");
+    printf("%8s %8s %6s %4s %8s %12s %12s %10s %8s %12s %10s %10s\n", "k", "features", "tile", "cus", "iter",
+           "device(ms)", "kernel(ms)", "Mpts/s", "gold_it", "golden(ms)", "mismatch%", "inertia%");
+    printf("%s", table.c_str());
+    printf("*******************************************************\n");
+    printf("(tile 0: whole clustering fits the kmeans kernel, inertia%%: device inertia relative to golden)\n");
+
+    free(membership);
+    free(golden_membership);
+    printf("TEST %s\n", failed ? "FAILED" : "PASSED");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,509 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+
+#include "kmeans_cpu.h"
+#include "kmeans.h"
+#include "threadpool.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+
+#define KMEANS_MAX_LOOPS        1000            /* same cap as fpga_kmeans_clustering() */
+#define KMEANS_PAR_ROUNDS       5               /* k-means|| sampling rounds */
+#define KMEANS_PAR_OVERSAMPLE   2               /* k-means|| samples ~2*nclusters points per round */
+#define KMEANS_ELKAN_FEATURES   32              /* AUTO picks Elkan from this dimension on ... */
+#define KMEANS_ELKAN_MAX_BYTES  (256u << 20)    /* ... while its lower bounds fit in this */
+
+/* partial results of one chunk of points. Every chunk owns its slot so the
+   merge order, and with it the result, does not depend on thread scheduling */
+struct kmeans_partial {
+    std::vector<double> sums;       /* [nclusters][nfeatures] change of cluster sums */
+    std::vector<int>    counts;     /* [nclusters] change of cluster sizes */
+    std::vector<int>    picked;     /* k-means|| samples */
+    long long           distances;
+    double              cost;
+    int                 delta;
+};
+
+static std::unique_ptr<sda::ThreadPool> g_cpu_pool;
+static int g_cpu_pool_threads = -1;
+
+static sda::ThreadPool& cpu_pool(int nthreads)
+{
+    if (!g_cpu_pool || g_cpu_pool_threads != nthreads) {
+        g_cpu_pool.reset(new sda::ThreadPool(nthreads > 0 ? nthreads : 0));
+        g_cpu_pool_threads = nthreads;
+    }
+    return *g_cpu_pool;
+}
+
+static inline double dist2(const float *a, const float *b, int n)
+{
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) {
+        double d = (double) a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+static inline float dist(const float *a, const float *b, int n)
+{
+    return (float) sqrt(dist2(a, b, n));
+}
+
+/* uniform [0, 1) value for (seed, stream, index), splitmix64 finalizer.
+   Stateless so sampling gives the same picks for any number of threads */
+static inline double uniform_hash(unsigned seed, unsigned stream, unsigned index)
+{
+    uint64_t z = (uint64_t) seed * 0x9E3779B97F4A7C15ULL;
+    z ^= ((uint64_t) stream << 32) | index;
+    z += 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void kmeans_cpu_default_options(kmeans_cpu_options *opt)
+{
+    opt->seeding  = KMEANS_SEED_PARALLEL;
+    opt->bounds   = KMEANS_BOUNDS_AUTO;
+    opt->nthreads = 0;
+    opt->seed     = 7;
+}
+
+/*---< seed_first() >---------------------------------------------------------*/
+/* initial centers are the first nclusters points like the device path */
+static void seed_first(float **feature, int nfeatures, int nclusters, float **clusters)
+{
+    for (int i = 0; i < nclusters; i++)
+        memcpy(clusters[i], feature[i], nfeatures * sizeof(float));
+}
+
+/*---< seed_parallel() >------------------------------------------------------*/
+/* k-means|| (Bahmani et al.): a few rounds oversample points with probability
+   proportional to their squared distance to the candidates so far, then the
+   candidates, weighted by the number of points closest to them, are reduced
+   to nclusters centers with k-means++. */
+static void seed_parallel(float **feature, int nfeatures, int npoints, int nclusters,
+                          unsigned seed, sda::ThreadPool &pool,
+                          std::vector<kmeans_partial> &parts, size_t grain,
+                          float **clusters, kmeans_cpu_stats *stats)
+{
+    std::vector<double> d2(npoints, DBL_MAX);   /* squared distance to the nearest candidate */
+    std::vector<int>    nearest(npoints, 0);    /* index of that candidate */
+    std::vector<int>    cand;                   /* candidate point indices */
+    std::vector<char>   is_cand(npoints, 0);
+
+    /* fold candidates [first, end) into d2/nearest, return the new cost */
+    auto absorb = [&](size_t first) -> double {
+        size_t last = cand.size();
+        pool.parallel_for(npoints, grain, [&](size_t b, size_t e) {
+            kmeans_partial &p = parts[b / grain];
+            p.cost = 0.0;
+            for (size_t i = b; i < e; i++) {
+                for (size_t c = first; c < last; c++) {
+                    double d = dist2(feature[i], feature[cand[c]], nfeatures);
+                    if (d < d2[i]) {
+                        d2[i] = d;
+                        nearest[i] = (int) c;
+                    }
+                }
+                p.cost += d2[i];
+            }
+        });
+        stats->seed_distances += (long long) npoints * (last - first);
+        double cost = 0.0;
+        for (size_t c = 0; c < parts.size(); c++)
+            cost += parts[c].cost;
+        return cost;
+    };
+
+    int first = (int) (uniform_hash(seed, 0, 0) * npoints);
+    cand.push_back(first);
+    is_cand[first] = 1;
+    double phi = absorb(0);
+
+    double ell = (double) KMEANS_PAR_OVERSAMPLE * nclusters;
+    for (int r = 1; r <= KMEANS_PAR_ROUNDS && phi > 0.0; r++) {
+        pool.parallel_for(npoints, grain, [&](size_t b, size_t e) {
+            kmeans_partial &p = parts[b / grain];
+            p.picked.clear();
+            for (size_t i = b; i < e; i++) {
+                if (uniform_hash(seed, r, i) * phi < ell * d2[i])
+                    p.picked.push_back((int) i);
+            }
+        });
+        size_t begin = cand.size();
+        for (size_t c = 0; c < parts.size(); c++) {
+            for (size_t j = 0; j < parts[c].picked.size(); j++) {
+                cand.push_back(parts[c].picked[j]);
+                is_cand[parts[c].picked[j]] = 1;
+            }
+            parts[c].picked.clear();
+        }
+        if (cand.size() > begin)
+            phi = absorb(begin);
+    }
+
+    size_t m = cand.size();
+    stats->seed_candidates = (int) m;
+    std::vector<double> weight(m, 0.0);
+    for (int i = 0; i < npoints; i++)
+        weight[nearest[i]] += 1.0;
+
+    /* weighted k-means++ over the candidates */
+    std::vector<double> cd2(m, DBL_MAX);
+    std::vector<char>   used(m, 0);
+    int chosen = 0;
+    for (; chosen < nclusters; chosen++) {
+        double total = 0.0;
+        for (size_t j = 0; j < m; j++) {
+            if (!used[j])
+                total += weight[j] * (chosen ? cd2[j] : 1.0);
+        }
+        long sel = -1;
+        if (total > 0.0) {
+            double target = uniform_hash(seed, KMEANS_PAR_ROUNDS + 1 + chosen, 0) * total;
+            double acc = 0.0;
+            for (size_t j = 0; j < m; j++) {
+                if (used[j]) continue;
+                double w = weight[j] * (chosen ? cd2[j] : 1.0);
+                if (w <= 0.0) continue;
+                sel = (long) j;
+                acc += w;
+                if (acc > target) break;
+            }
+        }
+        if (sel < 0) {
+            /* the rest coincide with picked centers, take them in order */
+            for (size_t j = 0; j < m && sel < 0; j++) {
+                if (!used[j]) sel = (long) j;
+            }
+        }
+        if (sel < 0)
+            break;
+        used[sel] = 1;
+        memcpy(clusters[chosen], feature[cand[sel]], nfeatures * sizeof(float));
+        for (size_t j = 0; j < m; j++) {
+            if (used[j]) continue;
+            double d = dist2(feature[cand[j]], feature[cand[sel]], nfeatures);
+            if (d < cd2[j]) cd2[j] = d;
+        }
+        stats->seed_distances += m;
+    }
+
+    /* fewer candidates than clusters: fill up with the first other points */
+    for (int i = 0; i < npoints && chosen < nclusters; i++) {
+        if (!is_cand[i])
+            memcpy(clusters[chosen++], feature[i], nfeatures * sizeof(float));
+    }
+}
+
+/* nearest and second nearest center of x; d_known is the distance to center
+   known (skipped when known < 0). Returns the number of distances evaluated */
+static int scan_centers(const float *x, float **clusters, int nclusters, int nfeatures,
+                        int known, float d_known, float *d_all,
+                        int *best, float *d_best, float *d_second)
+{
+    int   b  = -1;
+    float d1 = FLT_MAX;
+    float d2 = FLT_MAX;
+    for (int j = 0; j < nclusters; j++) {
+        float d = (j == known) ? d_known : dist(x, clusters[j], nfeatures);
+        if (d_all) d_all[j] = d;
+        if (d < d1) {
+            d2 = d1;
+            d1 = d;
+            b = j;
+        } else if (d < d2) {
+            d2 = d;
+        }
+    }
+    *best = b;
+    *d_best = d1;
+    *d_second = d2;
+    return (known >= 0) ? nclusters - 1 : nclusters;
+}
+
+/*---< kmeans_clustering_cpu() >----------------------------------------------*/
+float** kmeans_clustering_cpu(float **feature,    /* in: [npoints][nfeatures] */
+                              int     nfeatures,
+                              int     npoints,
+                              int     nclusters,
+                              float   threshold,
+                              int    *membership, /* out: [npoints] */
+                              const kmeans_cpu_options *opt,
+                              kmeans_cpu_stats *stats)
+{
+    kmeans_cpu_options defaults;
+    kmeans_cpu_stats   local_stats;
+    struct timespec    t_start, t_seed, t_end;
+    int                i, j;
+
+    if (opt == NULL) {
+        kmeans_cpu_default_options(&defaults);
+        opt = &defaults;
+    }
+    if (stats == NULL)
+        stats = &local_stats;
+    memset(stats, 0, sizeof(*stats));
+
+    /* nclusters should never be > npoints
+       that would guarantee a cluster without points */
+    if (nclusters > npoints)
+        nclusters = npoints;
+
+    float **clusters = (float**) malloc(nclusters * sizeof(float*));
+    if (clusters == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for clusters\n");
+        exit(EXIT_FAILURE);
+    }
+    clusters[0] = (float*) malloc(nclusters * nfeatures * sizeof(float));
+    if (clusters[0] == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for clusters[0]\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 1; i < nclusters; i++)
+        clusters[i] = clusters[i-1] + nfeatures;
+
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+
+    sda::ThreadPool &pool = cpu_pool(opt->nthreads);
+    size_t nchunks = 4 * pool.size();
+    size_t grain   = (npoints + nchunks - 1) / nchunks;
+    nchunks = (npoints + grain - 1) / grain;
+    std::vector<kmeans_partial> parts(nchunks);
+    for (size_t c = 0; c < nchunks; c++) {
+        parts[c].sums.assign((size_t) nclusters * nfeatures, 0.0);
+        parts[c].counts.assign(nclusters, 0);
+    }
+
+    if (opt->seeding == KMEANS_SEED_PARALLEL)
+        seed_parallel(feature, nfeatures, npoints, nclusters, opt->seed, pool, parts, grain, clusters, stats);
+    else
+        seed_first(feature, nfeatures, nclusters, clusters);
+    clock_gettime(CLOCK_MONOTONIC, &t_seed);
+
+    int bounds = opt->bounds;
+    if (bounds == KMEANS_BOUNDS_AUTO) {
+        size_t elkan_bytes = (size_t) npoints * nclusters * sizeof(float);
+        bounds = (nfeatures >= KMEANS_ELKAN_FEATURES && elkan_bytes <= KMEANS_ELKAN_MAX_BYTES)
+               ? KMEANS_BOUNDS_ELKAN : KMEANS_BOUNDS_HAMERLY;
+    }
+    stats->bounds = bounds;
+    bool elkan = (bounds == KMEANS_BOUNDS_ELKAN);
+
+    /* per point bounds: upper on the distance to its center, lower on the
+       distance to the second closest center (Hamerly) or to every center (Elkan) */
+    std::vector<float> upper(npoints, FLT_MAX);
+    std::vector<float> lower((size_t) npoints * (elkan ? nclusters : 1), 0.0f);
+
+    std::vector<double> sums((size_t) nclusters * nfeatures, 0.0);
+    std::vector<int>    counts(nclusters, 0);
+    std::vector<float>  moved(nclusters, 0.0f);                  /* center drift of the last update */
+    std::vector<float>  half_cc((size_t) nclusters * nclusters); /* half center/center distance */
+    std::vector<float>  half_min(nclusters);                     /* half distance to the closest other center */
+    std::vector<float>  old_center(nfeatures);
+
+    for (i = 0; i < npoints; i++)
+        membership[i] = -1;
+
+    int   loop = 0;
+    int   delta;
+    bool  first_pass = true;
+    float max_moved = 0.0f, second_moved = 0.0f;
+    int   max_moved_id = -1;
+
+    do {
+        for (i = 0; i < nclusters; i++)
+            half_min[i] = FLT_MAX;
+        for (i = 0; i < nclusters; i++) {
+            half_cc[(size_t) i * nclusters + i] = 0.0f;
+            for (j = i + 1; j < nclusters; j++) {
+                float h = 0.5f * dist(clusters[i], clusters[j], nfeatures);
+                half_cc[(size_t) i * nclusters + j] = h;
+                half_cc[(size_t) j * nclusters + i] = h;
+                if (h < half_min[i]) half_min[i] = h;
+                if (h < half_min[j]) half_min[j] = h;
+            }
+        }
+        stats->center_distances += (long long) nclusters * (nclusters - 1) / 2;
+
+        /* assignment, parallel over chunks of points */
+        pool.parallel_for(npoints, grain, [&](size_t b, size_t e) {
+            kmeans_partial &p = parts[b / grain];
+            p.distances = 0;
+            p.delta = 0;
+            for (size_t pi = b; pi < e; pi++) {
+                const float *x = feature[pi];
+                int    a  = membership[pi];
+                int    na = a;
+                float &u  = upper[pi];
+
+                if (!elkan) {
+                    float &l = lower[pi];
+                    if (first_pass) {
+                        p.distances += scan_centers(x, clusters, nclusters, nfeatures, -1, 0.0f, NULL, &na, &u, &l);
+                    } else {
+                        u += moved[a];
+                        l -= (a == max_moved_id) ? second_moved : max_moved;
+                        float m = (half_min[a] > l) ? half_min[a] : l;
+                        if (u > m) {
+                            u = dist(x, clusters[a], nfeatures);
+                            p.distances++;
+                            if (u > m)
+                                p.distances += scan_centers(x, clusters, nclusters, nfeatures, a, u, NULL, &na, &u, &l);
+                        }
+                    }
+                } else {
+                    float *l = &lower[pi * nclusters];
+                    if (first_pass) {
+                        float second;
+                        p.distances += scan_centers(x, clusters, nclusters, nfeatures, -1, 0.0f, l, &na, &u, &second);
+                    } else {
+                        for (int c = 0; c < nclusters; c++) {
+                            l[c] -= moved[c];
+                            if (l[c] < 0.0f) l[c] = 0.0f;
+                        }
+                        u += moved[a];
+                        if (u > half_min[a]) {
+                            bool stale = true;
+                            for (int c = 0; c < nclusters; c++) {
+                                if (c == na || u <= l[c] || u <= half_cc[(size_t) na * nclusters + c])
+                                    continue;
+                                if (stale) {
+                                    u = dist(x, clusters[na], nfeatures);
+                                    l[na] = u;
+                                    p.distances++;
+                                    stale = false;
+                                    if (u <= l[c] || u <= half_cc[(size_t) na * nclusters + c])
+                                        continue;
+                                }
+                                float d = dist(x, clusters[c], nfeatures);
+                                l[c] = d;
+                                p.distances++;
+                                if (d < u || (d == u && c < na)) {
+                                    na = c;
+                                    u = d;
+                                }
+                            }
+                        }
+                    }
+                }
+
+                if (na != a) {
+                    p.delta++;
+                    membership[pi] = na;
+                    double *dst = &p.sums[(size_t) na * nfeatures];
+                    for (int f = 0; f < nfeatures; f++)
+                        dst[f] += x[f];
+                    p.counts[na]++;
+                    if (a >= 0) {
+                        double *src = &p.sums[(size_t) a * nfeatures];
+                        for (int f = 0; f < nfeatures; f++)
+                            src[f] -= x[f];
+                        p.counts[a]--;
+                    }
+                }
+            }
+        });
+
+        /* merge the chunk deltas in chunk order */
+        delta = 0;
+        for (size_t c = 0; c < nchunks; c++) {
+            kmeans_partial &p = parts[c];
+            delta += p.delta;
+            stats->distances += p.distances;
+            for (size_t k = 0; k < sums.size(); k++) {
+                sums[k] += p.sums[k];
+                p.sums[k] = 0.0;
+            }
+            for (i = 0; i < nclusters; i++) {
+                counts[i] += p.counts[i];
+                p.counts[i] = 0;
+            }
+        }
+
+        /* new centers and how far each one moved */
+        max_moved = second_moved = 0.0f;
+        max_moved_id = -1;
+        for (i = 0; i < nclusters; i++) {
+            moved[i] = 0.0f;
+            if (counts[i] == 0)
+                continue;
+            memcpy(&old_center[0], clusters[i], nfeatures * sizeof(float));
+            for (j = 0; j < nfeatures; j++)
+                clusters[i][j] = (float) (sums[(size_t) i * nfeatures + j] / counts[i]);
+            moved[i] = dist(&old_center[0], clusters[i], nfeatures);
+            if (moved[i] > max_moved) {
+                second_moved = max_moved;
+                max_moved = moved[i];
+                max_moved_id = i;
+            } else if (moved[i] > second_moved) {
+                second_moved = moved[i];
+            }
+        }
+        first_pass = false;
+        stats->iterations++;
+    } while ((delta > threshold) && (loop++ < KMEANS_MAX_LOOPS));
+
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    stats->brute_distances = (long long) stats->iterations * npoints * nclusters;
+    stats->seed_time  = time_elapsed(t_start, t_seed);
+    stats->total_time = time_elapsed(t_start, t_end);
+    return clusters;
+}
+
+int kmeans_cpu_print_report(const kmeans_cpu_stats *stats)
+{
+    double ratio = stats->brute_distances
+                 ? 100.0 * stats->distances / stats->brute_distances : 0.0;
+    printf("*******************************************************\n");
+    printf("\tK-means CPU Execution Summary:\n");
+    printf("*******************************************************\n");
+    printf("\tBounds                        : %s\n", stats->bounds == KMEANS_BOUNDS_ELKAN ? "Elkan" : "Hamerly");
+    printf("\tIteration                     : %d\n", stats->iterations);
+    printf("\tSeed Candidates               : %d\n", stats->seed_candidates);
+    printf("\tSeed Distance Evaluations     : %lld\n", stats->seed_distances);
+    printf("\tDistance Evaluations          : %lld (%.2f%% of brute force %lld)\n",
+           stats->distances, ratio, stats->brute_distances);
+    printf("\tCenter Distance Evaluations   : %lld\n", stats->center_distances);
+    printf("\tSeeding Time(ms)              : %f\n", stats->seed_time);
+    printf("\tExecution Time(ms)            : %f\n", stats->total_time);
+    printf("*******************************************************\n");
+    return 0;
+}
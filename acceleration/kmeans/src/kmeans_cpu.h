@@ -0,0 +1,82 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+
+#ifndef _H_KMEANS_CPU_
+#define _H_KMEANS_CPU_
+
+/* Host CPU K-means engine. Used as fallback when no device is wanted and as a
+   golden model for fpga_kmeans_clustering(). Seeding uses k-means|| (scalable
+   k-means++) and the assignment step skips point/center distances with
+   triangle-inequality bounds (Hamerly or Elkan) in parallel over a thread
+   pool. Memberships match brute force Lloyd iterations from the same seeds. */
+
+/* initial centers */
+#define KMEANS_SEED_FIRST       0   /* first nclusters points, same as the device path */
+#define KMEANS_SEED_PARALLEL    1   /* k-means|| followed by weighted k-means++ */
+
+/* distance bounds */
+#define KMEANS_BOUNDS_AUTO      0   /* Elkan for high dimensional data, Hamerly otherwise */
+#define KMEANS_BOUNDS_HAMERLY   1   /* one upper and one lower bound per point */
+#define KMEANS_BOUNDS_ELKAN     2   /* one upper and nclusters lower bounds per point */
+
+typedef struct {
+    int      seeding;
+    int      bounds;
+    int      nthreads;              /* 0: one per hardware thread */
+    unsigned seed;                  /* k-means|| sampling seed */
+} kmeans_cpu_options;
+
+typedef struct {
+    int       iterations;           /* Lloyd iterations until convergence */
+    int       bounds;               /* bound scheme actually used */
+    int       seed_candidates;      /* k-means|| candidate set size */
+    long long seed_distances;       /* point/center distances evaluated while seeding */
+    long long distances;            /* point/center distances evaluated by assignment */
+    long long center_distances;     /* center/center distances evaluated for bounds */
+    long long brute_distances;      /* distances brute force would have evaluated */
+    double    seed_time;            /* ms */
+    double    total_time;           /* ms */
+} kmeans_cpu_stats;
+
+void kmeans_cpu_default_options(kmeans_cpu_options *opt);
+
+float** kmeans_clustering_cpu(
+                          float **feature,    /* in: [npoints][nfeatures] */
+                          int     nfeatures,
+                          int     npoints,
+                          int     nclusters,
+                          float   threshold,
+                          int    *membership, /* out: [npoints] */
+                          const kmeans_cpu_options *opt,  /* NULL: defaults */
+                          kmeans_cpu_stats *stats         /* out, may be NULL */
+        );
+
+int kmeans_cpu_print_report(const kmeans_cpu_stats *stats);
+
+#endif // _H_KMEANS_CPU_
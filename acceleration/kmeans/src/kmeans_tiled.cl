@@ -0,0 +1,270 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+
+//Default Setting
+#ifndef CLUSTER_MEM_SIZE_IN_KB
+#define CLUSTER_MEM_SIZE_IN_KB 32
+#endif
+
+#ifndef PARALLEL_POINTS 
+#define PARALLEL_POINTS 4
+#endif
+
+#define FLOAT_DT 0
+#define INT_DT   1
+
+#ifndef USE_DATA_TYPE
+#define USE_DATA_TYPE INT_DT
+#endif
+
+#define VECTOR_SIZE 16
+#define MEMBERSHIP_TYPE int16
+#if USE_DATA_TYPE == INT_DT
+    #define DATA_TYPE   unsigned int
+    #define VDATA_TYPE  uint16
+    #define VMULT_TYPE  ulong16
+    #define MAX_VALUE   0xFFFFFFFFFFFFFFFF
+    //Same per feature quantisation as kmeans kernel, features are not packed here
+    #ifndef QUANT_BITS
+    #define QUANT_BITS 24
+    #endif
+    #if QUANT_BITS == 24
+        #define DIST_SHIFT 16
+    #else
+        #define DIST_SHIFT ((QUANT_BITS == 16) ? 16 : 0)
+    #endif
+#else
+    #define DATA_TYPE   float
+    #define VDATA_TYPE  float16
+    #define VMULT_TYPE  float16
+    #define MAX_VALUE   3.40282347e+38
+#endif
+
+// Features of a point group are buffered on chip FEATURE_CHUNK at a time, so 
+// any number of features is supported.
+#define FEATURE_CHUNK 64
+
+// Host has to size tiles so that tile_clusters <= MAX_TILE_CLUSTERS and 
+// tile_clusters * nfeatures <= MAX_CLUSTER_SIZE (see fpga_kmeans.cpp)
+#define MAX_TILE_CLUSTERS 64
+#define MAX_CLUSTER_SIZE (CLUSTER_MEM_SIZE_IN_KB * 1024) // 32KB Reserve for Cluster
+
+/*
+   Tiled K-means assignment for more features or clusters than kmeans kernel can hold on chip.
+    operation:Host streams the centroids through this kernel one tile at a time. For each point the 
+              distance to every centroid of the tile is computed and the running minimum distance and 
+              cluster id, kept in global memory across tiles, are updated. After the last tile the 
+              membership holds the nearest cluster of every point.
+    Arguments:
+        feature       (input)     --> Memory location of all the points's features (same layout as kmeans kernel)
+        clusters      (input)     --> Centroid tile [tile_clusters][nfeatures]
+        weights       (input)     --> INT only: weight of each feature's squared difference (scale^2)
+        membership    (in/out)    --> Running nearest cluster id of each point
+        min_dist      (in/out)    --> Running minimum distance of each point
+        npoints       (input)     --> Total number of points to execute
+        tile_start    (input)     --> Cluster id of the first centroid of the tile
+        tile_clusters (input)     --> Number of centroids in the tile
+        nfeatures     (input)     --> Total number of features
+        first_tile    (input)     --> Non zero for the first tile of an iteration, resets the running minimum
+   */
+__kernel __attribute__ ((reqd_work_group_size(1, 1, 1))) 
+void kmeans_tiled(
+                __global VDATA_TYPE         * feature,   
+                __global DATA_TYPE          * clusters,
+#if USE_DATA_TYPE == INT_DT
+                __global DATA_TYPE          * weights,
+#endif
+                __global MEMBERSHIP_TYPE    * membership,
+                __global VMULT_TYPE         * min_dist,
+                int     _npoints,
+                int     tile_start,
+                int     tile_clusters,
+                int     nfeatures,
+                int     first_tile
+              ) 
+{
+    //Local memory to store the centroid tile, read only once per kernel call
+    DATA_TYPE cluster_features[ MAX_CLUSTER_SIZE ];
+
+    //local memory for a chunk of features of the point group
+    local VDATA_TYPE point_features[PARALLEL_POINTS][FEATURE_CHUNK] __attribute__((xcl_array_partition(complete, 1))); 
+#if USE_DATA_TYPE == INT_DT
+    DATA_TYPE chunk_weights[FEATURE_CHUNK];
+#endif
+
+    //Partial distance of the point group to every centroid of the tile across feature chunks
+    VMULT_TYPE tile_dist[PARALLEL_POINTS][MAX_TILE_CLUSTERS] __attribute__((xcl_array_partition(complete, 1)));
+
+    __attribute__((xcl_pipeline_loop))
+    cluster_read:for (int i = 0 ; i < tile_clusters * nfeatures ; i++)
+    {
+        cluster_features[i] = clusters[i];
+    }
+
+    int npoints   = (_npoints   -1) / VECTOR_SIZE + 1;
+
+    int global_size = get_global_size(0);
+    int global_id   = get_global_id(0);
+    int kernel_point_size  = ((npoints -1 ) / global_size + 1);
+    int kernel_point_start = global_id * kernel_point_size;
+    int kernel_point_end   = kernel_point_start + kernel_point_size;
+    if (kernel_point_end > npoints) kernel_point_end = npoints;
+
+    tile_itr:for(int start_point_id = kernel_point_start ; start_point_id < kernel_point_end ; start_point_id += PARALLEL_POINTS)
+    {
+        int total_points = PARALLEL_POINTS;
+        if (start_point_id + total_points > kernel_point_end)
+        {
+            total_points = kernel_point_end  - start_point_id;
+        }
+
+        //Running minimum of the previous tiles
+        MEMBERSHIP_TYPE vIndex[PARALLEL_POINTS];
+        VMULT_TYPE vMinDist[PARALLEL_POINTS];
+        VMULT_TYPE vAcc[PARALLEL_POINTS];
+        init_state:for (int i = 0 ; i < PARALLEL_POINTS ; i++)
+        {
+            vAcc[i] = 0;
+            if (first_tile || i >= total_points)
+            {
+                vIndex[i]   = 0;
+                vMinDist[i] = MAX_VALUE;
+            }else
+            {
+                vIndex[i]   = membership[start_point_id + i];
+                vMinDist[i] = min_dist[start_point_id + i];
+            }
+        }
+
+        __attribute__((xcl_pipeline_loop))
+        dist_init:for (int c = 0 ; c < tile_clusters ; c++)
+        {
+            __attribute__((opencl_unroll_hint))
+            for (int pid = 0 ; pid < PARALLEL_POINTS ; pid++)
+                tile_dist[pid][c] = 0;
+        }
+
+        chunk_itr:for (int fstart = 0 ; fstart < nfeatures ; fstart += FEATURE_CHUNK)
+        {
+            int fcount = nfeatures - fstart;
+            if (fcount > FEATURE_CHUNK) fcount = FEATURE_CHUNK;
+
+            //Reading chunk of features of the point group into local memory
+            int fIdx = 0;
+            int pIdx = 0;
+            __attribute__((xcl_pipeline_loop))
+            read_features:for (int i = 0 ; i < total_points * fcount ; i++, fIdx++)
+            {
+                if (fIdx == fcount)
+                {
+                    fIdx = 0;
+                    pIdx++;
+                }
+                point_features[pIdx][fIdx] = feature[(start_point_id + pIdx) * nfeatures + fstart + fIdx];
+            }
+#if USE_DATA_TYPE == INT_DT
+            __attribute__((xcl_pipeline_loop))
+            read_weights:for (int i = 0 ; i < fcount ; i++)
+            {
+                chunk_weights[i] = weights[fstart + i];
+            }
+#endif
+
+            int cIdx = 0;
+            fIdx = 0;
+            __attribute__((xcl_pipeline_loop))
+            tile_ops:for (int i = 0 ; i < tile_clusters * fcount ; i++)
+            {
+                DATA_TYPE cf = cluster_features[cIdx * nfeatures + fstart + fIdx];
+                __attribute__((opencl_unroll_hint))
+                square_and_add:for (int pid = 0 ; pid < PARALLEL_POINTS ; pid++)
+                {
+                    VMULT_TYPE vDiff;
+                    VDATA_TYPE vValue = point_features[pid][fIdx];
+                    __attribute__((opencl_unroll_hint))
+                    for (int vid = 0 ; vid < VECTOR_SIZE ; vid++)
+                        vDiff[vid] = vValue[vid];
+                    vDiff = vDiff - cf;
+#if USE_DATA_TYPE == INT_DT
+                    vAcc[pid] += (vDiff * vDiff * chunk_weights[fIdx]) >> DIST_SHIFT;
+#else
+                    vAcc[pid] += vDiff * vDiff;
+#endif
+                }
+                if (fIdx + 1 < fcount)
+                {
+                    fIdx++;
+                }else
+                {
+                    //end of the chunk for this centroid, fold into its partial distance
+                    __attribute__((opencl_unroll_hint))
+                    fold_dist:for (int pid = 0 ; pid < PARALLEL_POINTS ; pid++)
+                    {
+                        tile_dist[pid][cIdx] += vAcc[pid];
+                        vAcc[pid] = 0;
+                    }
+                    fIdx = 0;
+                    cIdx++;
+                }
+            }
+        }
+
+        //Centroids are visited in increasing cluster id, so ties keep the lowest id like the C-Model
+        __attribute__((xcl_pipeline_loop))
+        update_min:for (int c = 0 ; c < tile_clusters ; c++)
+        {
+            __attribute__((opencl_unroll_hint))
+            for (int pid = 0 ; pid < PARALLEL_POINTS ; pid++)
+            {
+                VMULT_TYPE t_vDist    = tile_dist[pid][c];
+                VMULT_TYPE t_vMinDist = vMinDist[pid];
+                MEMBERSHIP_TYPE t_vIndex = vIndex[pid];
+                __attribute__((opencl_unroll_hint))
+                for (int vid = 0 ; vid < VECTOR_SIZE ; vid++)
+                {
+                    if (t_vDist[vid] < t_vMinDist[vid])
+                    {
+                        t_vMinDist[vid] = t_vDist[vid];
+                        t_vIndex[vid]   = tile_start + c;
+                    }
+                }
+                vMinDist[pid] = t_vMinDist;
+                vIndex[pid]   = t_vIndex;
+            }
+        }
+
+        __attribute__((xcl_pipeline_loop))
+        state_write:for (int i = 0 ; i < total_points ; i++)
+        {
+            membership[start_point_id + i] = vIndex[i];
+            min_dist[start_point_id + i]   = vMinDist[i];
+        }
+    }
+    return;
+}
@@ -33,6 +33,7 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <algorithm>
 #define _COMPUTE_FULL_MATRIX 1
 #include "sw.h"
 #include "matcharray.h"
@@ -120,13 +121,21 @@ void printMatrix(int readSize, int refSize, short** mat, char* msg)
     }
 }
 
+//Gotoh local alignment, scoring laid out as described in sw.h
 void computeMatrix(int readSize, int refSize, short* readSeq,
-    short* refSeq, short** mat, short* maxr, short* maxc, short* maxv)
+    short* refSeq, short** mat, short* maxr, short* maxc, short* maxv, const int* scoring)
 {
+    short gapOpen = scoring[SCORING_GAPO];
+    short gapExtend = scoring[SCORING_GAPE];
+    short* e = new short[readSize];
     *maxv = MINVAL;
     int row, col;
+    for (row = 0; row < readSize; ++row) {
+        e[row] = 0;
+    }
     for (col = 0; col < refSize; col++) {
         short d = refSeq[col];
+        short f = 0;
         for (row = 0; row < readSize; ++row) {
             short n, nw, w;
             if (row == 0) {
@@ -151,9 +160,11 @@ void computeMatrix(int readSize, int refSize, short* readSeq,
 
             short q = readSeq[row];
             short max = 0;
-            short match = (d == q) ? MATCH : MISS_MATCH;
+            short match = scoring[d * SW_ALPHABET + q];
             short t1 = (nw + match > max) ? nw + match : max;
-            short t2 = (n + GAP > w + GAP) ? n + GAP : w + GAP;
+            e[row] = (w - gapOpen > e[row] - gapExtend) ? w - gapOpen : e[row] - gapExtend;
+            f = (n - gapOpen > f - gapExtend) ? n - gapOpen : f - gapExtend;
+            short t2 = (e[row] > f) ? e[row] : f;
             max = t1 > t2 ? t1 : t2;
             mat[row][col] = max;
             if (max > *maxv) {
@@ -163,6 +174,7 @@ void computeMatrix(int readSize, int refSize, short* readSeq,
             }
         }
     }
+    delete[] e;
 }
 
 void compareMatrix(int readSize, int refSize, short** matRef, short** matComp)
@@ -255,8 +267,13 @@ void compareSeq(int sz, short* seq, short* seqT, char* s)
     }
 }
 
-unsigned int* generatePackedNReadRefPair(int N, int readSize, int refSize, unsigned int** maxVal, int computeOutput = 1)
+unsigned int* generatePackedNReadRefPair(int N, int readSize, int refSize, unsigned int** maxVal, int computeOutput = 1, const int* scoring = NULL)
 {
+    int defaultScoring[SCORINGSZ];
+    if (scoring == NULL) {
+        initScoring(defaultScoring, MATCH, MISS_MATCH, GAP_OPEN, GAP_EXTEND);
+        scoring = defaultScoring;
+    }
     int numInt = READREFUINTSZ(readSize, refSize);
     unsigned int* pairs = new unsigned int[N * numInt];
     short* readSeq = new short[readSize];
@@ -278,7 +295,7 @@ unsigned int* generatePackedNReadRefPair(int N, int readSize, int refSize, unsig
         makeSeq(readSize, refSize, readSeq, refSeq);
         //compute max ref value
         if (computeOutput) {
-            computeMatrix(readSize, refSize, readSeq, refSeq, matRef, &maxr, &maxc, &maxv);
+            computeMatrix(readSize, refSize, readSeq, refSeq, matRef, &maxr, &maxc, &maxv, scoring);
             (*maxVal)[3 * i + 0] = maxr;
             (*maxVal)[3 * i + 1] = maxc;
             (*maxVal)[3 * i + 2] = maxv;
@@ -301,6 +318,160 @@ unsigned int* generatePackedNReadRefPair(int N, int readSize, int refSize, unsig
     return pairs;
 }
 
+//CPU reference over packed read-ref pairs, same output layout as the kernel
+void computePackedNReadRefPair(int N, int readSize, int refSize, unsigned int* pairs, unsigned int* maxVal, const int* scoring)
+{
+    int numInt = READREFUINTSZ(readSize, refSize);
+    short* readSeq = new short[readSize];
+    short* refSeq = new short[refSize];
+    short** matRef = buildMat(readSize, refSize);
+    for (int i = 0; i < N; ++i) {
+        short maxv, maxr, maxc;
+        maxv = 0;
+        maxc = 0;
+        maxr = 0;
+        int offset = numInt * i;
+        uintTouint2Array(readSize / UINTNUMBP, (pairs + offset), readSeq);
+        uintTouint2Array(refSize / UINTNUMBP, (pairs + offset + readSize / UINTNUMBP), refSeq);
+        computeMatrix(readSize, refSize, readSeq, refSeq, matRef, &maxr, &maxc, &maxv, scoring);
+        maxVal[3 * i + 0] = maxr;
+        maxVal[3 * i + 1] = maxc;
+        maxVal[3 * i + 2] = maxv;
+    }
+    delete[] readSeq;
+    delete[] refSeq;
+    deleteMat(readSize, refSize, &matRef);
+}
+
+//read lengths of common short read runs, each trimmed by up to 10%
+static const int g_readLens[] = { 75, 100, 150, 250, 300 };
+
+static void makeVarLengths(int* readSize, int* refSize)
+{
+    int nominal = g_readLens[rand() % (sizeof(g_readLens) / sizeof(g_readLens[0]))];
+    int rd = nominal - rand() % (nominal / 10 + 1);
+    //reference window of up to twice the read around the locus
+    int rf = rd + rand() % (rd + 1);
+    *readSize = std::min(rd, MAXREADLEN);
+    *refSize = std::min(rf, MAXREFLEN);
+}
+
+/*
+ * Generates N read-ref pairs with a realistic length distribution. lens gets
+ * PAIRLENS of each pair and offsets the uint offset of the pair in the
+ * returned buffer, where the packed read is followed by the packed ref.
+ */
+unsigned int* generateVarReadRefPairs(int N, unsigned int* lens, unsigned int* offsets)
+{
+    int numInt = 0;
+    for (int i = 0; i < N; ++i) {
+        int rd, rf;
+        makeVarLengths(&rd, &rf);
+        lens[i] = PAIRLENS(rd, rf);
+        offsets[i] = numInt;
+        numInt += SEQUINTSZ(rd) + SEQUINTSZ(rf);
+    }
+    unsigned int* pairs = new unsigned int[numInt];
+    short* readSeq = new short[SEQUINTSZ(MAXREADLEN) * UINTNUMBP];
+    short* refSeq = new short[SEQUINTSZ(MAXREFLEN) * UINTNUMBP];
+    for (int i = 0; i < N; ++i) {
+        int rd = PAIRREADLEN(lens[i]);
+        int rf = PAIRREFLEN(lens[i]);
+        //the tail of the last uint packs as A and is never scored
+        memset(readSeq, 0, sizeof(short) * SEQUINTSZ(rd) * UINTNUMBP);
+        memset(refSeq, 0, sizeof(short) * SEQUINTSZ(rf) * UINTNUMBP);
+        makeSeq(rd, rf, readSeq, refSeq);
+        uint2TouintArray(SEQUINTSZ(rd) * UINTNUMBP, readSeq, pairs + offsets[i]);
+        uint2TouintArray(SEQUINTSZ(rf) * UINTNUMBP, refSeq, pairs + offsets[i] + SEQUINTSZ(rd));
+    }
+    delete[] readSeq;
+    delete[] refSeq;
+    return pairs;
+}
+
+//CPU reference for pairs laid out by generateVarReadRefPairs
+void computeVarReadRefPairs(int N, unsigned int* pairs, unsigned int* lens, unsigned int* offsets, unsigned int* maxVal, const int* scoring)
+{
+    short* readSeq = new short[SEQUINTSZ(MAXREADLEN) * UINTNUMBP];
+    short* refSeq = new short[SEQUINTSZ(MAXREFLEN) * UINTNUMBP];
+    short** matRef = buildMat(MAXREADLEN, MAXREFLEN);
+    for (int i = 0; i < N; ++i) {
+        short maxv, maxr, maxc;
+        maxv = 0;
+        maxc = 0;
+        maxr = 0;
+        int rd = PAIRREADLEN(lens[i]);
+        int rf = PAIRREFLEN(lens[i]);
+        uintTouint2Array(SEQUINTSZ(rd), pairs + offsets[i], readSeq);
+        uintTouint2Array(SEQUINTSZ(rf), pairs + offsets[i] + SEQUINTSZ(rd), refSeq);
+        computeMatrix(rd, rf, readSeq, refSeq, matRef, &maxr, &maxc, &maxv, scoring);
+        maxVal[3 * i + 0] = maxr;
+        maxVal[3 * i + 1] = maxc;
+        maxVal[3 * i + 2] = maxv;
+    }
+    delete[] readSeq;
+    delete[] refSeq;
+    deleteMat(MAXREADLEN, MAXREFLEN, &matRef);
+}
+
+/*
+ * Orders pairs by the stripes and rows the kernel spends on them, so the
+ * NUMPACKED pairs scored side by side finish at about the same time.
+ */
+void sortPairsByCost(int N, unsigned int* lens, int* order)
+{
+    for (int i = 0; i < N; ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order, order + N, [lens](int a, int b) {
+        unsigned int sa = (PAIRREFLEN(lens[a]) + MAXPE - 1) / MAXPE;
+        unsigned int sb = (PAIRREFLEN(lens[b]) + MAXPE - 1) / MAXPE;
+        if (sa != sb) {
+            return sa < sb;
+        }
+        return PAIRREADLEN(lens[a]) < PAIRREADLEN(lens[b]);
+    });
+}
+
+/*
+ * Lays out N pairs as kernel blocks of blockPairs pairs: the PAIRHDRSZ header
+ * of every pair then their packed sequences, taken in the given order (or as
+ * they are when order is NULL). All blocks share the stride of the largest one,
+ * which is returned in uints.
+ */
+int packReadRefBatch(int N, int blockPairs, unsigned int* pairs, unsigned int* lens, unsigned int* offsets, int* order, unsigned int** batch)
+{
+    assert(N % blockPairs == 0);
+    int numBlocks = N / blockPairs;
+    int stride = 0;
+    for (int b = 0; b < numBlocks; ++b) {
+        int words = 0;
+        for (int j = 0; j < blockPairs; ++j) {
+            int src = order ? order[b * blockPairs + j] : b * blockPairs + j;
+            words += SEQUINTSZ(PAIRREADLEN(lens[src])) + SEQUINTSZ(PAIRREFLEN(lens[src]));
+        }
+        stride = std::max(stride, words);
+    }
+    stride += PAIRHDRSZ * blockPairs;
+
+    *batch = new unsigned int[(size_t)stride * numBlocks];
+    for (int b = 0; b < numBlocks; ++b) {
+        unsigned int* header = *batch + (size_t)stride * b;
+        unsigned int* payload = header + PAIRHDRSZ * blockPairs;
+        unsigned int pos = 0;
+        for (int j = 0; j < blockPairs; ++j) {
+            int src = order ? order[b * blockPairs + j] : b * blockPairs + j;
+            unsigned int words = SEQUINTSZ(PAIRREADLEN(lens[src])) + SEQUINTSZ(PAIRREFLEN(lens[src]));
+            header[PAIRHDRSZ * j] = pos;
+            header[PAIRHDRSZ * j + 1] = lens[src];
+            memcpy(payload + pos, pairs + offsets[src], sizeof(unsigned int) * words);
+            pos += words;
+        }
+        memset(payload + pos, 0, sizeof(unsigned int) * (stride - PAIRHDRSZ * blockPairs - pos));
+    }
+    return stride;
+}
+
 void writeReadRefFile(char* fname, unsigned int* pairs, unsigned int* maxVals, int N)
 {
     FILE* fp = fopen(fname, "w");
@@ -16,6 +16,7 @@
 #include <unistd.h>
 #include "ssw.h"
 #include "kseq.h"
+#include "sw.h"
 #include <omp.h>
 
 #ifdef __GNUC__
@@ -199,10 +200,11 @@ void deleteSSWData(int niter, int numsample, kseq_t **read, kseq_t **ref){
   free(*ref);
 }
 
-float SSW(int numsample, int tid, kseq_t *read, kseq_t *ref, unsigned int *maxr, unsigned int *maxc, unsigned int *maxv){
+float SSW(int numsample, int tid, kseq_t *read, kseq_t *ref, unsigned int *maxr, unsigned int *maxc, unsigned int *maxv, const int *scoring){
   
   kseq_t *read_seq, *ref_seq;
-  int32_t l, m, k, match = 2, mismatch = 2, gap_open = 3, gap_extension = 1, path = 0, n = 5, s1 = 67108864, s2 = 128, filter = 0;
+  int32_t m, k, path = 0, n = 5, s1 = 67108864, s2 = 128, filter = 0;
+  int32_t gap_open = scoring[SCORING_GAPO], gap_extension = scoring[SCORING_GAPE];
   int8_t* mata = (int8_t*)calloc(25, sizeof(int8_t));
   const int8_t* mat = mata;
   int8_t* ref_num = (int8_t*)malloc(s1);
@@ -226,12 +228,8 @@ float SSW(int numsample, int tid, kseq_t *read, kseq_t *ref, unsigned int *maxr,
   int8_t* table = nt_table;
   fprintf(stdout, "Processing %d samples using Intel Vector Instruction Set in Thread %d\n", numsample, tid);
   
-  // initialize scoring matrix for genome sequences
-  for (l = k = 0; LIKELY(l < 4); ++l) {
-    for (m = 0; LIKELY(m < 4); ++m) mata[k++] = l == m ? match : -mismatch;	/* weight_match : -weight_mismatch */
-    mata[k++] = 0; // ambiguous base
-  }
-  for (m = 0; LIKELY(m < 5); ++m) mata[k++] = 0;
+  // scoring matrix shared with the FPGA kernel, same [ref * n + read] layout
+  for (k = 0; LIKELY(k < n * n); ++k) mata[k] = (int8_t)scoring[k];
   
   // alignment
   int ii;
@@ -297,7 +295,7 @@ long xgetusec() {
   return retval;
 }
 
-int SSW_par(int nblocks, int nSamples, int nThreads, char **rd, char **rf, unsigned int *maxr, unsigned int *maxc, unsigned int *maxv){
+int SSW_par(int nblocks, int nSamples, int nThreads, char **rd, char **rf, unsigned int *maxr, unsigned int *maxc, unsigned int *maxv, const int *scoring){
     int i;
     omp_set_num_threads(nThreads);
     kseq_t *read, *ref;
@@ -318,7 +316,7 @@ int SSW_par(int nblocks, int nSamples, int nThreads, char **rd, char **rf, unsig
 for(i = 0; i < nIter; ++i)
 {
     ID = omp_get_thread_num();
-    SSW(samples, ID, (read + i*samples), (ref + i*samples), (maxr + i*samples), (maxc + i*samples), (maxv + i*samples));
+    SSW(samples, ID, (read + i*samples), (ref + i*samples), (maxr + i*samples), (maxc + i*samples), (maxv + i*samples), scoring);
 }
     double oend = omp_get_wtime();
     float Gsamples = 256*128;
@@ -485,10 +485,14 @@ static alignment_end* sw_sse2_word (const int8_t* ref,
       for (j = 0; LIKELY(j < segLen); ++j) {
 	vH = _mm_load_si128(pvHStore + j);
 	vH = _mm_max_epi16(vH, vF);
+	vMaxColumn = _mm_max_epi16(vMaxColumn, vH); /* H raised by F can be the column max */
 	_mm_store_si128(pvHStore + j, vH);
 	vH = _mm_subs_epu16(vH, vGapO);
 	vF = _mm_subs_epu16(vF, vGapE);
-	if (UNLIKELY(! _mm_movemask_epi8(_mm_cmpgt_epi16(vF, vH)))) goto end;
+	/* with gapO == gapE a tie vF == vH - gapO can still raise the next H */
+	vTemp = _mm_andnot_si128(_mm_cmpeq_epi16(vF, vZero), _mm_cmpeq_epi16(vF, vH));
+	vTemp = _mm_or_si128(vTemp, _mm_cmpgt_epi16(vF, vH));
+	if (UNLIKELY(! _mm_movemask_epi8(vTemp))) goto end;
       }
     }
     
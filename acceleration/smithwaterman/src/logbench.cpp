@@ -0,0 +1,108 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+
+/*
+ * Per call cost of LogInfo in the synchronous and asynchronous modes of
+ * libs/logger, as seen by the calling threads of a host run loop.
+ *
+ *   ./logbench [ncalls] [nthreads]
+ *
+ * Console output is discarded while measuring so that only formatting, the
+ * time stamp and the log file writes are timed. Every record still goes to
+ * benchapp.log.
+ */
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include "logger.h"
+
+using namespace std;
+
+//swallows the console output during a measurement
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) { return n; }
+};
+
+//ns per LogInfo call on the producers, and ns until everything is written
+static void measure(const string& name, long ncalls, int nthreads)
+{
+    NullBuffer null_buffer;
+    std::streambuf* console = cout.rdbuf(&null_buffer);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    vector<thread> producers;
+    for (int t = 0; t < nthreads; t++) {
+        producers.emplace_back([=]() {
+            for (long i = 0; i < ncalls; i++)
+                LogInfo("thread %d block %ld score %d", t, i, (int)(i * 7 % 113));
+        });
+    }
+    for (size_t t = 0; t < producers.size(); t++)
+        producers[t].join();
+    auto pushed = std::chrono::high_resolution_clock::now();
+    sda::LogFlush();
+    auto written = std::chrono::high_resolution_clock::now();
+
+    cout.rdbuf(console);
+    double ncalls_total = (double)ncalls * nthreads;
+    cout << name << ": "
+         << std::chrono::duration<double, std::nano>(pushed - start).count() * nthreads / ncalls_total
+         << " ns/call, "
+         << std::chrono::duration<double, std::nano>(written - start).count() / ncalls_total
+         << " ns/record until written, dropped " << sda::LogDroppedCount() << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    long ncalls = (argc > 1) ? atol(argv[1]) : 20000;
+    int nthreads = (argc > 2) ? atoi(argv[2]) : 1;
+    if (ncalls <= 0 || nthreads <= 0) {
+        cout << "Usage: " << argv[0] << " [ncalls] [nthreads]" << endl;
+        return EXIT_FAILURE;
+    }
+    cout << "LogInfo cost over " << ncalls << " calls on " << nthreads << " threads" << endl;
+
+    sda::LogSetAsync(false);
+    measure("sync        ", ncalls, nthreads);
+
+    sda::LogSetAsync(true, 4096, sda::ldpBlock);
+    measure("async block ", ncalls, nthreads);
+
+    sda::LogSetAsync(true, 4096, sda::ldpDrop);
+    measure("async drop  ", ncalls, nthreads);
+
+    sda::LogSetAsync(false);
+    return EXIT_SUCCESS;
+}
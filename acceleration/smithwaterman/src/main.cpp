@@ -42,34 +42,41 @@ using namespace sda::utils;
 
 #include "sw.h"
 
-extern int SSW_par(int, int, int, char**, char**, unsigned int*, unsigned int*, unsigned int*);
-
-void intelImpl(int nBlocks, int blkSz, int nThreads, int writeMatchArray, MatchArray* pm)
+/*!
+ * Reads a substitution matrix of 16 (ACGT) or 25 (ACGTN) integers separated
+ * by whitespace or commas, one row per reference base. A 4x4 matrix scores N
+ * with 0.
+ */
+static bool loadScoringMatrix(const char* fname, int* scoring)
 {
-    int totalSz = nBlocks * NUMPACKED * blkSz;
-    unsigned int* maxr = new unsigned int[totalSz];
-    unsigned int* maxc = new unsigned int[totalSz];
-    unsigned int* maxv = new unsigned int[totalSz];
-    char** rd = new char*[totalSz];
-    char** rf = new char*[totalSz];
-    for (int i = 0; i < totalSz; ++i) {
-        rd[i] = new char[MAXROW + 1];
-        rf[i] = new char[MAXCOL + 1];
+    FILE* fp = fopen(fname, "r");
+    if (fp == NULL) {
+        LogError("Unable to open scoring matrix: [%s]", fname);
+        return false;
+    }
+    int vals[SW_ALPHABET * SW_ALPHABET];
+    int n = 0;
+    while (n < SW_ALPHABET * SW_ALPHABET && fscanf(fp, " %d%*[ ,]", &vals[n]) == 1) {
+        n++;
+    }
+    fclose(fp);
+
+    if (n == 16) {
+        for (int rf = 0; rf < SW_ALPHABET; ++rf) {
+            for (int rd = 0; rd < SW_ALPHABET; ++rd) {
+                bool isN = (rf == SW_ALPHABET - 1 || rd == SW_ALPHABET - 1);
+                scoring[rf * SW_ALPHABET + rd] = isN ? 0 : vals[rf * 4 + rd];
+            }
+        }
     }
-    SSW_par(nBlocks, NUMPACKED * blkSz, nThreads, rd, rf, maxr, maxc, maxv);
-    if (writeMatchArray && pm) {
-        pm->populateArray(rd, rf, maxr, maxc, maxv);
-        pm->dumpArray();
+    else if (n == 25) {
+        memcpy(scoring, vals, sizeof(vals));
     }
-    for (int i = 0; i < totalSz; ++i) {
-        delete[] rd[i];
-        delete[] rf[i];
+    else {
+        LogError("Scoring matrix [%s] has %d values, expected 16 or 25", fname, n);
+        return false;
     }
-    delete[] rd;
-    delete[] rf;
-    delete[] maxv;
-    delete[] maxr;
-    delete[] maxc;
+    return true;
 }
 
 //pass cmd line options to select opencl device
@@ -92,8 +99,18 @@ int main(int argc, char* argv[])
     parser.addSwitch("--double-buffered", "-db", "Double buffred host to fpga communication(now working)", "0");
     parser.addSwitch("--verify-mode", "-vm", "Verify output of FPGA using precomputed ref.txt", "0");
     parser.addSwitch("--write-match-array", "-wm", "Write match array", "0");
+    parser.addSwitch("--variable-length", "-vl", "Score generated pairs of realistic, varying lengths", "0");
+    parser.addSwitch("--traceback", "-tb", "Rebuild CIGAR alignments from kernel direction codes", "0");
+    parser.addSwitch("--alignment-file", "-af", "Write scores, and traceback alignments, to this file");
+    parser.addSwitch("--read-file", "-rd", "Stream reads from this FASTQ/FASTA file (plain or gzip'd) instead of generating pairs");
+    parser.addSwitch("--ref-file", "-rf", "FASTA/FASTQ file of one reference per read, or of a single reference for all reads");
     parser.addSwitch("--zmq-pub-port", "-z", "ZeroMQ publisher port for web visualization. FPGA=5020, CPU=5021", "5020");
     parser.addSwitch("--output", "-o", "results output file", "result.json");
+    parser.addSwitch("--match", "-ma", "Score of a base match", "2");
+    parser.addSwitch("--mismatch", "-mm", "Penalty of a base mismatch", "1");
+    parser.addSwitch("--gap-open", "-go", "Penalty of opening a gap", "1");
+    parser.addSwitch("--gap-extend", "-ge", "Penalty of extending a gap", "1");
+    parser.addSwitch("--scoring-matrix", "-sm", "Substitution matrix file (4x4 ACGT or 5x5 ACGTN), overrides match and mismatch");
     parser.setDefaultKey("--kernel-file");
     parser.parse(argc, argv);
 
@@ -116,6 +133,29 @@ int main(int argc, char* argv[])
     int nThreads = parser.value_to_int("number-of-threads");
     int verifyMode = parser.value_to_int("verify-mode");
     int writeMatchArray = parser.value_to_int("write-match-array");
+    int variableLength = parser.value_to_int("variable-length");
+    int traceback = parser.value_to_int("traceback");
+    string strAlignmentFP = parser.isValid("alignment-file") ? parser.value("alignment-file") : string("");
+
+    int scoring[SCORINGSZ];
+    initScoring(scoring, parser.value_to_int("match"), -parser.value_to_int("mismatch"),
+        parser.value_to_int("gap-open"), parser.value_to_int("gap-extend"));
+    if (parser.isValid("scoring-matrix")) {
+        if (!loadScoringMatrix(parser.value("scoring-matrix").c_str(), scoring)) {
+            return -1;
+        }
+    }
+    //the SSW library keeps scores in 8 bits and penalties unsigned
+    for (int i = 0; i < SW_ALPHABET * SW_ALPHABET; ++i) {
+        if (scoring[i] < -127 || scoring[i] > 127) {
+            LogError("Substitution score %d is out of range [-127, 127]", scoring[i]);
+            return -1;
+        }
+    }
+    if (scoring[SCORING_GAPO] < 0 || scoring[SCORING_GAPO] > 255 || scoring[SCORING_GAPE] < 0 || scoring[SCORING_GAPE] > 255) {
+        LogError("Gap penalties must be in range [0, 255]");
+        return -1;
+    }
 
     string str_zmq_port = parser.value("zmq-pub-port");
     LogInfo("Platform: %s, Device: %s", strPlatformName.c_str(), strDeviceName.c_str());
@@ -139,39 +179,40 @@ int main(int argc, char* argv[])
 #endif
 
     //SWAN Execution 
-    if (strPlatformName == string("intel")) {
-        for (int r = 0; r < nRuns; r++) {
-            //SWAN-CPU Intel Intrinsic flow	
-            intelImpl(nBlocks, blkSz, nThreads, writeMatchArray, pMatchInfo.get());
-        }
-    } else {
-        if (parser.isValid("kernel-file")) {
-            strKernelFullPath += parser.value("kernel-file");
-        }
-        if (verifyMode) {
-            if (!is_file(parser.value("sample-file"))) {
-                LogError("Input sample file: %s does not exist!", parser.value("sample-file").c_str());
-                return -1;
-            }
-        }
-
-        SmithWatermanApp smithwaterman(strPlatformName, strDeviceName, idxSelectedDevice,
-            strKernelFullPath, strSampleFP, nBlocks, blkSz,
-            doubleBuffered == 0 ? false : true,
-            verifyMode == 0 ? false : true,
-            writeMatchArray == 0 ? false : true,
-            pMatchInfo.get());
-
-        // SWAN-HLS Xilinx SDAccel flow
-        bool res = smithwaterman.run(0, nRuns);
-        if (!res) {
-            LogError("An error occurred when running benchmark on device 0");
+    if (parser.isValid("kernel-file")) {
+        strKernelFullPath += parser.value("kernel-file");
+    }
+    bool streamMode = parser.isValid("read-file");
+    if (streamMode && !parser.isValid("ref-file")) {
+        LogError("Streaming reads needs a reference file, see --ref-file");
+        return -1;
+    }
+    if (verifyMode && !variableLength && !streamMode) {
+        if (!is_file(parser.value("sample-file"))) {
+            LogError("Input sample file: %s does not exist!", parser.value("sample-file").c_str());
             return -1;
         }
+    }
 
-        LogInfo("finished");
+    //SWAN-CPU Intel Intrinsic flow when the platform is intel, SWAN-HLS Xilinx SDAccel flow otherwise
+    SmithWatermanApp smithwaterman(strPlatformName, strDeviceName, idxSelectedDevice,
+        strKernelFullPath, strSampleFP, nBlocks, blkSz,
+        doubleBuffered == 0 ? false : true,
+        verifyMode == 0 ? false : true,
+        writeMatchArray == 0 ? false : true,
+        variableLength == 0 ? false : true,
+        traceback == 0 ? false : true,
+        pMatchInfo.get(), scoring, nThreads, strAlignmentFP);
+
+    bool res = streamMode ? smithwaterman.run_stream(0, parser.value("read-file"), parser.value("ref-file"))
+                          : smithwaterman.run(0, nRuns);
+    if (!res) {
+        LogError("An error occurred when running benchmark on device 0");
+        return -1;
     }
 
+    LogInfo("finished");
+
     return 0;
 }
 
@@ -34,52 +34,71 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 typedef ap_uint<2> uint2_t;
 typedef ap_uint<1> uint1_t;
 
-void simpleSW(uint2_t refSeq[MAXCOL], uint2_t readSeq[MAXROW], short *maxr, short *maxc, short *maxv){
+void simpleSW(uint2_t refSeq[MAXREFLEN], uint2_t readSeq[MAXREADLEN], short *maxr, short *maxc, short *maxv, short rows, short cols,
+    short sub[4][4], short gapOpen, short gapExtend, unsigned int *trace, int traceback){
 #pragma HLS inline region off
 	*maxv = MINVAL;
     int row, col;
-    short mat[MAXROW][MAXCOL];
-	for(col = 0; col < MAXCOL; col++){
+    /*score column of the previous ref base, overwritten row by row with the current one*/
+    short h[MAXREADLEN];
+    short e[MAXREADLEN];
+    /*direction codes of the current MAXPE column stripe, laid out as the systolic kernel writes them*/
+    unsigned int traceBuf[MAXREADLEN][TRACEWORDS];
+	for(col = 0; col < cols; col++){
 		short d = refSeq[col];
-		for(row = 0; row < MAXROW; ++row){
+		short f = 0;
+		short up = 0;   /*H[row-1][col]*/
+		short diag = 0; /*H[row-1][col-1]*/
+		int pe = col % MAXPE;
+		int shift = TRACEBITS * (pe % (MAXPE / TRACEWORDS));
+		if(traceback && pe == 0){
+			memset(traceBuf, 0, sizeof(traceBuf));
+		}
+		for(row = 0; row < rows; ++row){
 			short n, nw, w;
-			 if (row == 0){
-				 n = 0;
-			 }else{
-			     n = mat[row-1][col];
-			 }
+			 n = up;
+			 nw = diag;
 			 if(col == 0){
 				 w = 0;
+				 e[row] = 0;
 			 }else{
-				 w = mat[row][col-1];
-			 }
-
-			 if(row > 0 && col > 0){
-				 nw = mat[row-1][col-1];
-			 }else{
-				 nw = 0;
+				 w = h[row];
 			 }
+			 diag = w;
 
 			 short q = readSeq[row];
 			 short max = 0;
-			 short match = (d == q) ? MATCH : MISS_MATCH;
+			 short match = sub[d][q];
 			 short t1 = (nw + match > max) ? nw + match : max;
-			 short t2 = (n + GAP > w + GAP) ? n + GAP : w + GAP;
+			 unsigned int t = (w - gapOpen > e[row] - gapExtend) ? 0 : TRACE_EEXT;
+			 t |= (n - gapOpen > f - gapExtend) ? 0 : TRACE_FEXT;
+			 e[row] = (w - gapOpen > e[row] - gapExtend) ? w - gapOpen : e[row] - gapExtend;
+			 f = (n - gapOpen > f - gapExtend) ? n - gapOpen : f - gapExtend;
+			 short t2 = (f > e[row]) ? f : e[row];
 			 max = t1 > t2 ? t1 : t2;
-			 mat[row][col] = max;
+			 h[row] = max;
+			 up = max;
+			 t |= (t1 >= t2) ? ((nw + match > 0) ? TRACE_DIAG : TRACE_ZERO) : ((f > e[row]) ? TRACE_F : TRACE_E);
+			 if(traceback){
+				 traceBuf[row][pe / (MAXPE / TRACEWORDS)] |= t << shift;
+			 }
 			 if(max > *maxv){
 				 *maxv = max;
 				 *maxr = row;
 				 *maxc = col;
 			 }
 		}
+		if(traceback && (pe == MAXPE - 1 || col == cols - 1)){
+			memcpy(trace + (col / MAXPE)*rows*TRACEWORDS, traceBuf, UINTSZ*TRACEWORDS*rows);
+		}
 	}
 
 }
 
-void sw(uint2_t d[MAXCOL], uint2_t q[MAXROW], short *maxr, short *maxc, short *maxv){
+void sw(uint2_t d[MAXREFLEN], uint2_t q[MAXREADLEN], short *maxr, short *maxc, short *maxv, short rows, short cols,
+    short sub[4][4], short gapOpen, short gapExtend, unsigned int *trace, int traceback){
 #pragma HLS inline region off
-    	simpleSW(d, q, maxr, maxc, maxv);
+    	simpleSW(d, q, maxr, maxc, maxv, rows, cols, sub, gapOpen, gapExtend, trace, traceback);
 }
 
 template <int BUFFERSZ>
@@ -94,51 +113,92 @@ void intTo2bit(unsigned int *buffer, uint2_t *buffer2b){
 }
 
 template <int FACTOR>
-void swInt(unsigned int *readRefPacked, short *maxr, short *maxc, short *maxv){
+void swInt(unsigned int *readRefPacked, short rows, short cols, short *maxr, short *maxc, short *maxv,
+    short sub[4][4], short gapOpen, short gapExtend, unsigned int *trace, int traceback){
 #pragma HLS function_instantiate variable=maxv
-    uint2_t d2bit[MAXCOL];
-    uint2_t q2bit[MAXROW];
+    uint2_t d2bit[MAXREFLEN];
+    uint2_t q2bit[MAXREADLEN];
 #pragma HLS array partition variable=d2bit,q2bit cyclic factor=FACTOR
 
-    intTo2bit<MAXCOL/16>((readRefPacked + MAXROW/16), d2bit);
-    intTo2bit<MAXROW/16>(readRefPacked, q2bit);
-    sw(d2bit, q2bit, maxr, maxc, maxv);
+    intTo2bit<MAXREFLEN/16>((readRefPacked + MAXREADLEN/16), d2bit);
+    intTo2bit<MAXREADLEN/16>(readRefPacked, q2bit);
+    sw(d2bit, q2bit, maxr, maxc, maxv, rows, cols, sub, gapOpen, gapExtend, trace, traceback);
 }
 
-void swMaxScore(unsigned int readRefPacked[NUMPACKED][PACKEDSZ], short out[NUMPACKED][3]){
+void swMaxScore(unsigned int readRefPacked[NUMPACKED][MAXPACKEDSZ], short rows[NUMPACKED], short cols[NUMPACKED], short out[NUMPACKED][3],
+    short sub[4][4], short gapOpen, short gapExtend, unsigned int *trace, unsigned int traceOff[NUMPACKED], int traceback){
 	/*instantiate NUMPACKED PE*/
 	for(int i = 0; i < NUMPACKED;++i){
 	#pragma HLS UNROLL
-		swInt<MAXPE>(readRefPacked[i], &out[i][0], &out[i][1], &out[i][2]);
+		swInt<MAXPE>(readRefPacked[i], rows[i], cols[i], &out[i][0], &out[i][1], &out[i][2], sub, gapOpen, gapExtend,
+		    trace + traceOff[i], traceback);
 	}
 }
 //#ifndef HLS_COMPILE
 extern "C" {
 //#endif
-    void opencl_sw_maxscore(unsigned int *input, unsigned int  *output, int *size) {
+    void opencl_sw_maxscore(unsigned int *input, unsigned int  *output, int *size, int *scoring, unsigned int *trace, int traceback) {
 #pragma HLS inline region off
 #pragma HLS INTERFACE m_axi port=input offset=slave bundle=gmem 
 #pragma HLS INTERFACE m_axi port=output offset=slave bundle=gmem 
 #pragma HLS INTERFACE m_axi port=size offset=slave bundle=gmem 
+#pragma HLS INTERFACE m_axi port=scoring offset=slave bundle=gmem 
+#pragma HLS INTERFACE m_axi port=trace offset=slave bundle=gmem1
 #pragma HLS INTERFACE s_axilite port=input bundle=control
 #pragma HLS INTERFACE s_axilite port=output bundle=control
 #pragma HLS INTERFACE s_axilite port=size bundle=control
+#pragma HLS INTERFACE s_axilite port=scoring bundle=control
+#pragma HLS INTERFACE s_axilite port=trace bundle=control
+#pragma HLS INTERFACE s_axilite port=traceback bundle=control
 #pragma HLS INTERFACE s_axilite port=return bundle=control
-        unsigned int inbuf[PACKEDSZ*NUMPACKED];
         unsigned int outbuf[3*NUMPACKED];
-        unsigned int readRefPacked[NUMPACKED][PACKEDSZ];
+        unsigned int header[NUMPACKED][PAIRHDRSZ];
+        unsigned int readRefPacked[NUMPACKED][MAXPACKEDSZ];
+        short rows[NUMPACKED];
+        short cols[NUMPACKED];
+        unsigned int traceOff[NUMPACKED];
         short out[NUMPACKED][3];
+        short sub[4][4];
+        short gapOpen, gapExtend;
         int numIter;
 #pragma HLS array partition variable=readRefPacked  dim=1
+#pragma HLS array partition variable=header dim=0
+#pragma HLS array partition variable=rows,cols,traceOff dim=0
 #pragma HLS array partition variable=out dim=0
+#pragma HLS array partition variable=sub complete dim=0
+        /*scoring is read once per call, the 2-bit input only reaches the ACGT block*/
+        for(int rf = 0; rf < 4; ++rf){
+            for(int rd = 0; rd < 4; ++rd){
+#pragma HLS PIPELINE
+                sub[rf][rd] = scoring[rf*SW_ALPHABET + rd];
+            }
+        }
+        gapOpen = scoring[SCORING_GAPO];
+        gapExtend = scoring[SCORING_GAPE];
         numIter = *size;
+        /*pair headers for the whole block come first, then the packed pairs*/
+        unsigned int *payload = input + PAIRHDRSZ*NUMPACKED*numIter;
+        /*direction codes of the block's pairs are packed back to back*/
+        unsigned int traceEnd = 0;
         int loop = 0;
         for(loop = 0; loop < numIter; loop++){
-            /*read from device memory to BRAM*/
-            memcpy(readRefPacked, 
-                (unsigned int *)(input + loop*PACKEDSZ*NUMPACKED),
-                UINTSZ*PACKEDSZ*NUMPACKED);
-            swMaxScore(readRefPacked, out);
+            memcpy(header,
+                (unsigned int *)(input + loop*PAIRHDRSZ*NUMPACKED),
+                UINTSZ*PAIRHDRSZ*NUMPACKED);
+            /*read from device memory to BRAM, only as many words as each pair holds*/
+            for(int i = 0; i < NUMPACKED; ++i){
+                unsigned int rdLen = PAIRREADLEN(header[i][1]);
+                unsigned int refLen = PAIRREFLEN(header[i][1]);
+                assert(rdLen <= MAXREADLEN && refLen <= MAXREFLEN);
+                rows[i] = rdLen;
+                cols[i] = refLen;
+                traceOff[i] = traceEnd;
+                traceEnd += PAIRTRACESZ(rdLen, refLen);
+                memcpy(readRefPacked[i], payload + header[i][0], UINTSZ*SEQUINTSZ(rdLen));
+                memcpy(readRefPacked[i] + MAXREADLEN/UINTNUMBP, payload + header[i][0] + SEQUINTSZ(rdLen),
+                    UINTSZ*SEQUINTSZ(refLen));
+            }
+            swMaxScore(readRefPacked, rows, cols, out, sub, gapOpen, gapExtend, trace, traceOff, traceback);
             /*PE OUT to outbuf*/
             for(int i = 0; i < NUMPACKED; ++i){
 #pragma HLS PIPELINE
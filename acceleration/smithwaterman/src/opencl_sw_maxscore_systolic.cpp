@@ -39,10 +39,20 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 typedef ap_uint<2> uint2_t;
 typedef ap_uint<1> uint1_t;
+typedef ap_uint<4> uint4_t;
 
+/*
+ * Each PE owns one column of the current stripe. Besides the score of the cell
+ * it keeps the Gotoh gap states: e (gap along the reference, fed to the next PE
+ * in the same row) and f (gap along the read, carried to the next row), and the
+ * traceback code t of the cell (see sw.h).
+ */
 typedef struct _pe{
     short d;
     short p;
+    short e;
+    short f;
+    uint4_t t;
 }pe;
 
 void initPE(pe *pex){
@@ -50,6 +60,9 @@ void initPE(pe *pex){
 	for(int i = 0; i < MAXPE; i++){
 		pex[i].d = 0;
 		pex[i].p = 0;
+		pex[i].e = 0;
+		pex[i].f = 0;
+		pex[i].t = TRACE_ZERO;
 	}
 }
 
@@ -59,18 +72,30 @@ static short  colIter = 0;
 #endif
 
 
-void updatePE(pe *pex, uint2_t d, uint2_t q, short n, short nw, short w, short r, short c){
+void updatePE(pe *pex, uint2_t d, uint2_t q, short n, short nw, short w, short ew, short nf,
+    short sub[4][4], short gapOpen, short gapExtend, short r, short c){
 #pragma HLS PIPELINE
     short max = 0;
-    short match = (d == q) ? MATCH : MISS_MATCH;
+    short match = sub[d][q];
     short x1 = nw+match;
     short t1 = (x1 > max) ? x1 : max;
-    short x2 = w+GAP;
+    short eo = w - gapOpen;
+    short ee = ew - gapExtend;
+    short x2 = (eo > ee) ? eo : ee;
     short t2 = (x2 > t1 ) ? x2 : t1;
-    short x3 = n+GAP;
+    short fo = n - gapOpen;
+    short fe = nf - gapExtend;
+    short x3 = (fo > fe) ? fo : fe;
     max = (x3 > t2) ? x3 : t2;
+    /*same tie order as the max: diagonal, then e, then f*/
+    unsigned int t = (x3 > t2) ? TRACE_F : (x2 > t1) ? TRACE_E : (x1 > 0) ? TRACE_DIAG : TRACE_ZERO;
+    if (!(eo > ee)) t |= TRACE_EEXT;
+    if (!(fo > fe)) t |= TRACE_FEXT;
     pex->p = max;
     pex->d = n;
+    pex->e = x2;
+    pex->f = x3;
+    pex->t = t;
 #ifdef _COMPUTE_FULL_MATRIX
     localMat[r][colIter*MAXPE + c] = max;
 #endif
@@ -78,47 +103,56 @@ void updatePE(pe *pex, uint2_t d, uint2_t q, short n, short nw, short w, short r
 }
 
 
-void executePE(short r,short c,pe *pex, pe*ppex, uint2_t *d, uint2_t *q){
+void executePE(short r,short c,pe *pex, pe*ppex, uint2_t *d, uint2_t *q,
+    short sub[4][4], short gapOpen, short gapExtend){
 #pragma HLS PIPELINE
-    short nw, w, n;
+    short nw, w, n, nf, ew;
 
     if (r == 0){
         n = 0;
         nw = 0;
+        nf = 0;
     }else{
         n = pex->p;
         nw = ppex->d;
+        nf = pex->f;
     }
     w = ppex->p;
+    ew = ppex->e;
     uint2_t d1 = d[c];
     uint2_t q1 = q[r];
-    updatePE(pex, d1, q1, n, nw, w, r, c);
+    updatePE(pex, d1, q1, n, nw, w, ew, nf, sub, gapOpen, gapExtend, r, c);
 }
 
-void executeFirstPE(short r,short c,pe *p, uint2_t *d, uint2_t *q, short nw, short w){
+void executeFirstPE(short r,short c,pe *p, uint2_t *d, uint2_t *q, short nw, short w, short ew,
+    short sub[4][4], short gapOpen, short gapExtend){
 #pragma HLS PIPELINE
-    short  n;
+    short  n, nf;
     if (r == 0){
         n = 0;
+        nf = 0;
     }else{
         n = p->p;
-
+        nf = p->f;
     }
     uint2_t d1 = d[c];
     uint2_t q1 = q[r];
-    updatePE(p, d1, q1, n, nw, w, r, c);
+    updatePE(p, d1, q1, n, nw, w, ew, nf, sub, gapOpen, gapExtend, r, c);
 }
 
 template <int FACTOR>
-void swCoreB(uint2_t *d, uint2_t *q, short *maxr, short *maxc, short *maxv, short *iterB, pe *myPE, short stripe, short rows){
+void swCoreB(uint2_t *d, uint2_t *q, short *maxr, short *maxc, short *maxv, short *iterB, short *iterE, pe *myPE, short stripe, short rows, short cols,
+    short sub[4][4], short gapOpen, short gapExtend, unsigned int traceBuf[MAXREADLEN][TRACEWORDS], int traceback){
 #pragma HLS inline
 #pragma HLS array partition variable=d cyclic factor=FACTOR
 	int i, loop;
     short w = 0; // Initial condition at the start of a row
+    short validPE = cols - stripe*MAXPE; // PEs past the end of the ref only see padding
     d+= stripe*MAXPE;
 	initPE(myPE);
     for(loop = 0; loop < rows; ++loop){
 #pragma HLS PIPELINE
+#pragma HLS LOOP_TRIPCOUNT min=75 max=512
         short rowmaxv = MINVAL;
         short rowmaxpe = 0;
         for(i = 0; i < MAXPE; i++){
@@ -126,14 +160,16 @@ void swCoreB(uint2_t *d, uint2_t *q, short *maxr, short *maxc, short *maxv, shor
             if(i == 0){
                 short nw = w;
                 w = (stripe == 0) ? 0 : iterB[loop];
-                executeFirstPE(loop,i,&myPE[i], d, q, nw, w);
+                short ew = (stripe == 0) ? 0 : iterE[loop];
+                executeFirstPE(loop,i,&myPE[i], d, q, nw, w, ew, sub, gapOpen, gapExtend);
             }else{
-                executePE(loop,i,&myPE[i], &myPE[i-1], d, q);
+                executePE(loop,i,&myPE[i], &myPE[i-1], d, q, sub, gapOpen, gapExtend);
             }
 			if(i == MAXPE-1){
                 iterB[loop] = myPE[i].p;
+                iterE[loop] = myPE[i].e;
 			}
-            if (myPE[i].p > rowmaxv){
+            if (i < validPE && myPE[i].p > rowmaxv){
                 rowmaxv = myPE[i].p;
                 rowmaxpe = i;
             }
@@ -144,80 +180,55 @@ void swCoreB(uint2_t *d, uint2_t *q, short *maxr, short *maxc, short *maxv, shor
             *maxc = rowmaxpe + stripe*MAXPE; // log2(MAXPE);
             *maxr = loop;
         }
+        if (traceback){
+            for(int tw = 0; tw < TRACEWORDS; ++tw){
+                unsigned int word = 0;
+                for(int k = 0; k < MAXPE/TRACEWORDS; ++k){
+                    word |= ((unsigned int)myPE[tw*(MAXPE/TRACEWORDS) + k].t) << (TRACEBITS*k);
+                }
+                traceBuf[loop][tw] = word;
+            }
+        }
     }
 }
 
 /*Only columns*/
-void swSystolicBlocking(uint2_t d[MAXCOL], uint2_t q[MAXROW], short *maxr, short *maxc, short *maxv, short rows, short cols){
+void swSystolicBlocking(uint2_t d[MAXREFLEN], uint2_t q[MAXREADLEN], short *maxr, short *maxc, short *maxv, short rows, short cols,
+    short sub[4][4], short gapOpen, short gapExtend, unsigned int *trace, int traceback){
 pe  myPE[MAXPE];
-short iterB[MAXROW];
+short iterB[MAXREADLEN];
+short iterE[MAXREADLEN];
+unsigned int traceBuf[MAXREADLEN][TRACEWORDS];
 #pragma HLS inline 
 #pragma HLS RESOURCE variable=iterB core=RAM_S2P_LUTRAM
+#pragma HLS RESOURCE variable=iterE core=RAM_S2P_LUTRAM
 #pragma HLS RESOURCE variable=q core=RAM_S2P_LUTRAM
 	*maxc = MINVAL;
 	*maxv = MINVAL;
 	*maxr = MINVAL;
-    short stripes = MAXCOL / MAXPE;
-    assert(stripes <= (MAXCOL+MAXPE-1)/MAXPE);
-    assert(rows <= MAXROW);
+    short stripes = (cols + MAXPE - 1) / MAXPE;
+    assert(stripes <= (MAXREFLEN+MAXPE-1)/MAXPE);
+    assert(rows <= MAXREADLEN);
 #pragma HLS array partition variable=myPE
+#pragma HLS array partition variable=traceBuf complete dim=2
 	for(short stripe = 0; stripe < stripes; stripe = stripe + 1){
+#pragma HLS LOOP_TRIPCOUNT min=4 max=32
 #ifdef _COMPUTE_FULL_MATRIX
 		colIter = stripe;
 #endif
-        swCoreB<MAXPE>(d, q, maxr, maxc, maxv, iterB, myPE, stripe, rows);
-	}
-
-}
-
-
-void simpleSW(uint2_t refSeq[MAXCOL], uint2_t readSeq[MAXROW], short *maxr, short *maxc, short *maxv){
-#pragma HLS inline region off
-	*maxv = MINVAL;
-    int row, col;
-    short mat[MAXROW][MAXCOL];
-	for(col = 0; col < MAXCOL; col++){
-		short d = refSeq[col];
-		for(row = 0; row < MAXROW; ++row){
-			short n, nw, w;
-			 if (row == 0){
-				 n = 0;
-			 }else{
-			     n = mat[row-1][col];
-			 }
-			 if(col == 0){
-				 w = 0;
-			 }else{
-				 w = mat[row][col-1];
-			 }
-
-			 if(row > 0 && col > 0){
-				 nw = mat[row-1][col-1];
-			 }else{
-				 nw = 0;
-			 }
-
-			 short q = readSeq[row];
-			 short max = 0;
-			 short match = (d == q) ? MATCH : MISS_MATCH;
-			 short t1 = (nw + match > max) ? nw + match : max;
-			 short t2 = (n + GAP > w + GAP) ? n + GAP : w + GAP;
-			 max = t1 > t2 ? t1 : t2;
-			 mat[row][col] = max;
-			 if(max > *maxv){
-				 *maxv = max;
-				 *maxr = row;
-				 *maxc = col;
-			 }
-		}
+        swCoreB<MAXPE>(d, q, maxr, maxc, maxv, iterB, iterE, myPE, stripe, rows, cols, sub, gapOpen, gapExtend, traceBuf, traceback);
+        /*the stripe's direction codes to device memory*/
+        if (traceback){
+            memcpy(trace + stripe*rows*TRACEWORDS, traceBuf, UINTSZ*TRACEWORDS*rows);
+        }
 	}
 
-
 }
 
-void sw(uint2_t d[MAXCOL], uint2_t q[MAXROW], short *maxr, short *maxc, short *maxv){
+void sw(uint2_t d[MAXREFLEN], uint2_t q[MAXREADLEN], short *maxr, short *maxc, short *maxv, short rows, short cols,
+    short sub[4][4], short gapOpen, short gapExtend, unsigned int *trace, int traceback){
 #pragma HLS inline region off
-	swSystolicBlocking(d, q, maxr, maxc, maxv, MAXROW, MAXCOL);
+	swSystolicBlocking(d, q, maxr, maxc, maxv, rows, cols, sub, gapOpen, gapExtend, trace, traceback);
 }
 
 template <int BUFFERSZ>
@@ -232,51 +243,92 @@ void intTo2bit(unsigned int *buffer, uint2_t *buffer2b){
 }
 
 template <int FACTOR>
-void swInt(unsigned int *readRefPacked, short *maxr, short *maxc, short *maxv){
+void swInt(unsigned int *readRefPacked, short rows, short cols, short *maxr, short *maxc, short *maxv,
+    short sub[4][4], short gapOpen, short gapExtend, unsigned int *trace, int traceback){
 #pragma HLS function_instantiate variable=maxv
-    uint2_t d2bit[MAXCOL];
-    uint2_t q2bit[MAXROW];
+    uint2_t d2bit[MAXREFLEN];
+    uint2_t q2bit[MAXREADLEN];
 #pragma HLS array partition variable=d2bit,q2bit cyclic factor=FACTOR
 
-    intTo2bit<MAXCOL/16>((readRefPacked + MAXROW/16), d2bit);
-    intTo2bit<MAXROW/16>(readRefPacked, q2bit);
-    sw(d2bit, q2bit, maxr, maxc, maxv);
+    intTo2bit<MAXREFLEN/16>((readRefPacked + MAXREADLEN/16), d2bit);
+    intTo2bit<MAXREADLEN/16>(readRefPacked, q2bit);
+    sw(d2bit, q2bit, maxr, maxc, maxv, rows, cols, sub, gapOpen, gapExtend, trace, traceback);
 }
 
-void swMaxScore(unsigned int readRefPacked[NUMPACKED][PACKEDSZ], short out[NUMPACKED][3]){
+void swMaxScore(unsigned int readRefPacked[NUMPACKED][MAXPACKEDSZ], short rows[NUMPACKED], short cols[NUMPACKED], short out[NUMPACKED][3],
+    short sub[4][4], short gapOpen, short gapExtend, unsigned int *trace, unsigned int traceOff[NUMPACKED], int traceback){
 	/*instantiate NUMPACKED PE*/
 	for(int i = 0; i < NUMPACKED;++i){
 	#pragma HLS UNROLL
-		swInt<MAXPE>(readRefPacked[i], &out[i][0], &out[i][1], &out[i][2]);
+		swInt<MAXPE>(readRefPacked[i], rows[i], cols[i], &out[i][0], &out[i][1], &out[i][2], sub, gapOpen, gapExtend,
+		    trace + traceOff[i], traceback);
 	}
 }
 //#ifndef HLS_COMPILE
 extern "C" {
 //#endif
-    void opencl_sw_maxscore(unsigned int *input, unsigned int  *output, int *size) {
+    void opencl_sw_maxscore(unsigned int *input, unsigned int  *output, int *size, int *scoring, unsigned int *trace, int traceback) {
 #pragma HLS inline region off
 #pragma HLS INTERFACE m_axi port=input offset=slave bundle=gmem 
 #pragma HLS INTERFACE m_axi port=output offset=slave bundle=gmem 
 #pragma HLS INTERFACE m_axi port=size offset=slave bundle=gmem 
+#pragma HLS INTERFACE m_axi port=scoring offset=slave bundle=gmem 
+#pragma HLS INTERFACE m_axi port=trace offset=slave bundle=gmem1
 #pragma HLS INTERFACE s_axilite port=input bundle=control
 #pragma HLS INTERFACE s_axilite port=output bundle=control
 #pragma HLS INTERFACE s_axilite port=size bundle=control
+#pragma HLS INTERFACE s_axilite port=scoring bundle=control
+#pragma HLS INTERFACE s_axilite port=trace bundle=control
+#pragma HLS INTERFACE s_axilite port=traceback bundle=control
 #pragma HLS INTERFACE s_axilite port=return bundle=control
-        unsigned int inbuf[PACKEDSZ*NUMPACKED];
         unsigned int outbuf[3*NUMPACKED];
-        unsigned int readRefPacked[NUMPACKED][PACKEDSZ];
+        unsigned int header[NUMPACKED][PAIRHDRSZ];
+        unsigned int readRefPacked[NUMPACKED][MAXPACKEDSZ];
+        short rows[NUMPACKED];
+        short cols[NUMPACKED];
+        unsigned int traceOff[NUMPACKED];
         short out[NUMPACKED][3];
+        short sub[4][4];
+        short gapOpen, gapExtend;
         int numIter;
 #pragma HLS array partition variable=readRefPacked  dim=1
+#pragma HLS array partition variable=header dim=0
+#pragma HLS array partition variable=rows,cols,traceOff dim=0
 #pragma HLS array partition variable=out dim=0
+#pragma HLS array partition variable=sub complete dim=0
+        /*scoring is read once per call, the 2-bit input only reaches the ACGT block*/
+        for(int rf = 0; rf < 4; ++rf){
+            for(int rd = 0; rd < 4; ++rd){
+#pragma HLS PIPELINE
+                sub[rf][rd] = scoring[rf*SW_ALPHABET + rd];
+            }
+        }
+        gapOpen = scoring[SCORING_GAPO];
+        gapExtend = scoring[SCORING_GAPE];
         numIter = *size;
+        /*pair headers for the whole block come first, then the packed pairs*/
+        unsigned int *payload = input + PAIRHDRSZ*NUMPACKED*numIter;
+        /*direction codes of the block's pairs are packed back to back*/
+        unsigned int traceEnd = 0;
         int loop = 0;
         for(loop = 0; loop < numIter; loop++){
-            /*read from device memory to BRAM*/
-            memcpy(readRefPacked, 
-                (unsigned int *)(input + loop*PACKEDSZ*NUMPACKED),
-                UINTSZ*PACKEDSZ*NUMPACKED);
-            swMaxScore(readRefPacked, out);
+            memcpy(header,
+                (unsigned int *)(input + loop*PAIRHDRSZ*NUMPACKED),
+                UINTSZ*PAIRHDRSZ*NUMPACKED);
+            /*read from device memory to BRAM, only as many words as each pair holds*/
+            for(int i = 0; i < NUMPACKED; ++i){
+                unsigned int rdLen = PAIRREADLEN(header[i][1]);
+                unsigned int refLen = PAIRREFLEN(header[i][1]);
+                assert(rdLen <= MAXREADLEN && refLen <= MAXREFLEN);
+                rows[i] = rdLen;
+                cols[i] = refLen;
+                traceOff[i] = traceEnd;
+                traceEnd += PAIRTRACESZ(rdLen, refLen);
+                memcpy(readRefPacked[i], payload + header[i][0], UINTSZ*SEQUINTSZ(rdLen));
+                memcpy(readRefPacked[i] + MAXREADLEN/UINTNUMBP, payload + header[i][0] + SEQUINTSZ(rdLen),
+                    UINTSZ*SEQUINTSZ(refLen));
+            }
+            swMaxScore(readRefPacked, rows, cols, out, sub, gapOpen, gapExtend, trace, traceOff, traceback);
             /*PE OUT to outbuf*/
             for(int i = 0; i < NUMPACKED; ++i){
 #pragma HLS PIPELINE
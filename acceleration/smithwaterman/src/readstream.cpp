@@ -0,0 +1,266 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+#include <chrono>
+#include "readstream.h"
+#include "logger.h"
+#include "sw.h"
+#include "intel/kseq.h"
+
+KSEQ_INIT(gzFile, gzread)
+
+using namespace sda;
+
+static double elapsedMs(const chrono::steady_clock::time_point& start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+//2-bit packs a sequence the way uintTouint2Array unpacks it, counting non-ACGT bases
+static void packSeq(const char* seq, int len, unsigned int* packed, long* ambiguous)
+{
+    memset(packed, 0, UINTSZ * SEQUINTSZ(len));
+    for (int i = 0; i < len; ++i) {
+        unsigned int code;
+        switch (seq[i]) {
+        case 'A': case 'a': code = 0; break;
+        case 'C': case 'c': code = 1; break;
+        case 'G': case 'g': code = 2; break;
+        case 'T': case 't': code = 3; break;
+        default: code = 0; (*ambiguous)++; break;
+        }
+        packed[i / UINTNUMBP] |= code << (BPSZ * (i % UINTNUMBP));
+    }
+}
+
+ReadRefStream::ReadRefStream(const string& strReadFP, const string& strRefFP, int blockPairs, int numBlocks, int depth)
+{
+    m_strReadFP = strReadFP;
+    m_strRefFP = strRefFP;
+    m_blockPairs = blockPairs;
+    m_numBlocks = numBlocks;
+    //every block can hold blockPairs of the longest pairs
+    m_blockInts = PAIRHDRSZ * blockPairs + MAXPACKEDSZ * blockPairs;
+    m_done = false;
+    m_stop = false;
+    m_records = 0;
+    m_skipped = 0;
+    m_ambiguous = 0;
+    m_parseMs = 0;
+    m_stallMs = 0;
+
+    //depth chunks queued ahead plus the one being scored
+    for (int i = 0; i < depth + 1; ++i) {
+        PairChunk* chunk = new PairChunk;
+        chunk->data = new unsigned int[(size_t)m_blockInts * numBlocks];
+        chunk->numPairs = 0;
+        m_pool.push_back(chunk);
+        m_free.push_back(chunk);
+    }
+}
+
+ReadRefStream::~ReadRefStream()
+{
+    if (m_producer.joinable()) {
+        //stop a producer that is still ahead of a consumer that left early
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        m_producer.join();
+    }
+    for (size_t i = 0; i < m_pool.size(); ++i) {
+        delete[] m_pool[i]->data;
+        delete m_pool[i];
+    }
+}
+
+bool ReadRefStream::start()
+{
+    gzFile fp = gzopen(m_strReadFP.c_str(), "r");
+    if (fp == NULL) {
+        LogError("Unable to open read file: [%s]", m_strReadFP.c_str());
+        return false;
+    }
+    gzclose(fp);
+    fp = gzopen(m_strRefFP.c_str(), "r");
+    if (fp == NULL) {
+        LogError("Unable to open reference file: [%s]", m_strRefFP.c_str());
+        return false;
+    }
+    gzclose(fp);
+
+    m_producer = thread(&ReadRefStream::produce, this);
+    return true;
+}
+
+PairChunk* ReadRefStream::pop()
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    unique_lock<mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return !m_full.empty() || m_done; });
+    m_stallMs += elapsedMs(start);
+    if (m_full.empty()) {
+        return NULL;
+    }
+    PairChunk* chunk = m_full.front();
+    m_full.pop_front();
+    return chunk;
+}
+
+void ReadRefStream::recycle(PairChunk* chunk)
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_free.push_back(chunk);
+    }
+    m_cv.notify_all();
+}
+
+void ReadRefStream::push(PairChunk* chunk)
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_full.push_back(chunk);
+    }
+    m_cv.notify_all();
+}
+
+//NULL once the consumer is gone
+PairChunk* ReadRefStream::acquire()
+{
+    unique_lock<mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return !m_free.empty() || m_stop; });
+    if (m_stop) {
+        return NULL;
+    }
+    PairChunk* chunk = m_free.front();
+    m_free.pop_front();
+    chunk->numPairs = 0;
+    chunk->names.clear();
+    return chunk;
+}
+
+void ReadRefStream::produce()
+{
+    gzFile rdFp = gzopen(m_strReadFP.c_str(), "r");
+    gzFile rfFp = gzopen(m_strRefFP.c_str(), "r");
+    kseq_t* rd = kseq_init(rdFp);
+    kseq_t* rf = kseq_init(rfFp);
+
+    //a reference file with a single record is shared by all reads
+    string firstRef;
+    bool sharedRef = false;
+    if (kseq_read(rf) >= 0) {
+        firstRef.assign(rf->seq.s, rf->seq.l);
+        sharedRef = (kseq_read(rf) < 0);
+    }
+    bool nextRef = true; //rf holds the reference of the second read
+
+    int chunkPairs = m_blockPairs * m_numBlocks;
+    unsigned int pos = 0;
+    PairChunk* chunk = acquire();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    while (chunk && !firstRef.empty() && kseq_read(rd) >= 0) {
+        const char* refSeq;
+        int refLen;
+        if (m_records == 0 || sharedRef) {
+            refSeq = firstRef.c_str();
+            refLen = (int)firstRef.size();
+        }
+        else {
+            if (!nextRef && kseq_read(rf) < 0) {
+                LogWarn("Reference file ends before the read file, stopping after %ld pairs", m_records);
+                break;
+            }
+            nextRef = false;
+            refSeq = rf->seq.s;
+            refLen = (int)rf->seq.l;
+        }
+        m_records++;
+
+        int rdLen = (int)rd->seq.l;
+        if (rdLen == 0 || rdLen > MAXREADLEN || refLen == 0 || refLen > MAXREFLEN) {
+            m_skipped++;
+            continue;
+        }
+
+        int slot = chunk->numPairs % m_blockPairs;
+        unsigned int* header = chunk->data + (size_t)m_blockInts * (chunk->numPairs / m_blockPairs);
+        unsigned int* payload = header + PAIRHDRSZ * m_blockPairs;
+        if (slot == 0) {
+            pos = 0;
+        }
+        header[PAIRHDRSZ * slot] = pos;
+        header[PAIRHDRSZ * slot + 1] = PAIRLENS(rdLen, refLen);
+        packSeq(rd->seq.s, rdLen, payload + pos, &m_ambiguous);
+        pos += SEQUINTSZ(rdLen);
+        packSeq(refSeq, refLen, payload + pos, &m_ambiguous);
+        pos += SEQUINTSZ(refLen);
+        chunk->names.push_back(string(rd->name.s, rd->name.l));
+
+        if (++chunk->numPairs == chunkPairs) {
+            m_parseMs += elapsedMs(start);
+            push(chunk);
+            chunk = acquire();
+            start = chrono::steady_clock::now();
+        }
+    }
+
+    //pad the last chunk with empty pairs
+    if (chunk && chunk->numPairs > 0) {
+        for (int i = chunk->numPairs; i < chunkPairs; ++i) {
+            unsigned int* header = chunk->data + (size_t)m_blockInts * (i / m_blockPairs);
+            header[PAIRHDRSZ * (i % m_blockPairs)] = 0;
+            header[PAIRHDRSZ * (i % m_blockPairs) + 1] = PAIRLENS(0, 0);
+        }
+        m_parseMs += elapsedMs(start);
+        push(chunk);
+    }
+    else if (chunk) {
+        recycle(chunk);
+    }
+    if (firstRef.empty()) {
+        LogError("No reference record in [%s]", m_strRefFP.c_str());
+    }
+
+    kseq_destroy(rd);
+    kseq_destroy(rf);
+    gzclose(rdFp);
+    gzclose(rfFp);
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_cv.notify_all();
+}
@@ -0,0 +1,103 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+
+#ifndef __READ_STREAM__
+#define __READ_STREAM__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+/*!
+ * numBlocks kernel blocks of read-ref pairs packed from FASTQ/FASTA files, in
+ * the block layout of sw.h with every block blockInts uints apart. Pairs past
+ * numPairs are empty (zero length) padding of the last chunk.
+ */
+struct PairChunk {
+    unsigned int* data;
+    int numPairs;
+    vector<string> names;
+};
+
+/*!
+ * Parses reads and references with kseq (plain or gzip'd FASTQ/FASTA) on a
+ * producer thread and 2-bit packs them into PairChunks. Read i is paired with
+ * reference record i, or with the only record when the reference file holds
+ * one. The producer runs at most depth chunks ahead of the consumer.
+ */
+class ReadRefStream {
+public:
+    ReadRefStream(const string& strReadFP, const string& strRefFP, int blockPairs, int numBlocks, int depth);
+    ~ReadRefStream();
+
+    bool start();
+    PairChunk* pop(); //next chunk in file order, NULL at the end of the stream
+    void recycle(PairChunk* chunk);
+
+    int blockInts() const { return m_blockInts; }
+
+    long records() const { return m_records; }
+    long skipped() const { return m_skipped; }
+    long ambiguous() const { return m_ambiguous; }
+    double parseMs() const { return m_parseMs; }
+    double stallMs() const { return m_stallMs; }
+
+private:
+    void produce();
+    void push(PairChunk* chunk);
+    PairChunk* acquire();
+
+    string m_strReadFP;
+    string m_strRefFP;
+    int m_blockPairs;
+    int m_numBlocks;
+    int m_blockInts;
+
+    vector<PairChunk*> m_pool;
+    deque<PairChunk*> m_free;
+    deque<PairChunk*> m_full;
+    bool m_done; //the producer has queued its last chunk
+    bool m_stop; //the consumer is gone
+    mutex m_mutex;
+    condition_variable m_cv;
+    thread m_producer;
+
+    long m_records; //pairs read from the files
+    long m_skipped; //pairs longer than the kernel accepts
+    long m_ambiguous; //bases other than ACGT, packed as A
+    double m_parseMs; //producer time spent parsing and packing
+    double m_stallMs; //consumer time spent waiting for a chunk
+};
+
+#endif
@@ -29,9 +29,14 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
+#include <omp.h>
+#include <map>
+#include <vector>
 #include "smithwaterman.h"
+#include "readstream.h"
 #include "logger.h"
 #include "sw.h"
+#include "intel/ssw.h"
 
 #if defined(__linux__) || defined(linux)
 	#include "sys/time.h"
@@ -49,7 +54,19 @@ typedef struct _eventLog {
 using namespace sda;
 using namespace sda::cl;
 
-unsigned int* generatePackedNReadRefPair(int N, int readSize, int refSize, unsigned int** maxVal, int computeOutput = 1);
+//profiler stage of each EvBreakDown event
+static const char* g_evtNames[SmithWatermanApp::evtCount] = { "host write", "kernel exec", "host read" };
+
+unsigned int* generatePackedNReadRefPair(int N, int readSize, int refSize, unsigned int** maxVal, int computeOutput = 1, const int* scoring = NULL);
+void computePackedNReadRefPair(int N, int readSize, int refSize, unsigned int* pairs, unsigned int* maxVal, const int* scoring);
+void uintTouint2Array(int bufferSz, unsigned int* buffer, short* buffer2b);
+unsigned int* generateVarReadRefPairs(int N, unsigned int* lens, unsigned int* offsets);
+void computeVarReadRefPairs(int N, unsigned int* pairs, unsigned int* lens, unsigned int* offsets, unsigned int* maxVal, const int* scoring);
+void sortPairsByCost(int N, unsigned int* lens, int* order);
+int packReadRefBatch(int N, int blockPairs, unsigned int* pairs, unsigned int* lens, unsigned int* offsets, int* order, unsigned int** batch);
+
+//read-ref pairs checked against intel/ssw.c per scoring scheme
+#define UNIT_TEST_PAIRS 32
 
 /////////////////////////////////////////////////////////////////////////////////
 static double timestamp() {
@@ -66,16 +83,6 @@ static double timestamp() {
 	return ms;
 }
 
-static double computeEventDurationInMS(const cl_event& event) {
-	cl_ulong ts_start = 0, ts_end = 0;
-	double duration = 0;
-	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ts_start, NULL);
-	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ts_end, NULL);
-	duration += (cl_double)(ts_end-ts_start)*(cl_double)(1e-06);
-
-	return duration;
-}
-
 static int getToken(FILE* fp, char* tok)
 {
     int pos = 0;
@@ -179,7 +186,12 @@ SmithWatermanApp::SmithWatermanApp(const string& vendor_name,
     const bool doubleBuffered,
     const bool verifyMode,
     const bool writeMatchArray,
-    MatchArray* pm)
+    const bool variableLength,
+    const bool traceback,
+    MatchArray* pm,
+    const int* scoring,
+    const int cpuThreads,
+    const string& strAlignmentFP)
     
 {
     //store path to input bitmap
@@ -191,6 +203,36 @@ SmithWatermanApp::SmithWatermanApp(const string& vendor_name,
     m_verifyMode = verifyMode;
     m_pMatchInfo = pm;
     m_writeMatchArray = writeMatchArray;
+    m_variableLength = variableLength;
+    if (m_variableLength && m_writeMatchArray) {
+        LogWarn("The match array holds MAXROW x MAXCOL pairs only, not writing it for variable length pairs");
+        m_writeMatchArray = false;
+    }
+    m_traceback = traceback;
+    m_strAlignmentFP = strAlignmentFP;
+    if (m_traceback && vendor_name == string("intel")) {
+        LogWarn("Traceback reads the direction codes of the FPGA kernel, not running it with the SSW engine");
+        m_traceback = false;
+    }
+    m_traceSz = 0;
+    m_traceMs = 0;
+    m_alignments = NULL;
+    if (scoring) {
+        memcpy(m_scoring, scoring, sizeof(m_scoring));
+    }
+    else {
+        initScoring(m_scoring, MATCH, MISS_MATCH, GAP_OPEN, GAP_EXTEND);
+    }
+
+    //the intel platform scores on the host with the SSW engine
+    m_useCpu = (vendor_name == string("intel"));
+    m_cpuThreads = (cpuThreads < 1) ? 1 : cpuThreads;
+    m_cpuExecMs = 0;
+    if (m_useCpu) {
+        m_program = NULL;
+        m_clKernelSmithWaterman = NULL;
+        return;
+    }
 
     m_world = xcl_world_single();
 
@@ -202,19 +244,282 @@ SmithWatermanApp::SmithWatermanApp(const string& vendor_name,
 
 SmithWatermanApp::~SmithWatermanApp()
 {
+    if (m_useCpu) {
+        return;
+    }
     clReleaseKernel(m_clKernelSmithWaterman);
     clReleaseProgram(m_program);
     xcl_release_world(m_world);
 }
 
-bool SmithWatermanApp::unit_test_kernel_cpu()
+/*!
+ * Scores one packed pair with the striped SSW library. maxr/maxc are the read
+ * and ref end positions of the best alignment, as returned by the kernel.
+ */
+static bool ssw_score_pair(unsigned int* pair, int rdLen, int refLen, const int8_t* mat, const int* scoring,
+    unsigned int* maxr, unsigned int* maxc, unsigned int* maxv)
+{
+    short seq[SEQUINTSZ(MAXREFLEN) * UINTNUMBP];
+    int8_t readNum[MAXREADLEN];
+    int8_t refNum[MAXREFLEN];
+    uintTouint2Array(SEQUINTSZ(rdLen), pair, seq);
+    for (int j = 0; j < rdLen; ++j) {
+        readNum[j] = (int8_t)seq[j];
+    }
+    uintTouint2Array(SEQUINTSZ(refLen), pair + SEQUINTSZ(rdLen), seq);
+    for (int j = 0; j < refLen; ++j) {
+        refNum[j] = (int8_t)seq[j];
+    }
+
+    //below 15 SSW skips the suboptimal score and warns on every call
+    int maskLen = (rdLen / 2 < 15) ? 15 : rdLen / 2;
+    float cups = 0;
+    s_profile* prof = ssw_init(readNum, rdLen, mat, SW_ALPHABET, 2);
+    s_align* res = ssw_align(prof, refNum, refLen, scoring[SCORING_GAPO], scoring[SCORING_GAPE],
+        0, 0, 0, maskLen, &cups, maxr, maxc, maxv);
+    init_destroy(prof);
+    if (res == NULL) {
+        return false;
+    }
+    align_destroy(res);
+    return true;
+}
+
+/*!
+ * Rebuilds the alignment ending at the kernel's max score position from the
+ * direction codes of one pair, see TRACEBITS in sw.h for their layout.
+ */
+static bool trace_pair(const unsigned int* trace, int rdLen, int refLen, const unsigned int* out, SwAlignment* aln)
+{
+    char ops[MAXREADLEN + MAXREFLEN];
+    int nops = 0;
+    int r = out[0];
+    int c = out[1];
+    aln->cigar.clear();
+    aln->rdStart = 0;
+    aln->refStart = 0;
+    if (out[2] == 0) {
+        return true; //nothing scored above zero, no alignment
+    }
+    if (r < 0 || r >= rdLen || c < 0 || c >= refLen) {
+        return false;
+    }
+
+    int state = TRACE_DIAG;
+    while (r >= 0 && c >= 0) {
+        unsigned int word = trace[((c / MAXPE) * rdLen + r) * TRACEWORDS + (c % MAXPE) / (MAXPE / TRACEWORDS)];
+        unsigned int code = (word >> (TRACEBITS * (c % (MAXPE / TRACEWORDS)))) & ((1 << TRACEBITS) - 1);
+        if (state == TRACE_E) {
+            ops[nops++] = 'D';
+            state = (code & TRACE_EEXT) ? TRACE_E : TRACE_DIAG;
+            c--;
+        }
+        else if (state == TRACE_F) {
+            ops[nops++] = 'I';
+            state = (code & TRACE_FEXT) ? TRACE_F : TRACE_DIAG;
+            r--;
+        }
+        else if ((code & TRACE_HMASK) == TRACE_DIAG) {
+            ops[nops++] = 'M';
+            r--;
+            c--;
+        }
+        else if ((code & TRACE_HMASK) == TRACE_ZERO) {
+            break;
+        }
+        else {
+            state = code & TRACE_HMASK;
+        }
+    }
+    //a local alignment can not start inside a gap
+    if (state != TRACE_DIAG || nops == 0) {
+        return false;
+    }
+    aln->rdStart = r + 1;
+    aln->refStart = c + 1;
+
+    //ops were collected from the end, run length encode them from the start
+    for (int i = nops - 1; i >= 0;) {
+        int j = i;
+        while (j >= 0 && ops[j] == ops[i]) {
+            j--;
+        }
+        aln->cigar += to_string(i - j);
+        aln->cigar += ops[i];
+        i = j;
+    }
+    return true;
+}
+
+/*!
+ * Checks that an alignment lies within the pair, ends at the reported max
+ * position and scores the reported max score under the given scoring.
+ */
+static bool check_alignment(unsigned int* pair, int rdLen, int refLen, const unsigned int* out, const SwAlignment& aln, const int* scoring)
+{
+    if (aln.cigar.empty()) {
+        return out[2] == 0;
+    }
+    short rd[SEQUINTSZ(MAXREADLEN) * UINTNUMBP];
+    short rf[SEQUINTSZ(MAXREFLEN) * UINTNUMBP];
+    uintTouint2Array(SEQUINTSZ(rdLen), pair, rd);
+    uintTouint2Array(SEQUINTSZ(refLen), pair + SEQUINTSZ(rdLen), rf);
+
+    int score = 0;
+    int r = aln.rdStart;
+    int c = aln.refStart;
+    const char* p = aln.cigar.c_str();
+    while (*p) {
+        int n = (int)strtol(p, (char**)&p, 10);
+        char op = *p++;
+        if (n <= 0) {
+            return false;
+        }
+        if (op == 'M') {
+            if (r + n > rdLen || c + n > refLen) {
+                return false;
+            }
+            for (int k = 0; k < n; ++k, ++r, ++c) {
+                score += scoring[rf[c] * SW_ALPHABET + rd[r]];
+            }
+        }
+        else if (op == 'I' || op == 'D') {
+            score -= scoring[SCORING_GAPO] + (n - 1) * scoring[SCORING_GAPE];
+            if (op == 'I') {
+                r += n;
+            }
+            else {
+                c += n;
+            }
+        }
+        else {
+            return false;
+        }
+    }
+    return score == (int)out[2] && r - 1 == (int)out[0] && c - 1 == (int)out[1];
+}
+
+static int verify_alignments(int numSample, unsigned int* pairs, unsigned int* lens, unsigned int* offsets,
+    unsigned int* output, SwAlignment* alignments, const int* scoring)
+{
+    int fail = 0;
+    printf("Verifying traceback alignments against their max scores\n");
+    for (int i = 0; i < numSample; ++i) {
+        if (!check_alignment(pairs + offsets[i], PAIRREADLEN(lens[i]), PAIRREFLEN(lens[i]), output + 3 * i, alignments[i], scoring)) {
+            printf("Fail %d: score=%u end=%u,%u start=%u,%u cigar=%s\n", i, output[3 * i + 2], output[3 * i], output[3 * i + 1],
+                alignments[i].rdStart, alignments[i].refStart, alignments[i].cigar.c_str());
+            fail = 1;
+        }
+    }
+    if (fail) {
+        printf("Fail\n");
+    }
+    else {
+        printf("Pass\n");
+    }
+    return fail;
+}
+
+/*!
+ * One line per pair: its name (or index), score, read and ref end positions
+ * and, in traceback mode, read and ref start positions and the CIGAR (* when
+ * nothing aligned).
+ */
+static void write_results(FILE* fp, int first, int numSample, const string* names, unsigned int* output, SwAlignment* alignments)
+{
+    for (int i = 0; i < numSample; ++i) {
+        if (names) {
+            fprintf(fp, "%s", names[i].c_str());
+        }
+        else {
+            fprintf(fp, "%d", first + i);
+        }
+        fprintf(fp, "\t%u\t%u\t%u", output[3 * i + 2], output[3 * i], output[3 * i + 1]);
+        if (alignments) {
+            fprintf(fp, "\t%u\t%u\t%s", alignments[i].rdStart, alignments[i].refStart,
+                alignments[i].cigar.empty() ? "*" : alignments[i].cigar.c_str());
+        }
+        fprintf(fp, "\n");
+    }
+}
+
+//traceback uints the kernel writes for one block
+static int block_trace_ints(unsigned int* header, int blockPairs)
+{
+    int ints = 0;
+    for (int i = 0; i < blockPairs; ++i) {
+        unsigned int l = header[PAIRHDRSZ * i + 1];
+        ints += PAIRTRACESZ(PAIRREADLEN(l), PAIRREFLEN(l));
+    }
+    return ints;
+}
+
+/*!
+ * Scores packed pairs with the CPU reference and with the striped SSW library
+ * and compares the max scores. End positions are not compared since the two
+ * break ties in a different order.
+ */
+static bool compare_with_ssw(const char* name, int numPairs, unsigned int* pairs, unsigned int* lens, unsigned int* offsets, const int* scoring)
+{
+    unsigned int* maxVal = new unsigned int[3 * numPairs];
+    computeVarReadRefPairs(numPairs, pairs, lens, offsets, maxVal, scoring);
+
+    int8_t mat[SW_ALPHABET * SW_ALPHABET];
+    for (int i = 0; i < SW_ALPHABET * SW_ALPHABET; ++i) {
+        mat[i] = (int8_t)scoring[i];
+    }
+    int fail = 0;
+    for (int i = 0; i < numPairs; ++i) {
+        unsigned int maxr, maxc, maxv;
+        bool res = ssw_score_pair(pairs + offsets[i], PAIRREADLEN(lens[i]), PAIRREFLEN(lens[i]), mat, scoring, &maxr, &maxc, &maxv);
+        if (!res || maxv != maxVal[3 * i + 2]) {
+            LogError("%s: pair %d scored %u, SSW scored %u", name, i, maxVal[3 * i + 2], res ? maxv : 0);
+            fail++;
+        }
+    }
+    delete[] maxVal;
+
+    if (fail) {
+        LogError("%s: %d of %d pairs differ from SSW", name, fail, numPairs);
+        return false;
+    }
+    LogInfo("%s: %d pairs match SSW", name, numPairs);
+    return true;
+}
+
+bool SmithWatermanApp::unit_test_kernel_cpu(const int* scoring)
 {
 
     LogInfo("Start unit tests for kernels on the CPU");
 
+    unsigned int lens[UNIT_TEST_PAIRS];
+    unsigned int offsets[UNIT_TEST_PAIRS];
+    unsigned int* pairs = generateVarReadRefPairs(UNIT_TEST_PAIRS, lens, offsets);
+
+    bool res = true;
+    int sc[SCORINGSZ];
+    initScoring(sc, MATCH, MISS_MATCH, GAP_OPEN, GAP_EXTEND);
+    res &= compare_with_ssw("linear", UNIT_TEST_PAIRS, pairs, lens, offsets, sc);
+
+    //the defaults of intel/sc_demo.c
+    initScoring(sc, 2, -2, 3, 1);
+    res &= compare_with_ssw("affine", UNIT_TEST_PAIRS, pairs, lens, offsets, sc);
+
+    //transitions (A<->G, C<->T) cost less than transversions
+    initScoring(sc, 3, -3, 5, 2);
+    sc[0 * SW_ALPHABET + 2] = sc[2 * SW_ALPHABET + 0] = -1;
+    sc[1 * SW_ALPHABET + 3] = sc[3 * SW_ALPHABET + 1] = -1;
+    res &= compare_with_ssw("transition matrix", UNIT_TEST_PAIRS, pairs, lens, offsets, sc);
+
+    initScoring(sc, MATCH, MISS_MATCH, GAP_OPEN, GAP_EXTEND);
+    if (scoring && memcmp(sc, scoring, sizeof(sc))) {
+        res &= compare_with_ssw("configured", UNIT_TEST_PAIRS, pairs, lens, offsets, scoring);
+    }
+    delete[] pairs;
+
     LogInfo("End unit tests for kernels on the CPU");
 
-    return true;
+    return res;
 }
 
 /*!
@@ -251,18 +556,17 @@ bool SmithWatermanApp::invoke_kernel(
     int sz_input,
     int sz_output,
     int sz_sz,
-    cl_event events[evtCount],
-    double eTotal[evtCount])
+    cl_event events[evtCount])
 {
     if (m_useDoubleBuffered) {
-        bool res = invoke_kernel_doublebuffered(input, output, iterNum, sz_input, sz_output, sz_sz, &events[0], eTotal);
+        bool res = invoke_kernel_doublebuffered(input, output, iterNum, sz_input, sz_output, sz_sz, &events[0]);
         if (!res) {
             LogError("Failed Double Buffered SW. Test Failed");
             return false;
         }
     }
     else {
-        bool res = invoke_kernel_blocking(input, output, iterNum, sz_input, sz_output, sz_sz, &events[0], eTotal);
+        bool res = invoke_kernel_blocking(input, output, iterNum, sz_input, sz_output, sz_sz, &events[0]);
         if (!res) {
             LogError("Failed Blocked SW. Test Failed");
             return false;
@@ -272,65 +576,250 @@ bool SmithWatermanApp::invoke_kernel(
     return true;
 }
 
-bool SmithWatermanApp::invoke_kernel_blocking(
+/*!
+ * Host fallback of invoke_kernel: scores the same blocks of pair headers and
+ * packed pairs with the striped SSW library on m_cpuThreads threads and
+ * writes maxr, maxc, maxv per pair in the kernel's output layout.
+ */
+bool SmithWatermanApp::invoke_cpu(
     unsigned int* input,
     unsigned int* output,
     int* iterNum,
     int sz_input,
-    int sz_output,
-    int sz_sz,
-    cl_event events[evtCount],
-    double eTotal[evtCount])
+    int sz_output)
 {
+    int blockPairs = NUMPACKED * (*iterNum);
+    int8_t mat[SW_ALPHABET * SW_ALPHABET];
+    for (int i = 0; i < SW_ALPHABET * SW_ALPHABET; ++i) {
+        mat[i] = (int8_t)m_scoring[i];
+    }
 
-    cl_kernel kernel = m_clKernelSmithWaterman;
+    cout << "Processing " << m_numSamples << " Samples on " << m_cpuThreads << " threads\n";
+    double startMS = timestamp();
+    int fail = 0;
+    for (int iter = 0; iter < m_numBlocks; ++iter) {
+        unsigned int* header = input + iter * (sz_input / sizeof(unsigned int));
+        unsigned int* payload = header + PAIRHDRSZ * blockPairs;
+        unsigned int* out = output + iter * (sz_output / sizeof(unsigned int));
+#pragma omp parallel for schedule(dynamic, NUMPACKED) num_threads(m_cpuThreads) reduction(+ : fail)
+        for (int i = 0; i < blockPairs; ++i) {
+            unsigned int lens = header[PAIRHDRSZ * i + 1];
+            if (PAIRREADLEN(lens) == 0 || PAIRREFLEN(lens) == 0) {
+                out[3 * i] = out[3 * i + 1] = out[3 * i + 2] = 0; //stream padding
+                continue;
+            }
+            if (!ssw_score_pair(payload + header[PAIRHDRSZ * i], PAIRREADLEN(lens), PAIRREFLEN(lens), mat, m_scoring,
+                    &out[3 * i], &out[3 * i + 1], &out[3 * i + 2])) {
+                fail++;
+            }
+        }
+    }
+    m_cpuExecMs += timestamp() - startMS;
+
+    if (fail) {
+        LogError("SSW failed to score %d pairs", fail);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * Rebuilds the alignments of one kernel block from its direction codes on
+ * m_cpuThreads threads. The double buffered flow calls it while the kernel
+ * scores the next block.
+ */
+void SmithWatermanApp::traceback_block(
+    unsigned int* input,
+    unsigned int* output,
+    unsigned int* trace,
+    int blockPairs,
+    SwAlignment* alignments)
+{
+    double startMS = timestamp();
+
+    //the kernel packs the codes of the block's pairs back to back in header order
+    unsigned int* traceOff = new unsigned int[blockPairs];
+    unsigned int off = 0;
+    for (int i = 0; i < blockPairs; ++i) {
+        unsigned int lens = input[PAIRHDRSZ * i + 1];
+        traceOff[i] = off;
+        off += PAIRTRACESZ(PAIRREADLEN(lens), PAIRREFLEN(lens));
+    }
+
+    int fail = 0;
+#pragma omp parallel for schedule(dynamic, NUMPACKED) num_threads(m_cpuThreads) reduction(+ : fail)
+    for (int i = 0; i < blockPairs; ++i) {
+        unsigned int lens = input[PAIRHDRSZ * i + 1];
+        if (PAIRREADLEN(lens) == 0 || PAIRREFLEN(lens) == 0) {
+            alignments[i] = SwAlignment(); //stream padding
+            continue;
+        }
+        if (!trace_pair(trace + traceOff[i], PAIRREADLEN(lens), PAIRREFLEN(lens), output + 3 * i, &alignments[i])) {
+            fail++;
+        }
+    }
+    delete[] traceOff;
+    if (fail) {
+        LogError("Traceback failed for %d of %d pairs", fail, blockPairs);
+    }
 
+    m_traceMs += timestamp() - startMS;
+}
+
+bool SmithWatermanApp::create_device_buffers(SwDeviceBuffers& buf, int sz_input, int sz_output, int sz_sz)
+{
     cl_int err;
-    cl_mem mem_input;
-    mem_input = clCreateBuffer(m_world.context, CL_MEM_READ_WRITE, sz_input, NULL, &err);
+    buf.input = buf.output = buf.sz = buf.scoring = buf.trace = NULL;
+    buf.traceSz = 0;
+
+    buf.input = clCreateBuffer(m_world.context, CL_MEM_READ_WRITE, sz_input, NULL, &err);
     if (err != CL_SUCCESS) {
         LogError("Error: Failed to allocate OpenCL source buffer of size %lu", sz_input);
         return false;
     }
 
-    cl_mem mem_output;
-    mem_output = clCreateBuffer(m_world.context, CL_MEM_READ_WRITE, sz_output, NULL, &err);
+    buf.output = clCreateBuffer(m_world.context, CL_MEM_READ_WRITE, sz_output, NULL, &err);
     if (err != CL_SUCCESS) {
         LogError("Failed to allocate worst case OpenCL output buffer of size %lu",
             sz_input);
         return false;
     }
 
-    cl_mem mem_sz_sz;
-    mem_sz_sz = clCreateBuffer(m_world.context, CL_MEM_READ_WRITE, sz_sz, NULL, &err);
+    buf.sz = clCreateBuffer(m_world.context, CL_MEM_READ_WRITE, sz_sz, NULL, &err);
     if (err != CL_SUCCESS) {
         LogError("Failed to allocate worst case OpenCL output buffer of size %lu",
             sizeof(u32));
         return false;
     }
 
+    buf.scoring = clCreateBuffer(m_world.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        sizeof(m_scoring), m_scoring, &err);
+    if (err != CL_SUCCESS) {
+        LogError("Failed to allocate OpenCL scoring buffer of size %lu", sizeof(m_scoring));
+        return false;
+    }
+
+    return true;
+}
+
+void SmithWatermanApp::release_device_buffers(SwDeviceBuffers& buf)
+{
+    releaseMemObject(buf.input);
+    releaseMemObject(buf.output);
+    releaseMemObject(buf.sz);
+    releaseMemObject(buf.scoring);
+    releaseMemObject(buf.trace);
+    buf.traceSz = 0;
+}
+
+/*!
+ * Grows the trace buffer of buf to m_traceSz when a batch needs more direction
+ * codes than it holds. The kernel only writes them in traceback mode.
+ */
+bool SmithWatermanApp::ensure_trace_buffer(SwDeviceBuffers& buf)
+{
+    cl_int err;
+    int traceSz = m_traceback ? m_traceSz : sizeof(unsigned int);
+    if (buf.trace == NULL || buf.traceSz < traceSz) {
+        releaseMemObject(buf.trace);
+        buf.trace = clCreateBuffer(m_world.context, CL_MEM_WRITE_ONLY, traceSz, NULL, &err);
+        if (err != CL_SUCCESS) {
+            LogError("Failed to allocate OpenCL traceback buffer of size %d", traceSz);
+            return false;
+        }
+        buf.traceSz = traceSz;
+    }
+    return true;
+}
+
+bool SmithWatermanApp::invoke_kernel_blocking(
+    unsigned int* input,
+    unsigned int* output,
+    int* iterNum,
+    int sz_input,
+    int sz_output,
+    int sz_sz,
+    cl_event events[evtCount])
+{
+    SwDeviceBuffers buf;
+    bool res = create_device_buffers(buf, sz_input, sz_output, sz_sz)
+        && invoke_kernel_buffers(buf, input, output, iterNum, sz_input, sz_output, sz_sz, events);
+
+    //cleanup
+    release_device_buffers(buf);
+    return res;
+}
+
+/*!
+ * Runs the m_numBlocks blocks of input one after the other through the device
+ * buffers of buf. The trace buffer grows to m_traceSz when a batch needs more
+ * direction codes than it holds, the other buffers are reused as they are.
+ */
+bool SmithWatermanApp::invoke_kernel_buffers(
+    SwDeviceBuffers& buf,
+    unsigned int* input,
+    unsigned int* output,
+    int* iterNum,
+    int sz_input,
+    int sz_output,
+    int sz_sz,
+    cl_event events[evtCount])
+{
+
+    cl_kernel kernel = m_clKernelSmithWaterman;
+
+    cl_int err;
+
+    if (!ensure_trace_buffer(buf)) {
+        return false;
+    }
+
     err = 0;
-    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &mem_input);
+    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buf.input);
     if (err != CL_SUCCESS) {
         LogError("Failed to set kernel argument [0] input_buffer! %d", err);
         LogError("Test failed");
         return false;
     }
 
-    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &mem_output);
+    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &buf.output);
     if (err != CL_SUCCESS) {
         LogError("Failed to set kernel argument [1] output_buffer! %d", err);
         LogError("Test failed");
         return false;
     }
 
-    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &mem_sz_sz);
+    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &buf.sz);
     if (err != CL_SUCCESS) {
         LogError("Failed to set kernel argument [2] sz_output! %d", err);
         LogError("Test failed");
         return false;
     }
 
+    err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &buf.scoring);
+    if (err != CL_SUCCESS) {
+        LogError("Failed to set kernel argument [3] scoring! %d", err);
+        LogError("Test failed");
+        return false;
+    }
+
+    err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &buf.trace);
+    if (err != CL_SUCCESS) {
+        LogError("Failed to set kernel argument [4] trace! %d", err);
+        LogError("Test failed");
+        return false;
+    }
+
+    int traceback = m_traceback ? 1 : 0;
+    err |= clSetKernelArg(kernel, 5, sizeof(int), &traceback);
+    if (err != CL_SUCCESS) {
+        LogError("Failed to set kernel argument [5] traceback! %d", err);
+        LogError("Test failed");
+        return false;
+    }
+
+    unsigned int* trace = m_traceback ? new unsigned int[m_traceSz / sizeof(unsigned int)] : NULL;
+    int blockPairs = NUMPACKED * (*iterNum);
     int numIter = m_numBlocks;
 
     cout << "Processing " << m_numSamples << " Samples \n";
@@ -339,16 +828,18 @@ bool SmithWatermanApp::invoke_kernel_blocking(
     for (int iter = 0; iter < numIter; ++iter) {
         //copy input dataset to OpenCL buffer
         //cout << "In iteration" << iter << "\n";
-        err = clEnqueueWriteBuffer(m_world.command_queue, mem_input, CL_TRUE, 0,
+        err = clEnqueueWriteBuffer(m_world.command_queue, buf.input, CL_TRUE, 0,
             sz_input, (input + iter * (sz_input / sizeof(unsigned int))), 0, NULL, &events[evtHostWrite]);
         if (err != CL_SUCCESS) {
             LogError("Failed to copy input dataset to OpenCL buffer");
+            delete[] trace;
             return false;
         }
-        err = clEnqueueWriteBuffer(m_world.command_queue, mem_sz_sz, CL_TRUE, 0,
+        err = clEnqueueWriteBuffer(m_world.command_queue, buf.sz, CL_TRUE, 0,
             sz_sz, iterNum, 0, NULL, NULL);
         if (err != CL_SUCCESS) {
             LogError("Failed to copy input dataset to OpenCL buffer");
+            delete[] trace;
             return false;
         }
         //finish all memory writes
@@ -359,29 +850,42 @@ bool SmithWatermanApp::invoke_kernel_blocking(
         if (err != CL_SUCCESS) {
             LogError("[EX1] Failed to execute kernel %d", err);
             LogError("Test failed");
+            delete[] trace;
             return false;
         }
         clFinish(m_world.command_queue);
 
         //read output size
-        err = clEnqueueReadBuffer(m_world.command_queue, mem_output, CL_TRUE, 0,
+        err = clEnqueueReadBuffer(m_world.command_queue, buf.output, CL_TRUE, 0,
             sz_output, (output + iter * (sz_output / sizeof(unsigned int))), 0, NULL, &events[evtHostRead]);
         if (err != CL_SUCCESS) {
             LogError("Failed to read output size buffer %d", err);
             LogError("Test failed");
+            delete[] trace;
             return false;
         }
         clFinish(m_world.command_queue);
-        eTotal[evtHostWrite] += computeEventDurationInMS(events[evtHostWrite]);
-        eTotal[evtKernelExec] += computeEventDurationInMS(events[evtKernelExec]);
-        eTotal[evtHostRead] += computeEventDurationInMS(events[evtHostRead]);
-    }
+        for (int i = 0; i < evtCount; i++) {
+            m_profiler.record(g_evtNames[i], events[i]);
+        }
 
-    //cleanup
-    releaseMemObject(mem_input);
-    releaseMemObject(mem_output);
-    releaseMemObject(mem_sz_sz);
+        if (m_traceback) {
+            cl_event evtTrace;
+            err = clEnqueueReadBuffer(m_world.command_queue, buf.trace, CL_TRUE, 0,
+                m_traceSz, trace, 0, NULL, &evtTrace);
+            if (err != CL_SUCCESS) {
+                LogError("Failed to read traceback buffer %d", err);
+                LogError("Test failed");
+                delete[] trace;
+                return false;
+            }
+            m_profiler.record(g_evtNames[evtHostRead], evtTrace);
+            traceback_block(input + iter * (sz_input / sizeof(unsigned int)),
+                output + iter * (sz_output / sizeof(unsigned int)), trace, blockPairs, m_alignments + iter * blockPairs);
+        }
+    }
 
+    delete[] trace;
     return true;
 }
 
@@ -392,55 +896,79 @@ bool SmithWatermanApp::invoke_kernel_doublebuffered(
     int sz_input,
     int sz_output,
     int sz_sz,
-    cl_event events[evtCount],
-    double eTotal[evtCount])
+    cl_event events[evtCount])
+{
+    SwDeviceBuffers buf[2];
+    bool res = create_device_buffers(buf[0], sz_input, sz_output, sz_sz)
+        && create_device_buffers(buf[1], sz_input, sz_output, sz_sz)
+        && invoke_kernel_doublebuffered(buf, input, output, iterNum, sz_input, sz_output, sz_sz, events);
+
+    //cleanup
+    release_device_buffers(buf[0]);
+    release_device_buffers(buf[1]);
+    return res;
+}
+
+/*!
+ * Runs the m_numBlocks blocks of input through the ping (buf[0]) and pong
+ * (buf[1]) device buffers, so that the transfers and the traceback of one
+ * block overlap with the kernel of the other. Size and scoring buffers of
+ * the ping set are used for both.
+ */
+bool SmithWatermanApp::invoke_kernel_doublebuffered(
+    SwDeviceBuffers buf[2],
+    unsigned int* input,
+    unsigned int* output,
+    int* iterNum,
+    int sz_input,
+    int sz_output,
+    int sz_sz,
+    cl_event events[evtCount])
 {
 
     cl_kernel kernel = m_clKernelSmithWaterman;
 
-    cl_int err;
-    cl_mem mem_input_ping;
-    mem_input_ping = clCreateBuffer(m_world.context, CL_MEM_READ_WRITE, sz_input, NULL, &err);
-    if (err != CL_SUCCESS) {
-        LogError("Error: Failed to allocate OpenCL source buffer of size %lu", sz_input);
-        return false;
-    }
+    cl_int err = 0;
 
-    cl_mem mem_input_pong;
-    mem_input_pong = clCreateBuffer(m_world.context, CL_MEM_READ_WRITE, sz_input, NULL, &err);
+    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &buf[0].sz);
     if (err != CL_SUCCESS) {
-        LogError("Error: Failed to allocate OpenCL source buffer of size %lu", sz_input);
+        LogError("Failed to set kernel argument [2] sz_output! %d", err);
+        LogError("Test failed");
         return false;
     }
 
-    cl_mem mem_output_ping;
-    mem_output_ping = clCreateBuffer(m_world.context, CL_MEM_READ_WRITE, sz_output, NULL, &err);
+    //scoring is constant across ping and pong
+    err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &buf[0].scoring);
     if (err != CL_SUCCESS) {
-        LogError("Failed to allocate worst case OpenCL output buffer of size %lu",
-            sz_input);
+        LogError("Failed to set kernel argument [3] scoring! %d", err);
+        LogError("Test failed");
         return false;
     }
 
-    cl_mem mem_output_pong;
-    mem_output_pong = clCreateBuffer(m_world.context, CL_MEM_READ_WRITE, sz_output, NULL, &err);
-    if (err != CL_SUCCESS) {
-        LogError("Failed to allocate worst case OpenCL output buffer of size %lu",
-            sz_input);
+    //direction codes of the ping and pong blocks, only written in traceback mode
+    if (!ensure_trace_buffer(buf[0]) || !ensure_trace_buffer(buf[1])) {
         return false;
     }
+    unsigned int* trace[2] = { NULL, NULL };
+    cl_event traceRd[2];
+    for (int i = 0; i < 2 && m_traceback; ++i) {
+        trace[i] = new unsigned int[m_traceSz / sizeof(unsigned int)];
+    }
 
-    cl_mem mem_sz_sz;
-    mem_sz_sz = clCreateBuffer(m_world.context, CL_MEM_READ_WRITE, sz_sz, NULL, &err);
+    int traceback = m_traceback ? 1 : 0;
+    err |= clSetKernelArg(kernel, 5, sizeof(int), &traceback);
     if (err != CL_SUCCESS) {
-        LogError("Failed to allocate worst case OpenCL output buffer of size %lu",
-            sizeof(u32));
+        LogError("Failed to set kernel argument [5] traceback! %d", err);
+        LogError("Test failed");
         return false;
     }
+    int blockPairs = NUMPACKED * (*iterNum);
 
-    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &mem_sz_sz);
+    //the kernel also locates the pairs behind the block headers with it
+    err = clEnqueueWriteBuffer(m_world.command_queue, buf[0].sz, CL_TRUE, 0,
+        sz_sz, iterNum, 0, NULL, NULL);
     if (err != CL_SUCCESS) {
-        LogError("Failed to set kernel argument [2] sz_output! %d", err);
-        LogError("Test failed");
+        LogError("Failed to copy block size to OpenCL buffer");
         return false;
     }
 
@@ -450,64 +978,98 @@ bool SmithWatermanApp::invoke_kernel_doublebuffered(
     int numIter = m_numBlocks;
     cout << "Processing " << m_numSamples << " Samples \n";
     if (numIter >= 1) {
-        err = clEnqueueWriteBuffer(m_world.command_queue, mem_input_ping, CL_FALSE, 0,
+        err = clEnqueueWriteBuffer(m_world.command_queue, buf[0].input, CL_FALSE, 0,
             sz_input, input, 0, NULL, &ping[evtHostWrite]);
+        m_profiler.record(g_evtNames[evtHostWrite], ping[evtHostWrite]);
         assert(err == CL_SUCCESS);
-        err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &mem_input_ping);
+        err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buf[0].input);
         assert(err == CL_SUCCESS);
-        err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &mem_output_ping);
+        err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &buf[0].output);
+        assert(err == CL_SUCCESS);
+        err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &buf[0].trace);
         assert(err == CL_SUCCESS);
 
         if (numIter > 1) {
-            err = clEnqueueWriteBuffer(m_world.command_queue, mem_input_pong, CL_FALSE, 0,
+            err = clEnqueueWriteBuffer(m_world.command_queue, buf[1].input, CL_FALSE, 0,
                 sz_input, (input + (sz_input / sizeof(unsigned int))), 0, NULL, &pong[evtHostWrite]);
+            m_profiler.record(g_evtNames[evtHostWrite], pong[evtHostWrite]);
         }
         assert(err == CL_SUCCESS);
         err = clEnqueueTask(m_world.command_queue, kernel, 0, NULL, &ping[evtKernelExec]);
+        m_profiler.record(g_evtNames[evtKernelExec], ping[evtKernelExec]);
         assert(err == CL_SUCCESS);
-        err = clEnqueueReadBuffer(m_world.command_queue, mem_output_ping, CL_FALSE, 0,
+        err = clEnqueueReadBuffer(m_world.command_queue, buf[0].output, CL_FALSE, 0,
             sz_output, output, 1, &ping[evtKernelExec], &ping[evtHostRead]);
+        m_profiler.record(g_evtNames[evtHostRead], ping[evtHostRead]);
         assert(err == CL_SUCCESS);
+        if (m_traceback) {
+            err = clEnqueueReadBuffer(m_world.command_queue, buf[0].trace, CL_FALSE, 0,
+                m_traceSz, trace[0], 1, &ping[evtKernelExec], &traceRd[0]);
+            m_profiler.record(g_evtNames[evtHostRead], traceRd[0]);
+            assert(err == CL_SUCCESS);
+        }
     }
 
     if (numIter >= 2) {
-        err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &mem_input_pong);
+        err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buf[1].input);
         assert(err == CL_SUCCESS);
 
-        err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &mem_output_pong);
+        err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &buf[1].output);
+        assert(err == CL_SUCCESS);
+        err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &buf[1].trace);
         assert(err == CL_SUCCESS);
         if (numIter > 2) {
             err = clWaitForEvents(1, &ping[evtHostWrite]);
             assert(err == CL_SUCCESS);
-            err = clEnqueueWriteBuffer(m_world.command_queue, mem_input_ping, CL_FALSE, 0,
-                sz_input, (input + (sz_input / sizeof(unsigned int))), 0, NULL, &ping[evtHostWrite]);
+            err = clEnqueueWriteBuffer(m_world.command_queue, buf[0].input, CL_FALSE, 0,
+                sz_input, (input + 2 * (sz_input / sizeof(unsigned int))), 0, NULL, &ping[evtHostWrite]);
+            m_profiler.record(g_evtNames[evtHostWrite], ping[evtHostWrite]);
             assert(err == CL_SUCCESS);
         }
 
         //call once to guarentee that all buffers are migrated to device memory
         err = clEnqueueTask(m_world.command_queue, kernel, 0, NULL, &pong[evtKernelExec]);
+        m_profiler.record(g_evtNames[evtKernelExec], pong[evtKernelExec]);
         assert(err == CL_SUCCESS);
 
+        //traceback of the first block runs while the kernel scores the second
+        if (m_traceback) {
+            err = clWaitForEvents(1, &ping[evtHostRead]);
+            err |= clWaitForEvents(1, &traceRd[0]);
+            assert(err == CL_SUCCESS);
+            traceback_block(input, output, trace[0], blockPairs, m_alignments);
+        }
+
         //read output size
-        err = clEnqueueReadBuffer(m_world.command_queue, mem_output_pong, CL_FALSE, 0,
+        err = clEnqueueReadBuffer(m_world.command_queue, buf[1].output, CL_FALSE, 0,
             sz_output, (output + (sz_output / sizeof(unsigned int))), 1, &pong[evtKernelExec], &pong[evtHostRead]);
+        m_profiler.record(g_evtNames[evtHostRead], pong[evtHostRead]);
         assert(err == CL_SUCCESS);
+        if (m_traceback) {
+            err = clEnqueueReadBuffer(m_world.command_queue, buf[1].trace, CL_FALSE, 0,
+                m_traceSz, trace[1], 1, &pong[evtKernelExec], &traceRd[1]);
+            m_profiler.record(g_evtNames[evtHostRead], traceRd[1]);
+            assert(err == CL_SUCCESS);
+        }
     }
 
     for (int iter = 2; iter < numIter; ++iter) {
         //copy input dataset to OpenCL buffer
         //cout << "In iteration" << iter << "\n";
         if (iter & 1) { //pong
-            err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &mem_input_pong);
+            err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buf[1].input);
             assert(err == CL_SUCCESS);
 
-            err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &mem_output_pong);
+            err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &buf[1].output);
+            assert(err == CL_SUCCESS);
+            err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &buf[1].trace);
             assert(err == CL_SUCCESS);
             if (iter < numIter - 1) {
                 err = clWaitForEvents(1, &ping[evtHostWrite]);
                 assert(err == CL_SUCCESS);
-                err = clEnqueueWriteBuffer(m_world.command_queue, mem_input_ping, CL_FALSE, 0,
+                err = clEnqueueWriteBuffer(m_world.command_queue, buf[0].input, CL_FALSE, 0,
                     sz_input, (input + (iter + 1) * (sz_input / sizeof(unsigned int))), 0, NULL, &ping[evtHostWrite]);
+                m_profiler.record(g_evtNames[evtHostWrite], ping[evtHostWrite]);
                 assert(err == CL_SUCCESS);
             }
 
@@ -517,25 +1079,46 @@ bool SmithWatermanApp::invoke_kernel_doublebuffered(
             err = clWaitForEvents(2, pong);
             assert(err == CL_SUCCESS);
             err = clEnqueueTask(m_world.command_queue, kernel, 0, NULL, &pong[evtKernelExec]);
+            m_profiler.record(g_evtNames[evtKernelExec], pong[evtKernelExec]);
             assert(err == CL_SUCCESS);
 
+            //traceback of the previous (ping) block overlaps with this kernel
+            if (m_traceback) {
+                err = clWaitForEvents(1, &ping[evtHostRead]);
+                err |= clWaitForEvents(1, &traceRd[0]);
+                assert(err == CL_SUCCESS);
+                traceback_block(input + (iter - 1) * (sz_input / sizeof(unsigned int)),
+                    output + (iter - 1) * (sz_output / sizeof(unsigned int)), trace[0], blockPairs,
+                    m_alignments + (iter - 1) * blockPairs);
+            }
+
             //read output size
             err = clWaitForEvents(2, pong + 1);
             assert(err == CL_SUCCESS);
-            err = clEnqueueReadBuffer(m_world.command_queue, mem_output_pong, CL_FALSE, 0,
+            err = clEnqueueReadBuffer(m_world.command_queue, buf[1].output, CL_FALSE, 0,
                 sz_output, (output + iter * (sz_output / sizeof(unsigned int))), 0, NULL, &pong[evtHostRead]);
+            m_profiler.record(g_evtNames[evtHostRead], pong[evtHostRead]);
             assert(err == CL_SUCCESS);
+            if (m_traceback) {
+                err = clEnqueueReadBuffer(m_world.command_queue, buf[1].trace, CL_FALSE, 0,
+                    m_traceSz, trace[1], 0, NULL, &traceRd[1]);
+                m_profiler.record(g_evtNames[evtHostRead], traceRd[1]);
+                assert(err == CL_SUCCESS);
+            }
         }
         else { //ping
-            err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &mem_input_ping);
+            err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buf[0].input);
             assert(err == CL_SUCCESS);
-            err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &mem_output_ping);
+            err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &buf[0].output);
+            assert(err == CL_SUCCESS);
+            err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &buf[0].trace);
             assert(err == CL_SUCCESS);
             if (iter < numIter - 1) {
                 err = clWaitForEvents(1, &pong[evtHostWrite]);
                 assert(err == CL_SUCCESS);
-                err = clEnqueueWriteBuffer(m_world.command_queue, mem_input_pong, CL_FALSE, 0,
+                err = clEnqueueWriteBuffer(m_world.command_queue, buf[1].input, CL_FALSE, 0,
                     sz_input, (input + (iter + 1) * (sz_input / sizeof(unsigned int))), 0, NULL, &pong[evtHostWrite]);
+                m_profiler.record(g_evtNames[evtHostWrite], pong[evtHostWrite]);
                 assert(err == CL_SUCCESS);
             }
 
@@ -543,27 +1126,47 @@ bool SmithWatermanApp::invoke_kernel_doublebuffered(
             err = clWaitForEvents(2, ping);
             assert(err == CL_SUCCESS);
             err = clEnqueueTask(m_world.command_queue, kernel, 0, NULL, &ping[evtKernelExec]);
+            m_profiler.record(g_evtNames[evtKernelExec], ping[evtKernelExec]);
             assert(err == CL_SUCCESS);
 
+            //traceback of the previous (pong) block overlaps with this kernel
+            if (m_traceback) {
+                err = clWaitForEvents(1, &pong[evtHostRead]);
+                err |= clWaitForEvents(1, &traceRd[1]);
+                assert(err == CL_SUCCESS);
+                traceback_block(input + (iter - 1) * (sz_input / sizeof(unsigned int)),
+                    output + (iter - 1) * (sz_output / sizeof(unsigned int)), trace[1], blockPairs,
+                    m_alignments + (iter - 1) * blockPairs);
+            }
+
             //read output size
             err = clWaitForEvents(2, ping + 1);
             assert(err == CL_SUCCESS);
-            err = clEnqueueReadBuffer(m_world.command_queue, mem_output_ping, CL_FALSE, 0,
+            err = clEnqueueReadBuffer(m_world.command_queue, buf[0].output, CL_FALSE, 0,
                 sz_output, (output + iter * (sz_output / sizeof(unsigned int))), 0, NULL, &ping[evtHostRead]);
+            m_profiler.record(g_evtNames[evtHostRead], ping[evtHostRead]);
             assert(err == CL_SUCCESS);
+            if (m_traceback) {
+                err = clEnqueueReadBuffer(m_world.command_queue, buf[0].trace, CL_FALSE, 0,
+                    m_traceSz, trace[0], 0, NULL, &traceRd[0]);
+                m_profiler.record(g_evtNames[evtHostRead], traceRd[0]);
+                assert(err == CL_SUCCESS);
+            }
         }
-        eTotal[evtHostWrite] += computeEventDurationInMS(events[evtHostWrite]);
-        eTotal[evtKernelExec] += computeEventDurationInMS(events[evtKernelExec]);
-        eTotal[evtHostRead] += computeEventDurationInMS(events[evtHostRead]);
     }
     clFinish(m_world.command_queue);
 
-    //cleanup
-    releaseMemObject(mem_input_ping);
-    releaseMemObject(mem_output_ping);
-    releaseMemObject(mem_input_pong);
-    releaseMemObject(mem_output_pong);
-    releaseMemObject(mem_sz_sz);
+    //the last block has no kernel left to hide behind
+    if (m_traceback && numIter >= 1) {
+        int last = numIter - 1;
+        traceback_block(input + last * (sz_input / sizeof(unsigned int)),
+            output + last * (sz_output / sizeof(unsigned int)), trace[last & 1], blockPairs,
+            m_alignments + last * blockPairs);
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        delete[] trace[i];
+    }
 
     return true;
 }
@@ -573,7 +1176,7 @@ bool SmithWatermanApp::run(int idevice, int nruns)
     if (nruns <= 0)
         return false;
 
-    assert(unit_test_kernel_cpu());
+    assert(unit_test_kernel_cpu(m_scoring));
 
     int err;
     unsigned int* output;
@@ -582,33 +1185,105 @@ bool SmithWatermanApp::run(int idevice, int nruns)
     int* iterNum;
     int hwBlockSize = NUMPACKED * m_blockSz;
     int totalSamples = m_numSamples;
-    cout << "------FPGA Accelerator Summary --------\n";
-    cout << "Number of SmithWaterman instances on FPGA:" << NUMPACKED << "\n";
-    cout << "Total processing elements:" << MAXPE * NUMPACKED << "\n";
-    cout << "Length of reference string:" << MAXCOL << "\n";
-    cout << "Length of read(query) string:" << MAXROW << "\n";
+    if (m_useCpu) {
+        cout << "------CPU SSW Engine Summary --------\n";
+        cout << "Number of threads:" << m_cpuThreads << "\n";
+    }
+    else {
+        cout << "------FPGA Accelerator Summary --------\n";
+        cout << "Number of SmithWaterman instances on FPGA:" << NUMPACKED << "\n";
+        cout << "Total processing elements:" << MAXPE * NUMPACKED << "\n";
+    }
+    if (m_variableLength) {
+        cout << "Longest reference string:" << MAXREFLEN << "\n";
+        cout << "Longest read(query) string:" << MAXREADLEN << "\n";
+    }
+    else {
+        cout << "Length of reference string:" << MAXCOL << "\n";
+        cout << "Length of read(query) string:" << MAXROW << "\n";
+    }
     cout << "Read-Ref pair block size(HOST to FPGA):" << m_blockSz << "\n";
+    cout << "Gap open/extend penalty:" << m_scoring[SCORING_GAPO] << "/" << m_scoring[SCORING_GAPE] << "\n";
     cout << "Verify Mode is:" << m_verifyMode << "\n";
+    cout << "Traceback Mode is:" << m_traceback << "\n";
     cout << "---------------------------------------\n";
 
     //seed random
     srand(time(NULL));
 
-    if (m_verifyMode) {
+    unsigned int* lens = new unsigned int[totalSamples];
+    unsigned int* offsets = new unsigned int[totalSamples];
+    int* order = NULL;
+    if (m_variableLength) {
+        cout << "Generating variable length read-ref samples\n";
+        input = generateVarReadRefPairs(totalSamples, lens, offsets);
+        order = new int[totalSamples];
+        sortPairsByCost(totalSamples, lens, order);
+        outputGolden = new unsigned int[3 * totalSamples];
+        if (m_verifyMode) {
+            cout << "Computing golden scores on the CPU\n";
+            computeVarReadRefPairs(totalSamples, input, lens, offsets, outputGolden, m_scoring);
+        }
+    }
+    else if (m_verifyMode) {
         cout << "Reading read-ref samples\n";
         err = readReadRefFile((char*)m_strSampleFP.c_str(), &input, &outputGolden, totalSamples);
         if (err != totalSamples) {
             LogError("Unable to read sample file: [%s]", m_strSampleFP.c_str());
             return false;
         }
+        //sample files carry scores for the default scoring only
+        int defaultScoring[SCORINGSZ];
+        initScoring(defaultScoring, MATCH, MISS_MATCH, GAP_OPEN, GAP_EXTEND);
+        if (memcmp(defaultScoring, m_scoring, sizeof(m_scoring))) {
+            cout << "Recomputing golden scores for the configured scoring\n";
+            computePackedNReadRefPair(totalSamples, MAXROW, MAXCOL, input, outputGolden, m_scoring);
+        }
     }
     else {
         cout << "Generating read-ref samples\n";
         input = generatePackedNReadRefPair(totalSamples, MAXROW, MAXCOL, &outputGolden, 0); //do not generate compute output
     }
+    if (!m_variableLength) {
+        for (int i = 0; i < totalSamples; ++i) {
+            lens[i] = PAIRLENS(MAXROW, MAXCOL);
+            offsets[i] = i * PACKEDSZ;
+        }
+    }
+
+    //kernel blocks of pair headers followed by the packed pairs
+    unsigned int* batch;
+    int blockInts = packReadRefBatch(totalSamples, hwBlockSize, input, lens, offsets, order, &batch);
+
+    //cells scored, and the PE cycles spent on them: the NUMPACKED pairs of a
+    //kernel step are scored side by side, so the step lasts as long as its longest pair
+    double cells = 0;
+    double peCells = 0;
+    for (int s = 0; s < totalSamples; s += NUMPACKED) {
+        double stepCells = 0;
+        for (int i = s; i < s + NUMPACKED; ++i) {
+            unsigned int l = lens[order ? order[i] : i];
+            cells += (double)PAIRREADLEN(l) * PAIRREFLEN(l);
+            double pe = (double)PAIRREADLEN(l) * ((PAIRREFLEN(l) + MAXPE - 1) / MAXPE) * MAXPE;
+            stepCells = (pe > stepCells) ? pe : stepCells;
+        }
+        peCells += stepCells * NUMPACKED;
+    }
+
+    //traceback buffers fit the direction codes of the largest block
+    m_traceSz = 0;
+    if (m_traceback) {
+        for (int b = 0; b < m_numBlocks; ++b) {
+            int blockTrace = block_trace_ints(batch + b * blockInts, hwBlockSize);
+            m_traceSz = (blockTrace > m_traceSz) ? blockTrace : m_traceSz;
+        }
+        m_traceSz *= sizeof(unsigned int);
+        cout << "Traceback buffer per block [KB]:" << m_traceSz / 1024 << "\n";
+        m_alignments = new SwAlignment[totalSamples];
+    }
 
     //input buffer size
-    int inSz = sizeof(unsigned int) * (hwBlockSize * PACKEDSZ);
+    int inSz = sizeof(unsigned int) * blockInts;
     int outSz = sizeof(unsigned int) * (hwBlockSize * 3);
     int szSz = sizeof(unsigned int);
 
@@ -619,18 +1294,17 @@ bool SmithWatermanApp::run(int idevice, int nruns)
     //timings
     cl_event events[evtCount];
     double eTotal[evtCount];
-    double durations[evtCount];
-    for (int i = 0; i < evtCount; i++) {
-        durations[i] = 0.0;
-        eTotal[i] = 0.0;
-    }
+    m_profiler.clear();
+    m_cpuExecMs = 0;
+    m_traceMs = 0;
 
     //start time stamps
     double startMS = timestamp();
 
     //execute
     for (int i = 0; i < nruns; i++) {
-        bool res = invoke_kernel(input, output, iterNum, inSz, outSz, szSz, &events[0], eTotal);
+        bool res = m_useCpu ? invoke_cpu(batch, output, iterNum, inSz, outSz)
+                            : invoke_kernel(batch, output, iterNum, inSz, outSz, szSz, &events[0]);
         if (!res) {
             LogError("Failed to encode the input. Test Failed");
             return false;
@@ -644,9 +1318,30 @@ bool SmithWatermanApp::run(int idevice, int nruns)
         //usleep(100);
     }
 
+    //back to generation order
+    if (order) {
+        unsigned int* sorted = output;
+        output = new unsigned int[totalSamples * 3];
+        for (int i = 0; i < totalSamples; ++i) {
+            memcpy(output + 3 * order[i], sorted + 3 * i, 3 * sizeof(unsigned int));
+        }
+        delete[] sorted;
+        if (m_alignments) {
+            SwAlignment* sortedAlns = m_alignments;
+            m_alignments = new SwAlignment[totalSamples];
+            for (int i = 0; i < totalSamples; ++i) {
+                m_alignments[order[i]] = sortedAlns[i];
+            }
+            delete[] sortedAlns;
+        }
+    }
+
     //collect times
     for (int i = 0; i < evtCount; i++) {
-        durations[i] += computeEventDurationInMS(events[i]);
+        eTotal[i] = m_profiler.total_ms(g_evtNames[i]);
+    }
+    if (m_useCpu) {
+        eTotal[evtKernelExec] = m_cpuExecMs;
     }
 
 	double totaltime = timestamp() - startMS;
@@ -656,16 +1351,20 @@ bool SmithWatermanApp::run(int idevice, int nruns)
 	LogInfo("Host write [ms] = %.3f", eTotal[evtHostWrite]);
 	LogInfo("Krnl exec [ms] = %.3f", eTotal[evtKernelExec]);
 	LogInfo("Host read [ms] = %.3f", eTotal[evtHostRead]);
+    if (m_traceback) {
+        LogInfo("Traceback [ms] = %.3f", m_traceMs);
+    }
 	
     
-    float gcups = (float)(totalSamples / (eTotal[evtKernelExec]));
+    float gcups = (float)(cells * nruns / (eTotal[evtKernelExec]));
     gcups = gcups / (1024 * 1024 * 1.024);
-    gcups = gcups * MAXROW * MAXCOL;
     cout << "GCups(based on kernel execution time):" << gcups << "\n";
-    gcups = (float)(totalSamples / (totaltime));
+    gcups = (float)(cells * nruns / (totaltime));
     gcups = gcups / (1024 * 1024 * 1.024);
-    gcups = gcups * MAXROW * MAXCOL;
     cout << "GCups(based on total execution time):" << gcups << "\n";
+    if (!m_useCpu) {
+        cout << "PE utilisation(scored cells / PE cycles):" << 100.0 * cells / peCells << "%\n";
+    }
 
     //compute transfer rate for host write
     if (eTotal[evtHostWrite] > 0) {
@@ -690,14 +1389,201 @@ bool SmithWatermanApp::run(int idevice, int nruns)
         tmp = tmp / (1024.0 * 1024.0);
 		LogInfo("Device2Host rate [mbps] = %.3f", tmp);
     }
+    if (!m_useCpu) {
+        m_profiler.report();
+    }
 
     if (m_verifyMode) {
         verify(totalSamples, outputGolden, output);
+        if (m_traceback) {
+            verify_alignments(totalSamples, input, lens, offsets, output, m_alignments, m_scoring);
+        }
+    }
+    if (!m_strAlignmentFP.empty()) {
+        FILE* fp = fopen(m_strAlignmentFP.c_str(), "w");
+        if (fp == NULL) {
+            LogError("Unable to open alignment file: [%s]", m_strAlignmentFP.c_str());
+        }
+        else {
+            write_results(fp, 0, totalSamples, NULL, output, m_alignments);
+            fclose(fp);
+        }
     }
 
     delete[] input;
+    delete[] batch;
+    delete[] lens;
+    delete[] offsets;
+    delete[] order;
     delete[] output;
+    delete[] outputGolden;
     delete iterNum;
+    delete[] m_alignments;
+    m_alignments = NULL;
     return true;
 }
 
+/*!
+ * Scores the read-ref pairs of FASTQ/FASTA files (plain or gzip'd). A
+ * producer thread parses and packs the next chunks of m_numBlocks blocks while
+ * the kernel, or the SSW engine, scores the current one.
+ */
+bool SmithWatermanApp::run_stream(int idevice, const string& strReadFP, const string& strRefFP)
+{
+    int hwBlockSize = NUMPACKED * m_blockSz;
+    int chunkPairs = hwBlockSize * m_numBlocks;
+    ReadRefStream stream(strReadFP, strRefFP, hwBlockSize, m_numBlocks, STREAM_DEPTH);
+    int blockInts = stream.blockInts();
+
+    cout << "------Streaming Summary --------\n";
+    cout << "Read file:" << strReadFP << "\n";
+    cout << "Reference file:" << strRefFP << "\n";
+    cout << "Pairs per chunk:" << chunkPairs << "\n";
+    cout << "Chunks parsed ahead:" << STREAM_DEPTH << "\n";
+    cout << "Verify Mode is:" << m_verifyMode << "\n";
+    cout << "Traceback Mode is:" << m_traceback << "\n";
+    cout << "---------------------------------------\n";
+
+    FILE* fp = NULL;
+    if (!m_strAlignmentFP.empty()) {
+        fp = fopen(m_strAlignmentFP.c_str(), "w");
+        if (fp == NULL) {
+            LogError("Unable to open alignment file: [%s]", m_strAlignmentFP.c_str());
+            return false;
+        }
+    }
+    if (!stream.start()) {
+        if (fp) {
+            fclose(fp);
+        }
+        return false;
+    }
+
+    //every chunk fills the same number of blocks, the last one is padded with empty pairs
+    m_numSamples = chunkPairs;
+    int inSz = sizeof(unsigned int) * blockInts;
+    int outSz = sizeof(unsigned int) * (hwBlockSize * 3);
+    int szSz = sizeof(unsigned int);
+    unsigned int* output = new unsigned int[chunkPairs * 3];
+    unsigned int* outputGolden = new unsigned int[chunkPairs * 3];
+    unsigned int* lens = new unsigned int[chunkPairs];
+    unsigned int* offsets = new unsigned int[chunkPairs];
+    int* iterNum = new int;
+    *iterNum = m_blockSz;
+    if (m_traceback) {
+        m_alignments = new SwAlignment[chunkPairs];
+    }
+
+    cl_event events[evtCount];
+    m_profiler.clear();
+    m_cpuExecMs = 0;
+    m_traceMs = 0;
+    double startMS = timestamp();
+
+    //device buffers of every pool slot, a ping and a pong set when double
+    //buffered, created the first time the slot is scored and reused for every
+    //chunk packed into it
+    map<PairChunk*, vector<SwDeviceBuffers> > slots;
+
+    bool res = true;
+    long pairs = 0;
+    int fail = 0;
+    double cells = 0;
+    PairChunk* chunk;
+    while ((chunk = stream.pop()) != NULL) {
+        m_traceSz = 0;
+        for (int b = 0; b < m_numBlocks; ++b) {
+            unsigned int* header = chunk->data + b * blockInts;
+            for (int i = 0; i < hwBlockSize; ++i) {
+                lens[b * hwBlockSize + i] = header[PAIRHDRSZ * i + 1];
+                offsets[b * hwBlockSize + i] = b * blockInts + PAIRHDRSZ * hwBlockSize + header[PAIRHDRSZ * i];
+            }
+            if (m_traceback) {
+                int blockTrace = block_trace_ints(header, hwBlockSize) * sizeof(unsigned int);
+                m_traceSz = (blockTrace > m_traceSz) ? blockTrace : m_traceSz;
+            }
+        }
+        for (int i = 0; i < chunk->numPairs; ++i) {
+            cells += (double)PAIRREADLEN(lens[i]) * PAIRREFLEN(lens[i]);
+        }
+
+        if (m_useCpu) {
+            res = invoke_cpu(chunk->data, output, iterNum, inSz, outSz);
+        }
+        else {
+            map<PairChunk*, vector<SwDeviceBuffers> >::iterator slot = slots.find(chunk);
+            if (slot == slots.end()) {
+                slot = slots.insert(make_pair(chunk, vector<SwDeviceBuffers>(m_useDoubleBuffered ? 2 : 1))).first;
+                for (size_t i = 0; i < slot->second.size() && res; ++i) {
+                    res = create_device_buffers(slot->second[i], inSz, outSz, szSz);
+                }
+            }
+            if (m_useDoubleBuffered) {
+                res = res && invoke_kernel_doublebuffered(&slot->second[0], chunk->data, output, iterNum, inSz, outSz, szSz, &events[0]);
+            }
+            else {
+                res = res && invoke_kernel_buffers(slot->second[0], chunk->data, output, iterNum, inSz, outSz, szSz, &events[0]);
+            }
+        }
+        if (!res) {
+            LogError("Failed to score chunk of %d pairs", chunk->numPairs);
+            stream.recycle(chunk);
+            break;
+        }
+
+        if (m_verifyMode) {
+            computeVarReadRefPairs(chunk->numPairs, chunk->data, lens, offsets, outputGolden, m_scoring);
+            fail |= verify(chunk->numPairs, outputGolden, output);
+            if (m_traceback) {
+                fail |= verify_alignments(chunk->numPairs, chunk->data, lens, offsets, output, m_alignments, m_scoring);
+            }
+        }
+        if (fp) {
+            write_results(fp, 0, chunk->numPairs, &chunk->names[0], output, m_alignments);
+        }
+        pairs += chunk->numPairs;
+        stream.recycle(chunk);
+    }
+    double totaltime = timestamp() - startMS;
+    for (map<PairChunk*, vector<SwDeviceBuffers> >::iterator it = slots.begin(); it != slots.end(); ++it) {
+        for (size_t i = 0; i < it->second.size(); ++i) {
+            release_device_buffers(it->second[i]);
+        }
+    }
+
+    double kernelMs = m_useCpu ? m_cpuExecMs : m_profiler.total_ms(g_evtNames[evtKernelExec]);
+    LogInfo("Records = %ld, skipped = %ld, ambiguous bases = %ld", stream.records(), stream.skipped(), stream.ambiguous());
+    LogInfo("Pairs scored = %ld", pairs);
+    LogInfo("total [ms] = %.3f", totaltime);
+    LogInfo("Parse [ms] = %.3f", stream.parseMs());
+    LogInfo("Parser stall [ms] = %.3f", stream.stallMs());
+    LogInfo("Krnl exec [ms] = %.3f", kernelMs);
+    if (m_traceback) {
+        LogInfo("Traceback [ms] = %.3f", m_traceMs);
+    }
+    if (kernelMs > 0) {
+        float gcups = (float)(cells / kernelMs);
+        gcups = gcups / (1024 * 1024 * 1.024);
+        cout << "GCups(based on kernel execution time):" << gcups << "\n";
+    }
+    if (totaltime > 0) {
+        float gcups = (float)(cells / totaltime);
+        gcups = gcups / (1024 * 1024 * 1.024);
+        cout << "GCups(based on total execution time):" << gcups << "\n";
+    }
+    if (m_verifyMode) {
+        printf("%s\n", fail ? "Stream verification: Fail" : "Stream verification: Pass");
+    }
+
+    if (fp) {
+        fclose(fp);
+    }
+    delete[] output;
+    delete[] outputGolden;
+    delete[] lens;
+    delete[] offsets;
+    delete iterNum;
+    delete[] m_alignments;
+    m_alignments = NULL;
+    return res;
+}
@@ -31,9 +31,12 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define SWAPP_H_
 
 #include "xcl.h"
+#include "profiler.h"
 #include "matcharray.h"
+#include "sw.h"
 
 #define COMPUTE_UNITS 1
+#define STREAM_DEPTH 2 //chunks the FASTQ/FASTA parser may run ahead of the kernel
 
 typedef unsigned char		u8;
 typedef unsigned short		u16;
@@ -46,6 +49,29 @@ typedef			 int		i32;
 namespace sda {
 namespace cl {
 
+    /*!
+ * Alignment of one read-ref pair rebuilt in traceback mode. Positions are 0
+ * based, the CIGAR uses M/I/D with the read as the query.
+ */
+    struct SwAlignment {
+        unsigned int rdStart;
+        unsigned int refStart;
+        string cigar;
+    };
+
+    /*!
+ * Device buffers of one kernel invocation, kept across invocations by the
+ * streaming mode so every pool slot allocates them once.
+ */
+    struct SwDeviceBuffers {
+        cl_mem input;
+        cl_mem output;
+        cl_mem sz;
+        cl_mem scoring;
+        cl_mem trace;
+        int traceSz; //bytes the trace buffer holds
+    };
+
     /*!
  *
  */
@@ -62,7 +88,12 @@ namespace cl {
             const bool doubleBuffered,
             const bool verifyMode,
             const bool writeMatchArray,
-            MatchArray* pm);
+            const bool variableLength,
+            const bool traceback,
+            MatchArray* pm,
+            const int* scoring = NULL,
+            const int cpuThreads = 1,
+            const string& strAlignmentFP = "");
         virtual ~SmithWatermanApp();
 
         enum EvBreakDown { evtHostWrite = 0,
@@ -71,29 +102,50 @@ namespace cl {
             evtCount = 3 };
 
         bool run(int idevice, int nruns);
+        bool run_stream(int idevice, const string& strReadFP, const string& strRefFP);
 
-        bool invoke_kernel(unsigned int* input, unsigned int* output, int* iterNum, int sz_input, int sz_output, int sz_sz, cl_event events[evtCount], double eTotal[evtCount]);
-        bool invoke_kernel_blocking(unsigned int* input, unsigned int* output, int* iterNum, int sz_input, int sz_output, int sz_sz, cl_event events[evtCount], double eTotal[evtCount]);
-        bool invoke_kernel_doublebuffered(unsigned int* input, unsigned int* output, int* iterNum, int sz_input, int sz_output, int sz_sz, cl_event events[evtCount], double eTotal[evtCount]);
+        bool invoke_kernel(unsigned int* input, unsigned int* output, int* iterNum, int sz_input, int sz_output, int sz_sz, cl_event events[evtCount]);
+        bool invoke_kernel_blocking(unsigned int* input, unsigned int* output, int* iterNum, int sz_input, int sz_output, int sz_sz, cl_event events[evtCount]);
+        bool invoke_kernel_buffers(SwDeviceBuffers& buf, unsigned int* input, unsigned int* output, int* iterNum, int sz_input, int sz_output, int sz_sz, cl_event events[evtCount]);
+        bool invoke_kernel_doublebuffered(unsigned int* input, unsigned int* output, int* iterNum, int sz_input, int sz_output, int sz_sz, cl_event events[evtCount]);
+        bool invoke_kernel_doublebuffered(SwDeviceBuffers buf[2], unsigned int* input, unsigned int* output, int* iterNum, int sz_input, int sz_output, int sz_sz, cl_event events[evtCount]);
+        bool invoke_cpu(unsigned int* input, unsigned int* output, int* iterNum, int sz_input, int sz_output);
+        void traceback_block(unsigned int* input, unsigned int* output, unsigned int* trace, int blockPairs, SwAlignment* alignments);
 
-        static bool unit_test_kernel_cpu();
+        static bool unit_test_kernel_cpu(const int* scoring = NULL);
         static bool unit_test_naive();
 
     protected:
         bool releaseMemObject(cl_mem& obj);
+        bool create_device_buffers(SwDeviceBuffers& buf, int sz_input, int sz_output, int sz_sz);
+        void release_device_buffers(SwDeviceBuffers& buf);
+        bool ensure_trace_buffer(SwDeviceBuffers& buf);
 
     private:
         string m_strSampleFP;
+        string m_strAlignmentFP; //traceback alignments are written here when set
         bool m_useDoubleBuffered;
         int m_numSamples;
         int m_numBlocks;
         int m_blockSz;
         bool m_verifyMode; //true == verify, false is not verify
         bool m_writeMatchArray; //true == writeMatchArray
+        bool m_variableLength; //true == pairs of varying length instead of MAXROW x MAXCOL
+        bool m_traceback; //true == the kernel writes direction codes and the host rebuilds alignments
+        int m_traceSz; //bytes of direction codes of the largest block
+        double m_traceMs;
+        SwAlignment* m_alignments; //per pair of the current batch, in batch order
+        int m_scoring[SCORINGSZ]; //substitution matrix and gap penalties, see sw.h
+        bool m_useCpu; //true == SSW engine on the host instead of the FPGA
+        int m_cpuThreads;
+        double m_cpuExecMs;
         cl_program m_program;
         cl_kernel m_clKernelSmithWaterman;
         xcl_world m_world;
 
+        //per stage event timings
+        Profiler m_profiler;
+
         MatchArray* m_pMatchInfo;
     };
 }
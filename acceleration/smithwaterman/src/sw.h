@@ -33,6 +33,8 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define GAP -1
 #define MATCH 2
 #define MISS_MATCH -1
+#define GAP_OPEN (-(GAP))
+#define GAP_EXTEND (-(GAP))
 #define ABSMAXCOST MATCH
 
 #define MINVAL -32000
@@ -51,7 +53,71 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define READREFUINTSZ(X, Y) ((((X) + (Y)))/(UINTNUMBP))
 #define NUMITER 1024
 
+/*
+ * Variable length batches. A kernel block starts with PAIRHDRSZ uints per
+ * pair: the offset of the pair in the payload that follows the headers and
+ * its read/ref lengths. A pair is its packed read followed by its packed ref,
+ * each padded to a whole uint. MAXREADLEN x MAXREFLEN is the largest pair the
+ * kernel accepts; fixed MAXROW x MAXCOL pairs are the special case where every
+ * header carries the same lengths.
+ */
+#define MAXREADLEN 512
+#define MAXREFLEN 1024
+#define MAXPACKEDSZ ((MAXREADLEN + MAXREFLEN) / UINTNUMBP)
+#define PAIRHDRSZ 2
+#define SEQUINTSZ(X) (((X) + UINTNUMBP - 1) / UINTNUMBP)
+#define PAIRLENS(RD, RF) ((((unsigned int)(RF)) << 16) | ((unsigned int)(RD)))
+#define PAIRREADLEN(L) ((L) & 0xFFFF)
+#define PAIRREFLEN(L) ((L) >> 16)
+
+/*
+ * Traceback mode. For every row and stripe of a pair the kernel writes the
+ * TRACEBITS direction code of each of the MAXPE cells, TRACEWORDS uints per
+ * row. A pair's codes are stored stripe by stripe and the pairs of a block
+ * follow each other in header order, PAIRTRACESZ uints each. The low two bits
+ * tell where H came from, TRACE_EEXT/TRACE_FEXT are set when the gap state of
+ * the cell extends the gap of its left/upper neighbour instead of opening one.
+ */
+#define TRACEBITS 4
+#define TRACEWORDS ((MAXPE * TRACEBITS) / (UINTSZ * 8))
+#define TRACE_ZERO 0
+#define TRACE_DIAG 1
+#define TRACE_E 2
+#define TRACE_F 3
+#define TRACE_HMASK 3
+#define TRACE_EEXT 4
+#define TRACE_FEXT 8
+#define PAIRTRACESZ(RD, RF) ((RD) * (((RF) + MAXPE - 1) / MAXPE) * TRACEWORDS)
+
 //A-0, C-1, G-2, T-3
 const char bases[5] = "ACGT";
+
+/*
+ * Scoring block handed to the kernel. A SW_ALPHABET x SW_ALPHABET substitution
+ * matrix indexed [ref * SW_ALPHABET + read] over A,C,G,T,N (the layout used by
+ * intel/ssw.c) followed by the gap open and gap extend penalties as positive
+ * values. A gap of length L costs gapOpen + (L - 1) * gapExtend, so
+ * GAP_OPEN == GAP_EXTEND gives back plain linear scoring.
+ */
+#define SW_ALPHABET 5
+#define SCORING_GAPO (SW_ALPHABET * SW_ALPHABET)
+#define SCORING_GAPE (SCORING_GAPO + 1)
+#define SCORINGSZ (SCORING_GAPE + 1)
+
+//match/mismatch on ACGT, 0 against N
+static inline void initScoring(int* scoring, int match, int mismatch, int gapOpen, int gapExtend)
+{
+    for (int rf = 0; rf < SW_ALPHABET; ++rf) {
+        for (int rd = 0; rd < SW_ALPHABET; ++rd) {
+            int s = (rf == rd) ? match : mismatch;
+            if (rf == SW_ALPHABET - 1 || rd == SW_ALPHABET - 1) {
+                s = 0;
+            }
+            scoring[rf * SW_ALPHABET + rd] = s;
+        }
+    }
+    scoring[SCORING_GAPO] = gapOpen;
+    scoring[SCORING_GAPE] = gapExtend;
+}
 #endif
 
@@ -28,9 +28,15 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 **********/
 #include <time.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <functional>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "logger.h"
 #ifdef WINDOWS
 		#include <direct.h>
@@ -117,27 +123,37 @@ string GetFileTitleOnly(const string& s) {
 }
 
 
-void LogWrapper(int etype, const char* file, int line, const char* desc, ...) {
+//one log call, formatted by the caller and completed by the writer
+struct LogRecord {
+	int etype;
+	const char* file;
+	int line;
+	time_t rawtime;
+	char msg[512];
+};
+
+//header, time stamp and message of a record, appended to out
+static void FormatRecord(const LogRecord& rec, string& out) {
 
 	//crop file name from full path
-	string strFileLoc(file);
+	string strFileLoc(rec.file);
 	strFileLoc = strFileLoc.substr(strFileLoc.find_last_of("\\/") + 1);
 
 	string strHeader = "";
 	{
 		char header[512];
 		//source
-		switch(etype) {
+		switch(rec.etype) {
 			case(sda::etError): {
-				snprintf(header, sizeof(header), "ERROR: [%s:%d]", strFileLoc.c_str(), line);
+				snprintf(header, sizeof(header), "ERROR: [%s:%d]", strFileLoc.c_str(), rec.line);
 				break;
 			}
 			case(sda::etInfo): {
-				snprintf(header, sizeof(header), "INFO: [%s:%d]", strFileLoc.c_str(), line);
+				snprintf(header, sizeof(header), "INFO: [%s:%d]", strFileLoc.c_str(), rec.line);
 				break;
 			}
 			case(sda::etWarning): {
-				snprintf(header, sizeof(header), "WARN: [%s:%d]", strFileLoc.c_str(), line);
+				snprintf(header, sizeof(header), "WARN: [%s:%d]", strFileLoc.c_str(), rec.line);
 				break;
 			}
 		}
@@ -148,57 +164,262 @@ void LogWrapper(int etype, const char* file, int line, const char* desc, ...) {
 	string strTime = "";
 #ifdef ENABLE_LOG_TIME
 	{
-		time_t rawtime;
-		time (&rawtime);
-	#ifdef ENABLE_SECURE_API
-		char buffer[64];
-		struct tm timeinfo;
-		localtime_s(&timeinfo, &rawtime);
-		asctime_s(timeinfo, buffer, sizeof(buffer))
-		snprintf(buffer, sizeof(buffer), "TIME: [%s]", asctime(timeinfo));
-		strTime = string(buffer);
-	#else
-		char buffer[64];
-		struct tm * timeinfo = localtime ( &rawtime );
-		string temp = string(asctime(timeinfo));
-		temp = trim(temp);
-
-//		strftime(buffer, sizeof(buffer), "TIME: []")
-		snprintf(buffer, sizeof(buffer), "TIME: [%s]", temp.c_str());
-		strTime = string(buffer);
-	#endif
-	}
+		//records of the same second share the formatted stamp
+		static thread_local time_t lastTime = 0;
+		static thread_local string lastStamp;
+		if(lastStamp.empty() || rec.rawtime != lastTime) {
+			char buffer[64];
+			char ascbuf[64];
+			struct tm timeinfo;
+#ifdef WINDOWS
+			localtime_s(&timeinfo, &rec.rawtime);
+			asctime_s(ascbuf, sizeof(ascbuf), &timeinfo);
+#else
+			localtime_r(&rec.rawtime, &timeinfo);
+			asctime_r(&timeinfo, ascbuf);
 #endif
+			string temp = string(ascbuf);
+			temp = trim(temp);
 
-	//format the message itself
-	string strMsg = "";
-	{
-		char msg[512];
-		va_list args;
-		va_start(args, desc);
-		vsnprintf(msg, sizeof(msg), desc, args);
-		va_end(args);
-		strMsg = string(msg);
+			snprintf(buffer, sizeof(buffer), "TIME: [%s]", temp.c_str());
+			lastStamp = string(buffer);
+			lastTime = rec.rawtime;
+		}
+		strTime = lastStamp;
 	}
+#endif
 
 	//combine
-	string strOut = strHeader + string(" ") + strTime + string(" ") + strMsg + string("\n");
+	out += strHeader + string(" ") + strTime + string(" ") + string(rec.msg) + string("\n");
+}
+
+//log file, opened once and shared by the synchronous and asynchronous paths
+struct LogOutput {
+	std::mutex mtx;
+#ifdef ENABLE_LOG_TOFILE
+	std::ofstream outfile;
+	LogOutput() : outfile("benchapp.log", std::ios_base::app) {}
+#endif
+};
+
+static LogOutput& Output() {
+	static LogOutput out;
+	return out;
+}
+
+//display and store formatted records
+static void WriteRecords(const string& strOut) {
+	LogOutput& out = Output();
+	std::lock_guard<std::mutex> lock(out.mtx);
 
 	//display
 	cout << strOut;
 
 	//store
 #ifdef ENABLE_LOG_TOFILE
-	std::ofstream outfile;
-	outfile.open("benchapp.log", std::ios_base::app);
-	outfile << strOut;
+	out.outfile << strOut;
+	out.outfile.flush();
 #endif
+}
+
+/*!
+ * Bounded multi producer, single consumer ring of log records. Every slot
+ * carries a sequence number: producers claim a position with a CAS on m_head
+ * and publish the slot by storing pos + 1, the writer thread releases it for
+ * the next lap by storing pos + capacity.
+ */
+class AsyncLogSink {
+public:
+	AsyncLogSink(size_t capacity, LogDropPolicy policy) :
+		m_mask(0), m_policy(policy), m_head(0), m_tail(0), m_dropped(0), m_stop(false) {
+		size_t n = 2;
+		while(n < capacity)
+			n <<= 1;
+		m_mask = n - 1;
+		m_slots.reset(new Slot[n]);
+		for(size_t i = 0; i < n; i++)
+			m_slots[i].seq.store(i, std::memory_order_relaxed);
+		m_writer = std::thread(&AsyncLogSink::run, this);
+	}
+
+	~AsyncLogSink() {
+		m_stop.store(true);
+		m_writer.join();
+	}
+
+	void push(int etype, const char* file, int line, const char* desc, va_list args) {
+		size_t pos = m_head.load(std::memory_order_relaxed);
+		Slot* slot;
+		for(;;) {
+			slot = &m_slots[pos & m_mask];
+			size_t seq = slot->seq.load(std::memory_order_acquire);
+			intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+			if(dif == 0) {
+				if(m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if(dif < 0) {
+				//full, the writer has not released this slot yet
+				if(m_policy == ldpDrop) {
+					m_dropped.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+				std::this_thread::yield();
+				pos = m_head.load(std::memory_order_relaxed);
+			}
+			else {
+				pos = m_head.load(std::memory_order_relaxed);
+			}
+		}
+
+		LogRecord& rec = slot->rec;
+		rec.etype = etype;
+		rec.file = file;
+		rec.line = line;
+		time(&rec.rawtime);
+		vsnprintf(rec.msg, sizeof(rec.msg), desc, args);
+		slot->seq.store(pos + 1, std::memory_order_release);
+	}
+
+	void flush() {
+		size_t target = m_head.load(std::memory_order_acquire);
+		while(m_tail.load(std::memory_order_acquire) < target)
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+
+	size_t dropped() const {
+		return m_dropped.load(std::memory_order_relaxed);
+	}
 
-	return;
+private:
+	struct Slot {
+		std::atomic<size_t> seq;
+		LogRecord rec;
+	};
+
+	void run() {
+		string batch;
+		size_t reported = 0;
+		for(;;) {
+			//stop is read first so that records pushed before it are drained
+			bool stop = m_stop.load();
+			size_t tail = m_tail.load(std::memory_order_relaxed);
+			batch.clear();
+			for(;;) {
+				Slot& slot = m_slots[tail & m_mask];
+				if(slot.seq.load(std::memory_order_acquire) != tail + 1)
+					break;
+				FormatRecord(slot.rec, batch);
+				slot.seq.store(tail + m_mask + 1, std::memory_order_release);
+				tail++;
+			}
+
+			size_t dropped = m_dropped.load(std::memory_order_relaxed);
+			if(dropped != reported) {
+				char msg[128];
+				snprintf(msg, sizeof(msg), "WARN: [logger] dropped %zu records, ring is full\n", dropped - reported);
+				batch += msg;
+				reported = dropped;
+			}
+
+			if(!batch.empty())
+				WriteRecords(batch);
+			m_tail.store(tail, std::memory_order_release);
+
+			if(batch.empty()) {
+				if(stop)
+					return;
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+	}
+
+	std::unique_ptr<Slot[]> m_slots;
+	size_t m_mask;
+	LogDropPolicy m_policy;
+	std::atomic<size_t> m_head;
+	std::atomic<size_t> m_tail;
+	std::atomic<size_t> m_dropped;
+	std::atomic<bool> m_stop;
+	std::thread m_writer;
+};
+
+static std::atomic<AsyncLogSink*> g_asyncSink(NULL);
+
+//owns the sink, at exit it drains the ring before the log file is closed
+struct AsyncHolder {
+	std::unique_ptr<AsyncLogSink> sink;
+	~AsyncHolder() { g_asyncSink.store(NULL); }
+};
+
+static AsyncHolder& Holder() {
+	//constructed first, so destroyed after the holder
+	Output();
+	static AsyncHolder holder;
+	return holder;
+}
+
+static void InitAsyncFromEnv() {
+	static std::once_flag once;
+	std::call_once(once, []() {
+		const char* mode = getenv("SDA_LOG_ASYNC");
+		if(mode == NULL)
+			return;
+		string strMode = ToLower(mode);
+		if(strMode == "drop")
+			LogSetAsync(true, 4096, ldpDrop);
+		else if(strMode == "block" || strMode == "1")
+			LogSetAsync(true, 4096, ldpBlock);
+	});
+}
+
+void LogSetAsync(bool enable, size_t capacity, LogDropPolicy policy) {
+	//drain and stop the current writer before replacing it
+	AsyncHolder& holder = Holder();
+	g_asyncSink.store(NULL);
+	holder.sink.reset();
+
+	if(enable) {
+		holder.sink.reset(new AsyncLogSink(capacity, policy));
+		g_asyncSink.store(holder.sink.get());
+	}
 }
 
+void LogFlush() {
+	AsyncLogSink* sink = g_asyncSink.load();
+	if(sink)
+		sink->flush();
 }
 
+size_t LogDroppedCount() {
+	AsyncLogSink* sink = g_asyncSink.load();
+	return sink ? sink->dropped() : 0;
+}
 
+void LogWrapper(int etype, const char* file, int line, const char* desc, ...) {
+	InitAsyncFromEnv();
 
+	va_list args;
+	va_start(args, desc);
+	AsyncLogSink* sink = g_asyncSink.load(std::memory_order_acquire);
+	if(sink) {
+		sink->push(etype, file, line, desc, args);
+		va_end(args);
+		return;
+	}
 
+	//synchronous: format and write on the calling thread
+	LogRecord rec;
+	rec.etype = etype;
+	rec.file = file;
+	rec.line = line;
+	time(&rec.rawtime);
+	vsnprintf(rec.msg, sizeof(rec.msg), desc, args);
+	va_end(args);
+
+	string strOut;
+	FormatRecord(rec, strOut);
+	WriteRecords(strOut);
+}
+
+}
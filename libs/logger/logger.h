@@ -83,6 +83,28 @@ namespace sda {
 	//logging
 	void LogWrapper(int etype, const char* file, int line, const char* desc, ...);
 
+	//what an asynchronous logger does with a record when its ring is full
+	enum LogDropPolicy {ldpBlock, ldpDrop};
+
+	/*!
+	 * Asynchronous logging. Callers format the message into a fixed size record
+	 * and push it to a lock-free ring, a background thread adds the header and
+	 * time stamp and writes the records in batches to the console and the log
+	 * file. capacity is rounded up to a power of two. With ldpBlock a full ring
+	 * makes the caller wait for a free slot, with ldpDrop the record is
+	 * discarded and counted.
+	 *
+	 * Setting SDA_LOG_ASYNC=block or SDA_LOG_ASYNC=drop enables it at the first
+	 * log call. Switch modes while no other thread is logging.
+	 */
+	void LogSetAsync(bool enable, size_t capacity = 4096, LogDropPolicy policy = ldpBlock);
+
+	//wait until every record pushed so far has been written
+	void LogFlush();
+
+	//records discarded by ldpDrop since the asynchronous logger was enabled
+	size_t LogDroppedCount();
+
 }
 
 
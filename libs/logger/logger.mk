@@ -1,3 +1,4 @@
 logger_SRCS:=${COMMON_REPO}/libs/logger/logger.cpp
 logger_HDRS:=${COMMON_REPO}/libs/logger/logger.h
 logger_CXXFLAGS:=-I${COMMON_REPO}/libs/logger
+logger_LDFLAGS:=-lpthread
@@ -0,0 +1,249 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "profiler.h"
+
+namespace sda {
+
+Profiler::Profiler() : m_pending(0) {
+}
+
+Profiler::~Profiler() {
+	//the completion callbacks still reference this object
+	wait();
+}
+
+void Profiler::record(const std::string& stage, cl_event event) {
+	if(event == NULL)
+		return;
+
+	cl_command_queue queue = NULL;
+	clGetEventInfo(event, CL_EVENT_COMMAND_QUEUE, sizeof(queue), &queue, NULL);
+
+	Pending *pending = new Pending;
+	pending->self = this;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::map<std::string, size_t>::iterator it = m_stage_ids.find(stage);
+		if(it == m_stage_ids.end()) {
+			it = m_stage_ids.insert(std::make_pair(stage, m_stages.size())).first;
+			m_stages.push_back(stage);
+		}
+		pending->stage = it->second;
+
+		size_t iq = std::find(m_queues.begin(), m_queues.end(), queue) - m_queues.begin();
+		if(iq == m_queues.size())
+			m_queues.push_back(queue);
+		pending->queue = iq;
+		m_pending++;
+	}
+
+	//the callback may run right away when the event has already completed
+	clRetainEvent(event);
+	if(clSetEventCallback(event, CL_COMPLETE, on_complete, pending) != CL_SUCCESS) {
+		printf("WARNING: Failed to set profiling callback for stage %s\n", stage.c_str());
+		clReleaseEvent(event);
+		delete pending;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pending--;
+		m_cv.notify_all();
+	}
+}
+
+void CL_CALLBACK Profiler::on_complete(cl_event event, cl_int status, void *data) {
+	Pending *pending = static_cast<Pending*>(data);
+	Profiler *self = pending->self;
+
+	Sample s;
+	s.stage = pending->stage;
+	s.queue = pending->queue;
+	cl_int err = CL_SUCCESS;
+	err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &s.queued, NULL);
+	err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &s.submit, NULL);
+	err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &s.start, NULL);
+	err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &s.end, NULL);
+	clReleaseEvent(event);
+	delete pending;
+
+	std::lock_guard<std::mutex> lock(self->m_mutex);
+	//failed commands and queues without profiling enabled leave no sample
+	if(status == CL_COMPLETE && err == CL_SUCCESS && s.end >= s.start)
+		self->m_samples.push_back(s);
+	self->m_pending--;
+	self->m_cv.notify_all();
+}
+
+void Profiler::wait() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_cv.wait(lock, [this]() { return m_pending == 0; });
+}
+
+//m_mutex must be held
+Profiler::Stats Profiler::summarize(size_t stage) {
+	Stats st;
+	st.stage = m_stages[stage];
+	st.count = 0;
+	st.total_ms = st.min_ms = st.avg_ms = st.p50_ms = st.p99_ms = st.max_ms = 0.0;
+	st.avg_wait_ms = 0.0;
+
+	std::vector<double> durations;
+	double wait_ms = 0.0;
+	for(size_t i = 0; i < m_samples.size(); i++) {
+		const Sample& s = m_samples[i];
+		if(s.stage != stage)
+			continue;
+		durations.push_back((s.end - s.start) * 1e-6);
+		if(s.start > s.queued)
+			wait_ms += (s.start - s.queued) * 1e-6;
+	}
+	if(durations.empty())
+		return st;
+
+	std::sort(durations.begin(), durations.end());
+	st.count = durations.size();
+	for(size_t i = 0; i < durations.size(); i++)
+		st.total_ms += durations[i];
+
+	//nearest rank percentiles
+	size_t n = durations.size();
+	st.min_ms = durations.front();
+	st.max_ms = durations.back();
+	st.avg_ms = st.total_ms / n;
+	st.p50_ms = durations[(size_t)std::ceil(0.50 * n) - 1];
+	st.p99_ms = durations[(size_t)std::ceil(0.99 * n) - 1];
+	st.avg_wait_ms = wait_ms / n;
+	return st;
+}
+
+std::vector<Profiler::Stats> Profiler::stats() {
+	wait();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::vector<Stats> res;
+	for(size_t i = 0; i < m_stages.size(); i++)
+		res.push_back(summarize(i));
+	return res;
+}
+
+Profiler::Stats Profiler::stats(const std::string& stage) {
+	wait();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::map<std::string, size_t>::iterator it = m_stage_ids.find(stage);
+	if(it == m_stage_ids.end()) {
+		Stats st = Stats();
+		st.stage = stage;
+		return st;
+	}
+	return summarize(it->second);
+}
+
+void Profiler::print_stats() {
+	std::vector<Stats> all = stats();
+	printf("%-16s %8s %12s %10s %10s %10s %10s %10s %10s\n", "stage [ms]", "count",
+			"total", "min", "avg", "p50", "p99", "max", "avg wait");
+	for(size_t i = 0; i < all.size(); i++) {
+		const Stats& st = all[i];
+		printf("%-16s %8zu %12.3f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+				st.stage.c_str(), st.count, st.total_ms, st.min_ms, st.avg_ms,
+				st.p50_ms, st.p99_ms, st.max_ms, st.avg_wait_ms);
+	}
+}
+
+static std::string json_escape(const std::string& str) {
+	std::string res;
+	for(size_t i = 0; i < str.size(); i++) {
+		if(str[i] == '"' || str[i] == '\\')
+			res += '\\';
+		res += str[i];
+	}
+	return res;
+}
+
+bool Profiler::write_trace(const std::string& path) {
+	wait();
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	FILE *fp = fopen(path.c_str(), "w");
+	if(fp == NULL) {
+		printf("ERROR: Failed to open trace file %s\n", path.c_str());
+		return false;
+	}
+
+	//timestamps are relative to the first queued command
+	cl_ulong t0 = 0;
+	for(size_t i = 0; i < m_samples.size(); i++) {
+		if(i == 0 || m_samples[i].queued < t0)
+			t0 = m_samples[i].queued;
+	}
+
+	//one process per command queue and one thread per stage
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	for(size_t q = 0; q < m_queues.size(); q++) {
+		fprintf(fp, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%zu,\"args\":{\"name\":\"queue %zu\"}}",
+				first ? "" : ",\n", q, q);
+		first = false;
+		for(size_t st = 0; st < m_stages.size(); st++) {
+			fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%zu,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+					q, st, json_escape(m_stages[st]).c_str());
+		}
+	}
+	for(size_t i = 0; i < m_samples.size(); i++) {
+		const Sample& s = m_samples[i];
+		fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"opencl\",\"ph\":\"X\",\"pid\":%zu,\"tid\":%zu,"
+				"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"queued_us\":%.3f,\"submit_us\":%.3f}}",
+				first ? "" : ",\n", json_escape(m_stages[s.stage]).c_str(), s.queue, s.stage,
+				(s.start - t0) * 1e-3, (s.end - s.start) * 1e-3,
+				(s.queued - t0) * 1e-3, (s.submit - t0) * 1e-3);
+		first = false;
+	}
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+
+	printf("INFO: Wrote %zu events to trace %s\n", m_samples.size(), path.c_str());
+	return true;
+}
+
+void Profiler::report() {
+	print_stats();
+	const char *path = getenv("SDA_TRACE");
+	if(path != NULL && path[0] != '\0')
+		write_trace(path);
+}
+
+void Profiler::clear() {
+	wait();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_samples.clear();
+}
+
+}
@@ -0,0 +1,132 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <CL/opencl.h>
+
+namespace sda {
+
+	/*!
+	 * Event timeline shared by the host applications. Commands are attached
+	 * to a named stage (host write, kernel exec, ...) when they are enqueued.
+	 * Their queued/submit/start/end timestamps are collected once the command
+	 * completes, so in flight events can be recorded without waiting on them.
+	 * The command queue must be created with CL_QUEUE_PROFILING_ENABLE.
+	 *
+	 * Setting SDA_TRACE=<file> makes report() also write a Chrome trace
+	 * (chrome://tracing) with one row per stage and command queue, showing how
+	 * transfers and kernel executions overlap.
+	 */
+	class Profiler {
+	public:
+		//per stage summary of the start to end durations, in milliseconds
+		struct Stats {
+			std::string stage;
+			size_t count;
+			double total_ms;
+			double min_ms;
+			double avg_ms;
+			double p50_ms;
+			double p99_ms;
+			double max_ms;
+			double avg_wait_ms; //queued to start
+		};
+
+		Profiler();
+		~Profiler();
+
+		Profiler(const Profiler&) = delete;
+		Profiler& operator=(const Profiler&) = delete;
+
+		//attach an event to a stage, the event is retained until it completes
+		void record(const std::string& stage, cl_event event);
+
+		//cl::Event and other wrappers returning the cl_event from operator()
+		template<typename E>
+		void record(const std::string& stage, const E& event) {
+			record(stage, event());
+		}
+
+		//block until every recorded event has completed and been collected
+		void wait();
+
+		//stages in the order they were first recorded
+		std::vector<Stats> stats();
+		Stats stats(const std::string& stage);
+		double total_ms(const std::string& stage) { return stats(stage).total_ms; }
+
+		void print_stats();
+
+		//write the collected timeline as Chrome trace JSON
+		bool write_trace(const std::string& path);
+
+		//print_stats() and write_trace($SDA_TRACE) when the variable is set
+		void report();
+
+		//drop collected samples, stage names are kept
+		void clear();
+
+	private:
+		struct Sample {
+			size_t stage;
+			size_t queue;
+			cl_ulong queued;
+			cl_ulong submit;
+			cl_ulong start;
+			cl_ulong end;
+		};
+
+		struct Pending {
+			Profiler *self;
+			size_t stage;
+			size_t queue;
+		};
+
+		static void CL_CALLBACK on_complete(cl_event event, cl_int status, void *data);
+		Stats summarize(size_t stage);
+
+		std::vector<std::string> m_stages;
+		std::map<std::string, size_t> m_stage_ids;
+		std::vector<cl_command_queue> m_queues;
+		std::vector<Sample> m_samples;
+		size_t m_pending;
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+	};
+
+}
+
+#endif /* PROFILER_H_ */
@@ -0,0 +1,4 @@
+profiler_SRCS:=${COMMON_REPO}/libs/profiler/profiler.cpp
+profiler_HDRS:=${COMMON_REPO}/libs/profiler/profiler.h
+profiler_CXXFLAGS:=-I${COMMON_REPO}/libs/profiler
+profiler_LDFLAGS:=-lpthread
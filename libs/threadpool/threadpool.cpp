@@ -0,0 +1,86 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+#include <algorithm>
+#include "threadpool.h"
+
+namespace sda {
+
+ThreadPool::ThreadPool(size_t nthreads) : m_stop(false) {
+	if(nthreads == 0)
+		nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+	for(size_t i = 0; i < nthreads; i++)
+		m_workers.emplace_back(&ThreadPool::worker, this);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cv.notify_all();
+	for(size_t i = 0; i < m_workers.size(); i++)
+		m_workers[i].join();
+}
+
+void ThreadPool::worker() {
+	for(;;) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+			if(m_stop && m_tasks.empty())
+				return;
+			task = std::move(m_tasks.front());
+			m_tasks.pop();
+		}
+		task();
+	}
+}
+
+void ThreadPool::parallel_for(size_t count, size_t grain,
+		const std::function<void(size_t, size_t)>& body) {
+	if(count == 0)
+		return;
+	if(grain == 0)
+		grain = std::max<size_t>(1, count / (4 * m_workers.size()));
+
+	std::vector<std::future<void>> pending;
+	pending.reserve((count + grain - 1) / grain);
+	for(size_t begin = 0; begin < count; begin += grain) {
+		size_t end = std::min(count, begin + grain);
+		pending.push_back(enqueue([&body, begin, end]() { body(begin, end); }));
+	}
+
+	//get() rethrows any exception raised by a chunk
+	for(size_t i = 0; i < pending.size(); i++)
+		pending[i].get();
+}
+
+}
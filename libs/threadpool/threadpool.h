@@ -0,0 +1,90 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace sda {
+
+	/*!
+	 * Fixed size pool of worker threads used by the host side CPU engines.
+	 * Tasks are run in submission order by whichever worker is free first.
+	 */
+	class ThreadPool {
+	public:
+		//nthreads == 0 selects one worker per hardware thread
+		explicit ThreadPool(size_t nthreads = 0);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		size_t size() const { return m_workers.size(); }
+
+		//queue a task and return a future for its result
+		template<typename F>
+		std::future<typename std::result_of<F()>::type> enqueue(F&& f) {
+			typedef typename std::result_of<F()>::type R;
+			auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+			std::future<R> res = task->get_future();
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_tasks.push([task]() { (*task)(); });
+			}
+			m_cv.notify_one();
+			return res;
+		}
+
+		//split [0, count) into chunks of at most grain items, run body(begin, end)
+		//on every chunk and wait for all of them. grain == 0 picks a chunk size
+		//giving a few chunks per worker.
+		void parallel_for(size_t count, size_t grain,
+				const std::function<void(size_t, size_t)>& body);
+
+	private:
+		void worker();
+
+		std::vector<std::thread> m_workers;
+		std::queue<std::function<void()>> m_tasks;
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		bool m_stop;
+	};
+
+}
+
+#endif /* THREADPOOL_H_ */
@@ -0,0 +1,4 @@
+threadpool_SRCS:=${COMMON_REPO}/libs/threadpool/threadpool.cpp
+threadpool_HDRS:=${COMMON_REPO}/libs/threadpool/threadpool.h
+threadpool_CXXFLAGS:=-I${COMMON_REPO}/libs/threadpool
+threadpool_LDFLAGS:=-lpthread
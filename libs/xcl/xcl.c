@@ -32,6 +32,8 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <unistd.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <string.h>
@@ -80,6 +82,61 @@ static int load_file_to_memory(const char *filename, char **result) {
 	return size;
 }
 
+/* Lookup and program caches
+ *
+ * xclbin name lookups and programs created from xclbins are cached for the
+ * lifetime of the process (programs until their context is released by
+ * xcl_release_world). Programs are keyed by context, device and the path,
+ * inode, size and modification time of the xclbin, so a hit never reads the
+ * file and a rebuilt xclbin misses. Setting XCL_PROGRAM_CACHE=0 disables both
+ * caches.
+ * The caches are not thread safe.
+ */
+#define XCL_CACHE_SIZE 16
+
+typedef struct {
+	char *key;
+	char *file_name;
+} xcl_name_entry;
+
+typedef struct {
+	cl_context context;
+	cl_device_id device_id;
+	char *file_name;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	cl_program program;
+} xcl_program_entry;
+
+static xcl_name_entry name_cache[XCL_CACHE_SIZE];
+static xcl_program_entry program_cache[XCL_CACHE_SIZE];
+
+static int cache_enabled() {
+	char *env = getenv("XCL_PROGRAM_CACHE");
+	return env == NULL || strcmp(env, "0") != 0;
+}
+
+/* Memory map a file instead of copying it into the heap */
+static void *map_file(const char *filename, size_t *size) {
+	struct stat sb;
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &sb) != 0) {
+		printf("Error: Could not read file %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	void *data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		printf("Error: Could not map file %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	*size = sb.st_size;
+	return data;
+}
+
 char* xcl_create_and_set(const char* str) {
 	size_t len = strlen(str);
 	char *ret = (char*) malloc(sizeof(char)*(len+1));
@@ -239,6 +296,15 @@ xcl_world xcl_world_single() {
 }
 
 void xcl_release_world(xcl_world world) {
+	int i;
+	for (i = 0; i < XCL_CACHE_SIZE; i++) {
+		if (program_cache[i].program && program_cache[i].context == world.context) {
+			clReleaseProgram(program_cache[i].program);
+			program_cache[i].program = NULL;
+			free(program_cache[i].file_name);
+			program_cache[i].file_name = NULL;
+		}
+	}
 	clReleaseCommandQueue(world.command_queue);
 	clReleaseContext(world.context);
 	free(world.device_name);
@@ -258,8 +324,29 @@ cl_program xcl_import_binary_file(xcl_world world,
 		exit(EXIT_FAILURE);
 	}
 
-	char *krnl_bin;
-	const size_t krnl_size = load_file_to_memory(xclbin_file_name, &krnl_bin);
+	int use_cache = cache_enabled();
+	struct stat sb;
+	int i, slot = -1;
+	if (use_cache && stat(xclbin_file_name, &sb) == 0) {
+		for (i = 0; i < XCL_CACHE_SIZE; i++) {
+			xcl_program_entry *e = &program_cache[i];
+			if (e->program == NULL) {
+				if (slot < 0)
+					slot = i;
+			} else if (e->context == world.context &&
+			           e->device_id == world.device_id &&
+			           e->ino == sb.st_ino && e->size == sb.st_size &&
+			           e->mtime == sb.st_mtime &&
+			           strcmp(e->file_name, xclbin_file_name) == 0) {
+				printf("INFO: Reusing cached program\n");
+				clRetainProgram(e->program);
+				return e->program;
+			}
+		}
+	}
+
+	size_t krnl_size;
+	void *krnl_bin = map_file(xclbin_file_name, &krnl_size);
 	printf("INFO: Loaded file\n");
 
 	cl_program program = clCreateProgramWithBinary(world.context, 1,
@@ -289,13 +376,54 @@ cl_program xcl_import_binary_file(xcl_world world,
 
 	printf("INFO: Built Program\n");
 
-	free(krnl_bin);
+	munmap(krnl_bin, krnl_size);
+
+	if (use_cache && slot >= 0) {
+		program_cache[slot].context = world.context;
+		program_cache[slot].device_id = world.device_id;
+		program_cache[slot].file_name = xcl_create_and_set(xclbin_file_name);
+		program_cache[slot].ino = sb.st_ino;
+		program_cache[slot].size = sb.st_size;
+		program_cache[slot].mtime = sb.st_mtime;
+		program_cache[slot].program = program;
+		clRetainProgram(program);
+	}
 
 	return program;
 }
 
+static char *search_xclbin_name(xcl_world world, const char *xclbin_name);
+
 char *xcl_get_xclbin_name(xcl_world world,
                                 const char *xclbin_name
+) {
+	/* the search probes up to 16 paths, resolve each name only once */
+	char *xcl_bindir = getenv("XCL_BINDIR");
+	char key[PATH_MAX];
+	snprintf(key, PATH_MAX, "%s|%s|%s|%s", world.mode, world.device_name,
+	         xclbin_name, xcl_bindir ? xcl_bindir : "");
+
+	int use_cache = cache_enabled();
+	int i;
+	if (use_cache) {
+		for (i = 0; i < XCL_CACHE_SIZE && name_cache[i].key; i++) {
+			if (strcmp(name_cache[i].key, key) == 0)
+				return xcl_create_and_set(name_cache[i].file_name);
+		}
+	}
+
+	char *xclbin_file_name = search_xclbin_name(world, xclbin_name);
+
+	if (use_cache && i < XCL_CACHE_SIZE) {
+		name_cache[i].key = xcl_create_and_set(key);
+		name_cache[i].file_name = xcl_create_and_set(xclbin_file_name);
+	}
+
+	return xclbin_file_name;
+}
+
+static char *search_xclbin_name(xcl_world world,
+                                const char *xclbin_name
 ) {
 	char *xcl_bindir = getenv("XCL_BINDIR");
 
@@ -29,9 +29,21 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <unistd.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include "xcl2.hpp"
 namespace xcl {
+
+// Guards the lookup, xclbin and program caches below
+static std::mutex cache_mutex;
+
+static bool cache_enabled()
+{
+    char *env = getenv("XCL_PROGRAM_CACHE");
+    return env == NULL || strcmp(env, "0") != 0;
+}
+
 std::vector<cl::Device> get_devices(const std::string& vendor_name) {
 
     size_t i;
@@ -61,30 +73,160 @@ std::vector<cl::Device> get_devices(const std::string& vendor_name) {
 std::vector<cl::Device> get_xil_devices() {
 	return get_devices("Xilinx");
 }
-cl::Program::Binaries import_binary_file(std::string xclbin_file_name) 
+static std::string search_binary_file(const std::string& _device_name,
+                                      const std::string& xclbin_name);
+
+// Memory mapped xclbin. Cached mappings are kept for the lifetime of the
+// process, the others belong to the caller (see unmap_xclbin).
+struct MappedXclbin {
+    const void *data;
+    size_t size;
+    unsigned long long hash;
+    bool cached;
+};
+
+// 64 bit FNV-1a over 8 byte words, good enough to tell xclbins apart
+static unsigned long long content_hash(const void *data, size_t size)
 {
-    std::cout << "INFO: Importing " << xclbin_file_name << std::endl;
+    unsigned long long h = 14695981039346656037ULL;
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        unsigned long long w;
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 1099511628211ULL;
+    }
+    for (; i < size; i++)
+        h = (h ^ p[i]) * 1099511628211ULL;
+    return (h ^ size) * 1099511628211ULL;
+}
+
+// keep forces the mapping into the cache, for callers that hand it out
+static MappedXclbin map_xclbin(const std::string &xclbin_file_name, bool keep)
+{
+    static std::map<std::string, MappedXclbin> mapped;
+    bool use_cache = cache_enabled() || keep;
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    std::map<std::string, MappedXclbin>::iterator it = mapped.find(xclbin_file_name);
+    if (use_cache && it != mapped.end())
+        return it->second;
 
-	if(access(xclbin_file_name.c_str(), R_OK) != 0) {
+    if(access(xclbin_file_name.c_str(), R_OK) != 0) {
 		printf("ERROR: %s xclbin not available please build\n", xclbin_file_name.c_str());
 		exit(EXIT_FAILURE);
 	}
-    //Loading XCL Bin into char buffer 
     std::cout << "Loading: '" << xclbin_file_name.c_str() << "'\n";
-    std::ifstream bin_file(xclbin_file_name.c_str(), std::ifstream::binary);
-    bin_file.seekg (0, bin_file.end);
-    unsigned nb = bin_file.tellg();
-    bin_file.seekg (0, bin_file.beg);
-    char *buf = new char [nb];
-    bin_file.read(buf, nb);
-   
+    int fd = open(xclbin_file_name.c_str(), O_RDONLY);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+        printf("ERROR: Failed to open %s\n", xclbin_file_name.c_str());
+        exit(EXIT_FAILURE);
+    }
+    void *data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("ERROR: Failed to map %s\n", xclbin_file_name.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    MappedXclbin xclbin;
+    xclbin.data = data;
+    xclbin.size = sb.st_size;
+    xclbin.hash = content_hash(data, sb.st_size);
+    xclbin.cached = use_cache;
+    if (use_cache)
+        mapped[xclbin_file_name] = xclbin;
+    return xclbin;
+}
+
+static void unmap_xclbin(const MappedXclbin &xclbin)
+{
+    if (!xclbin.cached)
+        munmap(const_cast<void *>(xclbin.data), xclbin.size);
+}
+
+cl::Program::Binaries import_binary_file(std::string xclbin_file_name) 
+{
+    std::cout << "INFO: Importing " << xclbin_file_name << std::endl;
+
+    //Memory map the XCL Bin, the returned binaries point into the mapping
+    //so it stays valid for the whole process, and is reused by later calls
+    MappedXclbin xclbin = map_xclbin(xclbin_file_name, true);
+
     cl::Program::Binaries bins;
-    bins.push_back({buf,nb});
+    bins.push_back({xclbin.data, xclbin.size});
     return bins;
 }
 
-std::string 
-find_binary_file(const std::string& _device_name, const std::string& xclbin_name) 
+cl::Program get_program(const cl::Context &context, const cl::Device &device,
+                        const std::string &xclbin_name)
+{
+    // cache key: context, device and xclbin contents
+    typedef std::pair<std::pair<cl_context, cl_device_id>, unsigned long long> Key;
+    static std::map<Key, cl::Program> programs;
+
+    std::string device_name = device.getInfo<CL_DEVICE_NAME>();
+    std::string binaryFile = find_binary_file(device_name, xclbin_name);
+    MappedXclbin xclbin = map_xclbin(binaryFile, false);
+
+    Key key(std::make_pair(context(), device()), xclbin.hash);
+    bool use_cache = cache_enabled();
+    if (use_cache) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        std::map<Key, cl::Program>::iterator it = programs.find(key);
+        if (it != programs.end())
+            return it->second;
+    }
+
+    std::cout << "INFO: Importing " << binaryFile << std::endl;
+    cl::Program::Binaries bins;
+    bins.push_back({xclbin.data, xclbin.size});
+    std::vector<cl::Device> devices(1, device);
+    cl_int err;
+    cl::Program program(context, devices, bins, NULL, &err);
+    //the program holds its own copy of the binary
+    unmap_xclbin(xclbin);
+    if (err != CL_SUCCESS) {
+        printf("Error: Failed to create program from %s, error %d\n", binaryFile.c_str(), err);
+        exit(EXIT_FAILURE);
+    }
+
+    if (use_cache) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        programs[key] = program;
+    }
+    return program;
+}
+
+std::string
+find_binary_file(const std::string& _device_name, const std::string& xclbin_name)
+{
+    // the search below probes up to 16 paths, resolve each name only once
+    static std::map<std::string, std::string> resolved;
+    char *xcl_mode = getenv("XCL_EMULATION_MODE");
+    char *xcl_target = getenv("XCL_TARGET");
+    char *xcl_bindir = getenv("XCL_BINDIR");
+    std::string key = _device_name + "|" + xclbin_name
+        + "|" + (xcl_mode ? xcl_mode : "") + "|" + (xcl_target ? xcl_target : "")
+        + "|" + (xcl_bindir ? xcl_bindir : "");
+    bool use_cache = cache_enabled();
+    if (use_cache) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        std::map<std::string, std::string>::iterator it = resolved.find(key);
+        if (it != resolved.end())
+            return it->second;
+    }
+
+    std::string file_name = search_binary_file(_device_name, xclbin_name);
+    if (use_cache) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        resolved[key] = file_name;
+    }
+    return file_name;
+}
+
+static std::string
+search_binary_file(const std::string& _device_name, const std::string& xclbin_name)
 {
     std::cout << "XCLBIN File Name: " << xclbin_name.c_str() << std::endl;
     char *xcl_mode = getenv("XCL_EMULATION_MODE");
@@ -274,4 +416,418 @@ bool is_xpr_device(const char *device_name) {
 }
 
 
+// Upper bound on the number of compute units probed per kernel
+#define MAX_CUS 16
+
+Scheduler::Scheduler(const cl::Context &context, const cl::Device &device,
+                     const cl::Program &program, const std::string &kernel_name,
+                     Policy policy, size_t max_inflight)
+    : m_policy(policy), m_max_inflight(max_inflight), m_next_cu(0),
+      m_pending(0), m_stop(false)
+{
+    std::vector<std::string> cu_names;
+    for (int i = 1; i <= MAX_CUS; i++) {
+        std::string cu = kernel_name + "_" + std::to_string(i);
+        cl_int err;
+        cl::Kernel probe(program, (kernel_name + ":{" + cu + "}").c_str(), &err);
+        if (err != CL_SUCCESS)
+            break;
+        cu_names.push_back(cu);
+    }
+    init(context, device, program, kernel_name, cu_names);
+}
+
+Scheduler::Scheduler(const cl::Context &context, const cl::Device &device,
+                     const cl::Program &program, const std::string &kernel_name,
+                     const std::vector<std::string> &cu_names,
+                     Policy policy, size_t max_inflight)
+    : m_policy(policy), m_max_inflight(max_inflight), m_next_cu(0),
+      m_pending(0), m_stop(false)
+{
+    init(context, device, program, kernel_name, cu_names);
+}
+
+void Scheduler::init(const cl::Context &context, const cl::Device &device,
+                     const cl::Program &program, const std::string &kernel_name,
+                     const std::vector<std::string> &cu_names)
+{
+    if (m_max_inflight == 0)
+        m_max_inflight = 1;
+
+    cl_int err;
+    if (cu_names.empty()) {
+        // no named compute units, let the runtime pick for every launch
+        std::unique_ptr<ComputeUnit> cu(new ComputeUnit());
+        cu->name = kernel_name;
+        cu->kernel = cl::Kernel(program, kernel_name.c_str(), &err);
+        if (err != CL_SUCCESS) {
+            printf("Error: Failed to create kernel %s\n", kernel_name.c_str());
+            exit(EXIT_FAILURE);
+        }
+        m_cus.push_back(std::move(cu));
+    }
+    for (size_t i = 0; i < cu_names.size(); i++) {
+        std::unique_ptr<ComputeUnit> cu(new ComputeUnit());
+        cu->name = cu_names[i];
+        cu->kernel = cl::Kernel(program, (kernel_name + ":{" + cu_names[i] + "}").c_str(), &err);
+        if (err != CL_SUCCESS) {
+            printf("Error: Failed to create compute unit %s of kernel %s\n",
+                   cu_names[i].c_str(), kernel_name.c_str());
+            exit(EXIT_FAILURE);
+        }
+        m_cus.push_back(std::move(cu));
+    }
+    for (size_t i = 0; i < m_cus.size(); i++) {
+        m_cus[i]->queue = cl::CommandQueue(context, device,
+                CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE | CL_QUEUE_PROFILING_ENABLE, &err);
+        if (err != CL_SUCCESS) {
+            printf("Error: Failed to create command queue for %s\n", m_cus[i]->name.c_str());
+            exit(EXIT_FAILURE);
+        }
+        m_cus[i]->inflight = 0;
+        m_cus[i]->completed = 0;
+    }
+    std::cout << "INFO: Scheduling " << kernel_name << " over " << m_cus.size()
+              << " compute unit(s)" << std::endl;
+
+    m_dispatcher = std::thread(&Scheduler::dispatcher, this);
+}
+
+Scheduler::~Scheduler()
+{
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    m_dispatcher.join();
+}
+
+std::future<size_t> Scheduler::submit(Task task)
+{
+    WorkItem item;
+    item.task = task;
+    item.promise = std::make_shared<std::promise<size_t>>();
+    std::future<size_t> res = item.promise->get_future();
+    enqueue(item);
+    return res;
+}
+
+void Scheduler::submit(Task task, Callback done)
+{
+    WorkItem item;
+    item.task = task;
+    item.done = done;
+    enqueue(item);
+}
+
+void Scheduler::enqueue(WorkItem item)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_ready.push_back(item);
+        m_pending++;
+    }
+    m_cv.notify_all();
+}
+
+void Scheduler::finish()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return m_pending == 0; });
+}
+
+std::vector<size_t> Scheduler::completed_per_cu() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<size_t> res;
+    for (size_t i = 0; i < m_cus.size(); i++)
+        res.push_back(m_cus[i]->completed);
+    return res;
+}
+
+// Select the compute unit for the next work item, called with m_mutex held.
+// Returns false if every compute unit already has max_inflight items.
+bool Scheduler::pick_cu(size_t &cu)
+{
+    size_t n = m_cus.size();
+    bool found = false;
+    for (size_t k = 0; k < n; k++) {
+        size_t i = (m_next_cu + k) % n;
+        if (m_cus[i]->inflight >= m_max_inflight)
+            continue;
+        if (!found || (m_policy == LEAST_LOADED && m_cus[i]->inflight < m_cus[cu]->inflight)) {
+            cu = i;
+            found = true;
+            if (m_policy == ROUND_ROBIN)
+                break;
+        }
+    }
+    if (found)
+        m_next_cu = (cu + 1) % n;
+    return found;
+}
+
+void Scheduler::dispatcher()
+{
+    for (;;) {
+        size_t cu = 0;
+        WorkItem item;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [&]() {
+                return m_stop || (!m_ready.empty() && pick_cu(cu));
+            });
+            if (m_ready.empty())
+                return;
+            item = m_ready.front();
+            m_ready.pop_front();
+            m_cus[cu]->inflight++;
+        }
+
+        // the work item enqueues its commands outside of the lock
+        Completion *c = new Completion();
+        c->sched = this;
+        c->cu = cu;
+        c->item = item;
+        try {
+            c->event = item.task(m_cus[cu]->queue, m_cus[cu]->kernel);
+        } catch (...) {
+            printf("Error: work item on %s threw\n", m_cus[cu]->name.c_str());
+            if (item.promise)
+                item.promise->set_exception(std::current_exception());
+            else if (item.done)
+                item.done(cu, CL_INVALID_OPERATION);
+            complete(c, CL_INVALID_OPERATION);
+            continue;
+        }
+        m_cus[cu]->queue.flush();
+        // an empty event has nothing to attach a callback to, the work item
+        // is over once whatever it enqueued has drained from the queue
+        cl_int status = CL_COMPLETE;
+        if (c->event() == nullptr)
+            status = m_cus[cu]->queue.finish();
+        else if (clSetEventCallback(c->event(), CL_COMPLETE, on_complete, c) == CL_SUCCESS)
+            continue;
+        else
+            // no callback possible, wait for the work item here
+            status = c->event.wait();
+        on_complete(c->event(), status, c);
+    }
+}
+
+void CL_CALLBACK Scheduler::on_complete(cl_event ev, cl_int status, void *data)
+{
+    Completion *c = static_cast<Completion *>(data);
+    if (status < 0) {
+        printf("Error: work item on %s failed, status %d\n",
+               c->sched->m_cus[c->cu]->name.c_str(), status);
+        if (c->item.promise)
+            c->item.promise->set_exception(std::make_exception_ptr(
+                    std::runtime_error("xcl::Scheduler work item failed")));
+        else if (c->item.done)
+            c->item.done(c->cu, status);
+    } else {
+        if (c->item.promise)
+            c->item.promise->set_value(c->cu);
+        else if (c->item.done)
+            c->item.done(c->cu, CL_COMPLETE);
+    }
+    c->sched->complete(c, status);
+}
+
+// Release the compute unit slot of a finished work item and free c
+void Scheduler::complete(Completion *c, cl_int status)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cus[c->cu]->inflight--;
+        if (status >= 0)
+            m_cus[c->cu]->completed++;
+        m_pending--;
+    }
+    m_cv.notify_all();
+    delete c;
+}
+
+#define POOL_PAGE_SIZE 4096
+
+struct PooledBuffer::Block {
+    void *host;
+    size_t capacity;
+    cl_mem_flags flags;
+    cl::Buffer buffer;
+};
+
+PooledBuffer::PooledBuffer(PooledBuffer &&other)
+    : m_pool(other.m_pool), m_block(other.m_block), m_size(other.m_size)
+{
+    other.m_pool = NULL;
+    other.m_block = NULL;
+    other.m_size = 0;
+}
+
+PooledBuffer &PooledBuffer::operator=(PooledBuffer &&other)
+{
+    if (this != &other) {
+        release();
+        m_pool = other.m_pool;
+        m_block = other.m_block;
+        m_size = other.m_size;
+        other.m_pool = NULL;
+        other.m_block = NULL;
+        other.m_size = 0;
+    }
+    return *this;
+}
+
+void *PooledBuffer::host() const
+{
+    return m_block ? m_block->host : NULL;
+}
+
+const cl::Buffer &PooledBuffer::buffer() const
+{
+    return m_block->buffer;
+}
+
+size_t PooledBuffer::capacity() const
+{
+    return m_block ? m_block->capacity : 0;
+}
+
+void PooledBuffer::release()
+{
+    if (m_block) {
+        m_pool->give_back(m_block);
+        m_pool = NULL;
+        m_block = NULL;
+        m_size = 0;
+    }
+}
+
+BufferPool::BufferPool(const cl::Context &context, size_t max_bytes_held)
+    : m_context(context), m_max_bytes_held(max_bytes_held)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+BufferPool::~BufferPool()
+{
+    // blocks still handed out are owned by their PooledBuffer and must have
+    // been released before the pool goes away
+    trim();
+}
+
+size_t BufferPool::size_class(size_t size)
+{
+    size_t pages = (size + POOL_PAGE_SIZE - 1) / POOL_PAGE_SIZE;
+    if (pages == 0)
+        pages = 1;
+    if (pages <= 16)
+        return pages * POOL_PAGE_SIZE;
+
+    size_t pow2 = 16;
+    while (pow2 * 2 <= pages)
+        pow2 *= 2;
+    size_t step = pow2 / 4;
+    return ((pages + step - 1) / step) * step * POOL_PAGE_SIZE;
+}
+
+PooledBuffer BufferPool::acquire(size_t size, cl_mem_flags flags)
+{
+    size_t capacity = size_class(size);
+    Key key(capacity, flags);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::multimap<Key, PooledBuffer::Block *>::iterator it = m_idle.find(key);
+        if (it != m_idle.end()) {
+            PooledBuffer::Block *block = it->second;
+            m_idle.erase(it);
+            m_stats.hits++;
+            m_stats.bytes_in_use += capacity;
+            return PooledBuffer(this, block, size);
+        }
+    }
+
+    // allocate outside of the lock, pinning can take a while
+    PooledBuffer::Block *block = new PooledBuffer::Block();
+    block->capacity = capacity;
+    block->flags = flags;
+    block->host = NULL;
+    if (posix_memalign(&block->host, POOL_PAGE_SIZE, capacity)) {
+        delete block;
+        throw std::bad_alloc();
+    }
+    if (flags != 0) {
+        cl_int err;
+        block->buffer = cl::Buffer(m_context, flags | CL_MEM_USE_HOST_PTR,
+                                   capacity, block->host, &err);
+        if (err != CL_SUCCESS) {
+            printf("Error: Failed to create pooled buffer of %zu bytes, error %d\n",
+                   capacity, err);
+            free(block->host);
+            delete block;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.misses++;
+    m_stats.bytes_held += capacity;
+    m_stats.bytes_in_use += capacity;
+    if (m_stats.bytes_held > m_stats.peak_bytes_held)
+        m_stats.peak_bytes_held = m_stats.bytes_held;
+    return PooledBuffer(this, block, size);
+}
+
+void BufferPool::give_back(PooledBuffer::Block *block)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.bytes_in_use -= block->capacity;
+    if (m_max_bytes_held && m_stats.bytes_held > m_max_bytes_held) {
+        free_block(block);
+        return;
+    }
+    m_idle.insert(std::make_pair(Key(block->capacity, block->flags), block));
+}
+
+// Called with m_mutex held
+void BufferPool::free_block(PooledBuffer::Block *block)
+{
+    m_stats.bytes_held -= block->capacity;
+    block->buffer = cl::Buffer();
+    free(block->host);
+    delete block;
+}
+
+void BufferPool::trim()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (std::multimap<Key, PooledBuffer::Block *>::iterator it = m_idle.begin();
+         it != m_idle.end(); ++it) {
+        free_block(it->second);
+    }
+    m_idle.clear();
+}
+
+BufferPool::Stats BufferPool::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void BufferPool::print_stats(std::ostream &os) const
+{
+    Stats s = stats();
+    size_t requests = s.hits + s.misses;
+    os << "Buffer pool: " << requests << " requests, " << s.hits << " hits, "
+       << s.misses << " misses";
+    if (requests)
+        os << " (" << (100.0 * s.hits / requests) << "% hit rate)";
+    os << ", " << s.bytes_held << " bytes held, " << s.bytes_in_use
+       << " in use, peak " << s.peak_bytes_held << std::endl;
+}
+
 };
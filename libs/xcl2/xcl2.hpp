@@ -38,6 +38,15 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <CL/cl2.hpp>
 #include <iostream>
 #include <fstream>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
 
 // When creating a buffer with user pointer (CL_MEM_USE_HOST_PTR), under the hood
 // User ptr is used if and only if it is properly aligned (page aligned). When not 
@@ -97,13 +106,234 @@ std::vector<cl::Device> get_devices(const std::string& vendor_name);
  *   _device_name - Targeted Device name
  *   xclbin_name - base name of the xclbin to import.
  *
+ *   The result is cached per device, name, XCL_EMULATION_MODE, XCL_TARGET
+ *   and XCL_BINDIR, so the search only runs once per process.
+ *
  * Returns:
  *   An opencl program Binaries object that was created from xclbin_name file.
  */
 std::string find_binary_file(const std::string& _device_name, const std::string& xclbin_name);
+/* import_binary_file
+ *
+ * Description:
+ *   Memory map an xclbin file. The mapping is kept for the lifetime of the
+ *   process and shared by every import of the same file.
+ */
 cl::Program::Binaries import_binary_file(std::string xclbin_file_name); 
+/* get_program
+ *
+ * Description:
+ *   Find, import and create the program of xclbin_name for a device. Programs
+ *   are cached per context, device and xclbin contents (64 bit hash), so
+ *   several kernels or modules of one process share a single cl::Program.
+ *
+ *   Setting XCL_PROGRAM_CACHE=0 disables the lookup, xclbin and program
+ *   caches, which is useful to measure their effect on startup time.
+ */
+cl::Program get_program(const cl::Context &context, const cl::Device &device,
+                        const std::string &xclbin_name);
 bool is_emulation () ;
 bool is_hw_emulation () ;
 bool is_xpr_device (const char *device_name);
 
+/* Scheduler
+ *
+ * Description:
+ *   Dispatches work items over all compute units of a kernel. Each compute
+ *   unit gets its own cl::Kernel (created with the "krnl:{cu}" naming) and
+ *   its own out of order command queue. Submitted work items wait in a ready
+ *   queue until a compute unit has less than max_inflight items running and
+ *   are then dispatched round robin or to the least loaded compute unit.
+ *
+ *   A work item is a function which enqueues its commands on the queue and
+ *   kernel it is given and returns the event of its last command, or an empty
+ *   event if the work item is over once its queue has drained. Completion is
+ *   reported through a future or a callback, also when the work item throws
+ *   or its commands fail. Callbacks are invoked from an OpenCL runtime thread
+ *   or the dispatcher thread and must not block on OpenCL calls.
+ *
+ *   Compute units are discovered by probing the default names given by
+ *   --nk <kernel>:<n>, i.e. <kernel>_1, <kernel>_2, ... If none is found the
+ *   kernel is used as a single compute unit. Explicit names can be passed
+ *   instead.
+ *
+ * Example:
+ *   xcl::Scheduler sched(context, device, program, "krnl_vadd");
+ *   std::future<size_t> done = sched.submit(
+ *       [&](cl::CommandQueue &q, cl::Kernel &krnl) {
+ *           cl::Event ev;
+ *           krnl.setArg(0, buffer);
+ *           q.enqueueTask(krnl, NULL, &ev);
+ *           return ev;
+ *       });
+ *   sched.finish();
+ */
+class Scheduler {
+public:
+    enum Policy { ROUND_ROBIN, LEAST_LOADED };
+    typedef std::function<cl::Event(cl::CommandQueue &q, cl::Kernel &krnl)> Task;
+    typedef std::function<void(size_t cu, cl_int status)> Callback;
+
+    Scheduler(const cl::Context &context, const cl::Device &device,
+              const cl::Program &program, const std::string &kernel_name,
+              Policy policy = LEAST_LOADED, size_t max_inflight = 2);
+    Scheduler(const cl::Context &context, const cl::Device &device,
+              const cl::Program &program, const std::string &kernel_name,
+              const std::vector<std::string> &cu_names,
+              Policy policy = LEAST_LOADED, size_t max_inflight = 2);
+    ~Scheduler();
+
+    Scheduler(const Scheduler &) = delete;
+    Scheduler &operator=(const Scheduler &) = delete;
+
+    size_t cu_count() const { return m_cus.size(); }
+    const std::string &cu_name(size_t cu) const { return m_cus[cu]->name; }
+
+    // Queue a work item. The future holds the index of the compute unit that
+    // ran it once its event has completed, or the exception of a failed item.
+    std::future<size_t> submit(Task task);
+    // Queue a work item, done(cu, status) is called once its event has
+    // completed. status is CL_COMPLETE or the negative error of a failed item.
+    void submit(Task task, Callback done);
+    // Block until every submitted work item has completed
+    void finish();
+    // Number of work items completed by each compute unit so far
+    std::vector<size_t> completed_per_cu() const;
+
+private:
+    struct ComputeUnit {
+        std::string name;
+        cl::Kernel kernel;
+        cl::CommandQueue queue;
+        size_t inflight;
+        size_t completed;
+    };
+    struct WorkItem {
+        Task task;
+        std::shared_ptr<std::promise<size_t>> promise;
+        Callback done;
+    };
+    struct Completion {
+        Scheduler *sched;
+        size_t cu;
+        WorkItem item;
+        cl::Event event;
+    };
+
+    void init(const cl::Context &context, const cl::Device &device,
+              const cl::Program &program, const std::string &kernel_name,
+              const std::vector<std::string> &cu_names);
+    void enqueue(WorkItem item);
+    bool pick_cu(size_t &cu);
+    void dispatcher();
+    void complete(Completion *c, cl_int status);
+    static void CL_CALLBACK on_complete(cl_event ev, cl_int status, void *data);
+
+    std::vector<std::unique_ptr<ComputeUnit>> m_cus;
+    std::deque<WorkItem> m_ready;
+    Policy m_policy;
+    size_t m_max_inflight;
+    size_t m_next_cu;
+    size_t m_pending;   // submitted but not yet completed
+    bool m_stop;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::thread m_dispatcher;
+};
+
+
+/* BufferPool
+ *
+ * Description:
+ *   Size class pool of page aligned host memory and of the
+ *   CL_MEM_USE_HOST_PTR buffers bound to it. Released blocks are kept and
+ *   handed out again to later requests of the same size class and flags,
+ *   which saves both the allocation and the buffer creation/page pinning.
+ *
+ *   Sizes are rounded up to whole pages below 64 KiB and to a quarter of the
+ *   next lower power of two above, so a block is at most 25% larger than
+ *   requested. Note that migrating a pooled buffer moves the whole block.
+ *
+ *   Requests with flags == 0 only get host memory and no cl::Buffer.
+ *   Idle blocks are freed once the pool holds more than max_bytes_held
+ *   bytes (0 means no limit) and by trim().
+ *
+ * Example:
+ *   xcl::BufferPool pool(context);
+ *   xcl::PooledBuffer in = pool.acquire(bytes, CL_MEM_READ_ONLY);
+ *   memcpy(in.data<char>(), src, bytes);
+ *   q.enqueueMigrateMemObjects({in.buffer()}, 0);
+ *   // in goes back to the pool when it goes out of scope
+ */
+class BufferPool;
+
+class PooledBuffer {
+public:
+    PooledBuffer() : m_pool(NULL), m_block(NULL), m_size(0) {}
+    PooledBuffer(PooledBuffer &&other);
+    PooledBuffer &operator=(PooledBuffer &&other);
+    ~PooledBuffer() { release(); }
+
+    PooledBuffer(const PooledBuffer &) = delete;
+    PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+    template <typename T> T *data() const { return static_cast<T *>(host()); }
+    void *host() const;
+    const cl::Buffer &buffer() const;
+    // requested size and actual size of the block
+    size_t size() const { return m_size; }
+    size_t capacity() const;
+    bool valid() const { return m_block != NULL; }
+    // give the block back to the pool early
+    void release();
+
+private:
+    friend class BufferPool;
+    struct Block;
+    PooledBuffer(BufferPool *pool, Block *block, size_t size)
+        : m_pool(pool), m_block(block), m_size(size) {}
+
+    BufferPool *m_pool;
+    Block *m_block;
+    size_t m_size;
+};
+
+class BufferPool {
+public:
+    struct Stats {
+        size_t hits;            // requests served from an idle block
+        size_t misses;          // requests which had to allocate
+        size_t bytes_held;      // bytes owned by the pool, idle or in use
+        size_t bytes_in_use;    // bytes currently handed out
+        size_t peak_bytes_held;
+    };
+
+    explicit BufferPool(const cl::Context &context, size_t max_bytes_held = 0);
+    ~BufferPool();
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    PooledBuffer acquire(size_t size, cl_mem_flags flags = 0);
+    // free every idle block
+    void trim();
+    Stats stats() const;
+    void print_stats(std::ostream &os = std::cout) const;
+
+    static size_t size_class(size_t size);
+
+private:
+    friend class PooledBuffer;
+    typedef std::pair<size_t, cl_mem_flags> Key;
+
+    void give_back(PooledBuffer::Block *block);
+    void free_block(PooledBuffer::Block *block);
+
+    cl::Context m_context;
+    size_t m_max_bytes_held;
+    std::multimap<Key, PooledBuffer::Block *> m_idle;
+    Stats m_stats;
+    mutable std::mutex m_mutex;
+};
+
 }
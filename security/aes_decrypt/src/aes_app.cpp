@@ -31,6 +31,7 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 
 #include "logger.h"
+#include "profiler.h"
 #include "aes_app.h"
 #include "aes_ecb.h"
 
@@ -62,16 +63,6 @@ static double timestamp() {
 	return ms;
 }
 
-static double computeEventDurationInMS(const cl_event& event) {
-	cl_ulong ts_start = 0, ts_end = 0;
-	double duration = 0;
-	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ts_start, NULL);
-	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ts_end, NULL);
-	duration += (cl_double)(ts_end-ts_start)*(cl_double)(1e-06);
-
-	return duration;
-}
-
 /////////////////////////////////////////////////////////////////////////////////
 AesApp::AesApp(const string& vendor_name,
 			   const string& device_name,
@@ -304,8 +295,12 @@ bool AesApp::run(int idevice, int nruns) {
 	LogInfo("START %ul END %ul DURATION %ul", nstimequeued, nstimeend, nsduration);
 
 	//set stats to valid data
-	double tHostWriteMS = computeEventDurationInMS(event_host_write);
-	double tHostReadMS = computeEventDurationInMS(event_host_read);
+	Profiler profiler;
+	profiler.record("host write", event_host_write);
+	profiler.record("kernel exec", ndrangeevent);
+	profiler.record("host read", event_host_read);
+	double tHostWriteMS = profiler.total_ms("host write");
+	double tHostReadMS = profiler.total_ms("host read");
 
 
 	double dnsduration = ((double) nsduration);
@@ -364,6 +359,7 @@ bool AesApp::run(int idevice, int nruns) {
 
 	LogInfo("TX rate host --> device [mbps] = %f", h2d_rate);
 	LogInfo("TX rate device --> host [mbps] = %f", d2h_rate);
+	profiler.report();
 
 
 
@@ -47,6 +47,9 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 using namespace sda;
 using namespace sda::cl;
 
+//profiler stage of each EvBreakDown event
+static const char *g_evtNames[RSAApp::evtCount] = {"host write", "kernel exec", "host read"};
+
 /////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////
 //load_file_to_memory
@@ -102,16 +105,6 @@ double RSAApp::timestamp() {
 	return ms;
 }
 
-double RSAApp::computeEventDurationInMS(const cl_event& event) {
-	cl_ulong ts_start = 0, ts_end = 0;
-	double duration = 0;
-	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ts_start, NULL);
-	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ts_end, NULL);
-	duration += (cl_double)(ts_end-ts_start)*(cl_double)(1e-06);
-
-	return duration;
-}
-
 bool RSAApp::releaseMemObject(cl_mem &obj)
 {
   cl_int   err = 0;
@@ -536,8 +529,7 @@ bool RSAApp::run(int idevice, int nruns) {
 	//timings
 	cl_event events[evtCount];
 	double durations[evtCount];
-	for(int i=0; i < evtCount; i++)
-		durations[i] = 0.0;
+	m_profiler.clear();
 
 	//start time stamps
 	double startMS = timestamp();
@@ -553,7 +545,10 @@ bool RSAApp::run(int idevice, int nruns) {
 
 	//collect times
 	for(int i=0; i < evtCount; i++) {
-		durations[i] += computeEventDurationInMS(events[i]);
+		m_profiler.record(g_evtNames[i], events[i]);
+	}
+	for(int i=0; i < evtCount; i++) {
+		durations[i] = m_profiler.total_ms(g_evtNames[i]);
 	}
 
 	double h2d_rate = 0.0;
@@ -591,6 +586,7 @@ bool RSAApp::run(int idevice, int nruns) {
 	LogInfo("Host read [ms] = %f", durations[evtHostRead]);
 	LogInfo("TX rate host --> device [mbps] = %f", h2d_rate);
 	LogInfo("TX rate device --> host [mbps] = %f", d2h_rate);
+	m_profiler.report();
 
 	print_big_number(message, 64, "message");
     	output_data_to_file(m_strOutputFP.c_str(), message);
@@ -34,6 +34,7 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include "common.h"
 #include "xcl.h"
+#include "profiler.h"
 #include <CL/cl.h>
 #include <openssl/bn.h>
 #include <openssl/rsa.h>
@@ -69,7 +70,6 @@ public:
 	bool invoke_kernel(cl_kernel kernel, cl_uint *message,cl_uint *Cp,cl_uint *Cq, cl_uint *p, cl_uint *q, cl_uint *dmp1, cl_uint *dmq1, cl_uint *iqmp, cl_uint *r2p, cl_uint *r2q, cl_event events[evtCount]);
 
 	static double timestamp();
-	static double computeEventDurationInMS(const cl_event& event);
 
 
 
@@ -84,6 +84,9 @@ private:
 	xcl_world m_world;
 	cl_program m_program;
 	cl_kernel m_clKernelRSA;
+
+	//per stage event timings
+	Profiler m_profiler;
 };
 
 }
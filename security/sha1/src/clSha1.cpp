@@ -55,10 +55,7 @@ clSha1Runner::clSha1Runner(cl_context context, cl_command_queue command_queue, c
     abort();
   }
 
-  for(size_t i = 0; i < 4; i++) {
-    mEventStats[i].cnt = 0;
-    mEventStats[i].max = 0;
-  }
+  mProfiler = NULL;
 }
 
 clSha1Runner::~clSha1Runner() {
@@ -143,6 +140,12 @@ cl_event clSha1Runner::run(const uint32_t *buf, uint32_t *mds) {
     abort();
   }
 
+  if (mProfiler) {
+    static const char *names[4] = {"write buf", "write state", "kernel exec", "read state"};
+    for(size_t i = 0; i < 4; i++)
+      mProfiler->record(names[i], mEvents[i]);
+  }
+
   return mEvents[3];
 }
 
@@ -150,77 +153,8 @@ bool clSha1Runner::isDone() {
   return mDone;
 }
 
-void clSha1Runner::initStats(size_t size) {
-  for(size_t i = 0; i < 4; i++) {
-    mEventStats[i].ent = (unsigned long*) malloc(sizeof(unsigned long) * size);
-    if (mEventStats[i].ent == NULL) {
-      std::cout << "ERROR: out of memory" << std::endl;
-      abort();
-    }
-
-    mEventStats[i].cnt = 0;
-    mEventStats[i].max = size;
-  }
-}
-
-void clSha1Runner::updateStats() {
-  for(size_t i = 0 ; i < 4; i++) {
-    size_t cnt = mEventStats[i].cnt;
-    size_t max = mEventStats[i].max;
-    if (cnt < max) {
-      unsigned long start, stop;
-      clGetEventProfilingInfo(mEvents[i], CL_PROFILING_COMMAND_START,
-                              sizeof(unsigned long), &start, NULL);
-      clGetEventProfilingInfo(mEvents[i], CL_PROFILING_COMMAND_END,
-                              sizeof(unsigned long), &stop, NULL);
-
-      if (stop > start) {
-        mEventStats[i].ent[cnt] = stop - start;
-      } else {
-        std::cout << "overflow" << std::endl;
-        mEventStats[i].ent[cnt] = 0xFFFFFFFF - start  +  stop + 1;
-      }
-
-      //std::cout << start << " " << stop << " ";
-
-      //mEventStats[i].ent[cnt] = 0xFFFFFFFF;
-
-      mEventStats[i].cnt = cnt + 1;
-
-      //double dur = mEventStats[i].ent[cnt] * 1.0;
-      //dur /= 1000.0;  // us
-      //dur /= 1000.0;  // ms
-
-      //std::cout << dur << " ms ";
-    }
-  }
-  //std::cout << std::endl;
-}
-
-void clSha1Runner::getStats(unsigned long min[4], unsigned long max[4], unsigned long avg[4], size_t cnt[4]) {
-  for(size_t i = 0; i < 4; i++) {
-    unsigned long long tot;
-
-    min[i] = max[i] = tot = mEventStats[i].ent[0];
-
-    for(size_t j = 1; j < mEventStats[i].cnt; j++) {
-      unsigned long val = mEventStats[i].ent[j];
-      if (val > max[i]) {
-        max[i] = val;
-      }
-      if (val < min[i]) {
-        min[i] = val;
-      }
-      tot += val;
-    }
-    if (mEventStats[i].cnt != 0) {
-      avg[i] = tot / mEventStats[i].cnt;
-      cnt[i] = mEventStats[i].cnt;
-    } else {
-      avg[i] = 0;
-      cnt[i] = 0;
-    }
-  }
+void clSha1Runner::setProfiler(sda::Profiler *profiler) {
+  mProfiler = profiler;
 }
 
 clSha1::clSha1(std::string Vendor, std::string Device, const char* filename) {
@@ -155,12 +155,7 @@ void int_to_char4(int in, global char *out) {
 
 #include <string>
 #include <CL/opencl.h>
-
-typedef struct {
-	unsigned long *ent;
-	size_t cnt;
-	size_t max;
-} clSha1Stats;
+#include "profiler.h"
 
 
 typedef cl_uint16 buf_t;
@@ -173,9 +168,8 @@ class clSha1Runner {
 
     cl_event run(const uint32_t *bufs, uint32_t *mds);
     
-    void initStats(size_t size);
-    void updateStats();
-    void getStats(unsigned long min[4], unsigned long max[4], unsigned long avg[4], size_t cnt[4]);
+    // Record the transfers and the kernel of every run on profiler
+    void setProfiler(sda::Profiler *profiler);
     bool isDone();
 
   private:
@@ -185,7 +179,7 @@ class clSha1Runner {
     cl_mem mDevGBuf;
     cl_mem mDevGState;
     cl_event mEvents[4];
-    clSha1Stats mEventStats[4];
+    sda::Profiler *mProfiler;
     bool mDone;
 };
 
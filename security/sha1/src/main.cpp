@@ -246,12 +246,16 @@ void sha1_parallel(clSha1 &host, double timelimit, size_t runners, const string&
 		abort();
 	}
 
+	//transfer and kernel timings of all runners
+	sda::Profiler profiler;
+
 	std::vector<clSha1Runner*> clRunners(runners);
 	for (size_t i = 0; i < runners; i++) {
 		buf[i] = new uint32_t[CHANNELS * BLOCKS * 64L];
 		mds[i] = new uint32_t[CHANNELS * 64L];
 
 		clRunners[i] = host.createRunner();
+		clRunners[i]->setProfiler(&profiler);
 	}
 
 	bool done = false;
@@ -325,9 +329,12 @@ void sha1_parallel(clSha1 &host, double timelimit, size_t runners, const string&
 	std::cout << "INFO: Jobs Processed: " << jcompleted << std::endl;
 	std::cout << "INFO: Rate = " << rate << " MB/s" << std::endl;
 
-	for(size_t i = 0; i < runners; i++) {
+	for(size_t i = 0; i < runners; i++)
 		while(!clRunners[i]->isDone());
 
+	profiler.report();
+
+	for(size_t i = 0; i < runners; i++) {
 		delete clRunners[i];
 		delete mds[i];
 		delete buf[i];
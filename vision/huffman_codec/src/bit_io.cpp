@@ -37,6 +37,10 @@ BitStorage::BitStorage(const BitStorage& rhs) {
 	this->copyfrom(rhs);
 }
 
+BitStorage::BitStorage(BitStorage&& rhs) {
+	this->movefrom(rhs);
+}
+
 BitStorage::BitStorage(const string& str) {
 	this->from_string(str);
 }
@@ -45,22 +49,64 @@ BitStorage::BitStorage(const vector<u8>& bits, u32 count_bits) {
 	m_bitwise_count = count_bits;
 	m_bitwise_index = m_bitwise_count;
 	m_storage.assign(bits.begin(), bits.end());
+	this->attach();
+}
+
+BitStorage::BitStorage(vector<u8>&& bits, u32 count_bits) {
+	m_bitwise_count = count_bits;
+	m_bitwise_index = m_bitwise_count;
+	m_storage.swap(bits);
+	this->attach();
 }
 
 BitStorage::~BitStorage() {
 
 }
 
+BitStorage& BitStorage::operator=(const BitStorage& rhs) {
+	if(this != &rhs)
+		this->copyfrom(rhs);
+	return *this;
+}
+
+BitStorage& BitStorage::operator=(BitStorage&& rhs) {
+	if(this != &rhs)
+		this->movefrom(rhs);
+	return *this;
+}
+
 void BitStorage::copyfrom(const BitStorage& other) {
 	m_bitwise_count = other.m_bitwise_count;
 	m_bitwise_index = other.m_bitwise_index;
 	m_storage.assign(other.m_storage.begin(), other.m_storage.end());
+	m_acc = other.m_acc;
+	m_acc_bits = other.m_acc_bits;
 }
 
-void BitStorage::appendfrom(const BitStorage& other) {
+void BitStorage::movefrom(BitStorage& other) {
+	m_bitwise_count = other.m_bitwise_count;
+	m_bitwise_index = other.m_bitwise_index;
+	m_storage.swap(other.m_storage);
+	m_acc = other.m_acc;
+	m_acc_bits = other.m_acc_bits;
+	other.reset();
+}
 
-	for(u32 i=0; i < other.count_total_bits(); i++)
-		this->write_bit((u8)other.read(1));
+void BitStorage::appendfrom(const BitStorage& other) {
+	//splice 32 bits at a time, the last word carries the partial bits
+	const u8* src = other.m_storage.data();
+	u32 count = other.count_total_bits();
+	m_storage.reserve(((m_bitwise_count + count) >> 3) + 1);
+
+	for(u32 done = 0; done < count; done += 32) {
+		u32 n = min<u32>(32, count - done);
+		u32 word = 0;
+		for(u32 i=0; i < (n + 7) / 8; i++)
+			word |= (u32)src[(done >> 3) + i] << (i * 8);
+		if(n < 32)
+			word &= (1u << n) - 1;
+		this->write_bits(word, n);
+	}
 }
 
 void BitStorage::reset() {
@@ -69,69 +115,120 @@ void BitStorage::reset() {
 	m_storage.resize(0);
 	m_storage.reserve(128);
 	m_storage.push_back(0);
+	m_acc = 0;
+	m_acc_bits = 0;
+}
+
+//loads the partial last byte of externally supplied storage into the accumulator
+void BitStorage::attach() {
+	m_storage.resize((m_bitwise_count >> 3) + 1, 0);
+	m_acc_bits = m_bitwise_count % 8;
+	m_acc = m_storage.back() & ((1u << m_acc_bits) - 1);
+	m_storage.back() = (u8)m_acc;
 }
 
 bool BitStorage::is_bit_set(u8 byte, u8 index) {
 	return  ((byte & (1 << index)) & 0xFF) != 0;
 }
 
+u32 BitStorage::reverse_bits(u32 bits, u32 length) {
+	if(length == 0)
+		return 0;
+
+	bits = ((bits >> 1) & 0x55555555) | ((bits & 0x55555555) << 1);
+	bits = ((bits >> 2) & 0x33333333) | ((bits & 0x33333333) << 2);
+	bits = ((bits >> 4) & 0x0F0F0F0F) | ((bits & 0x0F0F0F0F) << 4);
+	bits = ((bits >> 8) & 0x00FF00FF) | ((bits & 0x00FF00FF) << 8);
+	bits = (bits >> 16) | (bits << 16);
+	return bits >> (32 - length);
+}
+
 int BitStorage::read(int count_bits) const {
-	assert(count_bits > 0);
+	assert(count_bits > 0 && count_bits <= 32);
 
 	//adjust count
 	count_bits = min<int>(count_bits, (m_bitwise_count - m_bitwise_index));
+	if(count_bits <= 0)
+		return 0;
 
 	//read count bits from storage and increment the index
 	assert((m_bitwise_index + count_bits) <= m_bitwise_count);
 
-	int output = 0;
-	for(int i = 0; i < count_bits; i++) {
-		u32 byte_index = m_bitwise_index >> 3;
-		u32 bit_index = m_bitwise_index % 8;
-		m_bitwise_index ++;
+	//load a 64 bit window starting at the byte of the read index, only the
+	//bytes covered by the requested bits are touched
+	u32 offset = m_bitwise_index & 7;
+	const u8* src = &m_storage[m_bitwise_index >> 3];
+	u32 nbytes = (offset + count_bits + 7) >> 3;
+	u64 window = src[0];
+	for(u32 i=1; i < nbytes; i++)
+		window |= (u64)src[i] << (i * 8);
 
-		u8 byte = m_storage[byte_index];
-		if(is_bit_set(byte, bit_index))
-			output |= (1 << i);
-	}
+	u64 mask = ((u64)1 << count_bits) - 1;
+	int output = (int)((window >> offset) & mask);
+	m_bitwise_index += count_bits;
 
 	return output;
 }
 
 bool BitStorage::write_bit(u8 bit) {
-	u8 byte = m_storage.back();
-	u8 bit_index = m_bitwise_index % 8;
-	if(bit == 1)
-		byte |= (1 << bit_index);
-	m_bitwise_count++;
-	m_bitwise_index++;
-	m_storage[m_storage.size() - 1] = byte;
-
-	//push new byte
-	if(bit_index == 7) {
-		m_storage.push_back(0);
+	return write_bits(bit & 0x01, 1);
+}
+
+//appends length bits lsb first, the accumulator holds at most 7 pending bits
+//between calls so up to 39 bits are in flight and whole bytes are spilled
+bool BitStorage::write_bits(u32 bits, u32 length) {
+	if(length == 0)
+		return false;
+	assert(length <= 32);
+	if(length < 32)
+		bits &= (1u << length) - 1;
+
+	m_acc |= (u64)bits << m_acc_bits;
+	m_acc_bits += length;
+	m_bitwise_count += length;
+	m_bitwise_index = m_bitwise_count;
+
+	u32 full = m_acc_bits >> 3;
+	if(full > 0) {
+		//the partial byte at the back is rewritten together with the completed bytes
+		u32 base = m_storage.size() - 1;
+		m_storage.resize(base + full + 1);
+		u8* dst = &m_storage[base];
+		for(u32 i=0; i < full; i++) {
+			dst[i] = (u8)m_acc;
+			m_acc >>= 8;
+		}
+		m_acc_bits &= 7;
 	}
+	m_storage.back() = (u8)m_acc;
 
 	return true;
 }
 
-
 bool BitStorage::write_multiple_bits(u32 bits, u32 length) {
 	if(length == 0)
 		return false;
 
 	//order is msb to lsb
-	for(int i= (int)length - 1; i >= 0; i--) {
-		u8 b = (bits >> i) & 0x01;
-		write_bit(b);
-	}
-
-	return true;
+	return write_bits(reverse_bits(bits, length), length);
 }
 
 bool BitStorage::write_multiple_bits(const string& str) {
-	BitStorage storage;
-	storage.from_string(str);
+	//lsb bit is on the right side, same as from_string
+	u32 word = 0;
+	u32 n = 0;
+	for(int i= (int)str.length() - 1; i >= 0; i--) {
+		if(str[i] != '0')
+			word |= (1u << n);
+		if(++n == 32) {
+			write_bits(word, n);
+			word = 0;
+			n = 0;
+		}
+	}
+
+	if(n > 0)
+		write_bits(word, n);
 	return true;
 }
 
@@ -146,31 +243,16 @@ int BitStorage::from_string(const string& bitstring) {
 	if(bitstring.length() == 0)
 		return 0;
 
-	//lsb bit is on the right side
-	for(int i= (int)bitstring.length() - 1; i >= 0; i--) {
-		if(bitstring[i] == '0')
-			write_bit(0);
-		else
-			write_bit(1);
-	}
-
+	write_multiple_bits(bitstring);
 	return (int)m_bitwise_count;
 }
 
 string BitStorage::to_string() const {
-	string str = "";
+	string str(m_bitwise_count, '0');
 	for(u32 i=0; i < m_bitwise_count; i++) {
-		u32 blk = i / 8;
-		u32 rem = i % 8;
-
-		u8 byte = m_storage[blk];
-		u8 bit = (byte >> rem) & 0x01;
-		if(bit == 0)
-			str += "0";
-		else
-			str += "1";
+		if((m_storage[i >> 3] >> (i % 8)) & 0x01)
+			str[i] = '1';
 	}
 
 	return str;
-}
-
+}
\ No newline at end of file
@@ -37,30 +37,45 @@ typedef unsigned char		uchar;
 typedef unsigned short		u16;
 typedef unsigned int		u32;
 typedef unsigned int		uint;
+typedef unsigned long long	u64;
 typedef			 char		i8;
 typedef			 short		i16;
 typedef			 int		i32;
 
 using namespace std;
 
-//BitStorage
+/*!
+ * Growable bit buffer. Bits are stored lsb first within each byte and the
+ * last byte always holds the partial bits, so size() is count_total_bits() / 8 + 1.
+ * Writes go through a 64-bit accumulator that spills whole bytes, reads load
+ * a 64-bit window at the read index.
+ */
 class BitStorage {
 public:
 	BitStorage();
 	BitStorage(const BitStorage& rhs);
+	BitStorage(BitStorage&& rhs);
 	BitStorage(const string& str);
 	BitStorage(const vector<u8>& bits, u32 count_bits);
+	BitStorage(vector<u8>&& bits, u32 count_bits);
 	virtual ~BitStorage();
 
+	BitStorage& operator=(const BitStorage& rhs);
+	BitStorage& operator=(BitStorage&& rhs);
+
 
 	//read
 	int read(int count_bits) const;
 
 	//write
 	bool write_bit(u8 bit);
+	bool write_bits(u32 bits, u32 length);
 	bool write_multiple_bits(u32 bits, u32 length);
 	bool write_multiple_bits(const string& str);
 
+	//capacity
+	void reserve_bits(u32 count_bits) { m_storage.reserve((count_bits >> 3) + 1); }
+
 
 	//access
 	vector<u8>& data() {return m_storage;}
@@ -80,16 +95,23 @@ public:
 
 
 	static bool is_bit_set(u8 byte, u8 index);
+	static u32 reverse_bits(u32 bits, u32 length);
 
 protected:
 	void copyfrom(const BitStorage& other);
+	void movefrom(BitStorage& other);
 	void appendfrom(const BitStorage& other);
 	void reset();
+	void attach();
 
 protected:
 	mutable u32 m_bitwise_index;
 	u32 m_bitwise_count;
 	vector<u8> m_storage;
+
+	//pending bits of the last byte plus the bits of the current write
+	u64 m_acc;
+	u32 m_acc_bits;
 };
 
 
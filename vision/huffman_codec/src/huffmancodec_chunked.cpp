@@ -0,0 +1,228 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "huffmancodec_chunked.h"
+#include "huffmancodec_optimized_cpuonly.h"
+#include "logger.h"
+
+//MSG LEN + CHUNK SIZE + N
+#define CHUNKS_HEADER_BYTES 12
+
+using namespace std;
+
+namespace sda {
+
+static void put_word(u8* ptr, u32 word) {
+	for(int i=0; i < 4; i++) {
+		ptr[i] = (u8)(word >> (i * 8));
+	}
+}
+
+static u32 get_word(const u8* ptr) {
+	return (u32)ptr[0] | ((u32)ptr[1] << 8) | ((u32)ptr[2] << 16) | ((u32)ptr[3] << 24);
+}
+
+//decode chunk i of a parsed container to its place in out
+static bool decode_chunk(const HuffmanChunks& chunks, u32 i, u8* out) {
+	u8* stream = const_cast<u8*>(chunks.stream(i));
+	u32 size_out_data = 0;
+	if(chunks.stream_size(i) >= 4) {
+		decode(stream, chunks.stream_size(i), NULL, &size_out_data, true);
+	}
+	if(size_out_data != chunks.raw_size(i)) {
+		LogError("Chunk %u decodes to %u bytes, expected %u", i, size_out_data, chunks.raw_size(i));
+		return false;
+	}
+
+	decode(stream, chunks.stream_size(i), out, &size_out_data, false);
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+HuffmanChunks::HuffmanChunks() : m_msg_len(0), m_chunk_size(0), m_streams(NULL) {
+}
+
+u32 HuffmanChunks::count(u32 msg_len, u32 chunk_size) {
+	return (msg_len + chunk_size - 1) / chunk_size;
+}
+
+u32 HuffmanChunks::raw_size(u32 i) const {
+	u32 offset = raw_offset(i);
+	return (m_msg_len - offset < m_chunk_size) ? (m_msg_len - offset) : m_chunk_size;
+}
+
+bool HuffmanChunks::parse(const u8* data, u32 size) {
+	m_ends.clear();
+	m_streams = NULL;
+	if(size < CHUNKS_HEADER_BYTES) {
+		LogError("Chunk container of %u bytes is shorter than its header", size);
+		return false;
+	}
+
+	m_msg_len = get_word(data);
+	m_chunk_size = get_word(data + 4);
+	u32 n = get_word(data + 8);
+	if(m_chunk_size == 0 || n != count(m_msg_len, m_chunk_size) || (size - CHUNKS_HEADER_BYTES) / 4 < n) {
+		LogError("Invalid chunk container header: MSG LEN = %u, CHUNK SIZE = %u, N = %u", m_msg_len, m_chunk_size, n);
+		return false;
+	}
+
+	const u8* index = data + CHUNKS_HEADER_BYTES;
+	u32 szStreams = size - CHUNKS_HEADER_BYTES - 4 * n;
+	m_ends.resize(n);
+	for(u32 i=0; i < n; i++) {
+		m_ends[i] = get_word(index + 4 * i);
+		if(m_ends[i] > szStreams || (i > 0 && m_ends[i] < m_ends[i - 1])) {
+			LogError("Chunk index entry %u = %u is out of order or past the %u stream bytes", i, m_ends[i], szStreams);
+			m_ends.clear();
+			return false;
+		}
+	}
+	m_streams = index + 4 * n;
+
+	return true;
+}
+
+void HuffmanChunks::pack(u32 msg_len, u32 chunk_size, const vector< vector<u8> >& streams, vector<u8>& out_data) {
+	u32 n = streams.size();
+	u32 szStreams = 0;
+	for(u32 i=0; i < n; i++) {
+		szStreams += streams[i].size();
+	}
+
+	out_data.resize(CHUNKS_HEADER_BYTES + 4 * n + szStreams);
+	u8* ptr = &out_data[0];
+	put_word(ptr, msg_len);
+	put_word(ptr + 4, chunk_size);
+	put_word(ptr + 8, n);
+	ptr += CHUNKS_HEADER_BYTES;
+
+	u32 end = 0;
+	for(u32 i=0; i < n; i++) {
+		end += streams[i].size();
+		put_word(ptr, end);
+		ptr += 4;
+	}
+
+	for(u32 i=0; i < n; i++) {
+		if(!streams[i].empty()) {
+			memcpy(ptr, &streams[i][0], streams[i].size());
+			ptr += streams[i].size();
+		}
+	}
+}
+
+bool HuffmanChunks::dispatch(u32 count, int nworkers, const function<bool (int, u32)>& func) {
+	atomic<u32> next(0);
+	atomic<bool> ok(true);
+
+	auto worker = [&](int w) {
+		for(u32 i = next++; i < count; i = next++) {
+			if(!func(w, i)) {
+				ok = false;
+			}
+		}
+	};
+
+	if(nworkers <= 1) {
+		worker(0);
+		return ok;
+	}
+
+	vector<thread> threads;
+	for(int w=0; w < nworkers; w++) {
+		threads.push_back(thread(worker, w));
+	}
+	for(size_t w=0; w < threads.size(); w++) {
+		threads[w].join();
+	}
+
+	return ok;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+HuffmanChunkedCPU::HuffmanChunkedCPU(u32 chunk_size, int nthreads) {
+	m_chunk_size = chunk_size > 0 ? chunk_size : DEFAULT_CHUNK_SIZE;
+	m_nthreads = nthreads > 0 ? nthreads : 1;
+}
+
+int HuffmanChunkedCPU::enc(const vector<u8>& in_data, vector<u8>& out_data) {
+	u32 msg_len = in_data.size();
+	u32 n = HuffmanChunks::count(msg_len, m_chunk_size);
+	vector< vector<u8> > streams(n);
+
+	u8* in = const_cast<u8*>(in_data.data());
+	bool res = HuffmanChunks::dispatch(n, m_nthreads, [&](int, u32 i) {
+		u32 offset = i * m_chunk_size;
+		u32 len = (msg_len - offset < m_chunk_size) ? (msg_len - offset) : m_chunk_size;
+
+		u32 size_out_data = 0;
+		u8 dummy = 0;
+		encode(in + offset, len, &dummy, &size_out_data, true);
+
+		streams[i].resize(size_out_data, 0);
+		encode(in + offset, len, &streams[i][0], &size_out_data, false);
+		return true;
+	});
+	if(!res)
+		return 0;
+
+	HuffmanChunks::pack(msg_len, m_chunk_size, streams, out_data);
+	return (int)out_data.size();
+}
+
+int HuffmanChunkedCPU::dec(const vector<u8>& in_data, vector<u8>& out_data) {
+	HuffmanChunks chunks;
+	if(!chunks.parse(in_data.data(), in_data.size()))
+		return 0;
+
+	out_data.resize(chunks.msg_len());
+	bool res = HuffmanChunks::dispatch(chunks.count(), m_nthreads, [&](int, u32 i) {
+		return decode_chunk(chunks, i, &out_data[chunks.raw_offset(i)]);
+	});
+
+	return res ? (int)out_data.size() : 0;
+}
+
+bool HuffmanChunkedCPU::dec_chunk(const vector<u8>& in_data, u32 i, vector<u8>& out_data) {
+	HuffmanChunks chunks;
+	if(!chunks.parse(in_data.data(), in_data.size()))
+		return false;
+	if(i >= chunks.count()) {
+		LogError("Chunk %u is past the %u chunks of the container", i, chunks.count());
+		return false;
+	}
+
+	out_data.resize(chunks.raw_size(i));
+	return decode_chunk(chunks, i, &out_data[0]);
+}
+
+}
@@ -0,0 +1,130 @@
+/**********
+Copyright (c) 2018, Xilinx, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**********/
+#ifndef HUFFMANCODEC_CHUNKED_H_
+#define HUFFMANCODEC_CHUNKED_H_
+
+#include <functional>
+#include <vector>
+#include "huffmancodec_naive.h"
+
+//default number of input bytes coded as one independent chunk
+#define DEFAULT_CHUNK_SIZE (256 * 1024)
+
+using namespace std;
+
+namespace sda {
+
+/*!
+ * Block container of independently coded chunks. The input is split into
+ * chunks of CHUNK SIZE bytes (the last one may be shorter) and every chunk is
+ * a complete huffman stream with its own code-length table, as written by the
+ * encode kernel. The chunk index gives the end of every stream, so chunks
+ * can be coded concurrently and any one of them decoded on its own.
+ *
+ * Byte Count 			| Description
+ * ============================================
+ * 4 				    | MSG LEN
+ * 4 				    | CHUNK SIZE
+ * 4 				    | N
+ * 4N				    | Chunk Index: end offset of every stream past the index
+ * Streams Size		    | N streams
+ */
+class HuffmanChunks {
+public:
+	HuffmanChunks();
+
+	//number of chunks holding msg_len input bytes
+	static u32 count(u32 msg_len, u32 chunk_size);
+
+	/*!
+	 * Reads the header and chunk index of a container, false when the index
+	 * does not match the container size
+	 */
+	bool parse(const u8* data, u32 size);
+
+	/*!
+	 * Writes the container of msg_len input bytes from its chunk streams
+	 */
+	static void pack(u32 msg_len, u32 chunk_size, const vector< vector<u8> >& streams, vector<u8>& out_data);
+
+	u32 msg_len() const { return m_msg_len; }
+	u32 chunk_size() const { return m_chunk_size; }
+	u32 count() const { return m_ends.size(); }
+
+	//encoded stream of chunk i in the parsed container
+	const u8* stream(u32 i) const { return m_streams + (i == 0 ? 0 : m_ends[i - 1]); }
+	u32 stream_size(u32 i) const { return m_ends[i] - (i == 0 ? 0 : m_ends[i - 1]); }
+
+	//input range of chunk i
+	u32 raw_offset(u32 i) const { return i * m_chunk_size; }
+	u32 raw_size(u32 i) const;
+
+	/*!
+	 * Hands chunks 0..count-1 out to nworkers threads, worker w calls
+	 * func(w, chunk) for the next chunk nobody has taken yet. A single worker
+	 * runs on the calling thread. Returns false when any call failed.
+	 */
+	static bool dispatch(u32 count, int nworkers, const function<bool (int, u32)>& func);
+
+private:
+	u32 m_msg_len;
+	u32 m_chunk_size;
+	vector<u32> m_ends;
+	const u8* m_streams;
+};
+
+/*!
+ * Chunked codec on the CPU: encode and decode kernels run on host threads,
+ * one chunk at a time
+ */
+class HuffmanChunkedCPU : public ICodec {
+public:
+	HuffmanChunkedCPU(u32 chunk_size = DEFAULT_CHUNK_SIZE, int nthreads = 1);
+	virtual ~HuffmanChunkedCPU() {}
+
+	int enc(const vector<u8>& in_data, vector<u8>& out_data);
+	int dec(const vector<u8>& in_data, vector<u8>& out_data);
+
+	/*!
+	 * Decodes chunk i of a container alone
+	 */
+	bool dec_chunk(const vector<u8>& in_data, u32 i, vector<u8>& out_data);
+
+	void set_threads(int nthreads) { m_nthreads = nthreads; }
+	int threads() const { return m_nthreads; }
+	u32 chunk_size() const { return m_chunk_size; }
+
+private:
+	u32 m_chunk_size;
+	int m_nthreads;
+};
+
+}
+
+#endif /* HUFFMANCODEC_CHUNKED_H_ */
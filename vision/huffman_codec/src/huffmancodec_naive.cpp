@@ -32,6 +32,7 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <queue>
 #include <stack>
 #include <sstream>
+#include <utility>
 #include <stdio.h>
 #include "huffmancodec_naive.h"
 #include "huffmancodec_optimized_cpuonly.h"
@@ -134,15 +135,11 @@ int HuffmanNaiveImpl::compute_huffmancodes_recursive(HTreeNode* parent) {
 }
 
 string HuffmanNaiveImpl::bitcode_to_string(const BitCode& code) {
-	string str = "";
-
+	//msb on the left
+	string str(code.bitlen, '0');
 	for(u32 i=0; i < code.bitlen; i++) {
-
-		u8 bit = (code.code >> i) & 0x01;
-		if(bit)
-			str = "1" + str;
-		else
-			str = "0" + str;
+		if((code.code >> i) & 0x01)
+			str[code.bitlen - 1 - i] = '1';
 	}
 	return str;
 }
@@ -190,15 +187,15 @@ int HuffmanNaiveImpl::enc(const vector<u8>& in_data, vector<u8>& out_data) {
 
 	//1. Visit all symbols and create the mapping of the alphabet and their
 	//associated weights
-	map<u8, u32> alphabet;
+	u32 histogram[256] = {0};
 	for(u32 i=0; i<in_data.size(); i++) {
-		u8 c = in_data[i];
-		if(alphabet.find(c) == alphabet.end()) {
-			alphabet[c] = 1;
-		}
-		else {
-			alphabet[c] ++;
-		}
+		histogram[ in_data[i] ]++;
+	}
+
+	map<u8, u32> alphabet;
+	for(u32 i=0; i < 256; i++) {
+		if(histogram[i] > 0)
+			alphabet[i] = histogram[i];
 	}
 
 	if(m_verbose)
@@ -304,21 +301,29 @@ int HuffmanNaiveImpl::enc(const vector<u8>& in_data, vector<u8>& out_data) {
 		print_codebook(codebook);
 
 
-	//3. Encode the entire data using the dictionary
+	//3. Encode the entire data using the dictionary. Codes are bit reversed
+	//once per symbol so the payload is written lsb first without a lookup
+	//in the codebook or a per symbol allocation
+	BitCode lut[256] = {{0, 0}};
+	u64 payload_bits = 0;
+	for(CodeBook::const_iterator it = codebook.begin(); it != codebook.end(); it++) {
+		assert(it->second.bitlen <= 32);
+		lut[it->first].code = BitStorage::reverse_bits(it->second.code, it->second.bitlen);
+		lut[it->first].bitlen = it->second.bitlen;
+		payload_bits += (u64)histogram[it->first] * it->second.bitlen;
+	}
+
 	BitStorage bits;
+	bits.reserve_bits((u32)payload_bits);
 	for(u32 i=0; i < in_data.size(); i++) {
-		assert(codebook[ in_data[i] ].bitlen <= 32);
-
-		u32 bitlen = codebook[ in_data[i] ].bitlen;
-		u32 mask = (1 << bitlen) - 1;
-		u32 code = (u32) (codebook[ in_data[i] ].code & mask);
-		bits.write_multiple_bits(code, bitlen);
+		const BitCode& bc = lut[ in_data[i] ];
+		bits.write_bits(bc.code, bc.bitlen);
 	}
 
 	//output
 	//header: count of bitlengths + count of codes + count of alphabets + msg len
-	//bits data
-	out_data.reserve( 8 + 3*codebook.size() + bits.cdata().size());
+	//bits data. A count of 0 stands for all 256 symbols and codes are 4 bytes
+	out_data.reserve( 8 + 6*codebook.size() + bits.cdata().size());
 
 	//out[0] = number of bit-lengths fields
 	out_data.push_back(codebook.size());
@@ -346,7 +351,8 @@ int HuffmanNaiveImpl::enc(const vector<u8>& in_data, vector<u8>& out_data) {
 
 	//write bit codes
 	for(CodeBook::const_iterator it = codebook.begin(); it != codebook.end(); it++) {
-		out_data.push_back(it->second.code); //code
+		for(int i=0; i < 4; i++)
+			out_data.push_back((u8)(it->second.code >> (i * 8)));
 	}
 
 
@@ -356,10 +362,7 @@ int HuffmanNaiveImpl::enc(const vector<u8>& in_data, vector<u8>& out_data) {
 	}
 
 	//write payload
-	for(u32 i = 0; i < bits.cdata().size(); i++) {
-		u8 tmp = bits.cdata().at(i);
-		out_data.push_back(tmp);
-	}
+	out_data.insert(out_data.end(), bits.cdata().begin(), bits.cdata().end());
 
 	//cleanup
 	for(u32 i=0; i < storage.size(); i++) {
@@ -373,16 +376,19 @@ int HuffmanNaiveImpl::enc(const vector<u8>& in_data, vector<u8>& out_data) {
 int HuffmanNaiveImpl::dec(const vector<u8>& in_data, vector<u8>& out_data) {
 	vector<u8>::const_iterator it = in_data.begin();
 
+	if(in_data.size() < 8)
+		return false;
+
 	//in[0] = number of bit-lengths fields
-	u8 ctBitLengths = *it;
+	u32 ctBitLengths = (*it == 0) ? 256 : *it;
 	it++;
 
 	//in[1] = number of codes
-	u8 ctCodes = *it;
+	u32 ctCodes = (*it == 0) ? 256 : *it;
 	it++;
 
 	//in[2] = number of alphabet
-	u8 ctAlphabet = *it;
+	u32 ctAlphabet = (*it == 0) ? 256 : *it;
 	it++;
 
 	//in[3] = partial bits
@@ -397,6 +403,13 @@ int HuffmanNaiveImpl::dec(const vector<u8>& in_data, vector<u8>& out_data) {
 		it++;
 	}
 
+	//every code has one bit-length and one alphabet
+	if(ctCodes != ctBitLengths || ctCodes != ctAlphabet)
+		return false;
+
+	if(in_data.size() < 8 + ctBitLengths + 4 * ctCodes + ctAlphabet)
+		return false;
+
 	//read bit-lengths
 	vector<u8> bitlengths;
 	bitlengths.resize(ctBitLengths);
@@ -406,11 +419,14 @@ int HuffmanNaiveImpl::dec(const vector<u8>& in_data, vector<u8>& out_data) {
 	}
 
 	//read bit-codes
-	vector<u8> codes;
+	vector<u32> codes;
 	codes.resize(ctCodes);
 	for(u32 i=0; i < ctCodes; i++) {
-		codes[i] = *it;
-		it++;
+		codes[i] = 0;
+		for(int j=0; j < 4; j++) {
+			codes[i] |= (u32)(*it) << (j * 8);
+			it++;
+		}
 	}
 
 	//read alphabets
@@ -421,20 +437,21 @@ int HuffmanNaiveImpl::dec(const vector<u8>& in_data, vector<u8>& out_data) {
 		it++;
 	}
 
-	u32 bit_count = 0;
-	vector<u8> payload;
-	payload.reserve(in_data.size());
-
-	while(it != in_data.end()) {
-		payload.push_back(*it);
-		it++;
+	//a single symbol has a zero length code and no payload bits
+	if(ctCodes == 1) {
+		out_data.assign(msg_len, alphabets[0]);
+		return true;
 	}
 
+	vector<u8> payload(it, in_data.end());
+	if(payload.size() == 0)
+		return false;
+
 	//bit counts
-	bit_count = (payload.size() - 1) * 8 + rem;
+	u32 bit_count = (payload.size() - 1) * 8 + rem;
 
-	//read payload
-	BitStorage bits(payload, bit_count);
+	//read payload, the storage takes over the buffer
+	BitStorage bits(std::move(payload), bit_count);
 	bits.begin();
 
 
@@ -466,10 +483,10 @@ int HuffmanNaiveImpl::dec(const vector<u8>& in_data, vector<u8>& out_data) {
 		HTreeNode* current = root;
 
 		u8 processed_bitlen = 0;
-		u8 processed_code = 0;
+		u32 processed_code = 0;
 		for(u32 j = 0; j < bitcode.bitlen; j++) {
 			u8 msb = (bitcode.code >> (bitcode.bitlen - j - 1)) & 0x1;
-			processed_code |= (processed_code << 1) + msb;
+			processed_code = (processed_code << 1) | msb;
 			processed_bitlen++;
 
 			bool is_leaf = (j == (u32)(bitcode.bitlen - 1));
@@ -532,6 +549,10 @@ int HuffmanNaiveImpl::dec(const vector<u8>& in_data, vector<u8>& out_data) {
 		else
 			current = current->left;
 
+		if(current == NULL) {
+			LogError("Invalid huffman code in the payload");
+			break;
+		}
 
 		//if is leaf
 		bool is_leaf = (current->left == NULL && current->right == NULL);
@@ -551,7 +572,7 @@ int HuffmanNaiveImpl::dec(const vector<u8>& in_data, vector<u8>& out_data) {
 		storage[i] = NULL;
 	}
 
-	return true;
+	return (out_data.size() == msg_len);
 }
 
 
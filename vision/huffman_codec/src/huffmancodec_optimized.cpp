@@ -29,6 +29,7 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "logger.h"
 #include "huffmancodec_optimized.h"
 #include "simplebmp.h"
@@ -47,6 +48,9 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 using namespace sda;
 using namespace sda::cl;
 
+//profiler stage of each EvBreakDown event
+static const char *g_evtNames[HuffmanOptimized::evtCount] = {"host write", "kernel exec", "host read"};
+
 /////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////
 //load_file_to_memory
@@ -61,10 +65,15 @@ HuffmanOptimized::HuffmanOptimized(string& vendor_name,
 			   string& device_name,
 			   int selected_device,
 			   string& strKernelFP,
-			   string& strBitmapFP)
+			   string& strBitmapFP,
+			   u32 chunk_size,
+			   int max_compute_units)
 {
 	//store path to input bitmap
 	m_strBitmapFP = strBitmapFP;
+	m_chunk_size = chunk_size > 0 ? chunk_size : DEFAULT_CHUNK_SIZE;
+	if(max_compute_units <= 0 || max_compute_units > MAX_COMPUTE_UNITS)
+		max_compute_units = MAX_COMPUTE_UNITS;
 
 
 	m_world = xcl_world_single();
@@ -72,10 +81,53 @@ HuffmanOptimized::HuffmanOptimized(string& vendor_name,
 
 	m_program = xcl_import_binary(m_world, "krnl_huffman");
 
-	//kernels
-	m_clKernelHuffmanEncoder  = xcl_get_kernel(m_program, "encode");
-	m_clKernelHuffmanDecoder  = xcl_get_kernel(m_program, "decode");
+	//kernels: compute units are named encode_1 .. encode_N and decode_1 ..
+	//decode_N by --nk, every pair gets its own queue to run concurrently
+	for(int i=1; i <= max_compute_units; i++) {
+		char encoder_name[64];
+		char decoder_name[64];
+		snprintf(encoder_name, sizeof(encoder_name), "encode:{encode_%d}", i);
+		snprintf(decoder_name, sizeof(decoder_name), "decode:{decode_%d}", i);
+
+		cl_int err_enc, err_dec;
+		cl_kernel encoder = clCreateKernel(m_program, encoder_name, &err_enc);
+		cl_kernel decoder = clCreateKernel(m_program, decoder_name, &err_dec);
+		if(err_enc != CL_SUCCESS || err_dec != CL_SUCCESS || encoder == NULL || decoder == NULL) {
+			if(encoder != NULL)
+				clReleaseKernel(encoder);
+			if(decoder != NULL)
+				clReleaseKernel(decoder);
+			break;
+		}
+
+		ComputeUnit cu;
+		cu.name = string(encoder_name + 8, strlen(encoder_name) - 9);
+		cu.encoder = encoder;
+		cu.decoder = decoder;
+		m_cus.push_back(cu);
+	}
 
+	//xclbin without numbered compute units
+	if(m_cus.empty()) {
+		ComputeUnit cu;
+		cu.name = "encode";
+		cu.encoder = xcl_get_kernel(m_program, "encode");
+		cu.decoder = xcl_get_kernel(m_program, "decode");
+		m_cus.push_back(cu);
+	}
+
+	for(size_t i=0; i < m_cus.size(); i++) {
+		cl_int err;
+		m_cus[i].queue = clCreateCommandQueue(m_world.context, m_world.device_id, CL_QUEUE_PROFILING_ENABLE, &err);
+		if(err != CL_SUCCESS) {
+			LogError("Failed to create command queue for compute unit %s", m_cus[i].name.c_str());
+			exit(EXIT_FAILURE);
+		}
+		m_cus[i].chunks = 0;
+		m_cus[i].busy_ms = 0.0;
+	}
+	m_activeCUs = m_cus.size();
+	LogInfo("Found %d compute units, chunk size = %u", m_activeCUs, m_chunk_size);
 }
 
 HuffmanOptimized::~HuffmanOptimized() {
@@ -85,12 +137,22 @@ HuffmanOptimized::~HuffmanOptimized() {
 
 void HuffmanOptimized::cleanup() {
 
-	clReleaseKernel(m_clKernelHuffmanDecoder);
-	clReleaseKernel(m_clKernelHuffmanEncoder);
+	for(size_t i=0; i < m_cus.size(); i++) {
+		clReleaseKernel(m_cus[i].decoder);
+		clReleaseKernel(m_cus[i].encoder);
+		clReleaseCommandQueue(m_cus[i].queue);
+	}
+	m_cus.clear();
 	clReleaseProgram(m_program);
 	xcl_release_world(m_world);
 }
 
+void HuffmanOptimized::set_active_compute_units(int count) {
+	if(count < 1 || count > (int)m_cus.size())
+		count = m_cus.size();
+	m_activeCUs = count;
+}
+
 double HuffmanOptimized::timestamp() {
 	double ms = 0.0;
 	#if  defined(__linux__) || defined(linux)
@@ -105,17 +167,6 @@ double HuffmanOptimized::timestamp() {
 	return ms;
 }
 
-double HuffmanOptimized::computeEventDurationInMS(const cl_event& event) {
-	cl_ulong ts_start = 0, ts_end = 0;
-	double duration = 0;
-	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ts_start, NULL);
-	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ts_end, NULL);
-	duration += (cl_double)(ts_end-ts_start)*(cl_double)(1e-06);
-
-	return duration;
-}
-
-
 bool HuffmanOptimized::releaseMemObject(cl_mem &obj)
 {
   cl_int   err = 0;
@@ -137,13 +188,14 @@ bool HuffmanOptimized::releaseMemObject(cl_mem &obj)
 }
 
 bool HuffmanOptimized::invoke_kernel(cl_kernel krnl,
-							   const vector<u8>& vec_input,
+							   cl_command_queue queue,
+							   const u8* input,
+							   u32 sz_input,
 							   vector<u8>& vec_output,
 							   cl_event events[evtCount]) {
-	if(vec_input.size() == 0)
+	if(sz_input == 0)
 		return false;
 
-	u32 sz_input = vec_input.size();
 	u32 sz_output = 0;
 
 	LogInfo("Creating input/output buffers");
@@ -179,15 +231,15 @@ bool HuffmanOptimized::invoke_kernel(cl_kernel krnl,
 
 	LogInfo("Write input data to device buffer");
 	//copy input dataset to OpenCL buffer
-	err = clEnqueueWriteBuffer(m_world.command_queue, mem_input, CL_TRUE, 0,
-							   sz_input, vec_input.data(), 0, NULL, NULL);
+	err = clEnqueueWriteBuffer(queue, mem_input, CL_TRUE, 0,
+							   sz_input, input, 0, NULL, NULL);
 	if (err != CL_SUCCESS) {
 		LogError("Failed to copy input dataset to OpenCL buffer");
 		return false;
 	}
 
 	//finish all memory writes
-	clFinish(m_world.command_queue);
+	clFinish(queue);
 
 	//execute kernel
 	/*!
@@ -245,27 +297,27 @@ bool HuffmanOptimized::invoke_kernel(cl_kernel krnl,
 	LogInfo("EX1: to make sure all buffers are migrated to device");
 
 	//call once to guarentee that all buffers are migrated to device memory
-	err = clEnqueueNDRangeKernel(m_world.command_queue, krnl, 1, NULL, global,
+	err = clEnqueueNDRangeKernel(queue, krnl, 1, NULL, global,
 			local, 0, NULL, &events[evtHostWrite]);
 	if (err != CL_SUCCESS) {
 		LogError("[EX1] Failed to execute kernel %d", err);
 		LogError("Test failed");
 		return false;
 	}
-	clFinish(m_world.command_queue);
+	clFinish(queue);
 
 
 	LogInfo("EX1: Readback the output size required for the actual kernel execution");
 
 	//read output size
-	err = clEnqueueReadBuffer(m_world.command_queue, mem_sz_output, CL_TRUE, 0,
+	err = clEnqueueReadBuffer(queue, mem_sz_output, CL_TRUE, 0,
 			sizeof(u32), (void *) &sz_output, 0, NULL, NULL);
 	if (err != CL_SUCCESS) {
 		LogError("Failed to read output size buffer %d", err);
 		LogError("Test failed");
 		return false;
 	}
-	clFinish(m_world.command_queue);
+	clFinish(queue);
 
 
 	LogInfo("EX1: sz_input = %u, sz_output = %u", sz_input, sz_output);
@@ -284,7 +336,7 @@ bool HuffmanOptimized::invoke_kernel(cl_kernel krnl,
 
 	LogInfo("Write output data to device buffer");
 	//copy input dataset to OpenCL buffer
-	err = clEnqueueWriteBuffer(m_world.command_queue, mem_output, CL_TRUE, 0,
+	err = clEnqueueWriteBuffer(queue, mem_output, CL_TRUE, 0,
 							   sz_output, vec_output.data(), 0, NULL, NULL);
 	if (err != CL_SUCCESS) {
 		LogError("Failed to clear output dataset in OpenCL buffer");
@@ -319,7 +371,7 @@ bool HuffmanOptimized::invoke_kernel(cl_kernel krnl,
 	LogInfo("EX2: Real execution of the algorithm to fill the output");
 
 	//call a second time to measure on-chip throughput
-	err = clEnqueueNDRangeKernel(m_world.command_queue, krnl, 1, NULL, global,
+	err = clEnqueueNDRangeKernel(queue, krnl, 1, NULL, global,
 			local, 0, NULL, &events[evtKernelExec]);
 	if (err != CL_SUCCESS) {
 		LogError("[EX2] Failed to execute kernel %d", err);
@@ -327,19 +379,19 @@ bool HuffmanOptimized::invoke_kernel(cl_kernel krnl,
 		return false;
 	}
 
-	clFinish(m_world.command_queue);
+	clFinish(queue);
 
 
 	LogInfo("EX2: Readback the results from codec");
 	//copy results back from OpenCL buffer
-	err = clEnqueueReadBuffer(m_world.command_queue, mem_output, CL_TRUE, 0,
+	err = clEnqueueReadBuffer(queue, mem_output, CL_TRUE, 0,
 			sz_output, (void *) vec_output.data(), 0, NULL, &events[evtHostRead]);
 	if (err != CL_SUCCESS) {
 		LogError("Failed to read output size buffer %d", err);
 		LogError("Test failed");
 		return false;
 	}
-	clFinish(m_world.command_queue);
+	clFinish(queue);
 
 
 	//cleanup
@@ -350,64 +402,154 @@ bool HuffmanOptimized::invoke_kernel(cl_kernel krnl,
 	return true;
 }
 
+bool HuffmanOptimized::invoke_chunks(bool encoder,
+							   const vector<u8>& in_data,
+							   vector<u8>& out_data) {
+	HuffmanChunks chunks;
+	u32 msg_len = in_data.size();
+	u32 n = 0;
+	if(encoder) {
+		n = HuffmanChunks::count(msg_len, m_chunk_size);
+	}
+	else {
+		if(!chunks.parse(in_data.data(), in_data.size()))
+			return false;
+		n = chunks.count();
+		out_data.resize(chunks.msg_len());
+	}
+
+	//every compute unit takes the next chunk as soon as it is done with its
+	//last one, so units stay busy when chunks code at different speeds
+	vector< vector<u8> > streams(n);
+	bool res = HuffmanChunks::dispatch(n, m_activeCUs, [&](int w, u32 i) {
+		ComputeUnit& cu = m_cus[w];
+		const u8* input = NULL;
+		u32 sz_input = 0;
+		if(encoder) {
+			input = &in_data[i * m_chunk_size];
+			sz_input = (msg_len - i * m_chunk_size < m_chunk_size) ? (msg_len - i * m_chunk_size) : m_chunk_size;
+		}
+		else {
+			input = chunks.stream(i);
+			sz_input = chunks.stream_size(i);
+		}
+
+		cl_event events[evtCount] = {NULL, NULL, NULL};
+		bool ok = invoke_kernel(encoder ? cu.encoder : cu.decoder, cu.queue, input, sz_input, streams[i], events);
+		for(int e=0; e < evtCount; e++) {
+			if(events[e] == NULL)
+				continue;
+			m_profiler.record(g_evtNames[e], events[e]);
+			if(ok)
+				cu.busy_ms += xcl_get_event_duration(events[e]) / 1000000.0;
+		}
+		if(!encoder && events[evtKernelExec] != NULL) {
+			m_profiler.record("decode kernel exec", events[evtKernelExec]);
+		}
+		for(int e=0; e < evtCount; e++) {
+			if(events[e] != NULL)
+				clReleaseEvent(events[e]);
+		}
+		if(!ok) {
+			LogError("Compute unit %s failed on chunk %u", cu.name.c_str(), i);
+			return false;
+		}
+		cu.chunks++;
+
+		//decoded chunks go straight to their place in the output
+		if(!encoder) {
+			if(streams[i].size() != chunks.raw_size(i)) {
+				LogError("Chunk %u decoded to %u bytes, expected %u", i, (u32)streams[i].size(), chunks.raw_size(i));
+				return false;
+			}
+			memcpy(&out_data[chunks.raw_offset(i)], streams[i].data(), streams[i].size());
+			vector<u8>().swap(streams[i]);
+		}
+		return true;
+	});
+
+	if(res && encoder) {
+		HuffmanChunks::pack(msg_len, m_chunk_size, streams, out_data);
+	}
+
+	return res;
+}
+
+void HuffmanOptimized::report_compute_units(double span_ms) {
+	for(int i=0; i < m_activeCUs; i++) {
+		const ComputeUnit& cu = m_cus[i];
+		double utilisation = span_ms > 0 ? 100.0 * cu.busy_ms / span_ms : 0.0;
+		LogInfo("Compute unit %s: chunks = %u, busy [ms] = %f, utilisation = %.1f%%",
+				cu.name.c_str(), cu.chunks, cu.busy_ms, utilisation);
+	}
+}
+
 int HuffmanOptimized::enc(const vector<u8>& in_data, vector<u8>& out_data) {
 	//timings
-	cl_event events[evtCount];
 	double durations[evtCount];
-	for(int i=0; i < evtCount; i++)
-		durations[i] = 0.0;
+	m_profiler.clear();
+	for(size_t i=0; i < m_cus.size(); i++) {
+		m_cus[i].chunks = 0;
+		m_cus[i].busy_ms = 0.0;
+	}
 
 	//start time stamps
 	double startMS = timestamp();
 
 	//encode image
 	LogInfo("Invoking encoder");
-	bool res = invoke_kernel(m_clKernelHuffmanEncoder, in_data, out_data, &events[0]);
+	bool res = invoke_chunks(true, in_data, out_data);
 	if(!res) {
 		LogError("Failed to encode the input. Test Failed");
 		return false;
 	}
+	double spanMS = timestamp() - startMS;
 
 	//collect times
 	for(int i=0; i < evtCount; i++) {
-		durations[i] += computeEventDurationInMS(events[i]);
+		durations[i] = m_profiler.total_ms(g_evtNames[i]);
 	}
 
-	LogInfo("Total time in [ms] = %f", timestamp() - startMS);
+	LogInfo("Total time in [ms] = %f", spanMS);
 	LogInfo("Host write [ms] = %f", durations[evtHostWrite]);
 	LogInfo("Kernel exec [ms] = %f", durations[evtKernelExec]);
 	LogInfo("Host read [ms] = %f", durations[evtHostRead]);
+	report_compute_units(spanMS);
 
 	return true;
 }
 
 int HuffmanOptimized::dec(const vector<u8>& in_data, vector<u8>& out_data) {
 	//timings
-	cl_event events[evtCount];
 	double durations[evtCount];
-	for(int i=0; i < evtCount; i++)
-		durations[i] = 0.0;
+	m_profiler.clear();
+	for(size_t i=0; i < m_cus.size(); i++) {
+		m_cus[i].chunks = 0;
+		m_cus[i].busy_ms = 0.0;
+	}
 
 	//start time stamps
 	double startMS = timestamp();
 
-	//encode image
-	LogInfo("Invoking encoder");
-	bool res = invoke_kernel(m_clKernelHuffmanDecoder, in_data, out_data, &events[0]);
+	//decode image
+	LogInfo("Invoking decoder");
+	bool res = invoke_chunks(false, in_data, out_data);
 	if(!res) {
-		LogError("Failed to encode the input. Test Failed");
+		LogError("Failed to decode the input. Test Failed");
 		return false;
 	}
+	double spanMS = timestamp() - startMS;
 
 	//collect times
 	for(int i=0; i < evtCount; i++) {
-		durations[i] += computeEventDurationInMS(events[i]);
+		durations[i] = m_profiler.total_ms(g_evtNames[i]);
 	}
 
-	LogInfo("Total time in [ms] = %f", timestamp() - startMS);
+	LogInfo("Total time in [ms] = %f", spanMS);
 	LogInfo("Host write [ms] = %f", durations[evtHostWrite]);
 	LogInfo("Kernel exec [ms] = %f", durations[evtKernelExec]);
 	LogInfo("Host read [ms] = %f", durations[evtHostRead]);
+	report_compute_units(spanMS);
 
 	return true;
 }
@@ -434,10 +576,12 @@ bool HuffmanOptimized::run(int idevice, int nruns) {
 	LogInfo("Read input data successfully. size = %u", szInputBuffer);
 
 	//timings
-	cl_event events[evtCount];
 	double durations[evtCount];
-	for(int i=0; i < evtCount; i++)
-		durations[i] = 0.0;
+	m_profiler.clear();
+	for(size_t i=0; i < m_cus.size(); i++) {
+		m_cus[i].chunks = 0;
+		m_cus[i].busy_ms = 0.0;
+	}
 
 	//start time stamps
 	double startMS = timestamp();
@@ -447,30 +591,28 @@ bool HuffmanOptimized::run(int idevice, int nruns) {
 	vector<u8> vec_decoded_data;
 
 	//encode image
-	LogInfo("Invoking encoder");
-	bool res = invoke_kernel(m_clKernelHuffmanEncoder, vec_in, vec_encoded_data, &events[0]);
+	LogInfo("Invoking encoder on %d compute units, %u chunks",
+			m_activeCUs, HuffmanChunks::count(szInputBuffer, m_chunk_size));
+	bool res = invoke_chunks(true, vec_in, vec_encoded_data);
 	if(!res) {
 		LogError("Failed to encode the input. Test Failed");
 		return false;
 	}
-
-	//collect times
-	for(int i=0; i < evtCount; i++) {
-		durations[i] += computeEventDurationInMS(events[i]);
-	}
+	LogInfo("Encoded %u bytes to %u bytes", szInputBuffer, (u32)vec_encoded_data.size());
 
 
 	//decode image
 	LogInfo("Invoking decoder");
-	res |= invoke_kernel(m_clKernelHuffmanDecoder, vec_encoded_data, vec_decoded_data, &events[0]);
+	res = invoke_chunks(false, vec_encoded_data, vec_decoded_data);
 	if(!res) {
 		LogError("Failed to decode the output. Test Failed");
 		return false;
 	}
+	double spanMS = timestamp() - startMS;
 
 	//collect times
 	for(int i=0; i < evtCount; i++) {
-		durations[i] += computeEventDurationInMS(events[i]);
+		durations[i] = m_profiler.total_ms(g_evtNames[i]);
 	}
 
 	double h2d_rate = 0.0;
@@ -501,12 +643,56 @@ bool HuffmanOptimized::run(int idevice, int nruns) {
 
 	//set stats to valid data
 	LogInfo("Number of runs = %d", nruns);
-	LogInfo("Total time in [ms] = %f", timestamp() - startMS);
+	LogInfo("Total time in [ms] = %f", spanMS);
 	LogInfo("Host write [ms] = %f", durations[evtHostWrite]);
 	LogInfo("Kernel exec [ms] = %f", durations[evtKernelExec]);
 	LogInfo("Host read [ms] = %f", durations[evtHostRead]);
 	LogInfo("TX rate host --> device [mbps] = %f", h2d_rate);
 	LogInfo("TX rate device --> host [mbps] = %f", d2h_rate);
+	double decode_ms = m_profiler.total_ms("decode kernel exec");
+	if(decode_ms > 0) {
+		LogInfo("Decode throughput [MB/s] = %f", vec_decoded_data.size() / (decode_ms * 1000.0));
+	}
+	report_compute_units(spanMS);
+	m_profiler.report();
+
+
+	//throughput of encode + decode with 1 .. N compute units sharing the chunks
+	if(m_activeCUs > 1) {
+		int ctCUs = m_activeCUs;
+		double baseMS = 0.0;
+		LogInfo("Throughput scaling over 1 .. %d compute units, nruns = %d", ctCUs, nruns);
+		for(int c=1; c <= ctCUs; c++) {
+			set_active_compute_units(c);
+
+			vector<u8> vec_scaling_encoded;
+			vector<u8> vec_scaling_decoded;
+			double encMS = 0.0;
+			double decMS = 0.0;
+			for(int r=0; r < nruns && res; r++) {
+				double tsMS = timestamp();
+				res &= invoke_chunks(true, vec_in, vec_scaling_encoded);
+				encMS += timestamp() - tsMS;
+
+				tsMS = timestamp();
+				res &= invoke_chunks(false, vec_scaling_encoded, vec_scaling_decoded);
+				decMS += timestamp() - tsMS;
+			}
+			if(!res) {
+				LogError("Scaling run on %d compute units failed", c);
+				break;
+			}
+
+			double encMBs = szInputBuffer * nruns / (encMS * 1000.0);
+			double decMBs = szInputBuffer * nruns / (decMS * 1000.0);
+			if(c == 1)
+				baseMS = encMS + decMS;
+			LogInfo("Compute units = %d, encode [MB/s] = %f, decode [MB/s] = %f, speedup = %.2fx, %s",
+					c, encMBs, decMBs, baseMS / (encMS + decMS),
+					(vec_scaling_decoded == vec_in) ? "PASS" : "FAIL");
+		}
+		set_active_compute_units(ctCUs);
+	}
 
 
 	//write decoded bmp
@@ -516,6 +702,5 @@ bool HuffmanOptimized::run(int idevice, int nruns) {
 	writebmp((char*)strOutputFP.c_str(), &inputbmp);
 
 
-	return true;
+	return res;
 }
-
@@ -33,9 +33,12 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include "bit_io.h"
 #include "xcl.h"
+#include "profiler.h"
 #include "huffmancodec_naive.h"
+#include "huffmancodec_chunked.h"
 
-#define COMPUTE_UNITS 1
+//encode:{encode_1} .. encode:{encode_N} and the decode units are looked up
+#define MAX_COMPUTE_UNITS 16
 
 using namespace std;
 
@@ -43,7 +46,9 @@ namespace sda {
 namespace cl {
 
 /*!
- *
+ * Encodes and decodes the chunk container of HuffmanChunks on the device.
+ * Chunks are handed out to the compute units, each driven by its own host
+ * thread and command queue.
  */
 class HuffmanOptimized : public ICodec {
 public:
@@ -52,7 +57,9 @@ public:
 		   string& device_name,
 		   int selected_device,
 		   string& strKernelFP,
-		   string& strBitmapFP);
+		   string& strBitmapFP,
+		   u32 chunk_size = DEFAULT_CHUNK_SIZE,
+		   int max_compute_units = 0);
 	virtual ~HuffmanOptimized();
 
 	enum EvBreakDown {evtHostWrite = 0, evtKernelExec = 1, evtHostRead = 2, evtCount = 3};
@@ -62,24 +69,44 @@ public:
 	int dec(const vector<u8>& in_data, vector<u8>& out_data);
 
 	bool run(int idevice, int nruns);
-	bool invoke_kernel(cl_kernel krnl, const vector<u8>& vec_input, vector<u8>& vec_output, cl_event events[evtCount]);
+	bool invoke_kernel(cl_kernel krnl, cl_command_queue queue, const u8* input, u32 sz_input, vector<u8>& vec_output, cl_event events[evtCount]);
+
+	//compute units sharing the chunks, 1 .. compute_units()
+	void set_active_compute_units(int count);
+	int compute_units() const { return m_cus.size(); }
 
 
 	static double timestamp();
-	static double computeEventDurationInMS(const cl_event& event);
 
 
 protected:
 	void cleanup();
 	bool releaseMemObject(cl_mem &obj);
 
+	bool invoke_chunks(bool encoder, const vector<u8>& in_data, vector<u8>& out_data);
+	void report_compute_units(double span_ms);
+
 private:
+	//an encode and a decode compute unit sharing a command queue
+	struct ComputeUnit {
+		string name;
+		cl_kernel encoder;
+		cl_kernel decoder;
+		cl_command_queue queue;
+		u32 chunks;
+		double busy_ms;
+	};
+
 	string m_strBitmapFP;
+	u32 m_chunk_size;
 
 	xcl_world m_world;
 	cl_program m_program;
-	cl_kernel m_clKernelHuffmanEncoder;
-	cl_kernel m_clKernelHuffmanDecoder;
+	vector<ComputeUnit> m_cus;
+	int m_activeCUs;
+
+	//per stage event timings
+	Profiler m_profiler;
 };
 
 }
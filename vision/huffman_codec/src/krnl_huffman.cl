@@ -38,76 +38,29 @@ typedef unsigned int		u32;
 typedef			 char		i8;
 typedef			 short		i16;
 typedef			 int		i32;
+typedef			 ulong		u64;
 
 
-#define OFFSET_WEIGHT 0
-#define OFFSET_CHILDREN 1
-#define OFFSET_CODE 2
-#define OFFSET_SYM_BITLEN 3
-#define ENTRY_STRIDE 4
-
-//2N - 1 where N is number of leaves
 //N = 256 leaves
 #define MAX_TREE_LEAVES 256
 
-//unbalanced tree has a depth of N - 1
-#define MAX_TREE_DEPTH MAX_TREE_LEAVES
-
-//Max nodes count = 2N-1
-#define MAX_TREE_NODES MAX_TREE_LEAVES * 2
-
-__constant const u16 C_INVALID_LINK = (u16)-1;
-
-struct FLAT_HTREE {
-	u32 weight;
-	u16 lc;
-	u16 rc;
-	u32 code;
-	u8 symbol;
-	u8 bitlen;
-};
-
-void write_ht_node(u32* pht_current, const struct FLAT_HTREE* pnode) {
-	pht_current[OFFSET_WEIGHT] = pnode->weight;
-	pht_current[OFFSET_CHILDREN] = (u32)((u32)(pnode->lc << 16) | pnode->rc);
-	pht_current[OFFSET_CODE] = pnode->code;
-	pht_current[OFFSET_SYM_BITLEN] = (u32)((u32)(pnode->symbol << 16) | pnode->bitlen);
-}
-
-
-void read_ht_node(const u32* pht_current, struct FLAT_HTREE* pnode) {
-	pnode->weight = pht_current[OFFSET_WEIGHT];
-	pnode->lc = (u16)((pht_current[OFFSET_CHILDREN] >> 16) & 0xFFFF);
-	pnode->rc = (u16)(pht_current[OFFSET_CHILDREN] & 0xFFFF);
-	pnode->code = pht_current[OFFSET_CODE];
-	pnode->symbol = (u8)((u8)(pht_current[OFFSET_SYM_BITLEN] >> 16) & 0xFF);
-	pnode->bitlen = (u16)(pht_current[OFFSET_SYM_BITLEN] & 0xFFFF);
-}
-
-
-int find_next_min(u32* pht, u32 count, const u8* visited) {
-	if(count == 0)
-		return -1;
-
-	//loop over unvisited entries only
-	u32 idx_min = -1;
-	u32 min_usage = UINT_MAX;
-	for(u32 i=0; i < count; i++) {
-
-		if(visited[i] > 0)
-			continue;
+//longest code the encoder emits, code lengths are stored in 4 bits
+#define MAX_CODE_BITS 15
 
-		struct FLAT_HTREE node;
-		read_ht_node(&pht[i * ENTRY_STRIDE], &node);
+//decode tables: a primary table indexed by the next LUT_PRIMARY_BITS payload
+//bits and overflow tables for longer codes. Every overflow table starts at
+//an internal tree node, and a tree has N - 1 of them
+#define LUT_PRIMARY_BITS 10
+#define LUT_OVERFLOW_BITS 5
+#define LUT_PRIMARY_MASK ((1 << LUT_PRIMARY_BITS) - 1)
+#define LUT_OVERFLOW_MASK ((1 << LUT_OVERFLOW_BITS) - 1)
+#define LUT_MAX_ENTRIES ((1 << LUT_PRIMARY_BITS) + (MAX_TREE_LEAVES - 1) * (1 << LUT_OVERFLOW_BITS))
 
-		if(node.weight < min_usage) {
-			idx_min = i;
-			min_usage = node.weight;
-		}
-	}
-
-	return (int)idx_min;
-}
+//entry = [link:1][unused:7][bits consumed:8][symbol or overflow table:16]
+#define LUT_LINK 0x80000000
+#define LUT_LEN(e) (((e) >> 16) & 0xFF)
+#define LUT_SYMBOL(e) ((e) & 0xFF)
+#define LUT_TABLE(e) ((e) & 0xFFFF)
 
 //returns 1 if the pointer is incremented otherwise 0
 u8 bit_writer(__global u8** pptr, u32* p_total_bit_count, u8 bit) {
@@ -128,11 +81,6 @@ u8 bit_writer(__global u8** pptr, u32* p_total_bit_count, u8 bit) {
 	return 0;
 }
 
-u8 is_bit_set(u8 byte, u8 index) {
-	return  ((byte & (1 << index)) & 0xFF) != 0;
-}
-
-
 u8 multiple_bits_writer(__global u8** pptr, u32* p_total_bit_count, u32 bits, u32 len) {
 	u8 bytes_written = 0;
 	if(len == 0)
@@ -150,28 +98,6 @@ u8 multiple_bits_writer(__global u8** pptr, u32* p_total_bit_count, u32 bits, u3
 }
 
 
-int bit_reader(__global u8** pptr, u32* p_total_bits_read, u32 count_bits) {
-	if(count_bits == 0)
-		return 0;
-
-	int output = 0;
-	for(u32 i = 0; i < count_bits; i++) {
-		//u32 byte_index = (*p_total_bits_read) >> 3;
-		u32 bit_index = (*p_total_bits_read) % 8;
-		(*p_total_bits_read) ++;
-
-		u8 msb = is_bit_set(**pptr, bit_index);
-		output = (output << 1) + msb;
-
-		if(bit_index == 7) {
-			(*pptr)++;
-		}
-	}
-
-	return output;
-}
-
-
 void write_word(__global u8** pptr, u32 word) {
 	//u8* ptr = *pptr;
 	for(int i=0; i < 4; i++) {
@@ -191,175 +117,367 @@ inline void read_word(__global u8** pptr, u32* pword) {
 
 
 
-__kernel
-__attribute__ ((reqd_work_group_size(1,1,1)))
-void encode(__global uchar* in_data, uint size_in_data, __global uchar* out_data, __global uint* size_out_data, uchar fetch_size_only)
-{
-	//storage for huffman tree
-	u32 ht[MAX_TREE_NODES * ENTRY_STRIDE];
-	u32 ht_current = 0;
+//reverses the low len bits of code
+u32 reverse_bits(u32 code, u32 len) {
+	u32 rev = 0;
+	for(u32 i = 0; i < len; i++) {
+		rev = (rev << 1) | (code & 0x01);
+		code >>= 1;
+	}
+
+	return rev;
+}
 
-	u8 visited[MAX_TREE_NODES];
-	for(u32 i=0; i < MAX_TREE_NODES; i++) {
-		visited[i] = 0;
+/*!
+ * Fills the decode tables from the code book. A code of up to LUT_PRIMARY_BITS
+ * resolves with a single lookup in the primary table, a longer one links to
+ * overflow tables of LUT_OVERFLOW_BITS each. Codes are written msb first and
+ * read lsb first, so the tables are indexed by the bit reversed codes and the
+ * next payload bits index them directly. Returns the number of entries used,
+ * or -1 if the codes are not prefix free or longer than 32 bits.
+ */
+int build_decode_lut(const u8* leaf_symbols, const u8* leaf_bitlen, const u32* leaf_bitcodes, u32 ctLeaves, u32* lut) {
+	for(u32 i=0; i < (1 << LUT_PRIMARY_BITS); i++) {
+		lut[i] = 0;
 	}
+	u32 lut_current = (1 << LUT_PRIMARY_BITS);
 
-	//define alphabet map and fill with zeroes
-	u32 alphabet_usage[MAX_TREE_LEAVES];
-	u16 alphabet_to_htree_node[MAX_TREE_LEAVES];
-	for(u32 i=0; i < MAX_TREE_LEAVES; i++) {
-	  alphabet_usage[i] = 0;
-	  alphabet_to_htree_node[i] = C_INVALID_LINK;
+	for(u32 i=0; i < ctLeaves; i++) {
+		u32 bitlen = leaf_bitlen[i];
+		if(bitlen == 0 || bitlen > 32)
+			return -1;
+		u32 rev = reverse_bits(leaf_bitcodes[i], bitlen);
+
+		//walk down to the table holding the last bits of the code
+		u32 base = 0;
+		u32 bits = LUT_PRIMARY_BITS;
+		u32 consumed = 0;
+		while(bitlen - consumed > bits) {
+			u32 index = base + ((rev >> consumed) & ((1 << bits) - 1));
+			if(lut[index] == 0) {
+				if(lut_current + (1 << LUT_OVERFLOW_BITS) > LUT_MAX_ENTRIES)
+					return -1;
+
+				for(u32 j=0; j < (1 << LUT_OVERFLOW_BITS); j++) {
+					lut[lut_current + j] = 0;
+				}
+				lut[index] = LUT_LINK | (bits << 16) | lut_current;
+				lut_current += (1 << LUT_OVERFLOW_BITS);
+			}
+			else if((lut[index] & LUT_LINK) == 0)
+				return -1;
+
+			base = LUT_TABLE(lut[index]);
+			consumed += bits;
+			bits = LUT_OVERFLOW_BITS;
+		}
+
+		//replicate the code over all entries it prefixes
+		u32 rem = bitlen - consumed;
+		u32 prefix = (rev >> consumed) & ((1 << rem) - 1);
+		for(u32 j=0; j < (1u << (bits - rem)); j++) {
+			u32 index = base + ((j << rem) | prefix);
+			if(lut[index] != 0)
+				return -1;
+			lut[index] = (rem << 16) | leaf_symbols[i];
+		}
 	}
 
-	for(u32 i=0; i < size_in_data; i++) {
-		u8 d = in_data[i];
-		alphabet_usage[d] ++;
+	return (int)lut_current;
+}
+
+//payload reader, acc holds the next avail payload bits lsb first
+struct BIT_READER {
+	u64 acc;
+	int avail;
+	u32 pos;
+};
+
+//tops up the accumulator to at least 56 bits while payload bytes are left,
+//the byte loop has a fixed trip count of at most 8
+inline void bit_refill(__global const u8* ptr, u32 size, struct BIT_READER* br) {
+	while(br->avail <= 56 && br->pos < size) {
+		br->acc |= (u64)ptr[br->pos] << br->avail;
+		br->pos++;
+		br->avail += 8;
 	}
+}
 
-	u8 ctLeaves = 0;
-	for(u16 i=0; i < MAX_TREE_LEAVES; i++) {
-	  if(alphabet_usage[i] > 0) {
-		  ctLeaves ++;
 
-		  //HTREE leaf node
-		  struct FLAT_HTREE node;
-		  node.lc = node.rc = C_INVALID_LINK;
-		  node.code = node.bitlen = 0;
-		  node.symbol = (u16)i;
-		  node.weight = alphabet_usage[i];
+/*!
+ * Sorts the used symbols by ascending weight, ties in symbol order, with a
+ * radix sort over the weight bytes. Returns the number of used symbols.
+ */
+u32 sort_symbols(const u32* weights, u16* sorted) {
+	u16 tmp[MAX_TREE_LEAVES];
+	u32 offsets[256];
+
+	u32 count = 0;
+	u32 max_weight = 0;
+	for(u32 i=0; i < MAX_TREE_LEAVES; i++) {
+		if(weights[i] > 0) {
+			sorted[count++] = (u16)i;
+			if(weights[i] > max_weight)
+				max_weight = weights[i];
+		}
+	}
+
+	//stable passes from the low byte up, skipping the bytes all weights leave 0
+	for(u32 shift=0; shift < 32 && (max_weight >> shift) != 0; shift += 8) {
+		for(u32 d=0; d < 256; d++) {
+			offsets[d] = 0;
+		}
+		for(u32 i=0; i < count; i++) {
+			offsets[(weights[sorted[i]] >> shift) & 0xFF]++;
+		}
 
-		  //final codebook lut
-		  alphabet_to_htree_node[i] = ht_current;
+		u32 sum = 0;
+		for(u32 d=0; d < 256; d++) {
+			u32 ct = offsets[d];
+			offsets[d] = sum;
+			sum += ct;
+		}
 
-		  //write ht node
-		  write_ht_node(&ht[ht_current * ENTRY_STRIDE], &node);
-		  ht_current++;
-	  }
+		for(u32 i=0; i < count; i++) {
+			tmp[offsets[(weights[sorted[i]] >> shift) & 0xFF]++] = sorted[i];
+		}
+		for(u32 i=0; i < count; i++) {
+			sorted[i] = tmp[i];
+		}
 	}
 
-	//now
-	//u32 nMaxTreeNodes = ctLeaves * 2 - 1;
-	//printf("There are %u unique symbols\n", ctLeaves);
+	return count;
+}
 
+/*!
+ * Code lengths of the symbols with a non zero weight, 0 for the others.
+ * Huffman lengths come from the in-place algorithm of Moffat and Katajainen
+ * over the sorted weights, with no tree and no search for the two smallest
+ * nodes. When the longest code exceeds max_bits (at most MAX_CODE_BITS, 0
+ * keeps the Huffman lengths) the long codes are cut to max_bits and the Kraft
+ * sum is restored by moving codes from the longest lengths below the limit
+ * one level down. A single symbol gets a 1 bit code. Returns the number of
+ * used symbols.
+ */
+u32 build_code_lengths(const u32* weights, u32 max_bits, u8* code_bitlen) {
+	u16 sorted[MAX_TREE_LEAVES];
+	u32 A[MAX_TREE_LEAVES];
+	u32 bl_count[MAX_CODE_BITS + 1];
 
-	u32 ctUnvisited = ctLeaves;
-	while(ctUnvisited > 1) {
+	for(u32 i=0; i < MAX_TREE_LEAVES; i++) {
+		code_bitlen[i] = 0;
+	}
 
-		int idxS0 = find_next_min(&ht[0], ht_current, &visited[0]);
-		//assert(idxS0 >= 0 && idxS0 < (int)ht_current);
-		visited[idxS0] = 1;
+	int n = (int)sort_symbols(weights, sorted);
+	if(n == 0)
+		return 0;
+	if(n == 1) {
+		code_bitlen[sorted[0]] = 1;
+		return 1;
+	}
 
-		int idxS1 = find_next_min(&ht[0], ht_current, &visited[0]);
-		//assert(idxS1 >= 0 && idxS1 < (int)ht_current);
-		visited[idxS1] = 1;
+	for(int i=0; i < n; i++) {
+		A[i] = weights[sorted[i]];
+	}
 
-		struct FLAT_HTREE lc_node;
-		read_ht_node(&ht[idxS0 * ENTRY_STRIDE], &lc_node);
+	//merge the two lightest of the leaves and internal nodes, internal node
+	//next keeps its weight and its leaf-side slots point to their parent
+	int root = 0;
+	int leaf = 2;
+	A[0] += A[1];
+	for(int next=1; next < n - 1; next++) {
+		if(leaf >= n || A[root] < A[leaf]) {
+			A[next] = A[root];
+			A[root++] = next;
+		}
+		else {
+			A[next] = A[leaf++];
+		}
 
-		struct FLAT_HTREE rc_node;
-		read_ht_node(&ht[idxS1 * ENTRY_STRIDE], &rc_node);
+		if(leaf >= n || (root < next && A[root] < A[leaf])) {
+			A[next] += A[root];
+			A[root++] = next;
+		}
+		else {
+			A[next] += A[leaf++];
+		}
+	}
 
-		//create the combined node
-		//htreenode
-		struct FLAT_HTREE node;
-		node.lc = idxS0;
-		node.rc = idxS1;
-		node.code = 0;
-		node.bitlen = 0;
-		node.symbol = rc_node.symbol;
-		node.weight = lc_node.weight + rc_node.weight;
+	//depths of the internal nodes
+	A[n - 2] = 0;
+	for(int next=n - 3; next >= 0; next--) {
+		A[next] = A[A[next]] + 1;
+	}
 
-		//write ht node
-		write_ht_node(&ht[ht_current * ENTRY_STRIDE], &node);
-		ht_current++;
+	//depths of the leaves, longest first
+	int avbl = 1;
+	int used = 0;
+	u32 depth = 0;
+	root = n - 2;
+	int next = n - 1;
+	while(avbl > 0) {
+		while(root >= 0 && A[root] == depth) {
+			used++;
+			root--;
+		}
+		while(avbl > used) {
+			A[next--] = depth;
+			avbl--;
+		}
+		avbl = 2 * used;
+		depth++;
+		used = 0;
+	}
 
-		ctUnvisited--;
+	if(max_bits == 0 || A[0] <= max_bits) {
+		for(int i=0; i < n; i++) {
+			code_bitlen[sorted[i]] = (u8)A[i];
+		}
+		return (u32)n;
 	}
 
+	//cut to max_bits, the Kraft sum in units of 2^-max_bits is then above 1
+	for(u32 l=0; l <= max_bits; l++) {
+		bl_count[l] = 0;
+	}
+	for(int i=0; i < n; i++) {
+		bl_count[(A[i] > max_bits) ? max_bits : A[i]]++;
+	}
 
-	//now compute bit-codes
-	u32 idxRoot = ht_current - 1;
+	u32 total = 0;
+	for(u32 l=1; l <= max_bits; l++) {
+		total += bl_count[l] << (max_bits - l);
+	}
 
-	//TODO: use a stack-less traversal such as:
-	//https://software.intel.com/sites/default/files/managed/10/af/dynamic-stackless-binary-tree-traversal.pdf
-	u16 stk_nodes[MAX_TREE_DEPTH];
-	int top = 0;
+	//a max_bits code becomes a child of the longest shorter code
+	while(total > (1u << max_bits)) {
+		bl_count[max_bits]--;
+		for(u32 l=max_bits - 1; l > 0; l--) {
+			if(bl_count[l] > 0) {
+				bl_count[l]--;
+				bl_count[l + 1] += 2;
+				break;
+			}
+		}
+		total--;
+	}
 
-	stk_nodes[top] = idxRoot;
+	//lightest symbols get the longest codes
+	int idx = 0;
+	for(u32 l=max_bits; l > 0; l--) {
+		for(u32 k=0; k < bl_count[l]; k++) {
+			code_bitlen[sorted[idx++]] = (u8)l;
+		}
+	}
 
-	//pop till stack is empty
-	while(top >= 0) {
-		struct FLAT_HTREE node;
-		struct FLAT_HTREE left_child;
-		struct FLAT_HTREE right_child;
+	return (u32)n;
+}
 
-		u32 index = stk_nodes[top--];
-		read_ht_node(&ht[index * ENTRY_STRIDE], &node);
+/*!
+ * Canonical codes from the code lengths: codes of one length are consecutive
+ * in symbol order, and all of them follow the codes of shorter lengths
+ */
+void build_canonical_codes(const u8* code_bitlen, u32* codes) {
+	u32 bl_count[MAX_CODE_BITS + 1];
+	u32 next_code[MAX_CODE_BITS + 1];
 
-		if(node.lc != C_INVALID_LINK) {
-			read_ht_node(&ht[node.lc * ENTRY_STRIDE], &left_child);
-			left_child.code = (node.code << 1);
-			left_child.bitlen = node.bitlen + 1;
-			write_ht_node(&ht[node.lc * ENTRY_STRIDE], &left_child);
+	for(u32 l=0; l <= MAX_CODE_BITS; l++) {
+		bl_count[l] = 0;
+	}
+	for(u32 i=0; i < MAX_TREE_LEAVES; i++) {
+		bl_count[code_bitlen[i]]++;
+	}
 
-			stk_nodes[++top] = node.lc;
-		}
+	u32 code = 0;
+	bl_count[0] = 0;
+	next_code[0] = 0;
+	for(u32 l=1; l <= MAX_CODE_BITS; l++) {
+		code = (code + bl_count[l - 1]) << 1;
+		next_code[l] = code;
+	}
 
-		if(node.rc != C_INVALID_LINK) {
-			read_ht_node(&ht[node.rc * ENTRY_STRIDE], &right_child);
-			right_child.code = (node.code << 1) + 1;
-			right_child.bitlen = node.bitlen + 1;
-			write_ht_node(&ht[node.rc * ENTRY_STRIDE], &right_child);
+	for(u32 i=0; i < MAX_TREE_LEAVES; i++) {
+		codes[i] = (code_bitlen[i] > 0) ? next_code[code_bitlen[i]]++ : 0;
+	}
+}
 
-			stk_nodes[++top] = node.rc;
+/*!
+ * Code book of the used symbols in symbol order, for the decode tables.
+ * Returns the number of used symbols.
+ */
+u32 canonical_code_book(const u8* code_bitlen, u8* leaf_symbols, u8* leaf_bitlen, u32* leaf_bitcodes) {
+	u32 codes[MAX_TREE_LEAVES];
+	build_canonical_codes(code_bitlen, codes);
+
+	u32 ctLeaves = 0;
+	for(u32 i=0; i < MAX_TREE_LEAVES; i++) {
+		if(code_bitlen[i] > 0) {
+			leaf_symbols[ctLeaves] = (u8)i;
+			leaf_bitlen[ctLeaves] = code_bitlen[i];
+			leaf_bitcodes[ctLeaves] = codes[i];
+			ctLeaves++;
 		}
 	}
 
+	return ctLeaves;
+}
+
+__kernel
+__attribute__ ((reqd_work_group_size(1,1,1)))
+void encode(__global uchar* in_data, uint size_in_data, __global uchar* out_data, __global uint* size_out_data, uchar fetch_size_only)
+{
+	//define alphabet map and fill with zeroes
+	u32 alphabet_usage[MAX_TREE_LEAVES];
+	for(u32 i=0; i < MAX_TREE_LEAVES; i++) {
+	  alphabet_usage[i] = 0;
+	}
+
+	for(u32 i=0; i < size_in_data; i++) {
+		u8 d = in_data[i];
+		alphabet_usage[d] ++;
+	}
+
+	//length limited canonical code book
+	u8 code_bitlen[MAX_TREE_LEAVES];
+	u32 codes[MAX_TREE_LEAVES];
+	u32 ctLeaves = build_code_lengths(alphabet_usage, MAX_CODE_BITS, code_bitlen);
+	build_canonical_codes(code_bitlen, codes);
+
+	u32 last_symbol = 0;
+	for(u32 i=0; i < MAX_TREE_LEAVES; i++) {
+		if(code_bitlen[i] > 0)
+			last_symbol = i;
+	}
+
 	//output = header + payload
 	/*!
 	 * Byte Count 			| Description
 	 * ============================================
 	 * 4 				    | MSG LEN
-	 * 1		  			| S
-	 * S + S      			| Symbol + BitLens Interlaced
-	 * BitCodes Size		| Bit Codes
+	 * 1		  			| L, last symbol with a code
+	 * (L + 2) / 2			| Code Lengths of symbols 0..L, 4 bits each, low nibble first
 	 * 4					| Payload SIZE
 	 * 1					| Payload REM
 	 * Payload Size			| Payload
 	 */
-	//BitCodes Size = (Sum(Bit-Lens) + 7) / 8
-	//Payload bits = (Payload Size - 1)* 8 + Payload REM
-	//total = 5 + 2S + BitCodes Size + 5 + Payload Size
-	//total = 10 + 2S + BitCodes Size + Payload Size
-
-	u32 total_bitcode_dict_bits = 0;
-	for(u32 i=0; i < ctLeaves; i++) {
-		struct FLAT_HTREE node;
-		read_ht_node(&ht[i * ENTRY_STRIDE], &node);
-		total_bitcode_dict_bits += node.bitlen;
-	}
-
-	u32 total_bitcode_dict_bytes = (total_bitcode_dict_bits + 7) / 8;
+	//Payload bits = (Payload Size - 1)* 8 + Payload REM, or Payload Size * 8 when REM is 0
+	//total = 5 + (L + 2) / 2 + 5 + Payload Size
+	//a single symbol has a 1 bit code and no payload
 
+	u32 total_code_length_bytes = (last_symbol + 2) / 2;
 
 	//estimate total size
 	u32 total_payload_bits = 0;
-	for(u32 i=0; i < size_in_data; i++) {
-		u16 ht_index = alphabet_to_htree_node[ in_data[i] ];
-		struct FLAT_HTREE node;
-
-		//fetch corresponding htree node
-		read_ht_node(&ht[ht_index * ENTRY_STRIDE], &node);
-
-		//count the output bits
-		total_payload_bits += node.bitlen;
+	if(ctLeaves > 1) {
+		for(u32 i=0; i < MAX_TREE_LEAVES; i++) {
+			total_payload_bits += alphabet_usage[i] * code_bitlen[i];
+		}
 	}
 
 	u32 total_payload_bytes = (total_payload_bits + 7) / 8;
 
 	//compute estimate based on our formula
-	u32 estimate_total = 10 + 2 * ctLeaves + total_bitcode_dict_bytes + total_payload_bytes + 2;
+	u32 estimate_total = 10 + total_code_length_bytes + total_payload_bytes + 2;
 
 	//return size if this is the first pass
 	if(fetch_size_only == 1) {
@@ -377,34 +495,13 @@ void encode(__global uchar* in_data, uint size_in_data, __global uchar* out_data
 	__global u8* ptr = &out_data[0];
 	write_word(&ptr, size_in_data);
 
-	//S
-	*ptr = ctLeaves;
+	//L
+	*ptr = (u8)last_symbol;
 	ptr++;
 
-	//Symbols + BitLens Interlaced
-	for(int i=0; i < ctLeaves; i++) {
-		struct FLAT_HTREE node;
-		read_ht_node(&ht[i * ENTRY_STRIDE], &node);
-
-		*ptr = node.symbol;
-		ptr++;
-		*ptr = node.bitlen;
-		ptr++;
-	}
-
-
-	//Bit-Codes
-	u32 total_bits_written = 0;
-	u32 total_bytes = 0;
-	for(int i=0; i < ctLeaves; i++) {
-		struct FLAT_HTREE node;
-		read_ht_node(&ht[i * ENTRY_STRIDE], &node);
-
-		total_bytes += multiple_bits_writer(&ptr, &total_bits_written, node.code, node.bitlen);
-	}
-
-	//check if need to increment
-	if(total_bits_written % 8 != 0) {
+	//Code Lengths
+	for(u32 i=0; i <= last_symbol; i += 2) {
+		*ptr = code_bitlen[i] | (code_bitlen[i + 1] << 4);
 		ptr++;
 	}
 
@@ -423,17 +520,15 @@ void encode(__global uchar* in_data, uint size_in_data, __global uchar* out_data
 	ptr++;
 
 	//Payload
-	total_bits_written = 0;
-	total_bytes = 0;
-	for(u32 i=0; i < size_in_data; i++) {
-		u16 ht_index = alphabet_to_htree_node[ in_data[i] ];
-		struct FLAT_HTREE node;
+	if(ctLeaves < 2)
+		return;
 
-		//fetch corresponding htree node
-		read_ht_node(&ht[ht_index * ENTRY_STRIDE], &node);
+	u32 total_bits_written = 0;
+	*ptr = 0;
+	for(u32 i=0; i < size_in_data; i++) {
+		u8 d = in_data[i];
 
-		//count the output bits
-		total_bytes += multiple_bits_writer(&ptr, &total_bits_written, node.code, node.bitlen);
+		multiple_bits_writer(&ptr, &total_bits_written, codes[d], code_bitlen[d]);
 	}
 }
 
@@ -443,46 +538,28 @@ void encode(__global uchar* in_data, uint size_in_data, __global uchar* out_data
 __kernel
 __attribute__ ((reqd_work_group_size(1,1,1)))
 void decode(__global uchar* in_data, uint size_in_data, __global uchar* out_data, __global uint* size_out_data, uchar fetch_size_only) {
+
 	//output = header + payload
 	/*!
 	 * Byte Count 			| Description
 	 * ============================================
 	 * 4 				    | MSG LEN
-	 * 1		  			| S
-	 * S + S      			| Symbol + BitLens Interlaced
-	 * BitCodes Size		| Bit Codes
+	 * 1		  			| L, last symbol with a code
+	 * (L + 2) / 2			| Code Lengths of symbols 0..L, 4 bits each, low nibble first
 	 * 4					| Payload SIZE
 	 * 1					| Payload REM
 	 * Payload Size			| Payload
 	 */
-	//BitCodes Size = (Sum(Bit-Lens) + 7) / 8
-	//Payload bits = (Payload Size - 1)* 8 + Payload REM
-	//total = 5 + 2S + BitCodes Size + 5 + Payload Size
-	//total = 10 + 2S + BitCodes Size + Payload Size
-
-	//storage for huffman tree
-	u32 ht[MAX_TREE_NODES * ENTRY_STRIDE];
-	u32 ht_current = 0;
+	//Payload bits = (Payload Size - 1)* 8 + Payload REM, or Payload Size * 8 when REM is 0
+	//total = 5 + (L + 2) / 2 + 5 + Payload Size
 
+	//decode tables, see build_decode_lut
+	u32 lut[LUT_MAX_ENTRIES];
 
 	u8 leaf_symbols[MAX_TREE_LEAVES];
 	u8 leaf_bitlen[MAX_TREE_LEAVES];
 	u32 leaf_bitcodes[MAX_TREE_LEAVES];
 
-	//define alphabet map and fill with zeroes
-	/*
-	u16 symbol_to_htreenode[MAX_TREE_LEAVES];
-	for(u32 i=0; i < MAX_TREE_LEAVES; i++) {
-		symbol_to_htreenode[i] = C_INVALID_LINK;
-	}
-
-	//define alphabet map and fill with zeroes
-	u16 bitcode_to_htree_node[MAX_TREE_NODES];
-	for(u32 i=0; i < MAX_TREE_NODES; i++) {
-	  bitcode_to_htree_node[i] = C_INVALID_LINK;
-	}
-	*/
-
 	//MSG_LEN
 	__global u8* ptr = &in_data[0];
 	u32 msg_len = 0;
@@ -495,171 +572,78 @@ void decode(__global uchar* in_data, uint size_in_data, __global uchar* out_data
 	}
 	else if(*size_out_data < msg_len) {
 		printf("Not enough memory\n");
+		return;
 	}
 
-	u8 ctLeaves = *ptr;
-	ptr++;
-
-	//Read Symbols
-	u32 total_bitcodes_bits = 0;
-	for(u32 i=0; i<ctLeaves; i++) {
-	  leaf_symbols[i] = *ptr;
-	  ptr++;
-
-	  leaf_bitlen[i] = *ptr;
-	  ptr++;
-
-	  //increment bits
-	  total_bitcodes_bits += leaf_bitlen[i];
-	}
-
-	//Read Bit-Codes
-	u32 total_bits_read = 0;
-	for(u32 i=0; i<ctLeaves; i++) {
-		//read bitcode
-		leaf_bitcodes[i] = bit_reader(&ptr, &total_bits_read, leaf_bitlen[i]);
-
-		//check
-		if(total_bits_read >= total_bitcodes_bits)
-			break;
+	//L and the Code Lengths
+	u8 code_bitlen[MAX_TREE_LEAVES];
+	for(u32 i=0; i < MAX_TREE_LEAVES; i++) {
+		code_bitlen[i] = 0;
 	}
 
-	//increment in case at middle byte
-	if(total_bits_read % 8 != 0)
+	u32 last_symbol = *ptr;
+	ptr++;
+	for(u32 i=0; i <= last_symbol; i += 2) {
+		code_bitlen[i] = *ptr & 0x0F;
+		code_bitlen[i + 1] = (*ptr >> 4) & 0x0F;
 		ptr++;
-
-
-	u32 ht_root = ht_current;
-	//Create a root node now
-	{
-		struct FLAT_HTREE root_node;
-		root_node.lc = root_node.rc = C_INVALID_LINK;
-		root_node.code = 0;
-		root_node.weight = 0;
-		root_node.symbol = 0;
-		root_node.bitlen = 0;
-
-		//write node
-		write_ht_node(&ht[ht_current * ENTRY_STRIDE], &root_node);
-		ht_current++;
 	}
 
-
-	//create all intermediate nodes
-	for(u32 i=0; i < ctLeaves; i++) {
-
-		u8 bitlen = leaf_bitlen[i];
-		u32 bitcode = leaf_bitcodes[i];
-
-		//create all missing tree nodes
-		u32 current = ht_root;
-
-		u8 processed_bitlen = 0;
-		u8 processed_code = 0;
-		for(u32 j = 0; j < bitlen; j++) {
-
-			//flat tree node
-			struct FLAT_HTREE node;
-
-			//read
-			read_ht_node(&ht[current * ENTRY_STRIDE], &node);
-
-			//
-			u8 msb = (bitcode >> (bitlen - j - 1)) & 0x1;
-			processed_code = (processed_code << 1) + msb;
-			processed_bitlen++;
-
-			bool is_leaf = (j == (u32)(bitlen - 1));
-			bool need_new_node = false;
-			bool new_node_on_left = false;
-
-			if((msb == 0) && (node.lc == C_INVALID_LINK)) {
-				need_new_node = true;
-				new_node_on_left = true;
-			}
-			else if((msb == 1) && (node.rc == C_INVALID_LINK)) {
-				need_new_node = true;
-			}
-
-			//add missing node
-			if(need_new_node) {
-				struct FLAT_HTREE child_node;
-				child_node.lc = child_node.rc = C_INVALID_LINK;
-				child_node.weight = 0;
-				child_node.code = processed_code;
-				child_node.bitlen = processed_bitlen;
-
-				if(is_leaf)
-					child_node.symbol = leaf_symbols[i];
-
-				//write the new node
-				write_ht_node(&ht[ht_current * ENTRY_STRIDE], &child_node);
-
-				if(new_node_on_left)
-					node.lc = ht_current;
-				else
-					node.rc = ht_current;
-
-				//write original node
-				write_ht_node(&ht[current * ENTRY_STRIDE], &node);
-
-				//increment for next
-				ht_current++;
-			}
-
-			//break at leaf
-			if(is_leaf)
-				break;
-
-			//if 0 goto left otherwise right
-			if(msb)
-				current = node.rc;
-			else
-				current = node.lc;
-		}
-	}
+	//canonical codes
+	u32 ctLeaves = canonical_code_book(code_bitlen, leaf_symbols, leaf_bitlen, leaf_bitcodes);
 
 	//Payload Size
 	u32 total_payload_bytes = 0;
 	read_word(&ptr, &total_payload_bytes);
 
-	u8 payload_rem = *ptr;
+	//skip Payload REM, decoding stops after MSG LEN symbols
 	ptr++;
 
-	u32 total_payload_bits = (total_payload_bytes - 1) * 8 + payload_rem;
-
-	total_bits_read = 0;
-
-	u32 current = ht_root;
-	u32 index_out_buf = 0;
-
-	//flat tree node
-	struct FLAT_HTREE node;
-
-	//read
-	read_ht_node(&ht[current * ENTRY_STRIDE], &node);
+	//a single symbol has no payload
+	if(ctLeaves == 1) {
+		for(u32 i=0; i < msg_len; i++)
+			out_data[i] = leaf_symbols[0];
+		return;
+	}
 
-	while(total_bits_read < total_payload_bits) {
-		u8 bit = bit_reader(&ptr, &total_bits_read, 1);
+	if(build_decode_lut(leaf_symbols, leaf_bitlen, leaf_bitcodes, ctLeaves, lut) < 0) {
+		printf("Invalid code book\n");
+		return;
+	}
 
-		//pick direction
-		if (bit && (node.rc != C_INVALID_LINK))
-			current = node.rc;
-		else if(node.lc != C_INVALID_LINK)
-			current = node.lc;
+	struct BIT_READER br;
+	br.acc = 0;
+	br.avail = 0;
+	br.pos = 0;
 
-		//read
-		read_ht_node(&ht[current * ENTRY_STRIDE], &node);
+	int max_bitlen = 0;
+	for(u32 i=0; i < ctLeaves; i++) {
+		if(leaf_bitlen[i] > max_bitlen)
+			max_bitlen = leaf_bitlen[i];
+	}
 
-		bool isleaf = (node.rc == C_INVALID_LINK) && (node.lc == C_INVALID_LINK);
-		if(isleaf) {
-			out_data[index_out_buf++] = node.symbol;
-			current = ht_root;
-			read_ht_node(&ht[current * ENTRY_STRIDE], &node);
+	u32 index_out_buf = 0;
+	while(index_out_buf < msg_len) {
+		bit_refill(ptr, total_payload_bytes, &br);
+
+		//decode from the accumulator while it holds the longest code
+		do {
+			//codes longer than the primary table continue in the overflow tables
+			u32 entry = lut[br.acc & LUT_PRIMARY_MASK];
+			while(entry & LUT_LINK) {
+				br.acc >>= LUT_LEN(entry);
+				br.avail -= LUT_LEN(entry);
+				entry = lut[LUT_TABLE(entry) + (br.acc & LUT_OVERFLOW_MASK)];
+			}
 
-			if(index_out_buf >= msg_len)
+			//not a code, or a code running past the payload
+			int len = LUT_LEN(entry);
+			if(len == 0 || len > br.avail)
 				return;
-		}
-	}
 
+			br.acc >>= len;
+			br.avail -= len;
+			out_data[index_out_buf++] = LUT_SYMBOL(entry);
+		} while(br.avail >= max_bitlen && index_out_buf < msg_len);
+	}
 }
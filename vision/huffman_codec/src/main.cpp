@@ -27,12 +27,16 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
 EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 **********/
 #include <iostream>
+#include <algorithm>
+#include <stdlib.h>
 #include <assert.h>
 #include "cmdlineparser.h"
 #include "logger.h"
 #include "huffmancodec_naive.h"
 #include "huffmancodec_optimized_cpuonly.h"
+#include "huffmancodec_chunked.h"
 #include "huffmancodec_optimized.h"
+#include "simplebmp.h"
 
 using namespace std;
 using namespace sda;
@@ -42,52 +46,48 @@ using namespace sda::utils;
 static void print_huffman_encoded_data(vector<u8> data) {
 
 	u32 msg_len = (data[0]) |
-	              (data[1] << 4) |
-	              (data[2] << 8) |
-	              (data[3] << 16);
+	              (data[1] << 8) |
+	              (data[2] << 16) |
+	              (data[3] << 24);
 
-	size_t s = data[4];
+	size_t last_symbol = data[4];
 
 	std::cout << std::dec << "MSG_LEN: " << msg_len << std::endl;
-	std::cout << std::dec << "S: " << s << std::endl;
+	std::cout << std::dec << "L: " << last_symbol << std::endl;
 
-	size_t bitcode_bits = 0;
-
-
-	for(size_t i = 0; i < s; i++) {
-		char sym = data[5+2*i];
-		size_t len = data[5+2*i+1];
-		bitcode_bits += len;
-
-		std::cout << "\t" << sym << ": " << len << std::endl;
-	}
-
-	size_t bitcode_bytes = (bitcode_bits + 7) / 8;
-
-	std::cout << "BITCODE: ";
-	for(size_t i = 0; i < bitcode_bytes; i++) {
-		std::cout << std::hex << std::setfill('0') << std::setw(2) << (unsigned) data[5+2*s+i];
+	for(size_t i = 0; i <= last_symbol; i++) {
+		size_t len = (data[5 + i / 2] >> ((i % 2) * 4)) & 0x0F;
+		if(len > 0) {
+			std::cout << "\t" << (char)i << ": " << len << std::endl;
+		}
 	}
-	std::cout << std::endl;
 
-	size_t o = 5+2*s+bitcode_bytes;
+	size_t o = 5 + (last_symbol + 2) / 2;
 	u32 payload_size = (data[o+0]) |
-	                   (data[o+1] << 4) |
-	                   (data[o+2] << 8) |
-	                   (data[o+3] << 16);
+	                   (data[o+1] << 8) |
+	                   (data[o+2] << 16) |
+	                   (data[o+3] << 24);
 	size_t payload_rem = data[o+4];
 
-	std::cout << std::dec << "Payload Size: " << payload_size-1 << " bytes + " << payload_rem << " bits" << std::endl;
+	std::cout << std::dec << "Payload Size: " << payload_size << " bytes, " << payload_rem << " bits in the last byte" << std::endl;
 
 	std::cout << "PAYLOAD: ";
-	for(size_t i = 0; i < payload_size-1; i++) {
-		std::cout << std::hex << std::setfill('0') << std::setw(2) << (unsigned) data[o+4+i];
+	for(size_t i = 0; i < payload_size; i++) {
+		std::cout << std::hex << std::setfill('0') << std::setw(2) << (unsigned) data[o+5+i];
 	}
-	u8 mask = 0xFF >> (8 - payload_rem);
-	u8 last = data[o+4+payload_size-1] & mask;
+	std::cout << std::dec << std::endl;
 
-	std::cout << std::hex << (unsigned) last << " (" << (unsigned) mask << ")" << std::endl;
+}
+
+static void print_huffman_chunks(const vector<u8>& data) {
+	HuffmanChunks chunks;
+	if(!chunks.parse(data.data(), data.size()))
+		return;
 
+	for(u32 i=0; i < chunks.count(); i++) {
+		std::cout << std::dec << "CHUNK " << i << " of " << chunks.count() << std::endl;
+		print_huffman_encoded_data(vector<u8>(chunks.stream(i), chunks.stream(i) + chunks.stream_size(i)));
+	}
 }
 
 static bool unit_test_codec(ICodec* pHuffmanCodec, ICodec* pHuffmanCodecGold) {
@@ -112,10 +112,10 @@ static bool unit_test_codec(ICodec* pHuffmanCodec, ICodec* pHuffmanCodecGold) {
 		res &= pHuffmanCodecGold->dec_str(encoded_data, out_str);
 
 		std::cout << "Encoded Data" << std::endl;
-		print_huffman_encoded_data(encoded_data);
+		print_huffman_chunks(encoded_data);
 
 		std::cout << "Golden Data" << std::endl;
-		print_huffman_encoded_data(gold_data);
+		print_huffman_chunks(gold_data);
 
 		if(msgs[i] == out_str) {
 			LogInfo("Test [%u of %u] PASS (%s)", i+1, total, out_str.c_str());
@@ -130,12 +130,176 @@ static bool unit_test_codec(ICodec* pHuffmanCodec, ICodec* pHuffmanCodecGold) {
 	return(ctPassed == total);
 }
 
+/*!
+ * Decode throughput of the table driven CPU decoder against the bit serial
+ * tree walk on the same encoded bitmap
+ */
+static bool benchmark_decoders(const string& strBitmapFP, int nruns) {
+	struct bmp_t inputbmp;
+	if(readbmp((char*)strBitmapFP.c_str(), &inputbmp) != 0) {
+		LogError("Unable to read bitmap file: [%s]", strBitmapFP.c_str());
+		return false;
+	}
 
-int main(int argc, char* argv[]) {
-	LogInfo("Xilinx Canonical Huffman Codec Application");
+	u32 szInputBuffer = inputbmp.height * inputbmp.width * 3;
+	u8* buffer = reinterpret_cast<u8*>(inputbmp.pixels);
+	vector<u8> vec_in(buffer, buffer + szInputBuffer);
+	vector<u8> vec_encoded_data;
+	vector<u8> vec_decoded_data(szInputBuffer);
 
-	LogInfo("Unit test optimized cpu-only");
 	HuffmanOptimizedCPUOnly cpuonly;
+	cpuonly.enc(vec_in, vec_encoded_data);
+	LogInfo("Encoded %u bytes to %u bytes", szInputBuffer, (u32)vec_encoded_data.size());
+
+	typedef void (*DecodeFunc)(u8*, u32, u8*, u32*, u8);
+	const char* names[] = {"bit serial", "table"};
+	DecodeFunc funcs[] = {decode_bitserial, decode};
+
+	bool res = true;
+	for(int i=0; i < 2; i++) {
+		std::fill(vec_decoded_data.begin(), vec_decoded_data.end(), 0);
+
+		double startMS = HuffmanOptimized::timestamp();
+		for(int r=0; r < nruns; r++) {
+			u32 size_out_data = szInputBuffer;
+			funcs[i](&vec_encoded_data[0], vec_encoded_data.size(), &vec_decoded_data[0], &size_out_data, 0);
+		}
+		double ms = (HuffmanOptimized::timestamp() - startMS) / nruns;
+
+		bool match = (vec_decoded_data == vec_in);
+		res &= match;
+		LogInfo("Decode %s [ms] = %f, [MB/s] = %f, %s", names[i], ms, szInputBuffer / (ms * 1000.0), match ? "PASS" : "FAIL");
+	}
+
+	free(inputbmp.pixels);
+	return res;
+}
+
+/*!
+ * Encode and decode throughput of the chunked CPU codec on 1 .. max_threads
+ * host threads, and a decode of one chunk on its own
+ */
+static bool benchmark_scaling(const string& strBitmapFP, u32 chunk_size, int max_threads, int nruns) {
+	struct bmp_t inputbmp;
+	if(readbmp((char*)strBitmapFP.c_str(), &inputbmp) != 0) {
+		LogError("Unable to read bitmap file: [%s]", strBitmapFP.c_str());
+		return false;
+	}
+
+	u32 szInputBuffer = inputbmp.height * inputbmp.width * 3;
+	u8* buffer = reinterpret_cast<u8*>(inputbmp.pixels);
+	vector<u8> vec_in(buffer, buffer + szInputBuffer);
+	vector<u8> vec_encoded_data;
+	vector<u8> vec_decoded_data;
+
+	HuffmanChunkedCPU chunked(chunk_size, 1);
+	LogInfo("Throughput scaling over 1 .. %d threads, %u chunks of %u bytes, nruns = %d",
+			max_threads, HuffmanChunks::count(szInputBuffer, chunked.chunk_size()), chunked.chunk_size(), nruns);
+
+	bool res = true;
+	double baseMS = 0.0;
+	for(int t=1; t <= max_threads; t++) {
+		chunked.set_threads(t);
+
+		double encMS = 0.0;
+		double decMS = 0.0;
+		for(int r=0; r < nruns; r++) {
+			double startMS = HuffmanOptimized::timestamp();
+			chunked.enc(vec_in, vec_encoded_data);
+			encMS += HuffmanOptimized::timestamp() - startMS;
+
+			startMS = HuffmanOptimized::timestamp();
+			chunked.dec(vec_encoded_data, vec_decoded_data);
+			decMS += HuffmanOptimized::timestamp() - startMS;
+		}
+		if(t == 1) {
+			baseMS = encMS + decMS;
+			LogInfo("Encoded %u bytes to %u bytes", szInputBuffer, (u32)vec_encoded_data.size());
+		}
+
+		bool match = (vec_decoded_data == vec_in);
+		res &= match;
+		LogInfo("Threads = %d, encode [MB/s] = %f, decode [MB/s] = %f, speedup = %.2fx, %s",
+				t, szInputBuffer * nruns / (encMS * 1000.0), szInputBuffer * nruns / (decMS * 1000.0),
+				baseMS / (encMS + decMS), match ? "PASS" : "FAIL");
+	}
+
+	//random access to the middle chunk
+	HuffmanChunks chunks;
+	vector<u8> vec_chunk;
+	if(res && chunks.parse(vec_encoded_data.data(), vec_encoded_data.size()) && chunks.count() > 0) {
+		u32 i = chunks.count() / 2;
+		bool match = chunked.dec_chunk(vec_encoded_data, i, vec_chunk) &&
+					 std::equal(vec_chunk.begin(), vec_chunk.end(), vec_in.begin() + chunks.raw_offset(i)) &&
+					 vec_chunk.size() == chunks.raw_size(i);
+		res &= match;
+		LogInfo("Decode chunk %u of %u alone, %s", i, chunks.count(), match ? "PASS" : "FAIL");
+	}
+
+	free(inputbmp.pixels);
+	return res;
+}
+
+/*!
+ * Time to build the length limited code lengths of symbol distributions that
+ * give deep huffman trees, and the cost of the limit in average code bits
+ */
+static bool benchmark_code_lengths(int nruns) {
+	const int nbuilds = 10000;
+	const char* names[] = {"uniform", "powers of two", "fibonacci", "one dominant", "random"};
+	const int ctDists = sizeof(names) / sizeof(names[0]);
+
+	bool res = true;
+	for(int d=0; d < ctDists; d++) {
+		u32 weights[256];
+		u32 f0 = 1, f1 = 1;
+		srand(d + 1);
+		for(u32 i=0; i < 256; i++) {
+			switch(d) {
+			case 0: weights[i] = 1000; break;
+			case 1: weights[i] = 1u << (i / 11); break;
+			case 2: weights[i] = (i < 40) ? f0 : 0; f1 += f0; f0 = f1 - f0; break;
+			case 3: weights[i] = (i == 0) ? (1u << 30) : 1; break;
+			default: weights[i] = 1 + rand() % 100000; break;
+			}
+		}
+
+		u8 unlimited[256];
+		u8 limited[256];
+		build_code_lengths(weights, 0, unlimited);
+
+		double startMS = HuffmanOptimized::timestamp();
+		for(int r=0; r < nruns * nbuilds; r++) {
+			build_code_lengths(weights, 15, limited);
+		}
+		double us = (HuffmanOptimized::timestamp() - startMS) * 1000.0 / (nruns * nbuilds);
+
+		u32 ctSymbols = 0, maxUnlimited = 0, maxLimited = 0;
+		double total = 0, bitsUnlimited = 0, bitsLimited = 0, kraft = 0;
+		for(u32 i=0; i < 256; i++) {
+			if(weights[i] == 0)
+				continue;
+			ctSymbols++;
+			maxUnlimited = std::max(maxUnlimited, (u32)unlimited[i]);
+			maxLimited = std::max(maxLimited, (u32)limited[i]);
+			total += weights[i];
+			bitsUnlimited += (double)weights[i] * unlimited[i];
+			bitsLimited += (double)weights[i] * limited[i];
+			kraft += 1.0 / (1 << limited[i]);
+		}
+
+		bool valid = (maxLimited <= 15 && kraft <= 1.0);
+		res &= valid;
+		LogInfo("Code lengths %s: symbols = %u, build [us] = %f, max bits = %u (%u unlimited), avg bits = %f (%f unlimited), %s",
+				names[d], ctSymbols, us, maxLimited, maxUnlimited, bitsLimited / total, bitsUnlimited / total,
+				valid ? "PASS" : "FAIL");
+	}
+
+	return res;
+}
+
+int main(int argc, char* argv[]) {
+	LogInfo("Xilinx Canonical Huffman Codec Application");
 
 	string strKernelFullPath = sda::GetApplicationPath() + "/";
 
@@ -147,6 +311,11 @@ int main(int argc, char* argv[]) {
 	parser.addSwitch("--kernel-file", "-k", "OpenCl kernel file to use");
 	parser.addSwitch("--select-device", "-s", "Select from multiple matched devices [0-based index]", "0");
 	parser.addSwitch("--number-of-runs", "-n", "Number of times the kernel runs on the device to compute the average.", "1");
+	parser.addSwitch("--benchmark-decode", "-bd", "Only time the CPU decoders on the bitmap", "0");
+	parser.addSwitch("--chunk-size", "-cs", "Input bytes coded as one independent chunk", "262144");
+	parser.addSwitch("--compute-units", "-u", "Compute units sharing the chunks, 0 uses all", "0");
+	parser.addSwitch("--benchmark-threads", "-bt", "Only time the chunked CPU codec on 1 .. N host threads", "0");
+	parser.addSwitch("--benchmark-codes", "-bc", "Only time the code length construction on skewed distributions", "0");
 	parser.setDefaultKey("--kernel-file");
 	parser.parse(argc, argv);
 
@@ -164,12 +333,31 @@ int main(int argc, char* argv[]) {
 
 	int nruns = parser.value_to_int("number-of-runs");
 	int idxSelectedDevice = parser.value_to_int("select-device");
+	int chunkSize = parser.value_to_int("chunk-size");
+	int nComputeUnits = parser.value_to_int("compute-units");
+	int nBenchmarkThreads = parser.value_to_int("benchmark-threads");
+	if(chunkSize <= 0) {
+		LogError("Chunk size must be positive, got %d", chunkSize);
+		return -1;
+	}
   
 	LogInfo("Chosen bitmap file is %s",strBitmapFP.c_str());
-	HuffmanOptimized huffman(strPlatformName, strDeviceName, idxSelectedDevice, strKernelFullPath, strBitmapFP);
+	if(parser.value_to_int("benchmark-decode")) {
+		return benchmark_decoders(strBitmapFP, nruns) ? 0 : -1;
+	}
+	if(parser.value_to_int("benchmark-codes")) {
+		return benchmark_code_lengths(nruns) ? 0 : -1;
+	}
+	if(nBenchmarkThreads > 0) {
+		return benchmark_scaling(strBitmapFP, chunkSize, nBenchmarkThreads, nruns) ? 0 : -1;
+	}
+
+	HuffmanOptimized huffman(strPlatformName, strDeviceName, idxSelectedDevice, strKernelFullPath, strBitmapFP,
+							 chunkSize, nComputeUnits);
 
 	LogInfo("Perform some unit tests before the actual image decode, encode");
-	unit_test_codec(&huffman,&cpuonly);
+	HuffmanChunkedCPU chunked(chunkSize);
+	unit_test_codec(&huffman,&chunked);
 
 	//Execute benchmark application
 	LogInfo("Run huffman on FPGA with an image dataset. nruns = [%d]", nruns);
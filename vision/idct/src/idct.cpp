@@ -38,6 +38,8 @@ EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string.h>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <string>
 
 typedef short int16_t;
 typedef unsigned short uint16_t;
@@ -146,11 +148,25 @@ The class manages the synchronization events and allows to bulk
 enqueue transactions. All buffer management is performed in the oclDct
 class.
 
+One oclDct drives one compute unit. Its buffers are placed in the DDR
+bank the compute unit is connected to and at most depth transactions
+are in flight on its queue.
+
 *************************************************************************** */
-class oclDct {
 
+// Default number of transactions in flight per compute unit
 #define NUM_SCHED 6
 
+// Compute units the host drives at most, one per DDR bank
+#ifndef DDR_BANKS
+#define DDR_BANKS 4
+#endif
+#if DDR_BANKS > 4
+#error "At most 4 DDR banks are supported"
+#endif
+
+class oclDct {
+
 public:
   oclDct();
   ~oclDct();
@@ -159,7 +175,9 @@ public:
 	    cl_device_id device, 
 	    cl_kernel    krnl, 
 	    cl_command_queue q,
-	    size_t blocks);
+	    size_t blocks,
+	    unsigned int bank,
+	    unsigned int depth = NUM_SCHED);
 
   void write(
 	     size_t start,
@@ -171,7 +189,13 @@ public:
   void run();
   void read();
   void finish();
+
+  unsigned int bank() const { return mBank; }
+  unsigned int transfers() const { return mTransfers; }
+  double busySeconds() const { return mBusyNs * 1e-9; }
 private:
+  void release(unsigned int slot);
+
   cl_context        mContext;
   cl_device_id      mDevice;
   cl_kernel         mKernel;
@@ -181,9 +205,14 @@ private:
   bool              mInit;
   unsigned int      mCount;
   bool              mHasRun;
+  unsigned int      mBank;
+  unsigned int      mDepth;
+
+  unsigned int      mTransfers; // transactions completed
+  cl_ulong          mBusyNs;    // kernel execution time of those transactions
 
-  cl_mem            mInBufferVec[NUM_SCHED][2];
-  cl_mem            mOutBufferVec[NUM_SCHED][1];
+  std::vector<cl_mem> mInBufferVec;  // 2 per slot
+  std::vector<cl_mem> mOutBufferVec; // 1 per slot
 
   cl_mem            *mInBuffer;
   cl_mem            *mOutBuffer;
@@ -193,9 +222,9 @@ private:
   cl_mem_ext_ptr_t  mQExt;
   cl_mem_ext_ptr_t  mOutExt;
 
-  cl_event          inEvVec[NUM_SCHED];
-  cl_event          runEvVec[NUM_SCHED];
-  cl_event          outEvVec[NUM_SCHED];
+  std::vector<cl_event> inEvVec;
+  std::vector<cl_event> runEvVec;
+  std::vector<cl_event> outEvVec;
 
 };
 
@@ -208,6 +237,10 @@ oclDct Constructor
 oclDct::oclDct() {
   mInit = false;
   mNumBlocks64 = 0;
+  mBank = 0;
+  mDepth = NUM_SCHED;
+  mTransfers = 0;
+  mBusyNs = 0;
 }
 
 
@@ -227,14 +260,20 @@ oclDct::init
 OclDct object initialization. This sets the internal state of the
 kernel interaction class. All general openCL objects are expected to
 be allocated externally and provided to the kernel interaction class.
+All buffers of the compute unit are placed in the given DDR bank.
 
 *************************************************************************** */
 void oclDct::init(cl_context   context, 
 		  cl_device_id device, 
 		  cl_kernel    krnl, 
 		  cl_command_queue q,
-		  size_t numBlocks64) 
+		  size_t numBlocks64,
+		  unsigned int bank,
+		  unsigned int depth) 
 {
+  static const unsigned int bankFlags[] = {XCL_MEM_DDR_BANK0, XCL_MEM_DDR_BANK1,
+					   XCL_MEM_DDR_BANK2, XCL_MEM_DDR_BANK3};
+
   mContext = context;
   mDevice  = device;
   mKernel  = krnl;
@@ -243,10 +282,19 @@ void oclDct::init(cl_context   context,
   mNumBlocks64 = numBlocks64;
   
   assert(mNumBlocks64 == numBlocks64); // check that there was not a truncation
+
+  mBank  = bank % DDR_BANKS;
+  mDepth = std::max(depth, 1u);
+
+  mInBufferVec.resize(2*mDepth);
+  mOutBufferVec.resize(mDepth);
+  inEvVec.resize(mDepth);
+  runEvVec.resize(mDepth);
+  outEvVec.resize(mDepth);
   
-  mBlockExt.flags = XCL_MEM_DDR_BANK0;
-  mQExt.flags = XCL_MEM_DDR_BANK0;
-  mOutExt.flags = XCL_MEM_DDR_BANK1;
+  mBlockExt.flags = bankFlags[mBank];
+  mQExt.flags = bankFlags[mBank];
+  mOutExt.flags = bankFlags[mBank];
   
   mBlockExt.obj = nullptr;
   mBlockExt.param = 0;
@@ -260,11 +308,41 @@ void oclDct::init(cl_context   context,
   mInit = true;
   mCount = 0;
   mHasRun = false;
+  mTransfers = 0;
+  mBusyNs = 0;
 
   mInit = true;
 }
 
 
+/* *************************************************************************** 
+
+oclDct::release
+
+This function releases the buffers and events of a completed
+transaction and adds its kernel execution time to the busy time of
+the compute unit.
+
+*************************************************************************** */
+void oclDct::release(unsigned int slot) {
+  cl_ulong start = 0, end = 0;
+  clGetEventProfilingInfo(runEvVec[slot], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, nullptr);
+  clGetEventProfilingInfo(runEvVec[slot], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, nullptr);
+  if(end > start) {
+    mBusyNs += end - start;
+  }
+  mTransfers++;
+
+  clReleaseMemObject(mOutBufferVec[slot]);
+  clReleaseMemObject(mInBufferVec[2*slot]);
+  clReleaseMemObject(mInBufferVec[2*slot + 1]);
+
+  clReleaseEvent(outEvVec[slot]);
+  clReleaseEvent(inEvVec[slot]);
+  clReleaseEvent(runEvVec[slot]);
+}
+
+
 /* *************************************************************************** 
 
 oclDct::write
@@ -283,26 +361,18 @@ void oclDct::write(
 		   bool ignore_dc
 		   ) {
 
-  if(mCount == NUM_SCHED) {
+  if(mCount == mDepth) {
     mHasRun = true;
     mCount = 0;
   }
 
   if(mHasRun) {
     clWaitForEvents(1, &outEvVec[mCount]);
-
-    clReleaseMemObject(mOutBufferVec[mCount][0]);
-    clReleaseMemObject(mInBufferVec[mCount][0]);
-    clReleaseMemObject(mInBufferVec[mCount][1]);
-
-    clReleaseEvent(outEvVec[mCount]);
-    clReleaseEvent(inEvVec[mCount]);
-    clReleaseEvent(runEvVec[mCount]);
-
+    release(mCount);
   }
 
-  mInBuffer = &(mInBufferVec[mCount][0]);
-  mOutBuffer = &(mOutBufferVec[mCount][0]);
+  mInBuffer = &(mInBufferVec[2*mCount]);
+  mOutBuffer = &(mOutBufferVec[mCount]);
 
   cl_int err;
   // Move Buffer over input vector
@@ -380,19 +450,15 @@ transactions and it releases the allocated opencl objects.
 *************************************************************************** */
 void oclDct::finish() {
   clFinish(mQ);
-  unsigned int delCount = mCount-1;
+  unsigned int delCount = mCount;
   if(mHasRun) {
-    delCount = NUM_SCHED;
+    delCount = mDepth;
   }
   for(unsigned int i = 0; i< delCount; i++) {
-    clReleaseMemObject(mOutBufferVec[i][0]);
-    clReleaseMemObject(mInBufferVec[i][0]);
-    clReleaseMemObject(mInBufferVec[i][1]);
-
-    clReleaseEvent(inEvVec[i]);
-    clReleaseEvent(runEvVec[i]);
-    clReleaseEvent(outEvVec[i]);
+    release(i);
   }
+  mCount = 0;
+  mHasRun = false;
 }
 
 
@@ -400,7 +466,10 @@ void oclDct::finish() {
 
 runFPGA
 
-This function guides the kernel execution of the idct algorithm.
+This function guides the kernel execution of the idct algorithm. One
+host thread per compute unit takes the next transfer of numBlocks64
+blocks from a shared counter, so faster compute units take more
+transfers.
 
 *************************************************************************** */
 void runFPGA(
@@ -408,18 +477,29 @@ void runFPGA(
 	std::vector<int16_t,aligned_allocator<int16_t>> &source_block,
 	std::vector<uint16_t,aligned_allocator<uint16_t>> &source_q,
 	std::vector<int16_t,aligned_allocator<int16_t>> &result_vpout,
-	cl_command_queue q,
 	bool ignore_dc,
-	oclDct &cu,
+	std::vector<oclDct> &cus,
 	unsigned int numBlocks64
 ) {
-  for(size_t j = 0; j < blocks/numBlocks64; j++) {
-    cu.write(j, &source_block, &source_q, &result_vpout, ignore_dc);
-    cu.run();
-    cu.read();
+  const size_t transfers = blocks/numBlocks64;
+  std::atomic<size_t> next(0);
+
+  std::vector<std::thread> threads;
+  for(size_t i = 0; i < cus.size(); i++) {
+    oclDct* cu = &cus[i];
+    threads.push_back(std::thread([&, cu]() {
+      for(size_t j = next++; j < transfers; j = next++) {
+	cu->write(j, &source_block, &source_q, &result_vpout, ignore_dc);
+	cu->run();
+	cu->read();
+      }
+      cu->finish();
+    }));
   }
 
-  cu.finish();
+  for(size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
 }
 
 
@@ -460,14 +540,23 @@ int main(int argc, char* argv[]) {
 
   char *xcl_mode = getenv("XCL_EMULATION_MODE");
 
-  if (argc != 2) {
+  if (argc < 2 || argc > 4) {
     printf("Usage: %s "
-	   "./xclbin/idct_kernel.<emulation_mode>.<dsa>.xclbin\n",
+	   "./xclbin/idct_kernel.<emulation_mode>.<dsa>.xclbin"
+	   " [compute units, 0 uses all] [transfers in flight per compute unit]\n",
 	   argv[0]);
     return EXIT_FAILURE;
   }
 
   char* binaryName = argv[1];
+  int reqCus = (argc > 2) ? atoi(argv[2]) : 0;
+  int depth = (argc > 3) ? atoi(argv[3]) : NUM_SCHED;
+  if (reqCus <= 0 || reqCus > DDR_BANKS) {
+    reqCus = DDR_BANKS;
+  }
+  if (depth < 1) {
+    depth = NUM_SCHED;
+  }
 
 
   // *********** Allocate and initialize test vectors **********
@@ -500,9 +589,6 @@ int main(int argc, char* argv[]) {
 
 
   // *********** Communication Parameters **********
-  int banks = 1;
-  const size_t cus = banks;
-  const size_t threads = cus;
   size_t numBlocks64 = 512; 
 
   if (xcl_mode != NULL) {
@@ -510,9 +596,8 @@ int main(int argc, char* argv[]) {
   }
 
   std::cout << "FPGA number of 64*int16_t blocks per transfer: " << numBlocks64 << std::endl;
-  if(blocks%(threads*numBlocks64) != 0) {
-    std::cout << "Error: The current implementation supports only full banks to be transfered"
-	      << " per thread" << std::endl;
+  if(blocks%numBlocks64 != 0) {
+    std::cout << "Error: The current implementation supports only full transfers" << std::endl;
     exit(1);
   }
 
@@ -580,18 +665,37 @@ int main(int argc, char* argv[]) {
 						 NULL, &err);
 
 
-  // Create Kernel
-  std::cout << "Create Kernel: krnl_idct" << std::endl;
-  cl_kernel krnl = clCreateKernel(program, "krnl_idct", &err);
-
-  // Create Command Queue
-  cl_command_queue q = clCreateCommandQueue(context, device_id, 
-					    CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &err);
-
-  // Create compute units
-  std::cout << "Create Compute Unit" << std::endl;
-  oclDct cu;
-  cu.init(context, device_id, krnl, q, numBlocks64);
+  // Create one kernel per compute unit, krnl_idct_<i> is connected to DDR
+  // bank i-1. An xclbin with a single compute unit is driven through the
+  // plain kernel name.
+  std::vector<cl_kernel> krnls;
+  for (int i = 0; i < reqCus; i++) {
+    std::string name = "krnl_idct:{krnl_idct_" + std::to_string(i + 1) + "}";
+    cl_kernel k = clCreateKernel(program, name.c_str(), &err);
+    if (k == NULL || err != CL_SUCCESS) {
+      break;
+    }
+    krnls.push_back(k);
+  }
+  if (krnls.empty()) {
+    krnls.push_back(clCreateKernel(program, "krnl_idct", &err));
+    if (krnls[0] == NULL || err != CL_SUCCESS) {
+      std::cout << "FAILED TEST - Kernel krnl_idct\n";
+      return EXIT_FAILURE;
+    }
+  }
+  std::cout << "Create Kernel: krnl_idct x " << krnls.size() << std::endl;
+
+  // Create compute units, each with its own command queue
+  std::cout << "Create Compute Units: " << krnls.size()
+	    << ", transfers in flight per compute unit: " << depth << std::endl;
+  std::vector<cl_command_queue> queues(krnls.size());
+  std::vector<oclDct> cus(krnls.size());
+  for (size_t i = 0; i < krnls.size(); i++) {
+    queues[i] = clCreateCommandQueue(context, device_id, 
+				     CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &err);
+    cus[i].init(context, device_id, krnls[i], queues[i], numBlocks64, i, depth);
+  }
 
   std::cout << "Setup complete" << std::endl;
 
@@ -610,17 +714,18 @@ int main(int argc, char* argv[]) {
 	  source_block, 
 	  source_q, 
 	  result_vpout, 
-	  q,
 	  ignore_dc, 
- 	  cu, 
+ 	  cus, 
 	  numBlocks64);
   auto fpga_end = std::chrono::high_resolution_clock::now();
 
 
   // *********** OpenCL Host Code cleanup **********
 
-  clReleaseCommandQueue(q);
-  clReleaseKernel(krnl);
+  for (size_t i = 0; i < krnls.size(); i++) {
+    clReleaseCommandQueue(queues[i]);
+    clReleaseKernel(krnls[i]);
+  }
   clReleaseProgram(program);
   clReleaseContext(context);
 
@@ -662,6 +767,18 @@ int main(int argc, char* argv[]) {
     std::cout << "FPGA PCIe Throughput: " 
 	      << (2*(double) blocks*128 + 128) / fpga_duration.count() / (1024.0*1024.0)
 	      << " MB/s" << std::endl;
+    std::cout << "FPGA Blocks/s:   " 
+	      << (double) blocks / fpga_duration.count()
+	      << " (" << cus.size() << " compute units)" << std::endl;
+
+    // Kernel busy time of every compute unit over the wall clock time
+    for (size_t i = 0; i < cus.size(); i++) {
+      std::cout << "CU " << i << " (bank" << cus[i].bank() << "): "
+		<< cus[i].transfers() << " transfers, "
+		<< (double) cus[i].transfers()*numBlocks64 / fpga_duration.count() << " blocks/s, "
+		<< "utilisation " << 100.0 * cus[i].busySeconds() / fpga_duration.count() << " %"
+		<< std::endl;
+    }
   } else {
     std::cout << "RUN COMPLETE" << std::endl;
   }